@@ -0,0 +1,46 @@
+#pragma once
+#include "disable_all_warnings.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vector_relational.hpp>
+DISABLE_WARNINGS_POP()
+#include "ray.h"
+#include <span>
+
+struct AxisAlignedBox {
+    glm::vec3 lower { 0.0f };
+    glm::vec3 upper { 0.0f };
+
+    [[nodiscard]] glm::vec3 center() const { return 0.5f * (lower + upper); }
+    [[nodiscard]] glm::vec3 extent() const { return 0.5f * (upper - lower); }
+    [[nodiscard]] float surfaceArea() const
+    {
+        const glm::vec3 size = upper - lower;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    [[nodiscard]] bool overlaps(const AxisAlignedBox& other) const
+    {
+        return glm::all(glm::lessThanEqual(lower, other.upper)) && glm::all(glm::lessThanEqual(other.lower, upper));
+    }
+    [[nodiscard]] bool contains(const AxisAlignedBox& other) const
+    {
+        return glm::all(glm::lessThanEqual(lower, other.lower)) && glm::all(glm::lessThanEqual(other.upper, upper));
+    }
+    [[nodiscard]] AxisAlignedBox merge(const AxisAlignedBox& other) const
+    {
+        return { glm::min(lower, other.lower), glm::max(upper, other.upper) };
+    }
+};
+
+// Smallest box containing all points (an empty box at the origin if there are none).
+[[nodiscard]] AxisAlignedBox computeBoundingBox(std::span<const glm::vec3> points);
+
+// Box containing the transformed box (the transformed box itself is generally not axis aligned).
+[[nodiscard]] AxisAlignedBox transformBox(const AxisAlignedBox& box, const glm::mat4& matrix);
+
+// Slab test. Returns true if the ray enters the box between 0 and ray.t, and stores the entry distance
+// (0 if the origin lies inside the box). The ray direction does not need to be normalized.
+[[nodiscard]] bool intersectRayWithBox(const AxisAlignedBox& box, const Ray& ray, float& tEnter);
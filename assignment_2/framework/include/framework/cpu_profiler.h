@@ -0,0 +1,149 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Records the CPU time of named zones on any thread, for Chrome trace files and a per-frame summary.
+//
+// Every thread writes the zones it finished into its own ring buffer of EVENTS_PER_THREAD events,
+// without locks; readers copy the recent events and drop those that were overwritten meanwhile. The
+// buffer (and thread id) of a thread that exited is reused by the next new thread. A
+// zone costs two clock reads and a store into the ring, or a single branch while disabled. Zone
+// names must outlive the profiler (string literals, or intern() for names built at runtime).
+//
+// beginFrame() marks the start of a frame on the main thread and summarizes the zones of all threads
+// that ran during the previous frame. writeChromeTrace() writes all events still in the buffers in
+// the trace event format of chrome://tracing and Perfetto.
+//
+// Building with FRAMEWORK_ENABLE_PROFILING off removes CPU_PROFILE_ZONE entirely.
+class CpuProfiler {
+public:
+    static constexpr size_t EVENTS_PER_THREAD = 1 << 14;
+
+    // Zones with the same name, depth and thread are summed.
+    struct ZoneSummary {
+        const char* name;
+        int depth;
+        uint32_t thread;
+        int count;
+        double milliseconds;
+    };
+
+    static CpuProfiler& get();
+
+    void setEnabled(bool enabled);
+    [[nodiscard]] bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    // Name of the calling thread in traces and summaries.
+    void setThreadName(std::string_view name);
+    // Returns a copy of the name that lives as long as the profiler (the same one for equal names).
+    const char* intern(std::string_view name);
+
+    void beginFrame();
+    // Of the frame before the last beginFrame(), by thread and then by start time of the first zone.
+    [[nodiscard]] const std::vector<ZoneSummary>& lastFrameSummary() const;
+    [[nodiscard]] double lastFrameMilliseconds() const;
+    [[nodiscard]] std::string threadName(uint32_t thread) const;
+
+    // Returns false if the file could not be written.
+    bool writeChromeTrace(const std::filesystem::path& filePath) const;
+
+    // Nanoseconds since the profiler was created.
+    [[nodiscard]] uint64_t now() const
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_epoch).count());
+    }
+
+private:
+    friend class CpuProfileScope;
+
+    struct Event {
+        const char* name;
+        uint64_t beginNs;
+        uint64_t endNs;
+        uint32_t depth;
+    };
+    struct ThreadBuffer {
+        uint32_t thread;
+        std::string name;
+        std::unique_ptr<Event[]> events { new Event[EVENTS_PER_THREAD] };
+        std::atomic<uint64_t> numWritten { 0 };
+        bool inUse { true };
+    };
+    // Hands the buffer of a thread to the next new thread when the thread exits.
+    struct ThreadBufferOwner {
+        ThreadBuffer* pBuffer { nullptr };
+        ~ThreadBufferOwner();
+    };
+
+    CpuProfiler();
+    // The buffer of a thread is acquired when its first zone begins, so threads that overlap in time
+    // never share a buffer.
+    ThreadBuffer& threadBuffer();
+    static void record(ThreadBuffer& buffer, const char* name, uint64_t beginNs, uint64_t endNs, uint32_t depth);
+    // Appends the events that are still in the ring of the thread.
+    static void copyEvents(const ThreadBuffer& buffer, std::vector<Event>& events);
+
+private:
+    static thread_local ThreadBufferOwner s_threadBuffer;
+
+    std::atomic<bool> m_enabled { true };
+    const std::chrono::steady_clock::time_point m_epoch;
+
+    mutable std::mutex m_mutex; // protects the list of threads and the interned names
+    std::vector<std::unique_ptr<ThreadBuffer>> m_threads; // indexed by thread id
+    std::unordered_set<std::string> m_names;
+
+    uint64_t m_frameBeginNs { 0 };
+    double m_lastFrameMilliseconds { 0.0 };
+    std::vector<ZoneSummary> m_lastFrameSummary;
+};
+
+// Measures the CPU time of the enclosing scope as a zone of CpuProfiler::get().
+class CpuProfileScope {
+public:
+    explicit CpuProfileScope(const char* name)
+    {
+        CpuProfiler& profiler = CpuProfiler::get();
+        if (profiler.isEnabled()) {
+            m_pBuffer = &profiler.threadBuffer();
+            m_name = name;
+            m_depth = s_depth++;
+            m_beginNs = profiler.now();
+        }
+    }
+    CpuProfileScope(const CpuProfileScope&) = delete;
+    ~CpuProfileScope()
+    {
+        if (m_name) {
+            CpuProfiler::record(*m_pBuffer, m_name, m_beginNs, CpuProfiler::get().now(), m_depth);
+            --s_depth;
+        }
+    }
+
+    CpuProfileScope& operator=(const CpuProfileScope&) = delete;
+
+private:
+    static thread_local uint32_t s_depth;
+
+    CpuProfiler::ThreadBuffer* m_pBuffer { nullptr };
+    const char* m_name { nullptr };
+    uint32_t m_depth { 0 };
+    uint64_t m_beginNs { 0 };
+};
+
+#ifdef FRAMEWORK_ENABLE_PROFILING
+#define CPU_PROFILE_CONCAT_IMPL(a, b) a##b
+#define CPU_PROFILE_CONCAT(a, b) CPU_PROFILE_CONCAT_IMPL(a, b)
+#define CPU_PROFILE_ZONE(name) const CpuProfileScope CPU_PROFILE_CONCAT(cpuProfileScope, __LINE__) { name }
+#else
+#define CPU_PROFILE_ZONE(name)
+#endif
@@ -0,0 +1,219 @@
+#pragma once
+#include "bounds.h"
+#include "frustum_culler.h"
+#include "ray.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over objects that move, appear and disappear (e.g. the objects of a
+// scene graph). Queries (frustum, ray, box overlap) visit O(log n) nodes for well separated objects.
+//
+// Leaves store "fat" boxes: the object box grown by a margin. Moving an object only changes the tree
+// if the new box leaves the fat box; the leaf is then removed and reinserted, and the ancestors of the
+// new leaf are rebalanced with tree rotations. Since incremental updates slowly degrade the quality of
+// the tree, call rebuild() once in a while (e.g. when areaRatio() has grown considerably).
+//
+// Proxy ids stay valid until destroyProxy() and are reused afterwards.
+class DynamicAabbTree {
+public:
+    static constexpr int32_t NULL_NODE = -1;
+
+    explicit DynamicAabbTree(float margin = 0.1f);
+
+    int32_t createProxy(const AxisAlignedBox& box, uint32_t userData);
+    void destroyProxy(int32_t proxyId);
+    // Returns true if the proxy was reinserted. The displacement (movement since the last frame) is used
+    // to extend the fat box in the direction of motion.
+    bool moveProxy(int32_t proxyId, const AxisAlignedBox& box, const glm::vec3& displacement = glm::vec3(0.0f));
+
+    [[nodiscard]] uint32_t userData(int32_t proxyId) const;
+    [[nodiscard]] const AxisAlignedBox& fatBox(int32_t proxyId) const;
+
+    // Rebuild the whole tree top-down (median split along the longest axis) from the current fat boxes.
+    void rebuild();
+
+    [[nodiscard]] size_t numProxies() const;
+    [[nodiscard]] int height() const;
+    // Sum of the surface areas of all internal nodes divided by the area of the root (lower is better).
+    [[nodiscard]] float areaRatio() const;
+
+    // Calls callback(proxyId) for every proxy whose fat box overlaps the box.
+    template <typename F>
+    void queryOverlap(const AxisAlignedBox& box, F&& callback) const;
+    // Calls callback(proxyId) for every proxy whose fat box intersects the frustum. Subtrees that lie
+    // completely inside the frustum are reported without testing their nodes.
+    template <typename F>
+    void queryFrustum(const Frustum& frustum, F&& callback) const;
+    // Calls callback(proxyId, ray) for every proxy whose fat box is hit before ray.t, closest subtree
+    // first. The callback returns the distance to its own hit (or ray.t on a miss), which clips the
+    // remaining search.
+    template <typename F>
+    void queryRay(const Ray& ray, F&& callback) const;
+
+private:
+    struct Node {
+        AxisAlignedBox box;
+        // Index of the next free node while on the free list.
+        int32_t parent { NULL_NODE };
+        int32_t child1 { NULL_NODE };
+        int32_t child2 { NULL_NODE };
+        // Leaves have height 0, free nodes -1.
+        int32_t height { -1 };
+        uint32_t userData { 0 };
+
+        [[nodiscard]] bool isLeaf() const { return child1 == NULL_NODE; }
+    };
+    enum class FrustumTest {
+        Outside,
+        Intersecting,
+        Inside
+    };
+
+    int32_t allocateNode();
+    void freeNode(int32_t nodeId);
+
+    void insertLeaf(int32_t leaf);
+    void removeLeaf(int32_t leaf);
+    // Walk from nodeId to the root, rebalancing and refitting every ancestor.
+    void refitAncestors(int32_t nodeId);
+    int32_t balance(int32_t nodeId);
+    int32_t buildTopDown(int32_t* pLeaves, size_t count);
+
+    // Reports all leaves below nodeId.
+    template <typename F>
+    void reportSubtree(int32_t nodeId, F& callback) const;
+
+    static FrustumTest testFrustum(const Frustum& frustum, const AxisAlignedBox& box);
+
+private:
+    float m_margin;
+    std::vector<Node> m_nodes;
+    int32_t m_root { NULL_NODE };
+    int32_t m_freeList { NULL_NODE };
+    size_t m_numProxies { 0 };
+
+    // Traversal stack, reused between queries (queries are therefore not thread safe).
+    mutable std::vector<int32_t> m_stack;
+};
+
+template <typename F>
+void DynamicAabbTree::reportSubtree(int32_t nodeId, F& callback) const
+{
+    const size_t stackBase = m_stack.size();
+    m_stack.push_back(nodeId);
+    while (m_stack.size() > stackBase) {
+        const int32_t currentId = m_stack.back();
+        m_stack.pop_back();
+        const Node& node = m_nodes[static_cast<size_t>(currentId)];
+        if (node.isLeaf()) {
+            callback(currentId);
+        } else {
+            m_stack.push_back(node.child1);
+            m_stack.push_back(node.child2);
+        }
+    }
+}
+
+template <typename F>
+void DynamicAabbTree::queryOverlap(const AxisAlignedBox& box, F&& callback) const
+{
+    if (m_root == NULL_NODE)
+        return;
+
+    m_stack.clear();
+    m_stack.push_back(m_root);
+    while (!m_stack.empty()) {
+        const int32_t nodeId = m_stack.back();
+        m_stack.pop_back();
+        const Node& node = m_nodes[static_cast<size_t>(nodeId)];
+        if (!node.box.overlaps(box))
+            continue;
+
+        if (node.isLeaf()) {
+            callback(nodeId);
+        } else {
+            m_stack.push_back(node.child1);
+            m_stack.push_back(node.child2);
+        }
+    }
+}
+
+template <typename F>
+void DynamicAabbTree::queryFrustum(const Frustum& frustum, F&& callback) const
+{
+    if (m_root == NULL_NODE)
+        return;
+
+    m_stack.clear();
+    m_stack.push_back(m_root);
+    while (!m_stack.empty()) {
+        const int32_t nodeId = m_stack.back();
+        m_stack.pop_back();
+        const Node& node = m_nodes[static_cast<size_t>(nodeId)];
+        const FrustumTest result = testFrustum(frustum, node.box);
+        if (result == FrustumTest::Outside)
+            continue;
+
+        if (node.isLeaf()) {
+            callback(nodeId);
+        } else if (result == FrustumTest::Inside) {
+            reportSubtree(nodeId, callback);
+        } else {
+            m_stack.push_back(node.child1);
+            m_stack.push_back(node.child2);
+        }
+    }
+}
+
+template <typename F>
+void DynamicAabbTree::queryRay(const Ray& ray, F&& callback) const
+{
+    if (m_root == NULL_NODE)
+        return;
+
+    // Entry distances are stored alongside the node ids so that nodes beyond the (shrinking) ray can be skipped.
+    struct Entry {
+        int32_t nodeId;
+        float tEnter;
+    };
+    std::vector<Entry> stack;
+    Ray clippedRay = ray;
+    float tEnter;
+    if (!intersectRayWithBox(m_nodes[static_cast<size_t>(m_root)].box, clippedRay, tEnter))
+        return;
+    stack.push_back({ m_root, tEnter });
+
+    while (!stack.empty()) {
+        const Entry entry = stack.back();
+        stack.pop_back();
+        if (entry.tEnter > clippedRay.t)
+            continue;
+
+        const Node& node = m_nodes[static_cast<size_t>(entry.nodeId)];
+        if (node.isLeaf()) {
+            const float t = callback(entry.nodeId, static_cast<const Ray&>(clippedRay));
+            if (t < clippedRay.t)
+                clippedRay.t = t;
+            continue;
+        }
+
+        float t1, t2;
+        const bool hit1 = intersectRayWithBox(m_nodes[static_cast<size_t>(node.child1)].box, clippedRay, t1);
+        const bool hit2 = intersectRayWithBox(m_nodes[static_cast<size_t>(node.child2)].box, clippedRay, t2);
+        // Push the farther child first so the closer one is visited first.
+        if (hit1 && hit2) {
+            if (t1 < t2) {
+                stack.push_back({ node.child2, t2 });
+                stack.push_back({ node.child1, t1 });
+            } else {
+                stack.push_back({ node.child1, t1 });
+                stack.push_back({ node.child2, t2 });
+            }
+        } else if (hit1) {
+            stack.push_back({ node.child1, t1 });
+        } else if (hit2) {
+            stack.push_back({ node.child2, t2 });
+        }
+    }
+}
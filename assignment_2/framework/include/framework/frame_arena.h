@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Linear allocator for scratch data that only lives for a single frame. Allocating is a pointer
+// bump and reset() releases everything at once, so there are no per-frame heap allocations once
+// the arena has grown to the size a frame needs.
+//
+// If a frame needs more memory than the arena holds, extra blocks are allocated; they are merged
+// into a single larger block at the next reset().
+class FrameArena {
+public:
+    explicit FrameArena(size_t capacity);
+    FrameArena(const FrameArena&) = delete;
+    FrameArena(FrameArena&&) = default;
+
+    FrameArena& operator=(const FrameArena&) = delete;
+    FrameArena& operator=(FrameArena&&) = default;
+
+    // Uninitialized storage for count objects; only valid until the next reset().
+    template <typename T>
+    T* allocate(size_t count)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "FrameArena never calls destructors");
+        return static_cast<T*>(allocateBytes(count * sizeof(T), alignof(T)));
+    }
+
+    void reset();
+
+    [[nodiscard]] size_t bytesUsed() const;
+    [[nodiscard]] size_t capacity() const;
+
+private:
+    void* allocateBytes(size_t size, size_t alignment);
+
+private:
+    struct Block {
+        std::unique_ptr<std::byte[]> pData;
+        size_t size;
+    };
+    std::vector<Block> m_blocks;
+    // Offset into the last block.
+    size_t m_head { 0 };
+    // Bytes used by all blocks except the last one.
+    size_t m_usedInFullBlocks { 0 };
+};
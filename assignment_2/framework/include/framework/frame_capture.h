@@ -0,0 +1,103 @@
+#pragma once
+#include "disable_all_warnings.h"
+#include "opengl_includes.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes frames (single screenshots or numbered image sequences) to image files without stalling
+// the render thread.
+//
+// capture() starts an asynchronous glReadPixels of the bound read framebuffer into one of
+// NUM_BUFFERS pixel buffer objects and puts a fence behind it. A few frames later beginFrame() finds
+// the fence signaled, maps the buffer and copies the rows out (bottom-up as OpenGL stores them, so
+// the copy flips the image), after which encoder threads write the file. The render thread only
+// waits when all buffers are still in flight or when the encoders fall more than MAX_QUEUED_IMAGES
+// behind; stats() counts both.
+//
+// The file format follows the extension: .png, .bmp or .jpg.
+class FrameCapture {
+public:
+    static constexpr size_t NUM_BUFFERS = 3;
+    static constexpr size_t MAX_QUEUED_IMAGES = 8;
+
+    struct Stats {
+        uint64_t captured { 0 };
+        uint64_t written { 0 }; // files
+        uint64_t failed { 0 };
+        uint64_t readbackWaits { 0 };
+        uint64_t encoderWaits { 0 };
+    };
+
+    explicit FrameCapture(unsigned numEncoderThreads = 2);
+    FrameCapture(const FrameCapture&) = delete;
+    // Writes all frames that were captured.
+    ~FrameCapture();
+
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // Captures the next frame to the file.
+    void requestScreenshot(const std::filesystem::path& filePath);
+    // Captures every frame to <prefix>_00000<extension>, <prefix>_00001<extension>, ...
+    void startSequence(const std::filesystem::path& prefix, const std::string& extension = ".png");
+    void stopSequence();
+    [[nodiscard]] bool isSequenceActive() const;
+    // Whether capture() would read the frame back.
+    [[nodiscard]] bool wantsCapture() const;
+
+    // Hands the frames whose read back finished to the encoders. Call once per frame.
+    void beginFrame();
+    // Reads the color buffer of the bound read framebuffer if a capture was requested.
+    void capture(const glm::ivec2& size);
+    // Waits until all captured frames were written.
+    void flush();
+
+    [[nodiscard]] Stats stats() const;
+
+private:
+    struct Readback {
+        GLuint buffer { 0 };
+        size_t bufferSize { 0 };
+        GLsync fence { nullptr };
+        glm::ivec2 size { 0 };
+        std::vector<std::filesystem::path> filePaths;
+    };
+    struct Image {
+        std::vector<uint8_t> pixels; // RGBA, top row first
+        glm::ivec2 size;
+        std::vector<std::filesystem::path> filePaths; // a frame can be a screenshot and part of a sequence
+    };
+
+    // Waits for the readback if it is not finished and `wait` is set; returns whether it was collected.
+    bool collect(Readback& readback, bool wait);
+    void encoderLoop();
+    static bool writeImage(const Image& image, const std::filesystem::path& filePath);
+
+private:
+    std::array<Readback, NUM_BUFFERS> m_readbacks;
+    size_t m_nextReadback { 0 }; // the oldest readback in flight, if any
+
+    std::filesystem::path m_screenshotPath;
+    std::filesystem::path m_sequencePrefix;
+    std::string m_sequenceExtension;
+    bool m_sequenceActive { false };
+    uint32_t m_sequenceFrame { 0 };
+
+    mutable std::mutex m_mutex; // protects the members below
+    std::condition_variable m_queueChanged;
+    std::deque<Image> m_queue;
+    size_t m_numEncoding { 0 };
+    bool m_stop { false };
+    Stats m_stats;
+    std::vector<std::thread> m_encoders;
+};
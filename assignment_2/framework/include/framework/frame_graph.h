@@ -0,0 +1,180 @@
+#pragma once
+#include "disable_all_warnings.h"
+#include "opengl_includes.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Size and format of a 2D render target texture.
+struct RenderTargetDesc {
+    glm::ivec2 size { 0 };
+    GLenum internalFormat { GL_RGBA8 };
+
+    [[nodiscard]] bool isDepth() const;
+    [[nodiscard]] size_t sizeInBytes() const;
+    bool operator==(const RenderTargetDesc&) const = default;
+};
+
+// A version of a frame graph resource. Writing a resource creates a new version, so a pass that
+// reads a handle depends on exactly the pass that produced it.
+struct FrameGraphResource {
+    static constexpr uint32_t INVALID = 0xFFFFFFFF;
+    uint32_t version { INVALID };
+
+    [[nodiscard]] bool isValid() const { return version != INVALID; }
+};
+
+// Describes the render passes of a frame with the resources they read and write, and runs them.
+//
+// The graph is rebuilt every frame: reset(), import/addPass(), compile(), execute(). Each pass
+// declares its inputs and outputs in a setup function that runs immediately; its execute function
+// runs during execute(). When compiling, the graph
+//  - culls passes whose outputs are never read (unless they have side effects or write the back
+//    buffer), together with the passes that only fed them,
+//  - orders the remaining passes by their dependencies, keeping the order in which they were added
+//    where possible but moving each pass to right before the first pass that needs its output
+//    (e.g. a shadow map pass right before the pass that samples it),
+//  - assigns textures to transient render targets, reusing (aliasing) the texture of a target
+//    whose last reader already ran for targets with the same description.
+//
+// Every pass is a zone of the GpuProfiler and the CpuProfiler. Before a pass executes, a framebuffer with the render targets it writes is bound and the viewport
+// is set to their size, with the depth target it reads through readDepth() (if any) attached as well.
+// Passes that write the back buffer get its framebuffer (0, or the framebuffer object of a headless
+// Window). Passes that only write external resources (e.g. a shadow map that manages its own
+// framebuffers) are left alone.
+//
+// Textures of transient targets are kept in a pool across frames and freed once a frame does not
+// need them anymore.
+class FrameGraph {
+public:
+    class Builder {
+    public:
+        // A transient render target, only valid during this frame.
+        FrameGraphResource create(std::string_view name, const RenderTargetDesc& desc);
+        FrameGraphResource read(FrameGraphResource resource);
+        // Reads a depth target through the depth attachment of the framebuffer of the pass, to depth
+        // test against it without writing (the pass must keep the depth mask off). A pass that writes
+        // no color target gets a framebuffer with just the depth target.
+        FrameGraphResource readDepth(FrameGraphResource resource);
+        // Returns the new version of the resource produced by this pass.
+        [[nodiscard]] FrameGraphResource write(FrameGraphResource resource);
+        // Never cull this pass (e.g. it issues queries or reads back data).
+        void setSideEffect();
+
+    private:
+        friend class FrameGraph;
+        Builder(FrameGraph& graph, uint32_t pass);
+
+        FrameGraph& m_graph;
+        uint32_t m_pass;
+    };
+
+    struct Stats {
+        int passes { 0 };
+        int culledPasses { 0 };
+        int transientTargets { 0 };
+        size_t transientBytes { 0 }; // sum of the sizes of all transient targets
+        size_t allocatedBytes { 0 }; // size of the textures they were assigned (after aliasing)
+    };
+
+    FrameGraph() = default;
+    FrameGraph(const FrameGraph&) = delete;
+    ~FrameGraph();
+
+    FrameGraph& operator=(const FrameGraph&) = delete;
+
+    // Forget all passes and resources of the previous frame.
+    void reset();
+
+    // framebuffer is the default framebuffer of the window (see Window::defaultFramebuffer()).
+    FrameGraphResource importBackbuffer(std::string_view name, const glm::ivec2& size, GLuint framebuffer = 0);
+    FrameGraphResource importTexture(std::string_view name, GLuint texture, const RenderTargetDesc& desc);
+    // A resource the graph only tracks for the dependencies between passes.
+    FrameGraphResource importExternal(std::string_view name);
+
+    void addPass(std::string_view name, const std::function<void(Builder&)>& setup, std::function<void()> execute);
+
+    void compile();
+    void execute();
+
+    // Texture of a render target; only valid while executing the passes.
+    [[nodiscard]] GLuint texture(FrameGraphResource resource) const;
+
+    // Of the last compile().
+    [[nodiscard]] const Stats& stats() const;
+    // Names of the passes that are not culled, in execution order.
+    [[nodiscard]] std::vector<std::string_view> executionOrder() const;
+
+private:
+    enum class ResourceKind {
+        Transient,
+        Texture,
+        Backbuffer,
+        External,
+    };
+    struct Resource {
+        std::string name;
+        ResourceKind kind;
+        RenderTargetDesc desc;
+        GLuint texture { 0 };
+        GLuint framebuffer { 0 }; // of the back buffer
+        // Range of execution order positions of the passes using the resource.
+        int firstUse { -1 };
+        int lastUse { -1 };
+    };
+    struct ResourceVersion {
+        uint32_t resource;
+        int writer { -1 }; // pass index, -1 for the initial contents
+        std::vector<uint32_t> readers;
+        uint32_t nextVersion { FrameGraphResource::INVALID };
+        int refCount { 0 };
+    };
+    struct Pass {
+        std::string name;
+        std::function<void()> execute;
+        const char* profileName; // interned for the CpuProfiler
+        std::vector<uint32_t> reads;
+        std::vector<uint32_t> writes;
+        uint32_t depthRead { FrameGraphResource::INVALID }; // version attached by readDepth()
+        bool sideEffect { false };
+        bool culled { false };
+        int refCount { 0 };
+    };
+    struct PooledTexture {
+        RenderTargetDesc desc;
+        GLuint texture;
+        bool inUse;
+        bool usedThisFrame;
+    };
+    struct CachedFramebuffer {
+        static constexpr size_t MAX_COLOR_ATTACHMENTS = 4;
+        std::array<GLuint, MAX_COLOR_ATTACHMENTS> colors;
+        GLuint depth;
+        GLuint framebuffer;
+    };
+
+    uint32_t addResource(std::string_view name, ResourceKind kind, const RenderTargetDesc& desc, GLuint texture);
+    void cullPasses();
+    void schedulePasses();
+    void bindTargets(const Pass& pass);
+    GLuint acquireTexture(const RenderTargetDesc& desc);
+    void releaseTexture(GLuint texture);
+    void trimPool();
+
+private:
+    std::vector<Resource> m_resources;
+    std::vector<ResourceVersion> m_versions;
+    std::vector<Pass> m_passes;
+    std::vector<uint32_t> m_order;
+    Stats m_stats;
+
+    std::vector<PooledTexture> m_pool;
+    std::vector<CachedFramebuffer> m_framebuffers;
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include "opengl_includes.h"
+#include <chrono>
+#include <deque>
+
+enum class PresentMode {
+    VSync, // wait for the vertical blank
+    Immediate, // present right away (may tear)
+    Adaptive, // wait for the vertical blank unless the frame is late (needs *_EXT_swap_control_tear)
+};
+
+struct FramePacingStats {
+    double frameMilliseconds { 0.0 }; // CPU time between the last two presents
+    double gpuWaitMilliseconds { 0.0 }; // blocked by the frames in flight limit in the last frame
+    double limiterMilliseconds { 0.0 }; // waited by the frame rate limiter in the last frame
+    int framesInFlight { 0 }; // presented but not finished on the GPU
+    double latencyMilliseconds { 0.0 }; // estimated input to photon latency, smoothed
+};
+
+// Keeps the CPU from running too far ahead of the GPU and limits the frame rate (see Window).
+//
+// A fence is inserted after every present. Once more than maxFramesInFlight fences are pending, the
+// CPU waits for the oldest one, so it is never more than that many frames ahead. The frame rate
+// limiter sleeps until shortly before the deadline of the frame and then spins, which is precise to
+// well below a millisecond unlike sleeping alone.
+//
+// The input to photon latency is estimated per frame as the time from polling its input until its
+// fence was seen signaled, plus one refresh period for scan out when presenting with vsync. Fences
+// are only checked once per frame (or waited for), so the estimate is an upper bound that gets
+// tighter with fewer frames in flight.
+class FramePacer {
+public:
+    FramePacer() = default;
+    FramePacer(const FramePacer&) = delete;
+    ~FramePacer();
+
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    // 0 lets the driver decide.
+    void setMaxFramesInFlight(int maxFramesInFlight);
+    [[nodiscard]] int maxFramesInFlight() const;
+    // 0 disables the limiter.
+    void setFrameRateLimit(double framesPerSecond);
+    [[nodiscard]] double frameRateLimit() const;
+    // Of the monitor, for the latency estimate.
+    void setRefreshRate(double hertz);
+    void setPresentMode(PresentMode presentMode);
+
+    // Forget the frames in flight; the OpenGL context must still be current.
+    void reset();
+
+    void onInputPolled();
+    void beforePresent();
+    void afterPresent();
+
+    [[nodiscard]] const FramePacingStats& stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    struct PendingFrame {
+        GLsync fence;
+        Clock::time_point inputTime;
+    };
+
+    void completeFrame(Clock::time_point completionTime);
+
+private:
+    int m_maxFramesInFlight { 2 };
+    double m_frameRateLimit { 0.0 };
+    double m_refreshPeriodMilliseconds { 1000.0 / 60.0 };
+    PresentMode m_presentMode { PresentMode::VSync };
+
+    std::deque<PendingFrame> m_pendingFrames;
+    Clock::time_point m_inputTime;
+    Clock::time_point m_lastPresent;
+    Clock::time_point m_nextDeadline;
+    FramePacingStats m_stats;
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include "bounds.h"
+#include "disable_all_warnings.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The six planes (left, right, bottom, top, near, far) of a view frustum. Normals point inwards and
+// are normalized, so dot(plane, vec4(p, 1)) is the signed distance of p to the plane.
+struct Frustum {
+    std::array<glm::vec4, 6> planes;
+
+    [[nodiscard]] static Frustum fromMatrix(const glm::mat4& viewProjection);
+    // Conservative: may return true for boxes near the corners of the frustum that lie outside.
+    [[nodiscard]] bool intersects(const AxisAlignedBox& box) const;
+};
+
+// Tests many world space bounding boxes against a frustum at once.
+//
+// Boxes are stored as structure of arrays (center and extent per axis) so they can be tested 8 at a
+// time with AVX, or 4 at a time with SSE on CPUs without AVX. AVX support is detected at runtime
+// and can be disabled at compile time with the FRAMEWORK_ENABLE_AVX CMake option. Large sets of
+// boxes are split into batches that are tested in parallel (see JobSystem).
+class FrustumCuller {
+public:
+    void clear();
+    // Transform the (local space) box and append it; returns its index for isVisible().
+    uint32_t add(const AxisAlignedBox& localBounds, const glm::mat4& modelMatrix);
+    uint32_t add(const AxisAlignedBox& worldBounds);
+
+    void cull(const Frustum& frustum);
+    [[nodiscard]] bool isVisible(uint32_t index) const;
+
+    // Of the last cull().
+    [[nodiscard]] size_t numTested() const;
+    [[nodiscard]] size_t numCulled() const;
+    // "AVX", "SSE" or "scalar".
+    [[nodiscard]] static const char* instructionSet();
+
+private:
+    std::vector<float> m_centerX, m_centerY, m_centerZ;
+    std::vector<float> m_extentX, m_extentY, m_extentZ;
+    std::vector<uint8_t> m_visible;
+    size_t m_numCulled { 0 };
+};
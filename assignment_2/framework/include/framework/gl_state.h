@@ -0,0 +1,83 @@
+#pragma once
+#include "opengl_includes.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Shadow copy of the OpenGL state that changes between draw calls (program, vertex array, texture
+// and sampler bindings, uniform buffer bindings, depth and blend state). Calls that would not
+// change the current state are skipped.
+//
+// The shadow copy is only correct if all code changes this state through GLState. Code that
+// modifies it directly (e.g. third party libraries) must call invalidate() afterwards. Deleting
+// a bound object implicitly unbinds it, so call invalidate() after deleting objects as well.
+//
+// There is a single instance since the framework only uses a single OpenGL context.
+class GLState {
+public:
+    static GLState& get();
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vertexArray);
+
+    // Texture units are indices (0, 1, ...) rather than GL_TEXTURE0 + i.
+    void activeTexture(GLuint unit);
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+    void bindSampler(GLuint unit, GLuint sampler);
+
+    void bindUniformBuffer(GLuint index, GLuint buffer);
+    void bindUniformBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+    void setDepthTest(bool enabled);
+    void setDepthFunc(GLenum func);
+    void setDepthMask(bool enabled);
+    void setBlend(bool enabled);
+    void setBlendFunc(GLenum srcFactor, GLenum dstFactor);
+
+    // Forget all cached state; the next call of every kind is passed on to OpenGL.
+    void invalidate();
+
+    // Number of calls that were passed on to OpenGL / skipped since the last resetCounters().
+    [[nodiscard]] uint64_t issuedCalls() const;
+    [[nodiscard]] uint64_t elidedCalls() const;
+    void resetCounters();
+
+private:
+    GLState();
+
+    // Returns true (and updates the cached value) if the call needs to be issued.
+    template <typename T>
+    bool changes(T& cached, const T& value);
+
+private:
+    static constexpr GLuint UNKNOWN = 0xFFFFFFFF;
+    // Bindings of higher units and other texture targets are not cached.
+    static constexpr size_t MAX_CACHED_UNITS = 32;
+    static constexpr size_t MAX_CACHED_UNIFORM_BUFFERS = 16;
+    static constexpr size_t NUM_CACHED_TEXTURE_TARGETS = 5;
+
+    struct BufferRange {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+
+        bool operator==(const BufferRange&) const = default;
+    };
+    // GL_TRUE/GL_FALSE, or UNKNOWN.
+    using Toggle = GLuint;
+
+    GLuint m_program;
+    GLuint m_vertexArray;
+    GLuint m_activeUnit;
+    std::array<std::array<GLuint, NUM_CACHED_TEXTURE_TARGETS>, MAX_CACHED_UNITS> m_textures;
+    std::array<GLuint, MAX_CACHED_UNITS> m_samplers;
+    std::array<BufferRange, MAX_CACHED_UNIFORM_BUFFERS> m_uniformBuffers;
+    Toggle m_depthTest;
+    GLenum m_depthFunc;
+    Toggle m_depthMask;
+    Toggle m_blend;
+    std::array<GLenum, 2> m_blendFunc;
+
+    uint64_t m_issuedCalls { 0 };
+    uint64_t m_elidedCalls { 0 };
+};
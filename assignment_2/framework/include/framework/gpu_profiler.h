@@ -0,0 +1,118 @@
+#pragma once
+#include "opengl_includes.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Measures the GPU time of named zones (e.g. the passes of a frame) with GL_TIMESTAMP queries.
+//
+// Zones are recorded between beginFrame() and endFrame() and may nest; the whole frame is the
+// outermost zone. Each frame uses its own queries from a ring of NUM_FRAMES frames. A frame is read
+// back once the GPU reports its last query as available, so the CPU never waits; if the oldest frame
+// is still in flight when its queries are needed again, the new frame is not measured. Timestamps are
+// used rather than GL_TIME_ELAPSED because elapsed-time queries cannot nest (also not with GpuTimer).
+//
+// setEnabled() takes effect at the next beginFrame(). While disabled no queries exist and zones
+// return right away. Building with FRAMEWORK_ENABLE_PROFILING off removes GPU_PROFILE_ZONE entirely.
+//
+// There is a single instance since the framework only uses a single OpenGL context. Its queries are
+// deleted when it is disabled, not at exit.
+class GpuProfiler {
+public:
+    static constexpr size_t NUM_FRAMES = 4;
+    static constexpr size_t HISTORY_SIZE = 240;
+
+    // Over the last HISTORY_SIZE measured frames in which the zone occurred. Zones with the same
+    // name and nesting depth are summed per frame.
+    struct ZoneStats {
+        std::string name;
+        int depth;
+        size_t numSamples;
+        double averageMs;
+        double medianMs;
+        double p95Ms;
+        double maxMs;
+    };
+
+    static GpuProfiler& get();
+
+    void setEnabled(bool enabled);
+    [[nodiscard]] bool isEnabled() const;
+
+    void beginFrame();
+    void endFrame();
+    void beginZone(std::string_view name);
+    void endZone();
+
+    // In the order in which the zones were first measured.
+    [[nodiscard]] std::vector<ZoneStats> zoneStats() const;
+    void clearHistory();
+    // One line per zone with the columns of ZoneStats. Returns false if the file could not be written.
+    bool writeCsv(const std::filesystem::path& filePath) const;
+
+private:
+    GpuProfiler() = default;
+
+    struct ZoneRecord {
+        uint32_t zone;
+        uint32_t beginQuery;
+        uint32_t endQuery;
+    };
+    struct FrameQueries {
+        std::vector<GLuint> queries;
+        uint32_t numQueries { 0 };
+        std::vector<ZoneRecord> zones;
+        bool pending { false };
+    };
+    struct ZoneHistory {
+        std::string name;
+        int depth;
+        std::array<float, HISTORY_SIZE> samples;
+        size_t numSamples { 0 };
+        size_t next { 0 };
+        double frameSum { 0.0 }; // while collecting the results of a frame
+    };
+
+    uint32_t timestamp(FrameQueries& frame);
+    void collectResults();
+    void deleteQueries();
+
+private:
+    bool m_enabled { false };
+    bool m_enabledNextFrame { false };
+    bool m_recording { false };
+    std::array<FrameQueries, NUM_FRAMES> m_frames;
+    size_t m_nextFrame { 0 };
+    std::vector<uint32_t> m_openZones;
+    std::vector<ZoneHistory> m_zones;
+};
+
+// Measures the GPU time of the enclosing scope as a zone of GpuProfiler::get().
+class GpuProfileScope {
+public:
+    explicit GpuProfileScope(std::string_view name)
+    {
+        if (GpuProfiler::get().isEnabled())
+            GpuProfiler::get().beginZone(name);
+    }
+    GpuProfileScope(const GpuProfileScope&) = delete;
+    ~GpuProfileScope()
+    {
+        if (GpuProfiler::get().isEnabled())
+            GpuProfiler::get().endZone();
+    }
+
+    GpuProfileScope& operator=(const GpuProfileScope&) = delete;
+};
+
+#ifdef FRAMEWORK_ENABLE_PROFILING
+#define GPU_PROFILE_CONCAT_IMPL(a, b) a##b
+#define GPU_PROFILE_CONCAT(a, b) GPU_PROFILE_CONCAT_IMPL(a, b)
+#define GPU_PROFILE_ZONE(name) const GpuProfileScope GPU_PROFILE_CONCAT(gpuProfileScope, __LINE__) { name }
+#else
+#define GPU_PROFILE_ZONE(name)
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+#include "opengl_includes.h"
+#include <array>
+#include <cstddef>
+#include <optional>
+
+// Measures the time the GPU spends on the commands between begin() and end() with GL_TIME_ELAPSED
+// queries.
+//
+// Results arrive a few frames late. Measurements are kept in a small ring of queries, and results
+// are only read once the GPU reports them as available, so the CPU never waits. If all queries are
+// still in flight, begin()/end() skip the measurement.
+//
+// GL_TIME_ELAPSED queries cannot be nested, so at most one GpuTimer may be between begin() and end().
+class GpuTimer {
+public:
+    GpuTimer();
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer(GpuTimer&&);
+    ~GpuTimer();
+
+    GpuTimer& operator=(const GpuTimer&) = delete;
+    GpuTimer& operator=(GpuTimer&&);
+
+    void begin();
+    void end();
+
+    // Duration of the most recent measurement whose result is available.
+    [[nodiscard]] std::optional<double> milliseconds();
+    // Drop the last result and those of measurements that are still in flight (e.g. after changing
+    // what is being measured).
+    void reset();
+
+private:
+    void collectResults();
+    void moveInto(GpuTimer&&);
+    void freeGpuMemory();
+
+private:
+    static constexpr GLuint INVALID = 0xFFFFFFFF;
+    static constexpr size_t NUM_QUERIES = 4;
+
+    std::array<GLuint, NUM_QUERIES> m_queries;
+    size_t m_firstPending { 0 };
+    size_t m_numPending { 0 };
+    // Number of pending queries (starting at m_firstPending) whose results are dropped.
+    size_t m_numDiscarded { 0 };
+    bool m_active { false };
+    std::optional<double> m_lastResult;
+};
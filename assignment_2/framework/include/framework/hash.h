@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+// FNV-1a hashes (http://www.isthe.com/chongo/tech/comp/fnv/).
+// Both are constexpr so that hashing string literals happens at compile time.
+constexpr uint32_t fnv1a32(std::string_view str, uint32_t hash = 2166136261u)
+{
+    for (char c : str) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+constexpr uint64_t fnv1a64(std::string_view str, uint64_t hash = 14695981039346656037ull)
+{
+    for (char c : str) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
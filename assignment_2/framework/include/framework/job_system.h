@@ -0,0 +1,160 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A unit of work of the JobSystem. Only valid until its thread has created MAX_JOBS_PER_THREAD more.
+class Job {
+public:
+    static constexpr size_t MAX_FUNCTION_SIZE = 48;
+    static constexpr size_t MAX_CONTINUATIONS = 4;
+
+    [[nodiscard]] bool isFinished() const { return m_numUnfinished.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class JobSystem;
+
+    void (*m_pInvoke)(Job&) { nullptr };
+    alignas(std::max_align_t) std::byte m_function[MAX_FUNCTION_SIZE];
+    Job* m_pParent { nullptr };
+    // The job itself and its unfinished children.
+    std::atomic<int> m_numUnfinished { 0 };
+    // Unfinished dependencies, plus one until run() is called.
+    std::atomic<int> m_numPendingDependencies { 0 };
+    std::array<Job*, MAX_CONTINUATIONS> m_continuations;
+    uint32_t m_numContinuations { 0 };
+};
+
+// Runs short CPU tasks on a pool of worker threads, for work that is split up every frame.
+//
+// Every thread that creates jobs gets a pool of MAX_JOBS_PER_THREAD jobs that is reused round robin,
+// and a queue of jobs that are ready to run. A thread pushes the jobs it runs to the back of its own
+// queue and takes the most recent one from there (the data it needs is still in the cache), while
+// idle workers steal the oldest jobs from the front of other queues. Nothing is allocated once every
+// thread has its pool, since functions are stored in the job itself: they must be trivially
+// destructible (for example lambdas that capture references or pointers) and fit MAX_FUNCTION_SIZE.
+//
+// A job finishes after its function returned and all of its children finished. Continuations of a
+// job (see addDependency()) are queued once all jobs they depend on finished. wait() runs other jobs
+// until the job finished, so threads that wait help instead of blocking.
+class JobSystem {
+public:
+    static constexpr size_t MAX_JOBS_PER_THREAD = 4096;
+    static constexpr size_t MAX_THREADS = 64; // workers and threads that create jobs, at a time
+
+    static JobSystem& get();
+
+    JobSystem(const JobSystem&) = delete;
+    ~JobSystem();
+
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Worker threads plus the calling thread.
+    [[nodiscard]] unsigned numThreads() const { return unsigned(m_workers.size()) + 1; }
+
+    // The children of a job must be created before the parent finishes (before it runs, or by the
+    // parent itself).
+    template <typename F>
+    Job* createJob(F&& function, Job* pParent = nullptr);
+    // pJob runs after pDependency finished. Both must not have been run yet.
+    void addDependency(Job* pJob, Job* pDependency);
+    // Queues the job once its dependencies finished.
+    void run(Job* pJob);
+    // Runs jobs (of any thread) until pJob finished.
+    void wait(const Job* pJob);
+
+    // Calls function(batch) for consecutive batches of at least minBatchSize items in parallel and
+    // returns when all are done.
+    template <typename T, typename F>
+    void parallelFor(std::span<T> items, size_t minBatchSize, F&& function);
+
+private:
+    struct ThreadQueue {
+        size_t index; // in m_threads
+        std::unique_ptr<Job[]> pJobs { new Job[MAX_JOBS_PER_THREAD] };
+        size_t nextJob { 0 };
+
+        std::mutex mutex; // protects the ring of ready jobs
+        std::unique_ptr<Job*[]> pReady { new Job*[MAX_JOBS_PER_THREAD] };
+        size_t front { 0 };
+        size_t back { 0 };
+
+        bool inUse { true };
+    };
+    // Hands the queue of a thread to the next new thread when the thread exits.
+    struct ThreadQueueOwner {
+        ThreadQueue* pQueue { nullptr };
+        ~ThreadQueueOwner();
+    };
+
+    JobSystem();
+    ThreadQueue& threadQueue();
+    Job* allocateJob(Job* pParent);
+    void push(Job* pJob);
+    // From the queue of this thread, or stolen from another one.
+    Job* tryGetJob();
+    void execute(Job* pJob);
+    void finish(Job* pJob);
+    void workerLoop(unsigned worker);
+
+private:
+    static thread_local ThreadQueueOwner s_threadQueue;
+
+    std::mutex m_threadsMutex; // protects the assignment of queues to threads
+    std::array<std::unique_ptr<ThreadQueue>, MAX_THREADS> m_threads;
+    std::atomic<size_t> m_numThreads { 0 }; // queues in m_threads, which are never removed
+
+    // Idle workers sleep until a job is queued.
+    std::atomic<int> m_numQueued { 0 };
+    std::atomic<int> m_numSleeping { 0 };
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wakeUp;
+    bool m_stop { false };
+    std::vector<std::thread> m_workers;
+};
+
+template <typename F>
+Job* JobSystem::createJob(F&& function, Job* pParent)
+{
+    using Function = std::decay_t<F>;
+    static_assert(sizeof(Function) <= Job::MAX_FUNCTION_SIZE, "Capture less, or pointers to the data");
+    static_assert(alignof(Function) <= alignof(std::max_align_t));
+    static_assert(std::is_trivially_destructible_v<Function>, "Jobs never call destructors");
+
+    Job* pJob = allocateJob(pParent);
+    new (pJob->m_function) Function(std::forward<F>(function));
+    pJob->m_pInvoke = [](Job& job) { (*std::launder(reinterpret_cast<Function*>(job.m_function)))(); };
+    return pJob;
+}
+
+template <typename T, typename F>
+void JobSystem::parallelFor(std::span<T> items, size_t minBatchSize, F&& function)
+{
+    // A few batches per thread balance the load when some take longer than others.
+    minBatchSize = std::max(minBatchSize, size_t(1));
+    const size_t numBatches = std::min((items.size() + minBatchSize - 1) / minBatchSize, size_t(4 * numThreads()));
+    if (numBatches <= 1) {
+        if (!items.empty())
+            function(items);
+        return;
+    }
+
+    Job* pRoot = createJob([]() {});
+    const size_t batchSize = (items.size() + numBatches - 1) / numBatches;
+    for (size_t begin = 0; begin < items.size(); begin += batchSize) {
+        const std::span<T> batch = items.subspan(begin, std::min(batchSize, items.size() - begin));
+        run(createJob([&function, batch]() { function(batch); }, pRoot));
+    }
+    run(pRoot);
+    wait(pRoot);
+}
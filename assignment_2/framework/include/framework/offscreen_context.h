@@ -0,0 +1,58 @@
+#pragma once
+#include "disable_all_warnings.h"
+#include "opengl_includes.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <stdexcept>
+#include <vector>
+
+enum class OffscreenBackend {
+    EGL, // surfaceless EGL context (EGL_KHR_surfaceless_context), hardware accelerated if the driver is
+    OSMesa, // Mesa software rendering
+};
+
+struct OffscreenContextException : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// An OpenGL context without a window or display server, for batch rendering and benchmarks on servers.
+//
+// It tries a surfaceless EGL context first and falls back to OSMesa. Both are optional: they are
+// only built if CMake found their libraries (see FRAMEWORK_ENABLE_HEADLESS). Since there is no
+// window system framebuffer to render to, the context has a framebuffer object of the requested
+// size with a color and a depth attachment that takes its place (see framebuffer()). The context is
+// current and the OpenGL functions are loaded when the constructor returns.
+class OffscreenContext {
+public:
+    // Throws OffscreenContextException if neither backend could create a context.
+    OffscreenContext(const glm::ivec2& size, int glVersionMajor, int glVersionMinor, bool coreProfile);
+    OffscreenContext(const OffscreenContext&) = delete;
+    ~OffscreenContext();
+
+    OffscreenContext& operator=(const OffscreenContext&) = delete;
+
+    void makeCurrent();
+
+    [[nodiscard]] OffscreenBackend backend() const;
+    [[nodiscard]] glm::ivec2 size() const;
+    // Replaces framebuffer 0 as the target of the final image.
+    [[nodiscard]] GLuint framebuffer() const;
+
+private:
+    bool createEglContext(int glVersionMajor, int glVersionMinor, bool coreProfile);
+    bool createOSMesaContext(int glVersionMajor, int glVersionMinor, bool coreProfile);
+    void destroyContext();
+
+private:
+    OffscreenBackend m_backend { OffscreenBackend::EGL };
+    glm::ivec2 m_size;
+
+    // Of the EGL or OSMesa API, not to depend on their headers here.
+    void* m_pDisplay { nullptr };
+    void* m_pContext { nullptr };
+    std::vector<uint8_t> m_osMesaBuffer; // OSMesa needs a color buffer even when rendering to the framebuffer object
+
+    GLuint m_framebuffer { 0 };
+    GLuint m_renderbuffers[2] { 0, 0 };
+};
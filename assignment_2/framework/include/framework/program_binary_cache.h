@@ -0,0 +1,38 @@
+#pragma once
+#include "opengl_includes.h"
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+// On-disk cache of linked shader programs (glGetProgramBinary / glProgramBinary).
+//
+// Entries are keyed by a hash of the shader sources and the driver (vendor, renderer and version
+// strings), so updating the driver or editing a shader simply results in a cache miss. Entries
+// that the driver rejects are deleted and the program is compiled from source instead.
+//
+// Use it through ShaderBuilder::useBinaryCache().
+class ProgramBinaryCache {
+public:
+    // Requires a current OpenGL context. The directory is created if it does not exist.
+    explicit ProgramBinaryCache(std::filesystem::path directory);
+
+    // Whether the driver supports retrieving program binaries at all (GL 4.1+ and at least one binary format).
+    [[nodiscard]] bool isSupported() const;
+
+    // Start a key from the driver identity; extend it with addToKey() for every shader stage.
+    [[nodiscard]] uint64_t baseKey() const;
+    [[nodiscard]] static uint64_t addToKey(uint64_t key, GLenum shaderStage, std::string_view source);
+
+    // Create a program from the cached binary. Returns 0 on a cache miss or if the binary was rejected.
+    [[nodiscard]] GLuint load(uint64_t key) const;
+    // Store the binary of a linked program that was created with GL_PROGRAM_BINARY_RETRIEVABLE_HINT.
+    void store(uint64_t key, GLuint program) const;
+
+private:
+    [[nodiscard]] std::filesystem::path entryPath(uint64_t key) const;
+
+private:
+    std::filesystem::path m_directory;
+    uint64_t m_driverKey { 0 };
+    bool m_supported { false };
+};
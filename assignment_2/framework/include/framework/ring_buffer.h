@@ -0,0 +1,63 @@
+#pragma once
+#include "opengl_includes.h"
+#include <cstddef>
+#include <exception>
+#include <vector>
+
+// GPU buffer for data that is rewritten every frame (e.g. uniform blocks).
+//
+// The buffer is split into a number of segments, one per frame in flight. Data of a frame is
+// appended to the current segment; at the end of the frame the segment is fenced and it will
+// only be written to again once the GPU has finished reading from it.
+//
+// On OpenGL 4.4+ the buffer is persistently mapped and push() writes straight into GPU visible
+// memory. Otherwise push() writes to a CPU staging copy which flush() uploads with a single
+// glBufferSubData call.
+class RingBuffer {
+public:
+    RingBuffer(GLenum target, size_t segmentSize, int numSegments = 3);
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer(RingBuffer&&);
+    ~RingBuffer();
+
+    RingBuffer& operator=(const RingBuffer&) = delete;
+    RingBuffer& operator=(RingBuffer&&);
+
+    // Start writing into the next segment. Waits for the GPU if it is still reading from it.
+    void beginFrame();
+    // Make all data pushed so far visible to the GPU.
+    void flush();
+    // Flush and fence the current segment.
+    void endFrame();
+
+    // Append data to the current segment; returns its offset in the buffer.
+    // Offsets are aligned such that they can be passed to glBindBufferRange.
+    GLintptr push(const void* pData, size_t size);
+    template <typename T>
+    GLintptr push(const T& value) { return push(&value, sizeof(T)); }
+
+    // Bind part of the buffer to an indexed binding point (e.g. a uniform block binding).
+    void bindRange(GLuint index, GLintptr offset, GLsizeiptr size) const;
+
+    [[nodiscard]] GLuint buffer() const;
+    [[nodiscard]] bool isPersistentlyMapped() const;
+
+private:
+    void moveInto(RingBuffer&&);
+    void freeGpuMemory();
+
+private:
+    static constexpr GLuint INVALID = 0xFFFFFFFF;
+
+    GLenum m_target;
+    size_t m_segmentSize { 0 };
+    size_t m_alignment { 16 };
+    GLuint m_buffer { INVALID };
+    std::byte* m_pMapped { nullptr };
+    std::vector<std::byte> m_staging;
+    std::vector<GLsync> m_fences;
+
+    int m_segment { 0 };
+    size_t m_head { 0 };
+    size_t m_flushed { 0 };
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include "disable_all_warnings.h"
+#include "hash.h"
 #include "opengl_includes.h"
 DISABLE_WARNINGS_PUSH()
 #include <glm/mat3x3.hpp>
@@ -8,14 +9,31 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 DISABLE_WARNINGS_POP()
+#include <array>
+#include <cstddef>
 #include <exception>
 #include <filesystem>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 struct ShaderLoadingException : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
+// Handle to a uniform, identified by the hash of its name. The hash is computed at compile time
+// when constructed from a string literal, so declare these once (e.g. static constexpr) and pass
+// them to Shader::set() instead of looking up uniform locations by name every draw.
+struct UniformId {
+    constexpr UniformId(std::string_view name)
+        : hash(fnv1a32(name))
+    {
+    }
+
+    uint32_t hash;
+};
+
 class Shader {
 public:
     Shader();
@@ -30,6 +48,9 @@ public:
 
     // Bind the uniform define by the given name to the given buffer and location in its assigned block, 
     void bindUniformBlock(const std::string& blockName, GLuint bindingLocation, GLuint uniformBlockBuffer) const;
+    // Assign the uniform block to a binding location without binding a buffer to it.
+    // Returns false if the program has no active block with that name.
+    bool setUniformBlockBinding(const std::string& blockName, GLuint bindingLocation) const;
 
     // Query an attribute location by its name in the shader
     GLuint getAttributeLocation(const std::string& name) const;
@@ -37,12 +58,94 @@ public:
     // Query a uniform location by its name in the shader
     GLint getUniformLocation(const std::string& name) const;
 
+    // Whether the program has an active uniform with the given name.
+    bool hasUniform(UniformId id) const;
+
+    // Set the value of a uniform. Unlike glUniform*, these do not require the shader to be bound.
+    // Uploads are skipped if the uniform already holds the given value or if it is not active in
+    // this program (e.g. optimized out by the compiler).
+    void set(UniformId id, bool value) const;
+    void set(UniformId id, int value) const;
+    void set(UniformId id, float value) const;
+    void set(UniformId id, const glm::vec2& value) const;
+    void set(UniformId id, const glm::vec3& value) const;
+    void set(UniformId id, const glm::vec4& value) const;
+    void set(UniformId id, const glm::mat3& value) const;
+    void set(UniformId id, const glm::mat4& value) const;
+
 private:
     friend class ShaderBuilder;
     Shader(GLuint program);
 
+    // Active uniform of the program, reflected once after linking.
+    struct UniformSlot {
+        uint32_t hash;
+        GLint location;
+        GLenum type;
+        // Last value uploaded through set(); large enough to hold a mat4.
+        bool hasShadow { false };
+        alignas(16) std::array<std::byte, sizeof(glm::mat4)> shadow;
+    };
+
+    void reflectUniforms();
+    UniformSlot* findUniform(uint32_t hash) const;
+    bool firstTimeMissing(uint32_t hash) const;
+    template <typename T>
+    UniformSlot* updateShadow(UniformId id, const T& value) const;
+
 private:
     GLuint m_program;
+    // Sorted by hash.
+    mutable std::vector<UniformSlot> m_uniforms;
+    // Uniform (block) names that were looked up but are not active; used to only warn about them once.
+    mutable std::vector<uint32_t> m_missingUniforms;
+    // Binding location of each uniform block (by name hash) that was assigned through setUniformBlockBinding().
+    mutable std::vector<std::pair<uint32_t, GLuint>> m_blockBindings;
+};
+
+class ProgramBinaryCache;
+
+// Shader program that is being compiled and linked in the background by the driver.
+// Created by ShaderBuilder::buildAsync(); poll isReady() (e.g. once per frame) and render with a
+// fallback shader until it returns true.
+class AsyncShader {
+public:
+    AsyncShader() = default;
+    AsyncShader(const AsyncShader&) = delete;
+    AsyncShader(AsyncShader&&);
+    ~AsyncShader();
+
+    AsyncShader& operator=(AsyncShader&&);
+
+    // Never blocks if the driver supports GL_KHR_parallel_shader_compile. Otherwise the first call
+    // waits until the driver has finished. Errors are printed and make hasFailed() return true.
+    [[nodiscard]] bool isReady();
+    [[nodiscard]] bool hasFailed() const;
+
+    // Only valid once isReady() returned true.
+    [[nodiscard]] const Shader& get() const;
+
+private:
+    friend class ShaderBuilder;
+    void freePending();
+
+private:
+    enum class State {
+        Empty,
+        Pending,
+        Ready,
+        Failed
+    };
+    State m_state { State::Empty };
+    Shader m_shader;
+
+    // Objects that are still being compiled/linked while pending.
+    GLuint m_program { 0 };
+    std::vector<GLuint> m_shaders;
+    std::vector<std::filesystem::path> m_stageFiles;
+    std::vector<std::pair<std::string, GLuint>> m_blockBindings;
+    const ProgramBinaryCache* m_pBinaryCache { nullptr };
+    uint64_t m_cacheKey { 0 };
 };
 
 class ShaderBuilder {
@@ -50,14 +153,39 @@ public:
     ShaderBuilder() = default;
     ShaderBuilder(const ShaderBuilder&) = delete;
     ShaderBuilder(ShaderBuilder&&) = default;
-    ~ShaderBuilder();
+    ~ShaderBuilder() = default;
 
+    // Stages are compiled by build(), which is skipped entirely if the program is found in the binary cache.
     ShaderBuilder& addStage(GLuint shaderStage, std::filesystem::path shaderFile);
+    // Inject "#define name value" into every stage, directly after its #version directive.
+    ShaderBuilder& addDefine(std::string name, std::string value = "");
+    // Look up the linked program in the cache before compiling, and store it after compiling.
+    // The cache must outlive the builder.
+    ShaderBuilder& useBinaryCache(const ProgramBinaryCache& cache);
+    // Assign a uniform block to a binding location once the program is linked (see Shader::setUniformBlockBinding).
+    ShaderBuilder& setUniformBlockBinding(std::string blockName, GLuint bindingLocation);
     Shader build();
+    // Submit all stages and the link to the driver without waiting for the result. This allows the
+    // driver to compile many programs in parallel when building several of them up front.
+    AsyncShader buildAsync();
 
 private:
-    void freeShaders();
+    struct Stage {
+        GLuint shaderStage;
+        std::filesystem::path filePath;
+        std::string source;
+    };
+
+    friend class AsyncShader;
+    std::string stageSource(const Stage& stage) const;
+    uint64_t cacheKey() const;
+    AsyncShader submit();
+    static void finishLink(AsyncShader& pending);
+    static Shader makeShader(GLuint program, const std::vector<std::pair<std::string, GLuint>>& blockBindings);
 
 private:
-    std::vector<GLuint> m_shaders;
+    std::vector<Stage> m_stages;
+    std::vector<std::pair<std::string, std::string>> m_defines;
+    std::vector<std::pair<std::string, GLuint>> m_blockBindings;
+    const ProgramBinaryCache* m_pBinaryCache { nullptr };
 };
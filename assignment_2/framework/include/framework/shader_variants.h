@@ -0,0 +1,47 @@
+#pragma once
+#include "opengl_includes.h"
+#include "shader.h"
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class ProgramBinaryCache;
+
+// Compile-time permutations of one shader program. Every bit of a feature mask corresponds to a
+// preprocessor define that is injected into all stages (see ShaderBuilder::addDefine()), so each
+// variant only contains the code paths it actually uses instead of branching on uniforms.
+//
+// Variants are built in the background the first time they are requested; render with a fallback
+// shader while tryGet() returns nullptr.
+class ShaderVariants {
+public:
+    // featureDefines[i] is defined in every variant whose feature mask has bit i set.
+    explicit ShaderVariants(std::vector<std::string> featureDefines);
+
+    // Same as the ShaderBuilder methods, applied to every variant.
+    ShaderVariants& addStage(GLuint shaderStage, std::filesystem::path shaderFile);
+    ShaderVariants& useBinaryCache(const ProgramBinaryCache& cache);
+    ShaderVariants& setUniformBlockBinding(std::string blockName, GLuint bindingLocation);
+
+    // Start compiling the variant if it was not requested before. Use it to warm up variants that
+    // will be needed soon.
+    void request(uint32_t features);
+    // Requests the variant if needed. Returns nullptr while it is being compiled or if it failed to compile.
+    [[nodiscard]] const Shader* tryGet(uint32_t features);
+
+    [[nodiscard]] size_t numVariants() const;
+
+private:
+    AsyncShader& variant(uint32_t features);
+
+private:
+    std::vector<std::string> m_featureDefines;
+    std::vector<std::pair<GLuint, std::filesystem::path>> m_stages;
+    std::vector<std::pair<std::string, GLuint>> m_blockBindings;
+    const ProgramBinaryCache* m_pBinaryCache { nullptr };
+
+    std::unordered_map<uint32_t, AsyncShader> m_variants;
+};
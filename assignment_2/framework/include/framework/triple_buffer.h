@@ -0,0 +1,45 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands the latest value from one producer thread to one consumer thread without locks.
+//
+// The producer fills back() and publish()es it; the consumer calls update() and reads front(). Of
+// the three slots one belongs to each side and the third holds the latest published value; both
+// sides swap their slot with that one in a single atomic exchange, so neither ever waits or sees a
+// value that is being written. Values the consumer did not pick up in time are skipped.
+//
+// The producer must write the whole value every time since back() may return an older value than
+// the one it published last. Reusing the slots keeps values with containers allocation-free once
+// their capacity suffices.
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() = default;
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Producer
+    [[nodiscard]] T& back() { return m_slots[m_back]; }
+    void publish() { m_back = m_ready.exchange(uint8_t(m_back | FRESH), std::memory_order_acq_rel) & INDEX; }
+
+    // Consumer: returns whether front() changed.
+    bool update()
+    {
+        if (!(m_ready.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        m_front = m_ready.exchange(m_front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    [[nodiscard]] const T& front() const { return m_slots[m_front]; }
+
+private:
+    static constexpr uint8_t INDEX = 0x3;
+    static constexpr uint8_t FRESH = 0x4; // the ready slot was published after the consumer last took one
+
+    std::array<T, 3> m_slots {};
+    uint8_t m_back { 0 };
+    uint8_t m_front { 1 };
+    std::atomic<uint8_t> m_ready { 2 };
+};
@@ -1,5 +1,7 @@
 #pragma once
 #include "disable_all_warnings.h"
+#include "frame_pacer.h"
+#include "offscreen_context.h"
 #include "opengl_includes.h"
 // Suppress warnings in third-party code.
 DISABLE_WARNINGS_PUSH()
@@ -7,6 +9,7 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/vec2.hpp>
 DISABLE_WARNINGS_POP()
 #include <functional>
+#include <memory>
 #include <optional>
 #include <string_view>
 #include <vector>
@@ -19,6 +22,10 @@ enum class OpenGLVersion {
 	GL45
 };
 
+// A window that is not presentable has no ImGui. It is headless (an OffscreenContext, without a
+// display server) if the framework was built with EGL or OSMesa, and a hidden GLFW window otherwise.
+// A headless window renders to a framebuffer object instead of framebuffer 0 (see
+// defaultFramebuffer()) and never receives input.
 class Window {
 public:
 	Window(std::string_view title, const glm::ivec2& windowSize, OpenGLVersion glVersion, bool presentable=true, bool visible=true);
@@ -29,9 +36,25 @@ public:
 
 	void updateInput();
 	void swapBuffers(); // Swap the front/back buffer
+	// Draw the Dear ImGui ui into the bound framebuffer now instead of in swapBuffers().
+	void renderImGui();
 
+	// Frame pacing (see FramePacer). Presenting with vsync and at most 2 frames in flight by default.
+	// Returns false (and keeps the current mode) if the driver does not support the mode.
+	bool setPresentMode(PresentMode presentMode);
+	[[nodiscard]] PresentMode presentMode() const;
+	[[nodiscard]] bool isPresentModeSupported(PresentMode presentMode) const;
+	void setMaxFramesInFlight(int maxFramesInFlight); // 0 lets the driver decide
+	[[nodiscard]] int maxFramesInFlight() const;
+	void setFrameRateLimit(double framesPerSecond); // 0 disables the limiter
+	[[nodiscard]] double frameRateLimit() const;
+	[[nodiscard]] const FramePacingStats& framePacingStats() const;
 
-	void renderToImage(const std::filesystem::path& filePath, const bool flipY = false); // renders the output to an image
+	[[nodiscard]] bool isHeadless() const;
+	// Framebuffer holding the image that swapBuffers() presents: 0, or that of the OffscreenContext.
+	[[nodiscard]] GLuint defaultFramebuffer() const;
+
+	void renderToImage(const std::filesystem::path& filePath, const bool flipY = false); // renders the output to an image (waits for the GPU, see FrameCapture)
 
 	using KeyCallback = std::function<void(int key, int scancode, int action, int mods)>;
 	void registerKeyCallback(KeyCallback&&);
@@ -72,11 +95,16 @@ private:
 	static void windowSizeCallback(GLFWwindow* window, int width, int height);
 
 private:
-	GLFWwindow* m_pWindow;
+	GLFWwindow* m_pWindow { nullptr };
+	std::unique_ptr<OffscreenContext> m_pOffscreenContext; // of a headless window
+	bool m_shouldClose { false }; // of a headless window
 	glm::ivec2 m_windowSize;
 	float m_dpiScalingFactor = 1.0f;
 	const OpenGLVersion m_glVersion;
         bool m_presentable;
+	bool m_imGuiRendered = false;
+	PresentMode m_presentMode = PresentMode::VSync;
+	FramePacer m_framePacer;
 
 	std::vector<KeyCallback> m_keyCallbacks;
 	std::vector<CharCallback> m_charCallbacks;
@@ -0,0 +1,46 @@
+#include "bounds.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/mat3x3.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+
+AxisAlignedBox computeBoundingBox(std::span<const glm::vec3> points)
+{
+    if (points.empty())
+        return {};
+
+    AxisAlignedBox box { points.front(), points.front() };
+    for (const glm::vec3& point : points) {
+        box.lower = glm::min(box.lower, point);
+        box.upper = glm::max(box.upper, point);
+    }
+    return box;
+}
+
+AxisAlignedBox transformBox(const AxisAlignedBox& box, const glm::mat4& matrix)
+{
+    // Arvo's method: the extent along each world axis is the sum of the absolute contributions of the local axes.
+    const glm::vec3 center = glm::vec3(matrix * glm::vec4(box.center(), 1.0f));
+    const glm::mat3 absLinear { glm::abs(glm::vec3(matrix[0])), glm::abs(glm::vec3(matrix[1])), glm::abs(glm::vec3(matrix[2])) };
+    const glm::vec3 extent = absLinear * box.extent();
+    return { center - extent, center + extent };
+}
+
+bool intersectRayWithBox(const AxisAlignedBox& box, const Ray& ray, float& tEnter)
+{
+    // Division by zero yields +-infinity, for which the comparisons below still give the right answer
+    // (unless the origin lies exactly on a slab boundary, which is harmless for culling purposes).
+    const glm::vec3 invDirection = 1.0f / ray.direction;
+    const glm::vec3 t0 = (box.lower - ray.origin) * invDirection;
+    const glm::vec3 t1 = (box.upper - ray.origin) * invDirection;
+    const glm::vec3 tMin = glm::min(t0, t1);
+    const glm::vec3 tMax = glm::max(t0, t1);
+
+    const float tNear = std::max({ tMin.x, tMin.y, tMin.z, 0.0f });
+    const float tFar = std::min({ tMax.x, tMax.y, tMax.z, ray.t });
+    if (tNear > tFar)
+        return false;
+    tEnter = tNear;
+    return true;
+}
@@ -0,0 +1,182 @@
+#include "cpu_profiler.h"
+#include <algorithm>
+#include <fstream>
+#include <utility>
+
+thread_local uint32_t CpuProfileScope::s_depth = 0;
+thread_local CpuProfiler::ThreadBufferOwner CpuProfiler::s_threadBuffer;
+
+CpuProfiler::ThreadBufferOwner::~ThreadBufferOwner()
+{
+    if (!pBuffer)
+        return;
+    const std::lock_guard lock { CpuProfiler::get().m_mutex };
+    pBuffer->name = "Thread " + std::to_string(pBuffer->thread);
+    pBuffer->inUse = false;
+}
+
+CpuProfiler& CpuProfiler::get()
+{
+    static CpuProfiler profiler;
+    return profiler;
+}
+
+CpuProfiler::CpuProfiler()
+    : m_epoch(std::chrono::steady_clock::now())
+{
+}
+
+void CpuProfiler::setEnabled(bool enabled)
+{
+    m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void CpuProfiler::setThreadName(std::string_view name)
+{
+    ThreadBuffer& buffer = threadBuffer();
+    const std::lock_guard lock { m_mutex };
+    buffer.name = name;
+}
+
+const char* CpuProfiler::intern(std::string_view name)
+{
+    const std::lock_guard lock { m_mutex };
+    return m_names.emplace(name).first->c_str();
+}
+
+void CpuProfiler::beginFrame()
+{
+    const uint64_t frameEndNs = now();
+    const uint64_t frameBeginNs = std::exchange(m_frameBeginNs, frameEndNs);
+    m_lastFrameMilliseconds = double(frameEndNs - frameBeginNs) * 1e-6;
+    m_lastFrameSummary.clear();
+
+    std::vector<Event> events;
+    std::vector<uint32_t> eventThreads;
+    {
+        const std::lock_guard lock { m_mutex };
+        for (const auto& pBuffer : m_threads) {
+            const size_t first = events.size();
+            copyEvents(*pBuffer, events);
+            events.erase(std::remove_if(std::begin(events) + ptrdiff_t(first), std::end(events),
+                             [&](const Event& event) { return event.beginNs < frameBeginNs || event.endNs > frameEndNs; }),
+                std::end(events));
+            eventThreads.resize(events.size(), pBuffer->thread);
+        }
+    }
+
+    std::vector<size_t> order(events.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::sort(std::begin(order), std::end(order), [&](size_t lhs, size_t rhs) {
+        return std::pair(events[lhs].beginNs, events[lhs].depth) < std::pair(events[rhs].beginNs, events[rhs].depth);
+    });
+    for (size_t i : order) {
+        const Event& event = events[i];
+        auto itSummary = std::find_if(std::begin(m_lastFrameSummary), std::end(m_lastFrameSummary), [&](const ZoneSummary& summary) {
+            return summary.thread == eventThreads[i] && summary.depth == int(event.depth) && std::string_view(summary.name) == event.name;
+        });
+        if (itSummary == std::end(m_lastFrameSummary)) {
+            m_lastFrameSummary.push_back({ event.name, int(event.depth), eventThreads[i], 0, 0.0 });
+            itSummary = std::prev(std::end(m_lastFrameSummary));
+        }
+        ++itSummary->count;
+        itSummary->milliseconds += double(event.endNs - event.beginNs) * 1e-6;
+    }
+    std::stable_sort(std::begin(m_lastFrameSummary), std::end(m_lastFrameSummary),
+        [](const ZoneSummary& lhs, const ZoneSummary& rhs) { return lhs.thread < rhs.thread; });
+}
+
+const std::vector<CpuProfiler::ZoneSummary>& CpuProfiler::lastFrameSummary() const
+{
+    return m_lastFrameSummary;
+}
+
+double CpuProfiler::lastFrameMilliseconds() const
+{
+    return m_lastFrameMilliseconds;
+}
+
+std::string CpuProfiler::threadName(uint32_t thread) const
+{
+    const std::lock_guard lock { m_mutex };
+    return thread < m_threads.size() ? m_threads[thread]->name : std::string();
+}
+
+bool CpuProfiler::writeChromeTrace(const std::filesystem::path& filePath) const
+{
+    std::ofstream file(filePath, std::ios::trunc);
+    const auto writeString = [&](std::string_view string) {
+        file << '"';
+        for (char c : string) {
+            if (c == '"' || c == '\\')
+                file << '\\';
+            file << c;
+        }
+        file << '"';
+    };
+
+    file << "{\"traceEvents\":[";
+    bool first = true;
+    std::vector<Event> events;
+    const std::lock_guard lock { m_mutex };
+    for (const auto& pBuffer : m_threads) {
+        file << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << pBuffer->thread << ",\"args\":{\"name\":";
+        writeString(pBuffer->name);
+        file << "}}";
+        first = false;
+
+        events.clear();
+        copyEvents(*pBuffer, events);
+        for (const Event& event : events) {
+            file << ",\n{\"name\":";
+            writeString(event.name);
+            // Microseconds with nanosecond precision.
+            file << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << pBuffer->thread << ",\"ts\":" << event.beginNs / 1000 << '.'
+                 << std::to_string(1000 + event.beginNs % 1000).substr(1) << ",\"dur\":" << (event.endNs - event.beginNs) / 1000 << '.'
+                 << std::to_string(1000 + (event.endNs - event.beginNs) % 1000).substr(1) << '}';
+        }
+    }
+    file << "\n]}\n";
+    return bool(file);
+}
+
+void CpuProfiler::record(ThreadBuffer& buffer, const char* name, uint64_t beginNs, uint64_t endNs, uint32_t depth)
+{
+    // Only this thread writes to the buffer; publishing the new count makes the event visible to readers.
+    const uint64_t numWritten = buffer.numWritten.load(std::memory_order_relaxed);
+    buffer.events[numWritten % EVENTS_PER_THREAD] = { name, beginNs, endNs, depth };
+    buffer.numWritten.store(numWritten + 1, std::memory_order_release);
+}
+
+CpuProfiler::ThreadBuffer& CpuProfiler::threadBuffer()
+{
+    if (!s_threadBuffer.pBuffer) {
+        const std::lock_guard lock { m_mutex };
+        auto itFree = std::find_if(std::begin(m_threads), std::end(m_threads), [](const auto& pBuffer) { return !pBuffer->inUse; });
+        if (itFree == std::end(m_threads)) {
+            m_threads.push_back(std::make_unique<ThreadBuffer>());
+            m_threads.back()->thread = uint32_t(m_threads.size() - 1);
+            m_threads.back()->name = "Thread " + std::to_string(m_threads.back()->thread);
+            itFree = std::prev(std::end(m_threads));
+        }
+        (*itFree)->inUse = true;
+        s_threadBuffer.pBuffer = itFree->get();
+    }
+    return *s_threadBuffer.pBuffer;
+}
+
+void CpuProfiler::copyEvents(const ThreadBuffer& buffer, std::vector<Event>& events)
+{
+    const uint64_t end = buffer.numWritten.load(std::memory_order_acquire);
+    const uint64_t begin = end > EVENTS_PER_THREAD ? end - EVENTS_PER_THREAD : 0;
+    const size_t first = events.size();
+    for (uint64_t i = begin; i < end; ++i)
+        events.push_back(buffer.events[i % EVENTS_PER_THREAD]);
+
+    // The owning thread may have overwritten the oldest events while they were copied, and may be
+    // writing the next one (which is not counted yet).
+    const uint64_t endAfterCopy = buffer.numWritten.load(std::memory_order_acquire) + 1;
+    const uint64_t numOverwritten = std::min(end - begin, endAfterCopy > EVENTS_PER_THREAD + begin ? endAfterCopy - EVENTS_PER_THREAD - begin : 0);
+    events.erase(std::begin(events) + ptrdiff_t(first), std::begin(events) + ptrdiff_t(first + numOverwritten));
+}
@@ -0,0 +1,363 @@
+#include "dynamic_aabb_tree.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cassert>
+
+// Fat boxes are extended by this multiple of the displacement, so objects moving at a constant
+// velocity are reinserted roughly every other frame at most.
+static constexpr float DISPLACEMENT_MULTIPLIER = 2.0f;
+
+static AxisAlignedBox grow(const AxisAlignedBox& box, float margin)
+{
+    return { box.lower - margin, box.upper + margin };
+}
+
+DynamicAabbTree::DynamicAabbTree(float margin)
+    : m_margin(margin)
+{
+}
+
+int32_t DynamicAabbTree::createProxy(const AxisAlignedBox& box, uint32_t userData)
+{
+    const int32_t proxyId = allocateNode();
+    Node& node = m_nodes[static_cast<size_t>(proxyId)];
+    node.box = grow(box, m_margin);
+    node.userData = userData;
+    node.height = 0;
+    insertLeaf(proxyId);
+    ++m_numProxies;
+    return proxyId;
+}
+
+void DynamicAabbTree::destroyProxy(int32_t proxyId)
+{
+    assert(m_nodes[static_cast<size_t>(proxyId)].height == 0);
+    removeLeaf(proxyId);
+    freeNode(proxyId);
+    --m_numProxies;
+}
+
+bool DynamicAabbTree::moveProxy(int32_t proxyId, const AxisAlignedBox& box, const glm::vec3& displacement)
+{
+    Node& node = m_nodes[static_cast<size_t>(proxyId)];
+    assert(node.height == 0);
+
+    AxisAlignedBox fatBox = grow(box, m_margin);
+    const glm::vec3 predicted = DISPLACEMENT_MULTIPLIER * displacement;
+    fatBox.lower += glm::min(predicted, glm::vec3(0.0f));
+    fatBox.upper += glm::max(predicted, glm::vec3(0.0f));
+
+    // Also reinsert if the fat box has become much larger than needed (e.g. the object stopped moving),
+    // since oversized leaves make all queries slower.
+    if (node.box.contains(box) && grow(fatBox, 4.0f * m_margin).contains(node.box))
+        return false;
+
+    removeLeaf(proxyId);
+    m_nodes[static_cast<size_t>(proxyId)].box = fatBox;
+    insertLeaf(proxyId);
+    return true;
+}
+
+uint32_t DynamicAabbTree::userData(int32_t proxyId) const
+{
+    return m_nodes[static_cast<size_t>(proxyId)].userData;
+}
+
+const AxisAlignedBox& DynamicAabbTree::fatBox(int32_t proxyId) const
+{
+    return m_nodes[static_cast<size_t>(proxyId)].box;
+}
+
+void DynamicAabbTree::rebuild()
+{
+    std::vector<int32_t> leaves;
+    leaves.reserve(m_numProxies);
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+        if (m_nodes[i].height == 0)
+            leaves.push_back(static_cast<int32_t>(i));
+        else if (m_nodes[i].height > 0)
+            freeNode(static_cast<int32_t>(i));
+    }
+
+    m_root = leaves.empty() ? NULL_NODE : buildTopDown(leaves.data(), leaves.size());
+    if (m_root != NULL_NODE)
+        m_nodes[static_cast<size_t>(m_root)].parent = NULL_NODE;
+}
+
+size_t DynamicAabbTree::numProxies() const
+{
+    return m_numProxies;
+}
+
+int DynamicAabbTree::height() const
+{
+    return m_root == NULL_NODE ? 0 : m_nodes[static_cast<size_t>(m_root)].height;
+}
+
+float DynamicAabbTree::areaRatio() const
+{
+    if (m_root == NULL_NODE)
+        return 0.0f;
+    const float rootArea = m_nodes[static_cast<size_t>(m_root)].box.surfaceArea();
+    if (rootArea <= 0.0f)
+        return 0.0f;
+
+    float totalArea = 0.0f;
+    for (const Node& node : m_nodes) {
+        if (node.height > 0)
+            totalArea += node.box.surfaceArea();
+    }
+    return totalArea / rootArea;
+}
+
+int32_t DynamicAabbTree::allocateNode()
+{
+    if (m_freeList == NULL_NODE) {
+        m_nodes.emplace_back();
+        return static_cast<int32_t>(m_nodes.size() - 1);
+    }
+
+    const int32_t nodeId = m_freeList;
+    Node& node = m_nodes[static_cast<size_t>(nodeId)];
+    m_freeList = node.parent;
+    node = Node {};
+    return nodeId;
+}
+
+void DynamicAabbTree::freeNode(int32_t nodeId)
+{
+    Node& node = m_nodes[static_cast<size_t>(nodeId)];
+    node.parent = m_freeList;
+    node.child1 = node.child2 = NULL_NODE;
+    node.height = -1;
+    m_freeList = nodeId;
+}
+
+void DynamicAabbTree::insertLeaf(int32_t leaf)
+{
+    if (m_root == NULL_NODE) {
+        m_root = leaf;
+        m_nodes[static_cast<size_t>(leaf)].parent = NULL_NODE;
+        return;
+    }
+
+    // Descend to the sibling that minimizes the increase in surface area (surface area heuristic):
+    // pairing the leaf with a node costs the area of their union, and every ancestor grows as well.
+    const AxisAlignedBox leafBox = m_nodes[static_cast<size_t>(leaf)].box;
+    int32_t index = m_root;
+    while (!m_nodes[static_cast<size_t>(index)].isLeaf()) {
+        const Node& node = m_nodes[static_cast<size_t>(index)];
+        const float area = node.box.surfaceArea();
+        const float combinedArea = node.box.merge(leafBox).surfaceArea();
+        const float siblingCost = 2.0f * combinedArea;
+        const float inheritanceCost = 2.0f * (combinedArea - area);
+
+        const auto descendCost = [&](int32_t childId) {
+            const Node& child = m_nodes[static_cast<size_t>(childId)];
+            const float childCombinedArea = child.box.merge(leafBox).surfaceArea();
+            return (child.isLeaf() ? childCombinedArea : childCombinedArea - child.box.surfaceArea()) + inheritanceCost;
+        };
+        const float cost1 = descendCost(node.child1);
+        const float cost2 = descendCost(node.child2);
+
+        if (siblingCost < cost1 && siblingCost < cost2)
+            break;
+        index = cost1 < cost2 ? node.child1 : node.child2;
+    }
+    const int32_t sibling = index;
+
+    // Replace the sibling by a new parent of the sibling and the leaf.
+    const int32_t oldParent = m_nodes[static_cast<size_t>(sibling)].parent;
+    const int32_t newParent = allocateNode();
+    Node& parent = m_nodes[static_cast<size_t>(newParent)];
+    parent.parent = oldParent;
+    parent.box = m_nodes[static_cast<size_t>(sibling)].box.merge(leafBox);
+    parent.height = m_nodes[static_cast<size_t>(sibling)].height + 1;
+    parent.child1 = sibling;
+    parent.child2 = leaf;
+    m_nodes[static_cast<size_t>(sibling)].parent = newParent;
+    m_nodes[static_cast<size_t>(leaf)].parent = newParent;
+
+    if (oldParent == NULL_NODE) {
+        m_root = newParent;
+    } else {
+        Node& grandParent = m_nodes[static_cast<size_t>(oldParent)];
+        (grandParent.child1 == sibling ? grandParent.child1 : grandParent.child2) = newParent;
+    }
+
+    refitAncestors(m_nodes[static_cast<size_t>(leaf)].parent);
+}
+
+void DynamicAabbTree::removeLeaf(int32_t leaf)
+{
+    if (leaf == m_root) {
+        m_root = NULL_NODE;
+        return;
+    }
+
+    const int32_t parent = m_nodes[static_cast<size_t>(leaf)].parent;
+    const int32_t grandParent = m_nodes[static_cast<size_t>(parent)].parent;
+    const Node& parentNode = m_nodes[static_cast<size_t>(parent)];
+    const int32_t sibling = parentNode.child1 == leaf ? parentNode.child2 : parentNode.child1;
+
+    // The sibling takes the place of the parent.
+    m_nodes[static_cast<size_t>(sibling)].parent = grandParent;
+    freeNode(parent);
+    if (grandParent == NULL_NODE) {
+        m_root = sibling;
+    } else {
+        Node& grandParentNode = m_nodes[static_cast<size_t>(grandParent)];
+        (grandParentNode.child1 == parent ? grandParentNode.child1 : grandParentNode.child2) = sibling;
+        refitAncestors(grandParent);
+    }
+}
+
+void DynamicAabbTree::refitAncestors(int32_t nodeId)
+{
+    while (nodeId != NULL_NODE) {
+        nodeId = balance(nodeId);
+
+        Node& node = m_nodes[static_cast<size_t>(nodeId)];
+        const Node& child1 = m_nodes[static_cast<size_t>(node.child1)];
+        const Node& child2 = m_nodes[static_cast<size_t>(node.child2)];
+        node.height = 1 + std::max(child1.height, child2.height);
+        node.box = child1.box.merge(child2.box);
+
+        nodeId = node.parent;
+    }
+}
+
+int32_t DynamicAabbTree::balance(int32_t iA)
+{
+    // If one subtree of A is more than one level deeper than the other, its root (B or C) is rotated
+    // up to take the place of A. A adopts the shallower child of the rotated node, which keeps the
+    // deeper one. Returns the node that now takes the place of A.
+    Node& A = m_nodes[static_cast<size_t>(iA)];
+    if (A.isLeaf() || A.height < 2)
+        return iA;
+
+    const int32_t iB = A.child1;
+    const int32_t iC = A.child2;
+    Node& B = m_nodes[static_cast<size_t>(iB)];
+    Node& C = m_nodes[static_cast<size_t>(iC)];
+    const int32_t imbalance = C.height - B.height;
+
+    const auto replaceChildOfParent = [&](int32_t oldChild, int32_t newChild) {
+        const int32_t parent = m_nodes[static_cast<size_t>(newChild)].parent;
+        if (parent == NULL_NODE) {
+            m_root = newChild;
+        } else {
+            Node& parentNode = m_nodes[static_cast<size_t>(parent)];
+            (parentNode.child1 == oldChild ? parentNode.child1 : parentNode.child2) = newChild;
+        }
+    };
+
+    if (imbalance > 1) {
+        // Rotate C up.
+        const int32_t iF = C.child1;
+        const int32_t iG = C.child2;
+        Node& F = m_nodes[static_cast<size_t>(iF)];
+        Node& G = m_nodes[static_cast<size_t>(iG)];
+
+        C.child1 = iA;
+        C.parent = A.parent;
+        A.parent = iC;
+        replaceChildOfParent(iA, iC);
+
+        // Keep the taller of F and G below C.
+        const bool keepF = F.height > G.height;
+        const int32_t iKeep = keepF ? iF : iG;
+        const int32_t iMove = keepF ? iG : iF;
+        Node& keep = keepF ? F : G;
+        Node& move = keepF ? G : F;
+        C.child2 = iKeep;
+        A.child2 = iMove;
+        move.parent = iA;
+        A.box = B.box.merge(move.box);
+        C.box = A.box.merge(keep.box);
+        A.height = 1 + std::max(B.height, move.height);
+        C.height = 1 + std::max(A.height, keep.height);
+        return iC;
+    }
+
+    if (imbalance < -1) {
+        // Rotate B up.
+        const int32_t iD = B.child1;
+        const int32_t iE = B.child2;
+        Node& D = m_nodes[static_cast<size_t>(iD)];
+        Node& E = m_nodes[static_cast<size_t>(iE)];
+
+        B.child1 = iA;
+        B.parent = A.parent;
+        A.parent = iB;
+        replaceChildOfParent(iA, iB);
+
+        const bool keepD = D.height > E.height;
+        const int32_t iKeep = keepD ? iD : iE;
+        const int32_t iMove = keepD ? iE : iD;
+        Node& keep = keepD ? D : E;
+        Node& move = keepD ? E : D;
+        B.child2 = iKeep;
+        A.child1 = iMove;
+        move.parent = iA;
+        A.box = C.box.merge(move.box);
+        B.box = A.box.merge(keep.box);
+        A.height = 1 + std::max(C.height, move.height);
+        B.height = 1 + std::max(A.height, keep.height);
+        return iB;
+    }
+
+    return iA;
+}
+
+int32_t DynamicAabbTree::buildTopDown(int32_t* pLeaves, size_t count)
+{
+    if (count == 1)
+        return pLeaves[0];
+
+    // Split at the median centroid along the axis in which the centroids are spread the most.
+    const auto centroid = [&](int32_t nodeId) { return m_nodes[static_cast<size_t>(nodeId)].box.center(); };
+    AxisAlignedBox centroidBounds { centroid(pLeaves[0]), centroid(pLeaves[0]) };
+    for (size_t i = 1; i < count; ++i)
+        centroidBounds = centroidBounds.merge({ centroid(pLeaves[i]), centroid(pLeaves[i]) });
+    const glm::vec3 spread = centroidBounds.upper - centroidBounds.lower;
+    const int axis = spread.x > spread.y ? (spread.x > spread.z ? 0 : 2) : (spread.y > spread.z ? 1 : 2);
+
+    const size_t half = count / 2;
+    std::nth_element(pLeaves, pLeaves + half, pLeaves + count,
+        [&](int32_t lhs, int32_t rhs) { return centroid(lhs)[axis] < centroid(rhs)[axis]; });
+
+    const int32_t child1 = buildTopDown(pLeaves, half);
+    const int32_t child2 = buildTopDown(pLeaves + half, count - half);
+
+    const int32_t nodeId = allocateNode();
+    Node& node = m_nodes[static_cast<size_t>(nodeId)];
+    Node& node1 = m_nodes[static_cast<size_t>(child1)];
+    Node& node2 = m_nodes[static_cast<size_t>(child2)];
+    node.child1 = child1;
+    node.child2 = child2;
+    node.box = node1.box.merge(node2.box);
+    node.height = 1 + std::max(node1.height, node2.height);
+    node1.parent = node2.parent = nodeId;
+    return nodeId;
+}
+
+DynamicAabbTree::FrustumTest DynamicAabbTree::testFrustum(const Frustum& frustum, const AxisAlignedBox& box)
+{
+    const glm::vec3 center = box.center();
+    const glm::vec3 extent = box.extent();
+    FrustumTest result = FrustumTest::Inside;
+    for (const glm::vec4& plane : frustum.planes) {
+        const glm::vec3 normal { plane };
+        const float distance = glm::dot(normal, center) + plane.w;
+        const float radius = glm::dot(glm::abs(normal), extent);
+        if (distance + radius < 0.0f)
+            return FrustumTest::Outside;
+        if (distance - radius < 0.0f)
+            result = FrustumTest::Intersecting;
+    }
+    return result;
+}
@@ -0,0 +1,51 @@
+#include "frame_arena.h"
+#include <algorithm>
+#include <cstdint>
+
+FrameArena::FrameArena(size_t capacity)
+{
+    m_blocks.push_back({ std::make_unique<std::byte[]>(capacity), capacity });
+}
+
+void FrameArena::reset()
+{
+    if (m_blocks.size() > 1) {
+        const size_t total = capacity();
+        m_blocks.clear();
+        m_blocks.push_back({ std::make_unique<std::byte[]>(total), total });
+    }
+    m_head = 0;
+    m_usedInFullBlocks = 0;
+}
+
+size_t FrameArena::bytesUsed() const
+{
+    return m_usedInFullBlocks + m_head;
+}
+
+size_t FrameArena::capacity() const
+{
+    size_t total = 0;
+    for (const Block& block : m_blocks)
+        total += block.size;
+    return total;
+}
+
+void* FrameArena::allocateBytes(size_t size, size_t alignment)
+{
+    const auto alignedHead = [&](const Block& block, size_t head) {
+        const auto address = reinterpret_cast<uintptr_t>(block.pData.get()) + head;
+        return head + (alignment - address % alignment) % alignment;
+    };
+
+    size_t offset = alignedHead(m_blocks.back(), m_head);
+    if (offset + size > m_blocks.back().size) {
+        m_usedInFullBlocks += m_head;
+        const size_t blockSize = std::max(2 * m_blocks.back().size, size + alignment);
+        m_blocks.push_back({ std::make_unique<std::byte[]>(blockSize), blockSize });
+        m_head = 0;
+        offset = alignedHead(m_blocks.back(), 0);
+    }
+    m_head = offset + size;
+    return m_blocks.back().pData.get() + offset;
+}
@@ -0,0 +1,218 @@
+#include "frame_capture.h"
+#include "cpu_profiler.h"
+DISABLE_WARNINGS_PUSH()
+#include <stb/stb_image_write.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+FrameCapture::FrameCapture(unsigned numEncoderThreads)
+{
+    for (unsigned i = 0; i < std::max(numEncoderThreads, 1u); ++i)
+        m_encoders.emplace_back([this]() { encoderLoop(); });
+}
+
+FrameCapture::~FrameCapture()
+{
+    flush();
+    {
+        const std::lock_guard lock { m_mutex };
+        m_stop = true;
+    }
+    m_queueChanged.notify_all();
+    for (std::thread& encoder : m_encoders)
+        encoder.join();
+    for (Readback& readback : m_readbacks)
+        glDeleteBuffers(1, &readback.buffer);
+}
+
+void FrameCapture::requestScreenshot(const std::filesystem::path& filePath)
+{
+    m_screenshotPath = filePath;
+}
+
+void FrameCapture::startSequence(const std::filesystem::path& prefix, const std::string& extension)
+{
+    m_sequencePrefix = prefix;
+    m_sequenceExtension = extension;
+    m_sequenceActive = true;
+    m_sequenceFrame = 0;
+}
+
+void FrameCapture::stopSequence()
+{
+    m_sequenceActive = false;
+}
+
+bool FrameCapture::isSequenceActive() const
+{
+    return m_sequenceActive;
+}
+
+bool FrameCapture::wantsCapture() const
+{
+    return m_sequenceActive || !m_screenshotPath.empty();
+}
+
+void FrameCapture::beginFrame()
+{
+    // Readbacks finish in the order in which they were issued.
+    for (size_t i = 0; i < NUM_BUFFERS; ++i) {
+        if (!collect(m_readbacks[m_nextReadback], false))
+            break;
+        m_nextReadback = (m_nextReadback + 1) % NUM_BUFFERS;
+    }
+}
+
+void FrameCapture::capture(const glm::ivec2& size)
+{
+    if (!wantsCapture())
+        return;
+    CPU_PROFILE_ZONE("FrameCapture::capture");
+
+    // Find the first free buffer after the ones in flight; if there is none, wait for the oldest.
+    size_t index = m_nextReadback;
+    while (m_readbacks[index].fence && (index = (index + 1) % NUM_BUFFERS) != m_nextReadback) { }
+    if (m_readbacks[index].fence) {
+        {
+            const std::lock_guard lock { m_mutex };
+            ++m_stats.readbackWaits;
+        }
+        collect(m_readbacks[m_nextReadback], true);
+        index = m_nextReadback;
+        m_nextReadback = (m_nextReadback + 1) % NUM_BUFFERS;
+    }
+
+    Readback& readback = m_readbacks[index];
+    readback.filePaths.clear();
+    if (m_sequenceActive) {
+        char number[16];
+        std::snprintf(number, sizeof(number), "_%05u", m_sequenceFrame++);
+        std::filesystem::path filePath = m_sequencePrefix;
+        filePath += number;
+        filePath += m_sequenceExtension;
+        readback.filePaths.push_back(std::move(filePath));
+    }
+    if (!m_screenshotPath.empty())
+        readback.filePaths.push_back(std::exchange(m_screenshotPath, {}));
+    readback.size = size;
+
+    const size_t numBytes = 4 * size_t(size.x) * size_t(size.y);
+    if (!readback.buffer)
+        glGenBuffers(1, &readback.buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    if (readback.bufferSize != numBytes) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(numBytes), nullptr, GL_STREAM_READ);
+        readback.bufferSize = numBytes;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    const std::lock_guard lock { m_mutex };
+    ++m_stats.captured;
+}
+
+void FrameCapture::flush()
+{
+    for (size_t i = 0; i < NUM_BUFFERS; ++i) {
+        collect(m_readbacks[m_nextReadback], true);
+        m_nextReadback = (m_nextReadback + 1) % NUM_BUFFERS;
+    }
+    std::unique_lock lock { m_mutex };
+    m_queueChanged.wait(lock, [&]() { return m_queue.empty() && m_numEncoding == 0; });
+}
+
+FrameCapture::Stats FrameCapture::stats() const
+{
+    const std::lock_guard lock { m_mutex };
+    return m_stats;
+}
+
+bool FrameCapture::collect(Readback& readback, bool wait)
+{
+    if (!readback.fence)
+        return false;
+    const GLenum status = glClientWaitSync(readback.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? GL_TIMEOUT_IGNORED : 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+        return false;
+    glDeleteSync(readback.fence);
+    readback.fence = nullptr;
+
+    Image image { std::vector<uint8_t>(readback.bufferSize), readback.size, std::move(readback.filePaths) };
+    {
+        CPU_PROFILE_ZONE("FrameCapture::map");
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        const auto* pPixels = static_cast<const uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(readback.bufferSize), GL_MAP_READ_BIT));
+        if (pPixels) {
+            // OpenGL stores the bottom row first; copying row by row flips the image for free.
+            const size_t rowSize = 4 * size_t(readback.size.x);
+            for (size_t y = 0; y < size_t(readback.size.y); ++y)
+                std::memcpy(image.pixels.data() + (size_t(readback.size.y) - 1 - y) * rowSize, pPixels + y * rowSize, rowSize);
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!pPixels) {
+            const std::lock_guard lock { m_mutex };
+            ++m_stats.failed;
+            return true;
+        }
+    }
+
+    std::unique_lock lock { m_mutex };
+    if (m_queue.size() >= MAX_QUEUED_IMAGES) {
+        ++m_stats.encoderWaits;
+        m_queueChanged.wait(lock, [&]() { return m_queue.size() < MAX_QUEUED_IMAGES; });
+    }
+    m_queue.push_back(std::move(image));
+    lock.unlock();
+    m_queueChanged.notify_all();
+    return true;
+}
+
+void FrameCapture::encoderLoop()
+{
+    CpuProfiler::get().setThreadName("Frame capture encoder");
+    std::unique_lock lock { m_mutex };
+    while (true) {
+        m_queueChanged.wait(lock, [&]() { return m_stop || !m_queue.empty(); });
+        if (m_queue.empty())
+            return;
+        const Image image = std::move(m_queue.front());
+        m_queue.pop_front();
+        ++m_numEncoding;
+        lock.unlock();
+        m_queueChanged.notify_all();
+
+        uint64_t numWritten = 0;
+        for (const std::filesystem::path& filePath : image.filePaths)
+            numWritten += writeImage(image, filePath) ? 1 : 0;
+
+        lock.lock();
+        --m_numEncoding;
+        m_stats.written += numWritten;
+        m_stats.failed += image.filePaths.size() - numWritten;
+        m_queueChanged.notify_all();
+    }
+}
+
+bool FrameCapture::writeImage(const Image& image, const std::filesystem::path& filePath)
+{
+    CPU_PROFILE_ZONE("FrameCapture::writeImage");
+    const std::filesystem::path extension = filePath.extension();
+    const std::string filePathString = filePath.string();
+    int result = 0;
+    if (extension == ".png")
+        result = stbi_write_png(filePathString.c_str(), image.size.x, image.size.y, 4, image.pixels.data(), 4 * image.size.x);
+    else if (extension == ".bmp")
+        result = stbi_write_bmp(filePathString.c_str(), image.size.x, image.size.y, 4, image.pixels.data());
+    else if (extension == ".jpg")
+        result = stbi_write_jpg(filePathString.c_str(), image.size.x, image.size.y, 4, image.pixels.data(), 95);
+    if (!result)
+        std::cerr << "Could not write the captured frame " << filePathString << std::endl;
+    return result != 0;
+}
@@ -0,0 +1,448 @@
+#include "frame_graph.h"
+#include "cpu_profiler.h"
+#include "gl_state.h"
+#include "gpu_profiler.h"
+#include <algorithm>
+#include <cassert>
+#include <optional>
+
+bool RenderTargetDesc::isDepth() const
+{
+    switch (internalFormat) {
+    case GL_DEPTH_COMPONENT16:
+    case GL_DEPTH_COMPONENT24:
+    case GL_DEPTH_COMPONENT32:
+    case GL_DEPTH_COMPONENT32F:
+    case GL_DEPTH24_STENCIL8:
+    case GL_DEPTH32F_STENCIL8:
+        return true;
+    default:
+        return false;
+    }
+}
+
+size_t RenderTargetDesc::sizeInBytes() const
+{
+    size_t bytesPerPixel = 4;
+    switch (internalFormat) {
+    case GL_R8:
+        bytesPerPixel = 1;
+        break;
+    case GL_RG8:
+    case GL_R16F:
+    case GL_DEPTH_COMPONENT16:
+        bytesPerPixel = 2;
+        break;
+    case GL_RGBA16F:
+    case GL_RG32F:
+    case GL_DEPTH32F_STENCIL8:
+        bytesPerPixel = 8;
+        break;
+    case GL_RGBA32F:
+        bytesPerPixel = 16;
+        break;
+    default:
+        break;
+    }
+    return size_t(size.x) * size_t(size.y) * bytesPerPixel;
+}
+
+FrameGraph::Builder::Builder(FrameGraph& graph, uint32_t pass)
+    : m_graph(graph)
+    , m_pass(pass)
+{
+}
+
+FrameGraphResource FrameGraph::Builder::create(std::string_view name, const RenderTargetDesc& desc)
+{
+    return { m_graph.addResource(name, ResourceKind::Transient, desc, 0) };
+}
+
+FrameGraphResource FrameGraph::Builder::read(FrameGraphResource resource)
+{
+    assert(resource.version < m_graph.m_versions.size());
+    std::vector<uint32_t>& readers = m_graph.m_versions[resource.version].readers;
+    if (std::find(std::begin(readers), std::end(readers), m_pass) == std::end(readers)) {
+        readers.push_back(m_pass);
+        m_graph.m_passes[m_pass].reads.push_back(resource.version);
+    }
+    return resource;
+}
+
+FrameGraphResource FrameGraph::Builder::readDepth(FrameGraphResource resource)
+{
+    read(resource);
+    assert(m_graph.m_resources[m_graph.m_versions[resource.version].resource].kind == ResourceKind::Backbuffer
+        || m_graph.m_resources[m_graph.m_versions[resource.version].resource].desc.isDepth());
+    m_graph.m_passes[m_pass].depthRead = resource.version;
+    return resource;
+}
+
+FrameGraphResource FrameGraph::Builder::write(FrameGraphResource resource)
+{
+    assert(resource.version < m_graph.m_versions.size());
+    // Only the latest version can be written; the graph does not fork resources.
+    assert(m_graph.m_versions[resource.version].nextVersion == FrameGraphResource::INVALID);
+
+    // Passes draw on top of the previous contents, so writing depends on them as well.
+    read(resource);
+    const auto version = uint32_t(m_graph.m_versions.size());
+    m_graph.m_versions.push_back({ m_graph.m_versions[resource.version].resource, int(m_pass) });
+    m_graph.m_versions[resource.version].nextVersion = version;
+    m_graph.m_passes[m_pass].writes.push_back(version);
+    return { version };
+}
+
+void FrameGraph::Builder::setSideEffect()
+{
+    m_graph.m_passes[m_pass].sideEffect = true;
+}
+
+FrameGraph::~FrameGraph()
+{
+    for (const PooledTexture& pooled : m_pool)
+        glDeleteTextures(1, &pooled.texture);
+    for (const CachedFramebuffer& cached : m_framebuffers)
+        glDeleteFramebuffers(1, &cached.framebuffer);
+    GLState::get().invalidate();
+}
+
+void FrameGraph::reset()
+{
+    m_resources.clear();
+    m_versions.clear();
+    m_passes.clear();
+    m_order.clear();
+    m_stats = {};
+}
+
+FrameGraphResource FrameGraph::importBackbuffer(std::string_view name, const glm::ivec2& size, GLuint framebuffer)
+{
+    const FrameGraphResource resource { addResource(name, ResourceKind::Backbuffer, { size, GL_RGBA8 }, 0) };
+    m_resources.back().framebuffer = framebuffer;
+    return resource;
+}
+
+FrameGraphResource FrameGraph::importTexture(std::string_view name, GLuint texture, const RenderTargetDesc& desc)
+{
+    return { addResource(name, ResourceKind::Texture, desc, texture) };
+}
+
+FrameGraphResource FrameGraph::importExternal(std::string_view name)
+{
+    return { addResource(name, ResourceKind::External, {}, 0) };
+}
+
+void FrameGraph::addPass(std::string_view name, const std::function<void(Builder&)>& setup, std::function<void()> execute)
+{
+    const auto pass = uint32_t(m_passes.size());
+    m_passes.push_back({ std::string(name), std::move(execute), CpuProfiler::get().intern(name) });
+    Builder builder { *this, pass };
+    setup(builder);
+}
+
+void FrameGraph::compile()
+{
+    CPU_PROFILE_ZONE("FrameGraph::compile");
+    cullPasses();
+    schedulePasses();
+
+    // Lifetimes of the transient targets, in execution order.
+    for (int position = 0; position < int(m_order.size()); ++position) {
+        const Pass& pass = m_passes[m_order[size_t(position)]];
+        for (const std::vector<uint32_t>* pVersions : { &pass.reads, &pass.writes }) {
+            for (uint32_t version : *pVersions) {
+                Resource& resource = m_resources[m_versions[version].resource];
+                if (resource.firstUse < 0)
+                    resource.firstUse = position;
+                resource.lastUse = position;
+            }
+        }
+    }
+
+    // Assign pooled textures: a texture is free again after the last pass using its target ran.
+    for (PooledTexture& pooled : m_pool)
+        pooled.inUse = pooled.usedThisFrame = false;
+    for (int position = 0; position < int(m_order.size()); ++position) {
+        for (Resource& resource : m_resources) {
+            if (resource.kind == ResourceKind::Transient && resource.firstUse == position) {
+                resource.texture = acquireTexture(resource.desc);
+                ++m_stats.transientTargets;
+                m_stats.transientBytes += resource.desc.sizeInBytes();
+            }
+        }
+        for (const Resource& resource : m_resources) {
+            if (resource.kind == ResourceKind::Transient && resource.lastUse == position)
+                releaseTexture(resource.texture);
+        }
+    }
+    trimPool();
+    for (const PooledTexture& pooled : m_pool)
+        m_stats.allocatedBytes += pooled.desc.sizeInBytes();
+}
+
+void FrameGraph::execute()
+{
+    for (uint32_t passIndex : m_order) {
+        const Pass& pass = m_passes[passIndex];
+        CPU_PROFILE_ZONE(pass.profileName);
+        GPU_PROFILE_ZONE(pass.name);
+        bindTargets(pass);
+        pass.execute();
+    }
+}
+
+GLuint FrameGraph::texture(FrameGraphResource resource) const
+{
+    assert(resource.version < m_versions.size());
+    return m_resources[m_versions[resource.version].resource].texture;
+}
+
+const FrameGraph::Stats& FrameGraph::stats() const
+{
+    return m_stats;
+}
+
+std::vector<std::string_view> FrameGraph::executionOrder() const
+{
+    std::vector<std::string_view> names;
+    for (uint32_t passIndex : m_order)
+        names.push_back(m_passes[passIndex].name);
+    return names;
+}
+
+uint32_t FrameGraph::addResource(std::string_view name, ResourceKind kind, const RenderTargetDesc& desc, GLuint texture)
+{
+    const auto resource = uint32_t(m_resources.size());
+    m_resources.push_back({ std::string(name), kind, desc, texture });
+    const auto version = uint32_t(m_versions.size());
+    m_versions.push_back({ resource });
+    return version;
+}
+
+void FrameGraph::cullPasses()
+{
+    // The contents of imported textures and of the back buffer outlive the frame.
+    const auto isRetained = [&](uint32_t version) {
+        const ResourceKind kind = m_resources[m_versions[version].resource].kind;
+        return kind == ResourceKind::Backbuffer || kind == ResourceKind::Texture;
+    };
+
+    std::vector<uint32_t> unused;
+    for (uint32_t version = 0; version < m_versions.size(); ++version) {
+        m_versions[version].refCount = int(m_versions[version].readers.size());
+        if (m_versions[version].refCount == 0 && !isRetained(version))
+            unused.push_back(version);
+    }
+    for (Pass& pass : m_passes) {
+        pass.refCount = int(pass.writes.size());
+        pass.culled = false;
+    }
+
+    const auto cullPass = [&](Pass& pass) {
+        pass.culled = true;
+        ++m_stats.culledPasses;
+        for (uint32_t version : pass.reads) {
+            if (--m_versions[version].refCount == 0 && !isRetained(version))
+                unused.push_back(version);
+        }
+    };
+    for (Pass& pass : m_passes) {
+        if (pass.refCount == 0 && !pass.sideEffect)
+            cullPass(pass);
+    }
+    while (!unused.empty()) {
+        const int writer = m_versions[unused.back()].writer;
+        unused.pop_back();
+        if (writer < 0)
+            continue;
+        Pass& pass = m_passes[size_t(writer)];
+        if (!pass.sideEffect && !pass.culled && --pass.refCount == 0)
+            cullPass(pass);
+    }
+    m_stats.passes = int(m_passes.size());
+}
+
+void FrameGraph::schedulePasses()
+{
+    // Pass a must run before pass b if b reads what a wrote, or if b overwrites what a read.
+    std::vector<std::vector<uint32_t>> successors(m_passes.size());
+    std::vector<int> numPredecessors(m_passes.size(), 0);
+    const auto addDependency = [&](uint32_t before, uint32_t after) {
+        if (before == after || m_passes[before].culled || m_passes[after].culled)
+            return;
+        successors[before].push_back(after);
+        ++numPredecessors[after];
+    };
+    for (const ResourceVersion& version : m_versions) {
+        for (uint32_t reader : version.readers) {
+            if (version.writer >= 0)
+                addDependency(uint32_t(version.writer), reader);
+            if (version.nextVersion != FrameGraphResource::INVALID)
+                addDependency(reader, uint32_t(m_versions[version.nextVersion].writer));
+        }
+    }
+
+    // Topological order that keeps the order in which the passes were added where there is a choice.
+    std::vector<uint32_t> ready;
+    for (uint32_t pass = 0; pass < m_passes.size(); ++pass) {
+        if (!m_passes[pass].culled && numPredecessors[pass] == 0)
+            ready.push_back(pass);
+    }
+    m_order.clear();
+    while (!ready.empty()) {
+        const auto itFirst = std::min_element(std::begin(ready), std::end(ready));
+        const uint32_t pass = *itFirst;
+        ready.erase(itFirst);
+        m_order.push_back(pass);
+        for (uint32_t successor : successors[pass]) {
+            if (--numPredecessors[successor] == 0)
+                ready.push_back(successor);
+        }
+    }
+    assert(m_order.size() == m_passes.size() - size_t(m_stats.culledPasses));
+
+    // Move every pass that produces something to right before the first pass that depends on it,
+    // starting at the end. The passes it moves past come later in a valid order, so none of them
+    // can be one of its predecessors.
+    std::vector<size_t> position(m_passes.size());
+    for (size_t i = 0; i < m_order.size(); ++i)
+        position[m_order[i]] = i;
+    for (size_t i = m_order.size(); i-- > 0;) {
+        const uint32_t pass = m_order[i];
+        if (successors[pass].empty())
+            continue;
+        size_t target = m_order.size();
+        for (uint32_t successor : successors[pass])
+            target = std::min(target, position[successor]);
+        std::rotate(std::begin(m_order) + ptrdiff_t(i), std::begin(m_order) + ptrdiff_t(i) + 1, std::begin(m_order) + ptrdiff_t(target));
+        for (size_t j = i; j < target; ++j)
+            position[m_order[j]] = j;
+    }
+}
+
+void FrameGraph::bindTargets(const Pass& pass)
+{
+    std::array<GLuint, CachedFramebuffer::MAX_COLOR_ATTACHMENTS> colors {};
+    size_t numColors = 0;
+    GLuint depth = 0;
+    GLenum depthAttachment = GL_DEPTH_ATTACHMENT;
+    glm::ivec2 size { 0 };
+    std::optional<GLuint> backbuffer;
+    for (uint32_t version : pass.writes) {
+        const Resource& resource = m_resources[m_versions[version].resource];
+        if (resource.kind == ResourceKind::External)
+            continue;
+        size = resource.desc.size;
+        if (resource.kind == ResourceKind::Backbuffer) {
+            backbuffer = resource.framebuffer;
+        } else if (resource.desc.isDepth()) {
+            depth = resource.texture;
+            if (resource.desc.internalFormat == GL_DEPTH24_STENCIL8 || resource.desc.internalFormat == GL_DEPTH32F_STENCIL8)
+                depthAttachment = GL_DEPTH_STENCIL_ATTACHMENT;
+        } else {
+            assert(numColors < colors.size());
+            colors[numColors++] = resource.texture;
+        }
+    }
+    if (pass.depthRead != FrameGraphResource::INVALID) {
+        const Resource& resource = m_resources[m_versions[pass.depthRead].resource];
+        assert(size == glm::ivec2(0) || size == resource.desc.size);
+        size = resource.desc.size;
+        if (resource.kind == ResourceKind::Backbuffer) {
+            assert(numColors == 0 && (!backbuffer || *backbuffer == resource.framebuffer));
+            backbuffer = resource.framebuffer;
+        } else {
+            assert(!backbuffer && (depth == 0 || depth == resource.texture));
+            depth = resource.texture;
+            if (resource.desc.internalFormat == GL_DEPTH24_STENCIL8 || resource.desc.internalFormat == GL_DEPTH32F_STENCIL8)
+                depthAttachment = GL_DEPTH_STENCIL_ATTACHMENT;
+        }
+    }
+    assert(!backbuffer || (numColors == 0 && depth == 0));
+
+    if (backbuffer) {
+        glBindFramebuffer(GL_FRAMEBUFFER, *backbuffer);
+    } else if (numColors > 0 || depth != 0) {
+        auto itCached = std::find_if(std::begin(m_framebuffers), std::end(m_framebuffers),
+            [&](const CachedFramebuffer& cached) { return cached.colors == colors && cached.depth == depth; });
+        if (itCached == std::end(m_framebuffers)) {
+            CachedFramebuffer cached { colors, depth, 0 };
+            glGenFramebuffers(1, &cached.framebuffer);
+            glBindFramebuffer(GL_FRAMEBUFFER, cached.framebuffer);
+            std::array<GLenum, CachedFramebuffer::MAX_COLOR_ATTACHMENTS> drawBuffers {};
+            for (size_t i = 0; i < numColors; ++i) {
+                drawBuffers[i] = GLenum(GL_COLOR_ATTACHMENT0 + i);
+                glFramebufferTexture2D(GL_FRAMEBUFFER, drawBuffers[i], GL_TEXTURE_2D, colors[i], 0);
+            }
+            if (depth != 0)
+                glFramebufferTexture2D(GL_FRAMEBUFFER, depthAttachment, GL_TEXTURE_2D, depth, 0);
+            if (numColors > 0)
+                glDrawBuffers(GLsizei(numColors), drawBuffers.data());
+            else
+                glDrawBuffer(GL_NONE);
+            assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+            m_framebuffers.push_back(cached);
+            itCached = std::prev(std::end(m_framebuffers));
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, itCached->framebuffer);
+    } else {
+        return;
+    }
+    glViewport(0, 0, size.x, size.y);
+}
+
+GLuint FrameGraph::acquireTexture(const RenderTargetDesc& desc)
+{
+    auto itPooled = std::find_if(std::begin(m_pool), std::end(m_pool),
+        [&](const PooledTexture& pooled) { return !pooled.inUse && pooled.desc == desc; });
+    if (itPooled == std::end(m_pool)) {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        GLState::get().bindTexture(0, GL_TEXTURE_2D, texture);
+        if (desc.isDepth()) {
+            const bool stencil = desc.internalFormat == GL_DEPTH24_STENCIL8 || desc.internalFormat == GL_DEPTH32F_STENCIL8;
+            glTexImage2D(GL_TEXTURE_2D, 0, GLint(desc.internalFormat), desc.size.x, desc.size.y, 0,
+                stencil ? GL_DEPTH_STENCIL : GL_DEPTH_COMPONENT, stencil ? GL_UNSIGNED_INT_24_8 : GL_FLOAT, nullptr);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, 0, GLint(desc.internalFormat), desc.size.x, desc.size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        m_pool.push_back({ desc, texture, false, false });
+        itPooled = std::prev(std::end(m_pool));
+    }
+    itPooled->inUse = itPooled->usedThisFrame = true;
+    return itPooled->texture;
+}
+
+void FrameGraph::releaseTexture(GLuint texture)
+{
+    for (PooledTexture& pooled : m_pool) {
+        if (pooled.texture == texture)
+            pooled.inUse = false;
+    }
+}
+
+void FrameGraph::trimPool()
+{
+    bool deleted = false;
+    for (const PooledTexture& pooled : m_pool) {
+        if (pooled.usedThisFrame)
+            continue;
+        glDeleteTextures(1, &pooled.texture);
+        std::erase_if(m_framebuffers, [&](const CachedFramebuffer& cached) {
+            if (cached.depth != pooled.texture && std::find(std::begin(cached.colors), std::end(cached.colors), pooled.texture) == std::end(cached.colors))
+                return false;
+            glDeleteFramebuffers(1, &cached.framebuffer);
+            return true;
+        });
+        deleted = true;
+    }
+    std::erase_if(m_pool, [](const PooledTexture& pooled) { return !pooled.usedThisFrame; });
+    if (deleted)
+        GLState::get().invalidate();
+}
@@ -0,0 +1,122 @@
+#include "frame_pacer.h"
+#include "cpu_profiler.h"
+#include <algorithm>
+#include <thread>
+
+// The limiter sleeps until this long before the deadline (sleeping overshoots by up to about a
+// millisecond on most systems) and spins for the rest.
+static constexpr std::chrono::microseconds LIMITER_SPIN_TIME { 1500 };
+// Weight of the latest frame in the smoothed latency.
+static constexpr double LATENCY_SMOOTHING = 0.1;
+
+static double milliseconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+FramePacer::~FramePacer()
+{
+    reset();
+}
+
+void FramePacer::setMaxFramesInFlight(int maxFramesInFlight)
+{
+    m_maxFramesInFlight = std::max(maxFramesInFlight, 0);
+}
+
+int FramePacer::maxFramesInFlight() const
+{
+    return m_maxFramesInFlight;
+}
+
+void FramePacer::setFrameRateLimit(double framesPerSecond)
+{
+    m_frameRateLimit = std::max(framesPerSecond, 0.0);
+}
+
+double FramePacer::frameRateLimit() const
+{
+    return m_frameRateLimit;
+}
+
+void FramePacer::setRefreshRate(double hertz)
+{
+    if (hertz > 0.0)
+        m_refreshPeriodMilliseconds = 1000.0 / hertz;
+}
+
+void FramePacer::setPresentMode(PresentMode presentMode)
+{
+    m_presentMode = presentMode;
+}
+
+void FramePacer::reset()
+{
+    for (const PendingFrame& frame : m_pendingFrames)
+        glDeleteSync(frame.fence);
+    m_pendingFrames.clear();
+    m_stats.framesInFlight = 0;
+}
+
+void FramePacer::onInputPolled()
+{
+    m_inputTime = Clock::now();
+}
+
+void FramePacer::beforePresent()
+{
+    m_stats.limiterMilliseconds = 0.0;
+    if (m_frameRateLimit <= 0.0)
+        return;
+
+    CPU_PROFILE_ZONE("FramePacer::limit");
+    const Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_frameRateLimit));
+    const Clock::time_point start = Clock::now();
+    if (start < m_nextDeadline) {
+        if (m_nextDeadline - start > LIMITER_SPIN_TIME)
+            std::this_thread::sleep_for(m_nextDeadline - start - LIMITER_SPIN_TIME);
+        while (Clock::now() < m_nextDeadline)
+            std::this_thread::yield();
+    }
+    const Clock::time_point end = Clock::now();
+    m_stats.limiterMilliseconds = milliseconds(end - start);
+    // A late frame moves the following deadlines instead of letting the next frames catch up.
+    m_nextDeadline = std::max(m_nextDeadline, end) + period;
+}
+
+void FramePacer::afterPresent()
+{
+    const Clock::time_point now = Clock::now();
+    m_stats.frameMilliseconds = m_lastPresent == Clock::time_point {} ? 0.0 : milliseconds(now - m_lastPresent);
+    m_lastPresent = now;
+    m_pendingFrames.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), m_inputTime });
+
+    m_stats.gpuWaitMilliseconds = 0.0;
+    if (m_maxFramesInFlight > 0 && m_pendingFrames.size() > size_t(m_maxFramesInFlight)) {
+        CPU_PROFILE_ZONE("FramePacer::waitForGpu");
+        while (m_pendingFrames.size() > size_t(m_maxFramesInFlight)) {
+            glClientWaitSync(m_pendingFrames.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            completeFrame(Clock::now());
+        }
+        m_stats.gpuWaitMilliseconds = milliseconds(Clock::now() - now);
+    }
+    while (!m_pendingFrames.empty() && glClientWaitSync(m_pendingFrames.front().fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+        completeFrame(Clock::now());
+    m_stats.framesInFlight = int(m_pendingFrames.size());
+}
+
+const FramePacingStats& FramePacer::stats() const
+{
+    return m_stats;
+}
+
+void FramePacer::completeFrame(Clock::time_point completionTime)
+{
+    const PendingFrame frame = m_pendingFrames.front();
+    m_pendingFrames.pop_front();
+    glDeleteSync(frame.fence);
+
+    const double scanOut = m_presentMode == PresentMode::Immediate ? 0.0 : m_refreshPeriodMilliseconds;
+    const double latency = milliseconds(completionTime - frame.inputTime) + scanOut;
+    m_stats.latencyMilliseconds = m_stats.latencyMilliseconds == 0.0 ? latency : m_stats.latencyMilliseconds + LATENCY_SMOOTHING * (latency - m_stats.latencyMilliseconds);
+}
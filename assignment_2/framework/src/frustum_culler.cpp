@@ -0,0 +1,198 @@
+#include "frustum_culler.h"
+#include "frustum_culler_kernels.h"
+#include "job_system.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64)
+#define FRUSTUM_CULLER_SSE 1
+#include <emmintrin.h>
+#endif
+#if defined(FRAMEWORK_ENABLE_AVX) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// A box takes a few nanoseconds, so smaller batches are not worth handing to another thread.
+static constexpr size_t MIN_BOXES_PER_JOB = 2048;
+
+static bool cpuSupportsAvx()
+{
+#if !defined(FRAMEWORK_ENABLE_AVX)
+    return false;
+#elif defined(_MSC_VER)
+    // CPUID.1:ECX.OSXSAVE[bit 27] and AVX[bit 28], and the OS must save the YMM registers (XCR0 bits 1 and 2).
+    int cpuInfo[4];
+    __cpuid(cpuInfo, 1);
+    const bool osxsaveAndAvx = (cpuInfo[2] & (3 << 27)) == (3 << 27);
+    return osxsaveAndAvx && (_xgetbv(0) & 6) == 6;
+#else
+    return __builtin_cpu_supports("avx");
+#endif
+}
+
+static const bool useAvx = cpuSupportsAvx();
+
+Frustum Frustum::fromMatrix(const glm::mat4& viewProjection)
+{
+    // Gribb and Hartmann: the planes are sums/differences of the fourth row and the other rows.
+    const glm::mat4 m = glm::transpose(viewProjection);
+    Frustum frustum;
+    frustum.planes = { m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[3] + m[2], m[3] - m[2] };
+    for (glm::vec4& plane : frustum.planes)
+        plane /= glm::length(glm::vec3(plane));
+    return frustum;
+}
+
+bool Frustum::intersects(const AxisAlignedBox& box) const
+{
+    const glm::vec3 center = box.center();
+    const glm::vec3 extent = box.extent();
+    for (const glm::vec4& plane : planes) {
+        const glm::vec3 normal { plane };
+        if (glm::dot(normal, center) + plane.w + glm::dot(glm::abs(normal), extent) < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+void FrustumCuller::clear()
+{
+    for (auto* pArray : { &m_centerX, &m_centerY, &m_centerZ, &m_extentX, &m_extentY, &m_extentZ })
+        pArray->clear();
+    m_visible.clear();
+    m_numCulled = 0;
+}
+
+uint32_t FrustumCuller::add(const AxisAlignedBox& localBounds, const glm::mat4& modelMatrix)
+{
+    return add(transformBox(localBounds, modelMatrix));
+}
+
+uint32_t FrustumCuller::add(const AxisAlignedBox& worldBounds)
+{
+    const glm::vec3 center = worldBounds.center();
+    const glm::vec3 extent = worldBounds.extent();
+    m_centerX.push_back(center.x);
+    m_centerY.push_back(center.y);
+    m_centerZ.push_back(center.z);
+    m_extentX.push_back(extent.x);
+    m_extentY.push_back(extent.y);
+    m_extentZ.push_back(extent.z);
+    return static_cast<uint32_t>(m_centerX.size() - 1);
+}
+
+#ifdef FRUSTUM_CULLER_SSE
+static size_t cullBoxesSse(const CullingInput& input, size_t begin, size_t end, uint8_t* pVisible)
+{
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        const __m128 centerX = _mm_loadu_ps(input.pCenterX + i);
+        const __m128 centerY = _mm_loadu_ps(input.pCenterY + i);
+        const __m128 centerZ = _mm_loadu_ps(input.pCenterZ + i);
+        const __m128 extentX = _mm_loadu_ps(input.pExtentX + i);
+        const __m128 extentY = _mm_loadu_ps(input.pExtentY + i);
+        const __m128 extentZ = _mm_loadu_ps(input.pExtentZ + i);
+
+        __m128 outside = _mm_setzero_ps();
+        for (int p = 0; p < 6; ++p) {
+            __m128 distance = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(input.normalX[p]), centerX), _mm_set1_ps(input.offset[p]));
+            distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(input.normalY[p]), centerY));
+            distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(input.normalZ[p]), centerZ));
+            __m128 radius = _mm_mul_ps(_mm_set1_ps(input.absNormalX[p]), extentX);
+            radius = _mm_add_ps(radius, _mm_mul_ps(_mm_set1_ps(input.absNormalY[p]), extentY));
+            radius = _mm_add_ps(radius, _mm_mul_ps(_mm_set1_ps(input.absNormalZ[p]), extentZ));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+        }
+
+        const int outsideMask = _mm_movemask_ps(outside);
+        for (int lane = 0; lane < 4; ++lane)
+            pVisible[i + static_cast<size_t>(lane)] = static_cast<uint8_t>(((outsideMask >> lane) & 1) ^ 1);
+    }
+    return i;
+}
+#endif
+
+static void cullBoxesScalar(const CullingInput& input, size_t begin, size_t end, uint8_t* pVisible)
+{
+    for (size_t i = begin; i < end; ++i) {
+        bool visible = true;
+        for (int p = 0; p < 6; ++p) {
+            const float distance = input.normalX[p] * input.pCenterX[i] + input.normalY[p] * input.pCenterY[i] + input.normalZ[p] * input.pCenterZ[i] + input.offset[p];
+            const float radius = input.absNormalX[p] * input.pExtentX[i] + input.absNormalY[p] * input.pExtentY[i] + input.absNormalZ[p] * input.pExtentZ[i];
+            visible &= distance + radius >= 0.0f;
+        }
+        pVisible[i] = visible ? 1 : 0;
+    }
+}
+
+void FrustumCuller::cull(const Frustum& frustum)
+{
+    CullingInput input;
+    for (int p = 0; p < 6; ++p) {
+        const glm::vec4& plane = frustum.planes[static_cast<size_t>(p)];
+        input.normalX[p] = plane.x;
+        input.normalY[p] = plane.y;
+        input.normalZ[p] = plane.z;
+        input.offset[p] = plane.w;
+        input.absNormalX[p] = std::abs(plane.x);
+        input.absNormalY[p] = std::abs(plane.y);
+        input.absNormalZ[p] = std::abs(plane.z);
+    }
+    input.pCenterX = m_centerX.data();
+    input.pCenterY = m_centerY.data();
+    input.pCenterZ = m_centerZ.data();
+    input.pExtentX = m_extentX.data();
+    input.pExtentY = m_extentY.data();
+    input.pExtentZ = m_extentZ.data();
+
+    m_visible.resize(m_centerX.size());
+    std::atomic<size_t> numCulled { 0 };
+    JobSystem::get().parallelFor(std::span(m_visible), MIN_BOXES_PER_JOB, [&](std::span<uint8_t> batch) {
+        const size_t begin = size_t(batch.data() - m_visible.data()), end = begin + batch.size();
+        size_t done = begin;
+#ifdef FRAMEWORK_ENABLE_AVX
+        if (useAvx)
+            done = cullBoxesAvx(input, done, end, m_visible.data());
+#endif
+#ifdef FRUSTUM_CULLER_SSE
+        done = cullBoxesSse(input, done, end, m_visible.data());
+#endif
+        cullBoxesScalar(input, done, end, m_visible.data());
+
+        size_t batchCulled = 0;
+        for (uint8_t visible : batch)
+            batchCulled += visible ^ 1;
+        numCulled.fetch_add(batchCulled, std::memory_order_relaxed);
+    });
+    m_numCulled = numCulled.load(std::memory_order_relaxed);
+}
+
+bool FrustumCuller::isVisible(uint32_t index) const
+{
+    assert(index < m_visible.size());
+    return m_visible[index] != 0;
+}
+
+size_t FrustumCuller::numTested() const
+{
+    return m_visible.size();
+}
+
+size_t FrustumCuller::numCulled() const
+{
+    return m_numCulled;
+}
+
+const char* FrustumCuller::instructionSet()
+{
+    if (useAvx)
+        return "AVX";
+#ifdef FRUSTUM_CULLER_SSE
+    return "SSE";
+#else
+    return "scalar";
+#endif
+}
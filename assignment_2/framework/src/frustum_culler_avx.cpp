@@ -0,0 +1,36 @@
+// Compiled with AVX enabled; only called after checking that the CPU supports it.
+#include "frustum_culler_kernels.h"
+#include <immintrin.h>
+
+size_t cullBoxesAvx(const CullingInput& input, size_t begin, size_t end, uint8_t* pVisible)
+{
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        const __m256 centerX = _mm256_loadu_ps(input.pCenterX + i);
+        const __m256 centerY = _mm256_loadu_ps(input.pCenterY + i);
+        const __m256 centerZ = _mm256_loadu_ps(input.pCenterZ + i);
+        const __m256 extentX = _mm256_loadu_ps(input.pExtentX + i);
+        const __m256 extentY = _mm256_loadu_ps(input.pExtentY + i);
+        const __m256 extentZ = _mm256_loadu_ps(input.pExtentZ + i);
+
+        __m256 outside = _mm256_setzero_ps();
+        for (int p = 0; p < 6; ++p) {
+            const __m256 nx = _mm256_set1_ps(input.normalX[p]);
+            const __m256 ny = _mm256_set1_ps(input.normalY[p]);
+            const __m256 nz = _mm256_set1_ps(input.normalZ[p]);
+            // Signed distance of the center plus the projected radius of the box onto the normal.
+            __m256 distance = _mm256_add_ps(_mm256_mul_ps(nx, centerX), _mm256_set1_ps(input.offset[p]));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(ny, centerY));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(nz, centerZ));
+            __m256 radius = _mm256_mul_ps(_mm256_set1_ps(input.absNormalX[p]), extentX);
+            radius = _mm256_add_ps(radius, _mm256_mul_ps(_mm256_set1_ps(input.absNormalY[p]), extentY));
+            radius = _mm256_add_ps(radius, _mm256_mul_ps(_mm256_set1_ps(input.absNormalZ[p]), extentZ));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+        }
+
+        const int outsideMask = _mm256_movemask_ps(outside);
+        for (int lane = 0; lane < 8; ++lane)
+            pVisible[i + static_cast<size_t>(lane)] = static_cast<uint8_t>(((outsideMask >> lane) & 1) ^ 1);
+    }
+    return i;
+}
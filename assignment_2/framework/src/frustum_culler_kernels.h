@@ -0,0 +1,17 @@
+#pragma once
+// Internal to frustum_culler*.cpp: the box/frustum test over structure of arrays.
+#include <cstddef>
+#include <cstdint>
+
+struct CullingInput {
+    // Plane i is (normalX[i], normalY[i], normalZ[i], offset[i]).
+    float normalX[6], normalY[6], normalZ[6], offset[6];
+    // Absolute values of the normals, for projecting the box extents.
+    float absNormalX[6], absNormalY[6], absNormalZ[6];
+    const float *pCenterX, *pCenterY, *pCenterZ;
+    const float *pExtentX, *pExtentY, *pExtentZ;
+};
+
+// Sets pVisible[i] to 1 if box i intersects the frustum and to 0 otherwise, for i in [begin, end).
+// Returns the index up to which the boxes were processed (kernels only process whole groups).
+size_t cullBoxesAvx(const CullingInput& input, size_t begin, size_t end, uint8_t* pVisible);
@@ -0,0 +1,162 @@
+#include "gl_state.h"
+
+// Index into the cached texture targets of a unit, or -1 if the target is not cached.
+static int textureTargetIndex(GLenum target)
+{
+    switch (target) {
+    case GL_TEXTURE_2D:
+        return 0;
+    case GL_TEXTURE_CUBE_MAP:
+        return 1;
+    case GL_TEXTURE_2D_ARRAY:
+        return 2;
+    case GL_TEXTURE_3D:
+        return 3;
+    case GL_TEXTURE_BUFFER:
+        return 4;
+    default:
+        return -1;
+    }
+}
+
+GLState& GLState::get()
+{
+    static GLState state;
+    return state;
+}
+
+GLState::GLState()
+{
+    invalidate();
+}
+
+template <typename T>
+bool GLState::changes(T& cached, const T& value)
+{
+    if (cached == value) {
+        ++m_elidedCalls;
+        return false;
+    }
+    cached = value;
+    ++m_issuedCalls;
+    return true;
+}
+
+void GLState::useProgram(GLuint program)
+{
+    if (changes(m_program, program))
+        glUseProgram(program);
+}
+
+void GLState::bindVertexArray(GLuint vertexArray)
+{
+    if (changes(m_vertexArray, vertexArray))
+        glBindVertexArray(vertexArray);
+}
+
+void GLState::activeTexture(GLuint unit)
+{
+    if (changes(m_activeUnit, unit))
+        glActiveTexture(GL_TEXTURE0 + unit);
+}
+
+void GLState::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+    const int targetIndex = textureTargetIndex(target);
+    if (unit < MAX_CACHED_UNITS && targetIndex >= 0) {
+        if (!changes(m_textures[unit][static_cast<size_t>(targetIndex)], texture))
+            return;
+    } else {
+        ++m_issuedCalls;
+    }
+    activeTexture(unit);
+    glBindTexture(target, texture);
+}
+
+void GLState::bindSampler(GLuint unit, GLuint sampler)
+{
+    if (unit >= MAX_CACHED_UNITS || changes(m_samplers[unit], sampler))
+        glBindSampler(unit, sampler);
+}
+
+void GLState::bindUniformBuffer(GLuint index, GLuint buffer)
+{
+    // Binding the whole buffer is cached as a range with size 0.
+    if (index >= MAX_CACHED_UNIFORM_BUFFERS || changes(m_uniformBuffers[index], BufferRange { buffer, 0, 0 }))
+        glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+}
+
+void GLState::bindUniformBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    if (index >= MAX_CACHED_UNIFORM_BUFFERS || changes(m_uniformBuffers[index], BufferRange { buffer, offset, size }))
+        glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+}
+
+void GLState::setDepthTest(bool enabled)
+{
+    if (changes(m_depthTest, Toggle(enabled ? GL_TRUE : GL_FALSE))) {
+        if (enabled)
+            glEnable(GL_DEPTH_TEST);
+        else
+            glDisable(GL_DEPTH_TEST);
+    }
+}
+
+void GLState::setDepthFunc(GLenum func)
+{
+    if (changes(m_depthFunc, func))
+        glDepthFunc(func);
+}
+
+void GLState::setDepthMask(bool enabled)
+{
+    if (changes(m_depthMask, Toggle(enabled ? GL_TRUE : GL_FALSE)))
+        glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+}
+
+void GLState::setBlend(bool enabled)
+{
+    if (changes(m_blend, Toggle(enabled ? GL_TRUE : GL_FALSE))) {
+        if (enabled)
+            glEnable(GL_BLEND);
+        else
+            glDisable(GL_BLEND);
+    }
+}
+
+void GLState::setBlendFunc(GLenum srcFactor, GLenum dstFactor)
+{
+    if (changes(m_blendFunc, std::array<GLenum, 2> { srcFactor, dstFactor }))
+        glBlendFunc(srcFactor, dstFactor);
+}
+
+void GLState::invalidate()
+{
+    m_program = UNKNOWN;
+    m_vertexArray = UNKNOWN;
+    m_activeUnit = UNKNOWN;
+    for (auto& unitTextures : m_textures)
+        unitTextures.fill(UNKNOWN);
+    m_samplers.fill(UNKNOWN);
+    m_uniformBuffers.fill(BufferRange { UNKNOWN, 0, 0 });
+    m_depthTest = UNKNOWN;
+    m_depthFunc = UNKNOWN;
+    m_depthMask = UNKNOWN;
+    m_blend = UNKNOWN;
+    m_blendFunc.fill(UNKNOWN);
+}
+
+uint64_t GLState::issuedCalls() const
+{
+    return m_issuedCalls;
+}
+
+uint64_t GLState::elidedCalls() const
+{
+    return m_elidedCalls;
+}
+
+void GLState::resetCounters()
+{
+    m_issuedCalls = m_elidedCalls = 0;
+}
@@ -0,0 +1,172 @@
+#include "gpu_profiler.h"
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+
+GpuProfiler& GpuProfiler::get()
+{
+    static GpuProfiler profiler;
+    return profiler;
+}
+
+void GpuProfiler::setEnabled(bool enabled)
+{
+    m_enabledNextFrame = enabled;
+}
+
+bool GpuProfiler::isEnabled() const
+{
+    return m_enabled;
+}
+
+void GpuProfiler::beginFrame()
+{
+    assert(m_openZones.empty());
+    if (m_enabled && !m_enabledNextFrame)
+        deleteQueries();
+    m_enabled = m_enabledNextFrame;
+    m_recording = false;
+    if (!m_enabled)
+        return;
+
+    collectResults();
+    FrameQueries& frame = m_frames[m_nextFrame];
+    if (frame.pending)
+        return;
+    frame.numQueries = 0;
+    frame.zones.clear();
+    m_recording = true;
+    beginZone("Frame");
+}
+
+void GpuProfiler::endFrame()
+{
+    if (!m_recording)
+        return;
+
+    endZone();
+    assert(m_openZones.empty());
+    m_frames[m_nextFrame].pending = true;
+    m_nextFrame = (m_nextFrame + 1) % NUM_FRAMES;
+    m_recording = false;
+}
+
+void GpuProfiler::beginZone(std::string_view name)
+{
+    if (!m_recording)
+        return;
+
+    const int depth = int(m_openZones.size());
+    auto itZone = std::find_if(std::begin(m_zones), std::end(m_zones),
+        [&](const ZoneHistory& zone) { return zone.depth == depth && zone.name == name; });
+    if (itZone == std::end(m_zones)) {
+        m_zones.push_back({ std::string(name), depth });
+        itZone = std::prev(std::end(m_zones));
+    }
+
+    FrameQueries& frame = m_frames[m_nextFrame];
+    m_openZones.push_back(uint32_t(frame.zones.size()));
+    frame.zones.push_back({ uint32_t(itZone - std::begin(m_zones)), timestamp(frame), 0 });
+}
+
+void GpuProfiler::endZone()
+{
+    if (!m_recording)
+        return;
+
+    assert(!m_openZones.empty());
+    FrameQueries& frame = m_frames[m_nextFrame];
+    frame.zones[m_openZones.back()].endQuery = timestamp(frame);
+    m_openZones.pop_back();
+}
+
+std::vector<GpuProfiler::ZoneStats> GpuProfiler::zoneStats() const
+{
+    std::vector<ZoneStats> stats;
+    std::vector<float> sorted;
+    for (const ZoneHistory& zone : m_zones) {
+        if (zone.numSamples == 0)
+            continue;
+
+        sorted.assign(std::begin(zone.samples), std::begin(zone.samples) + ptrdiff_t(zone.numSamples));
+        std::sort(std::begin(sorted), std::end(sorted));
+        double sum = 0.0;
+        for (float sample : sorted)
+            sum += sample;
+        const auto percentile = [&](double fraction) { return double(sorted[size_t(fraction * double(sorted.size() - 1) + 0.5)]); };
+        stats.push_back({ zone.name, zone.depth, sorted.size(), sum / double(sorted.size()), percentile(0.5), percentile(0.95), double(sorted.back()) });
+    }
+    return stats;
+}
+
+void GpuProfiler::clearHistory()
+{
+    for (ZoneHistory& zone : m_zones)
+        zone.numSamples = zone.next = 0;
+}
+
+bool GpuProfiler::writeCsv(const std::filesystem::path& filePath) const
+{
+    std::ofstream file(filePath, std::ios::trunc);
+    file << "zone,depth,samples,average_ms,median_ms,p95_ms,max_ms\n";
+    for (const ZoneStats& zone : zoneStats()) {
+        file << '"' << zone.name << "\"," << zone.depth << ',' << zone.numSamples << ',' << zone.averageMs << ','
+             << zone.medianMs << ',' << zone.p95Ms << ',' << zone.maxMs << '\n';
+    }
+    return bool(file);
+}
+
+uint32_t GpuProfiler::timestamp(FrameQueries& frame)
+{
+    if (frame.numQueries == frame.queries.size()) {
+        // Grow in steps so that a frame with a few more zones does not create queries one by one.
+        const size_t oldSize = frame.queries.size();
+        frame.queries.resize(std::max<size_t>(32, 2 * oldSize));
+        glGenQueries(GLsizei(frame.queries.size() - oldSize), frame.queries.data() + oldSize);
+    }
+    glQueryCounter(frame.queries[frame.numQueries], GL_TIMESTAMP);
+    return frame.numQueries++;
+}
+
+void GpuProfiler::collectResults()
+{
+    // Frames complete in order, starting with the oldest one (the one that is reused next).
+    for (size_t i = 0; i < NUM_FRAMES; ++i) {
+        FrameQueries& frame = m_frames[(m_nextFrame + i) % NUM_FRAMES];
+        if (!frame.pending)
+            continue;
+
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(frame.queries[frame.numQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        std::vector<GLuint64> timestamps(frame.numQueries);
+        for (uint32_t query = 0; query < frame.numQueries; ++query)
+            glGetQueryObjectui64v(frame.queries[query], GL_QUERY_RESULT, &timestamps[query]);
+        for (const ZoneRecord& record : frame.zones)
+            m_zones[record.zone].frameSum += double(timestamps[record.endQuery] - timestamps[record.beginQuery]) * 1e-6;
+        for (const ZoneRecord& record : frame.zones) {
+            ZoneHistory& zone = m_zones[record.zone];
+            if (zone.frameSum < 0.0)
+                continue; // already added (the zone occurred more than once)
+            zone.samples[zone.next] = float(zone.frameSum);
+            zone.next = (zone.next + 1) % HISTORY_SIZE;
+            zone.numSamples = std::min(zone.numSamples + 1, HISTORY_SIZE);
+            zone.frameSum = -1.0;
+        }
+        for (const ZoneRecord& record : frame.zones)
+            m_zones[record.zone].frameSum = 0.0;
+        frame.pending = false;
+    }
+}
+
+void GpuProfiler::deleteQueries()
+{
+    for (FrameQueries& frame : m_frames) {
+        if (!frame.queries.empty())
+            glDeleteQueries(GLsizei(frame.queries.size()), frame.queries.data());
+        frame = {};
+    }
+    m_nextFrame = 0;
+}
@@ -0,0 +1,100 @@
+#include "gpu_timer.h"
+#include <utility>
+
+GpuTimer::GpuTimer()
+{
+    glGenQueries(static_cast<GLsizei>(m_queries.size()), m_queries.data());
+}
+
+GpuTimer::GpuTimer(GpuTimer&& other)
+{
+    m_queries.fill(INVALID);
+    moveInto(std::move(other));
+}
+
+GpuTimer::~GpuTimer()
+{
+    freeGpuMemory();
+}
+
+GpuTimer& GpuTimer::operator=(GpuTimer&& other)
+{
+    if (this != &other)
+        moveInto(std::move(other));
+    return *this;
+}
+
+void GpuTimer::begin()
+{
+    collectResults();
+    if (m_numPending == NUM_QUERIES)
+        return;
+
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[(m_firstPending + m_numPending) % NUM_QUERIES]);
+    m_active = true;
+}
+
+void GpuTimer::end()
+{
+    if (!m_active)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    ++m_numPending;
+    m_active = false;
+}
+
+std::optional<double> GpuTimer::milliseconds()
+{
+    collectResults();
+    return m_lastResult;
+}
+
+void GpuTimer::reset()
+{
+    m_numDiscarded = m_numPending;
+    m_lastResult.reset();
+}
+
+void GpuTimer::collectResults()
+{
+    while (m_numPending > 0) {
+        const GLuint query = m_queries[m_firstPending];
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+        if (m_numDiscarded > 0)
+            --m_numDiscarded;
+        else
+            m_lastResult = static_cast<double>(nanoseconds) * 1e-6;
+
+        m_firstPending = (m_firstPending + 1) % NUM_QUERIES;
+        --m_numPending;
+    }
+}
+
+void GpuTimer::moveInto(GpuTimer&& other)
+{
+    freeGpuMemory();
+    m_queries = other.m_queries;
+    m_firstPending = other.m_firstPending;
+    m_numPending = other.m_numPending;
+    m_numDiscarded = other.m_numDiscarded;
+    m_active = other.m_active;
+    m_lastResult = other.m_lastResult;
+
+    other.m_queries.fill(INVALID);
+    other.m_numPending = other.m_numDiscarded = 0;
+    other.m_active = false;
+}
+
+void GpuTimer::freeGpuMemory()
+{
+    if (m_queries[0] != INVALID)
+        glDeleteQueries(static_cast<GLsizei>(m_queries.size()), m_queries.data());
+    m_queries.fill(INVALID);
+}
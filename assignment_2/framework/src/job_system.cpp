@@ -0,0 +1,191 @@
+#include "job_system.h"
+#include "cpu_profiler.h"
+#include <cassert>
+#include <stdexcept>
+#include <string>
+
+// Idle workers look for jobs this many times before going to sleep.
+static constexpr int IDLE_SPINS = 64;
+
+thread_local JobSystem::ThreadQueueOwner JobSystem::s_threadQueue;
+
+JobSystem::ThreadQueueOwner::~ThreadQueueOwner()
+{
+    if (!pQueue)
+        return;
+    const std::lock_guard lock { JobSystem::get().m_threadsMutex };
+    pQueue->inUse = false;
+}
+
+JobSystem& JobSystem::get()
+{
+    static JobSystem jobSystem;
+    return jobSystem;
+}
+
+JobSystem::JobSystem()
+{
+    // The thread that waits for jobs helps running them, so one worker less than there are cores.
+    const unsigned numWorkers = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    for (unsigned i = 0; i < numWorkers; ++i)
+        m_workers.emplace_back([this, i]() { workerLoop(i); });
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        const std::lock_guard lock { m_sleepMutex };
+        m_stop = true;
+    }
+    m_wakeUp.notify_all();
+    for (std::thread& worker : m_workers)
+        worker.join();
+}
+
+void JobSystem::addDependency(Job* pJob, Job* pDependency)
+{
+    assert(pDependency->m_numContinuations < Job::MAX_CONTINUATIONS);
+    pJob->m_numPendingDependencies.fetch_add(1, std::memory_order_relaxed);
+    pDependency->m_continuations[pDependency->m_numContinuations++] = pJob;
+}
+
+void JobSystem::run(Job* pJob)
+{
+    if (pJob->m_numPendingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        push(pJob);
+}
+
+void JobSystem::wait(const Job* pJob)
+{
+    while (!pJob->isFinished()) {
+        if (Job* pOther = tryGetJob())
+            execute(pOther);
+        else
+            std::this_thread::yield();
+    }
+}
+
+JobSystem::ThreadQueue& JobSystem::threadQueue()
+{
+    if (!s_threadQueue.pQueue) {
+        const std::lock_guard lock { m_threadsMutex };
+        const size_t numThreads = m_numThreads.load(std::memory_order_relaxed);
+        auto itFree = std::find_if(std::begin(m_threads), std::begin(m_threads) + numThreads, [](const auto& pQueue) { return !pQueue->inUse; });
+        if (itFree == std::begin(m_threads) + numThreads) {
+            if (numThreads == MAX_THREADS)
+                throw std::runtime_error("JobSystem: more than " + std::to_string(MAX_THREADS) + " threads create jobs");
+            m_threads[numThreads] = std::make_unique<ThreadQueue>();
+            m_threads[numThreads]->index = numThreads;
+            m_numThreads.store(numThreads + 1, std::memory_order_release);
+        }
+        (*itFree)->inUse = true;
+        s_threadQueue.pQueue = itFree->get();
+    }
+    return *s_threadQueue.pQueue;
+}
+
+Job* JobSystem::allocateJob(Job* pParent)
+{
+    ThreadQueue& queue = threadQueue();
+    Job* pJob = &queue.pJobs[queue.nextJob++ % MAX_JOBS_PER_THREAD];
+    assert(pJob->isFinished() && "More than MAX_JOBS_PER_THREAD jobs of a thread in flight");
+    pJob->m_pParent = pParent;
+    pJob->m_numUnfinished.store(1, std::memory_order_relaxed);
+    pJob->m_numPendingDependencies.store(1, std::memory_order_relaxed);
+    pJob->m_numContinuations = 0;
+    if (pParent)
+        pParent->m_numUnfinished.fetch_add(1, std::memory_order_relaxed);
+    return pJob;
+}
+
+void JobSystem::push(Job* pJob)
+{
+    ThreadQueue& queue = threadQueue();
+    {
+        const std::lock_guard lock { queue.mutex };
+        if (queue.back - queue.front < MAX_JOBS_PER_THREAD) {
+            queue.pReady[queue.back++ % MAX_JOBS_PER_THREAD] = pJob;
+            pJob = nullptr;
+        }
+    }
+    // Rather than growing the queue, a thread that queued too much runs the job right away.
+    if (pJob) {
+        execute(pJob);
+        return;
+    }
+
+    // Sleeping workers check m_numQueued after announcing themselves in m_numSleeping, under the
+    // lock; taking the lock before notifying makes sure they are waiting by then.
+    m_numQueued.fetch_add(1);
+    if (m_numSleeping.load() > 0) {
+        { const std::lock_guard lock { m_sleepMutex }; }
+        m_wakeUp.notify_one();
+    }
+}
+
+Job* JobSystem::tryGetJob()
+{
+    ThreadQueue& ownQueue = threadQueue();
+    {
+        const std::lock_guard lock { ownQueue.mutex };
+        if (ownQueue.back != ownQueue.front) {
+            m_numQueued.fetch_sub(1, std::memory_order_relaxed);
+            return ownQueue.pReady[--ownQueue.back % MAX_JOBS_PER_THREAD];
+        }
+    }
+
+    // Steal from the other threads, starting after this one so they are not all robbed in the same order.
+    const size_t numThreads = m_numThreads.load(std::memory_order_acquire);
+    for (size_t i = 1; i < numThreads; ++i) {
+        ThreadQueue& queue = *m_threads[(ownQueue.index + i) % numThreads];
+        const std::lock_guard lock { queue.mutex };
+        if (queue.back != queue.front) {
+            m_numQueued.fetch_sub(1, std::memory_order_relaxed);
+            return queue.pReady[queue.front++ % MAX_JOBS_PER_THREAD];
+        }
+    }
+    return nullptr;
+}
+
+void JobSystem::execute(Job* pJob)
+{
+    pJob->m_pInvoke(*pJob);
+    finish(pJob);
+}
+
+void JobSystem::finish(Job* pJob)
+{
+    // The job may be reused as soon as it is finished, so read everything needed first.
+    Job* pParent = pJob->m_pParent;
+    std::array<Job*, Job::MAX_CONTINUATIONS> continuations = pJob->m_continuations;
+    const uint32_t numContinuations = pJob->m_numContinuations;
+    if (pJob->m_numUnfinished.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+    for (uint32_t i = 0; i < numContinuations; ++i)
+        run(continuations[i]);
+    if (pParent)
+        finish(pParent);
+}
+
+void JobSystem::workerLoop(unsigned worker)
+{
+    CpuProfiler::get().setThreadName("Job worker " + std::to_string(worker));
+    while (true) {
+        for (int spin = 0; spin < IDLE_SPINS; ++spin) {
+            if (Job* pJob = tryGetJob()) {
+                execute(pJob);
+                spin = 0;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+
+        std::unique_lock lock { m_sleepMutex };
+        m_numSleeping.fetch_add(1);
+        m_wakeUp.wait(lock, [&]() { return m_stop || m_numQueued.load() > 0; });
+        m_numSleeping.fetch_sub(1);
+        if (m_stop)
+            return;
+    }
+}
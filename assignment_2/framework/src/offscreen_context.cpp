@@ -0,0 +1,224 @@
+#include "offscreen_context.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <string_view>
+#ifdef FRAMEWORK_HAS_EGL
+// Keep eglplatform.h from pulling in the X11 headers (and their macros).
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#ifdef FRAMEWORK_HAS_OSMESA
+// After glad, which keeps osmesa.h from including GL/gl.h.
+#include <GL/osmesa.h>
+#endif
+
+// Whether the space separated extension string contains the extension.
+[[maybe_unused]] static bool hasExtension(const char* pExtensions, std::string_view extension)
+{
+    if (!pExtensions)
+        return false;
+    const std::string_view extensions { pExtensions };
+    for (size_t begin = 0; begin < extensions.size();) {
+        const size_t end = std::min(extensions.find(' ', begin), extensions.size());
+        if (extensions.substr(begin, end - begin) == extension)
+            return true;
+        begin = end + 1;
+    }
+    return false;
+}
+
+static void* getEglProcAddress([[maybe_unused]] const char* pName)
+{
+#ifdef FRAMEWORK_HAS_EGL
+    return reinterpret_cast<void*>(eglGetProcAddress(pName));
+#else
+    return nullptr;
+#endif
+}
+
+static void* getOSMesaProcAddress([[maybe_unused]] const char* pName)
+{
+#ifdef FRAMEWORK_HAS_OSMESA
+    return reinterpret_cast<void*>(OSMesaGetProcAddress(pName));
+#else
+    return nullptr;
+#endif
+}
+
+OffscreenContext::OffscreenContext(const glm::ivec2& size, int glVersionMajor, int glVersionMinor, bool coreProfile)
+    : m_size(size)
+{
+    if (createEglContext(glVersionMajor, glVersionMinor, coreProfile)) {
+        m_backend = OffscreenBackend::EGL;
+    } else if (createOSMesaContext(glVersionMajor, glVersionMinor, coreProfile)) {
+        m_backend = OffscreenBackend::OSMesa;
+    } else {
+#if !defined(FRAMEWORK_HAS_EGL) && !defined(FRAMEWORK_HAS_OSMESA)
+        throw OffscreenContextException("The framework was built without EGL and OSMesa");
+#else
+        throw OffscreenContextException("Could not create an EGL or OSMesa context");
+#endif
+    }
+
+    if (!gladLoadGLLoader(m_backend == OffscreenBackend::EGL ? getEglProcAddress : getOSMesaProcAddress)) {
+        destroyContext();
+        throw OffscreenContextException("Could not load the OpenGL functions of the offscreen context");
+    }
+
+    glGenRenderbuffers(2, m_renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, size.x, size.y);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, size.x, size.y);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glGenFramebuffers(1, &m_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_renderbuffers[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        glDeleteFramebuffers(1, &m_framebuffer);
+        glDeleteRenderbuffers(2, m_renderbuffers);
+        destroyContext();
+        throw OffscreenContextException("The framebuffer of the offscreen context is incomplete");
+    }
+    glViewport(0, 0, size.x, size.y);
+}
+
+OffscreenContext::~OffscreenContext()
+{
+    makeCurrent();
+    glDeleteFramebuffers(1, &m_framebuffer);
+    glDeleteRenderbuffers(2, m_renderbuffers);
+    destroyContext();
+}
+
+void OffscreenContext::makeCurrent()
+{
+#ifdef FRAMEWORK_HAS_EGL
+    if (m_backend == OffscreenBackend::EGL)
+        eglMakeCurrent(m_pDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, m_pContext);
+#endif
+#ifdef FRAMEWORK_HAS_OSMESA
+    if (m_backend == OffscreenBackend::OSMesa)
+        OSMesaMakeCurrent(static_cast<OSMesaContext>(m_pContext), m_osMesaBuffer.data(), GL_UNSIGNED_BYTE, 1, 1);
+#endif
+    if (m_framebuffer)
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+}
+
+OffscreenBackend OffscreenContext::backend() const
+{
+    return m_backend;
+}
+
+glm::ivec2 OffscreenContext::size() const
+{
+    return m_size;
+}
+
+GLuint OffscreenContext::framebuffer() const
+{
+    return m_framebuffer;
+}
+
+bool OffscreenContext::createEglContext([[maybe_unused]] int glVersionMajor, [[maybe_unused]] int glVersionMinor, [[maybe_unused]] bool coreProfile)
+{
+#ifdef FRAMEWORK_HAS_EGL
+    // Mesa can create a display without any window system or GPU device node; other drivers
+    // (NVIDIA) only offer surfaceless contexts on their default display.
+    EGLDisplay display = EGL_NO_DISPLAY;
+    const auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (getPlatformDisplay && hasExtension(eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS), "EGL_MESA_platform_surfaceless"))
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        std::cerr << "Could not initialize EGL" << std::endl;
+        return false;
+    }
+
+    const char* pExtensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (!hasExtension(pExtensions, "EGL_KHR_surfaceless_context") || !eglBindAPI(EGL_OPENGL_API)) {
+        std::cerr << "EGL does not support surfaceless OpenGL contexts" << std::endl;
+        eglTerminate(display);
+        return false;
+    }
+    EGLConfig config = EGL_NO_CONFIG_KHR;
+    if (!hasExtension(pExtensions, "EGL_KHR_no_config_context")) {
+        const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        EGLint numConfigs = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &numConfigs) || numConfigs == 0) {
+            std::cerr << "EGL has no OpenGL config" << std::endl;
+            eglTerminate(display);
+            return false;
+        }
+    }
+
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, glVersionMajor,
+        EGL_CONTEXT_MINOR_VERSION, glVersionMinor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, coreProfile ? EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT : EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        std::cerr << "Could not create an OpenGL " << glVersionMajor << "." << glVersionMinor << " context with EGL" << std::endl;
+        if (context != EGL_NO_CONTEXT)
+            eglDestroyContext(display, context);
+        eglTerminate(display);
+        return false;
+    }
+    m_pDisplay = display;
+    m_pContext = context;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool OffscreenContext::createOSMesaContext([[maybe_unused]] int glVersionMajor, [[maybe_unused]] int glVersionMinor, [[maybe_unused]] bool coreProfile)
+{
+#ifdef FRAMEWORK_HAS_OSMESA
+    const int attributes[] = {
+        OSMESA_FORMAT, OSMESA_RGBA,
+        OSMESA_DEPTH_BITS, 0, // the framebuffer object has its own
+        OSMESA_PROFILE, coreProfile ? OSMESA_CORE_PROFILE : OSMESA_COMPAT_PROFILE,
+        OSMESA_CONTEXT_MAJOR_VERSION, glVersionMajor,
+        OSMESA_CONTEXT_MINOR_VERSION, glVersionMinor,
+        0
+    };
+    OSMesaContext context = OSMesaCreateContextAttribs(attributes, nullptr);
+    m_osMesaBuffer.resize(4);
+    if (!context || !OSMesaMakeCurrent(context, m_osMesaBuffer.data(), GL_UNSIGNED_BYTE, 1, 1)) {
+        std::cerr << "Could not create an OpenGL " << glVersionMajor << "." << glVersionMinor << " context with OSMesa" << std::endl;
+        if (context)
+            OSMesaDestroyContext(context);
+        return false;
+    }
+    m_pContext = context;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void OffscreenContext::destroyContext()
+{
+#ifdef FRAMEWORK_HAS_EGL
+    if (m_backend == OffscreenBackend::EGL) {
+        eglMakeCurrent(m_pDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(m_pDisplay, m_pContext);
+        eglTerminate(m_pDisplay);
+    }
+#endif
+#ifdef FRAMEWORK_HAS_OSMESA
+    if (m_backend == OffscreenBackend::OSMesa)
+        OSMesaDestroyContext(static_cast<OSMesaContext>(m_pContext));
+#endif
+    m_pDisplay = nullptr;
+    m_pContext = nullptr;
+}
@@ -0,0 +1,150 @@
+#include "program_binary_cache.h"
+#include "hash.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Header of a cache entry, followed by the program binary itself.
+struct ProgramBinaryHeader {
+    static constexpr uint32_t MAGIC = 0x42505243; // "CRPB"
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t magic { MAGIC };
+    uint32_t version { VERSION };
+    uint64_t key { 0 };
+    uint32_t binaryFormat { 0 };
+    uint32_t binaryLength { 0 };
+};
+
+// Sanity check for corrupted entries.
+static constexpr uint32_t MAX_BINARY_LENGTH = 64 * 1024 * 1024;
+
+static std::string_view glString(GLenum name)
+{
+    const auto* pString = reinterpret_cast<const char*>(glGetString(name));
+    return pString ? std::string_view(pString) : std::string_view();
+}
+
+ProgramBinaryCache::ProgramBinaryCache(std::filesystem::path directory)
+    : m_directory(std::move(directory))
+{
+    if (GLAD_GL_VERSION_4_1) {
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        m_supported = numFormats > 0;
+    }
+
+    // Binaries are only valid for the exact driver that produced them.
+    m_driverKey = fnv1a64(glString(GL_VENDOR));
+    m_driverKey = fnv1a64(glString(GL_RENDERER), m_driverKey);
+    m_driverKey = fnv1a64(glString(GL_VERSION), m_driverKey);
+
+    std::error_code error;
+    std::filesystem::create_directories(m_directory, error);
+    if (error) {
+        std::cerr << "Could not create shader cache directory " << m_directory << ": " << error.message() << std::endl;
+        m_supported = false;
+    }
+}
+
+bool ProgramBinaryCache::isSupported() const
+{
+    return m_supported;
+}
+
+uint64_t ProgramBinaryCache::baseKey() const
+{
+    return m_driverKey;
+}
+
+uint64_t ProgramBinaryCache::addToKey(uint64_t key, GLenum shaderStage, std::string_view source)
+{
+    key = fnv1a64(std::string_view(reinterpret_cast<const char*>(&shaderStage), sizeof(shaderStage)), key);
+    return fnv1a64(source, key);
+}
+
+GLuint ProgramBinaryCache::load(uint64_t key) const
+{
+    if (!m_supported)
+        return 0;
+
+    const std::filesystem::path filePath = entryPath(key);
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file)
+        return 0;
+
+    ProgramBinaryHeader header;
+    std::vector<char> binary;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (file && header.magic == ProgramBinaryHeader::MAGIC && header.version == ProgramBinaryHeader::VERSION && header.key == key && header.binaryLength <= MAX_BINARY_LENGTH) {
+        binary.resize(header.binaryLength);
+        file.read(binary.data(), static_cast<std::streamsize>(binary.size()));
+    }
+    const bool validFile = file && !binary.empty();
+    file.close();
+
+    GLuint program = 0;
+    if (validFile) {
+        program = glCreateProgram();
+        glProgramBinary(program, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+
+        // The driver may reject binaries (e.g. after an update that did not change the version string).
+        GLint linkSuccessful = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linkSuccessful);
+        if (!linkSuccessful) {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+
+    if (program == 0) {
+        std::error_code error;
+        std::filesystem::remove(filePath, error);
+    }
+    return program;
+}
+
+void ProgramBinaryCache::store(uint64_t key, GLuint program) const
+{
+    if (!m_supported)
+        return;
+
+    GLint binaryLength = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+    if (binaryLength <= 0)
+        return;
+
+    ProgramBinaryHeader header;
+    header.key = key;
+    std::vector<char> binary(static_cast<size_t>(binaryLength));
+    GLsizei writtenLength = 0;
+    glGetProgramBinary(program, binaryLength, &writtenLength, &header.binaryFormat, binary.data());
+    header.binaryLength = static_cast<uint32_t>(writtenLength);
+
+    // Write to a temporary file first so other instances never read a partially written entry.
+    const std::filesystem::path filePath = entryPath(key);
+    std::filesystem::path tmpFilePath = filePath;
+    tmpFilePath += ".tmp";
+    {
+        std::ofstream file(tmpFilePath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(binary.data(), writtenLength);
+        if (!file)
+            return;
+    }
+    std::error_code error;
+    std::filesystem::rename(tmpFilePath, filePath, error);
+    if (error)
+        std::filesystem::remove(tmpFilePath, error);
+}
+
+std::filesystem::path ProgramBinaryCache::entryPath(uint64_t key) const
+{
+    return m_directory / fmt::format("{:016x}.bin", key);
+}
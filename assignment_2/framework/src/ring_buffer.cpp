@@ -0,0 +1,162 @@
+#include "ring_buffer.h"
+#include "gl_state.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+static size_t alignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+RingBuffer::RingBuffer(GLenum target, size_t segmentSize, int numSegments)
+    : m_target(target)
+    , m_fences(static_cast<size_t>(numSegments), nullptr)
+    , m_segment(numSegments - 1)
+{
+    assert(numSegments > 0);
+    if (target == GL_UNIFORM_BUFFER) {
+        GLint uboAlignment;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uboAlignment);
+        m_alignment = std::max(m_alignment, static_cast<size_t>(uboAlignment));
+    }
+    // Segments must start at an aligned offset.
+    m_segmentSize = alignUp(segmentSize, m_alignment);
+    const auto totalSize = static_cast<GLsizeiptr>(m_segmentSize * m_fences.size());
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(m_target, m_buffer);
+    if (GLAD_GL_VERSION_4_4) {
+        constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(m_target, totalSize, nullptr, flags);
+        m_pMapped = static_cast<std::byte*>(glMapBufferRange(m_target, 0, totalSize, flags));
+    } else {
+        glBufferData(m_target, totalSize, nullptr, GL_STREAM_DRAW);
+        m_staging.resize(m_segmentSize);
+    }
+}
+
+RingBuffer::RingBuffer(RingBuffer&& other)
+{
+    moveInto(std::move(other));
+}
+
+RingBuffer::~RingBuffer()
+{
+    freeGpuMemory();
+}
+
+RingBuffer& RingBuffer::operator=(RingBuffer&& other)
+{
+    if (this != &other)
+        moveInto(std::move(other));
+    return *this;
+}
+
+void RingBuffer::beginFrame()
+{
+    m_segment = (m_segment + 1) % static_cast<int>(m_fences.size());
+    m_head = m_flushed = 0;
+
+    GLsync& fence = m_fences[static_cast<size_t>(m_segment)];
+    if (fence) {
+        // Flush on the first wait so the fence is guaranteed to be signaled eventually.
+        GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (glClientWaitSync(fence, waitFlags, 1'000'000) == GL_TIMEOUT_EXPIRED)
+            waitFlags = 0;
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+}
+
+void RingBuffer::flush()
+{
+    if (m_pMapped || m_head == m_flushed)
+        return;
+
+    const size_t segmentOffset = static_cast<size_t>(m_segment) * m_segmentSize;
+    glBindBuffer(m_target, m_buffer);
+    glBufferSubData(m_target, static_cast<GLintptr>(segmentOffset + m_flushed), static_cast<GLsizeiptr>(m_head - m_flushed), m_staging.data() + m_flushed);
+    m_flushed = m_head;
+}
+
+void RingBuffer::endFrame()
+{
+    flush();
+    m_fences[static_cast<size_t>(m_segment)] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+GLintptr RingBuffer::push(const void* pData, size_t size)
+{
+    const size_t offset = alignUp(m_head, m_alignment);
+    if (offset + size > m_segmentSize)
+        throw std::length_error(fmt::format("RingBuffer segment of {} bytes is full", m_segmentSize));
+    m_head = offset + size;
+
+    const size_t segmentOffset = static_cast<size_t>(m_segment) * m_segmentSize;
+    if (m_pMapped) {
+        std::memcpy(m_pMapped + segmentOffset + offset, pData, size);
+    } else {
+        std::memcpy(m_staging.data() + offset, pData, size);
+    }
+    return static_cast<GLintptr>(segmentOffset + offset);
+}
+
+void RingBuffer::bindRange(GLuint index, GLintptr offset, GLsizeiptr size) const
+{
+    if (m_target == GL_UNIFORM_BUFFER)
+        GLState::get().bindUniformBufferRange(index, m_buffer, offset, size);
+    else
+        glBindBufferRange(m_target, index, m_buffer, offset, size);
+}
+
+GLuint RingBuffer::buffer() const
+{
+    return m_buffer;
+}
+
+bool RingBuffer::isPersistentlyMapped() const
+{
+    return m_pMapped != nullptr;
+}
+
+void RingBuffer::moveInto(RingBuffer&& other)
+{
+    freeGpuMemory();
+    m_target = other.m_target;
+    m_segmentSize = other.m_segmentSize;
+    m_alignment = other.m_alignment;
+    m_buffer = std::exchange(other.m_buffer, INVALID);
+    m_pMapped = std::exchange(other.m_pMapped, nullptr);
+    m_staging = std::move(other.m_staging);
+    m_fences = std::move(other.m_fences);
+    m_segment = other.m_segment;
+    m_head = other.m_head;
+    m_flushed = other.m_flushed;
+}
+
+void RingBuffer::freeGpuMemory()
+{
+    for (GLsync fence : m_fences) {
+        if (fence)
+            glDeleteSync(fence);
+    }
+    m_fences.clear();
+
+    if (m_buffer != INVALID) {
+        if (m_pMapped) {
+            glBindBuffer(m_target, m_buffer);
+            glUnmapBuffer(m_target);
+        }
+        glDeleteBuffers(1, &m_buffer);
+        GLState::get().invalidate();
+    }
+    m_buffer = INVALID;
+    m_pMapped = nullptr;
+}
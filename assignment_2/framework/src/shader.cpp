@@ -1,16 +1,26 @@
 #include "shader.h"
+#include "gl_state.h"
+#include "program_binary_cache.h"
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <fmt/format.h>
+#include <glm/gtc/type_ptr.hpp>
 DISABLE_WARNINGS_POP()
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <utility>
 
 static constexpr GLuint invalid = 0xFFFFFFFF;
 
+// From GL_KHR_parallel_shader_compile, which is not part of the generated GLAD headers.
+static constexpr GLenum GL_COMPLETION_STATUS_KHR = 0x91B1;
+
+static bool hasParallelShaderCompile();
 static bool checkShaderErrors(GLuint shader);
 static bool checkProgramErrors(GLuint program);
 static std::string readFile(std::filesystem::path filePath);
@@ -18,6 +28,7 @@ static std::string readFile(std::filesystem::path filePath);
 Shader::Shader(GLuint program)
     : m_program(program)
 {
+    reflectUniforms();
 }
 
 Shader::Shader()
@@ -26,6 +37,9 @@ Shader::Shader()
 }
 
 Shader::Shader(Shader&& other)
+    : m_uniforms(std::move(other.m_uniforms))
+    , m_missingUniforms(std::move(other.m_missingUniforms))
+    , m_blockBindings(std::move(other.m_blockBindings))
 {
     m_program = other.m_program;
     other.m_program = invalid;
@@ -33,16 +47,23 @@ Shader::Shader(Shader&& other)
 
 Shader::~Shader()
 {
-    if (m_program != invalid)
+    if (m_program != invalid) {
         glDeleteProgram(m_program);
+        GLState::get().invalidate();
+    }
 }
 
 Shader& Shader::operator=(Shader&& other)
 {
-    if (m_program != invalid)
+    if (m_program != invalid) {
         glDeleteProgram(m_program);
+        GLState::get().invalidate();
+    }
 
     m_program = other.m_program;
+    m_uniforms = std::move(other.m_uniforms);
+    m_missingUniforms = std::move(other.m_missingUniforms);
+    m_blockBindings = std::move(other.m_blockBindings);
     other.m_program = invalid;
     return *this;
 }
@@ -50,20 +71,37 @@ Shader& Shader::operator=(Shader&& other)
 void Shader::bind() const
 {
     assert(m_program != invalid);
-    glUseProgram(m_program);
+    GLState::get().useProgram(m_program);
 }
 
 void Shader::bindUniformBlock(const std::string& blockName, GLuint bindingLocation, GLuint uniformBlockBuffer) const
 {
-    GLuint blockIdx = glGetUniformBlockIndex(m_program, blockName.data());
-    if (blockIdx != GL_INVALID_INDEX) {
-        glUniformBlockBinding(m_program, blockIdx, bindingLocation);
-        glBindBufferBase(GL_UNIFORM_BUFFER, bindingLocation, uniformBlockBuffer);
-    } else {
+    if (setUniformBlockBinding(blockName, bindingLocation)) {
+        GLState::get().bindUniformBuffer(bindingLocation, uniformBlockBuffer);
+    } else if (firstTimeMissing(fnv1a32(blockName))) {
         std::cout << "Could not bind uniform block " << blockName << " invalid name" << std::endl;
     }
 }
 
+bool Shader::setUniformBlockBinding(const std::string& blockName, GLuint bindingLocation) const
+{
+    // Typically called for every draw (e.g. by GPUMesh::draw), so skip the lookup if nothing changes.
+    const uint32_t hash = fnv1a32(blockName);
+    auto iter = std::find_if(std::begin(m_blockBindings), std::end(m_blockBindings), [=](const auto& binding) { return binding.first == hash; });
+    if (iter != std::end(m_blockBindings) && iter->second == bindingLocation)
+        return true;
+
+    GLuint blockIdx = glGetUniformBlockIndex(m_program, blockName.data());
+    if (blockIdx == GL_INVALID_INDEX)
+        return false;
+    glUniformBlockBinding(m_program, blockIdx, bindingLocation);
+    if (iter != std::end(m_blockBindings))
+        iter->second = bindingLocation;
+    else
+        m_blockBindings.emplace_back(hash, bindingLocation);
+    return true;
+}
+
 GLuint Shader::getAttributeLocation(const std::string& name) const
 {
     GLuint loc = glGetAttribLocation(m_program, name.c_str());
@@ -75,16 +113,211 @@ GLuint Shader::getAttributeLocation(const std::string& name) const
 
 GLint Shader::getUniformLocation(const std::string& name) const
 {
-    GLint loc = glGetUniformLocation(m_program, name.c_str());
-    if (loc == GL_INVALID_INDEX) {
+    const uint32_t hash = fnv1a32(name);
+    if (const UniformSlot* pSlot = findUniform(hash))
+        return pSlot->location;
+
+    // Only warn the first time, this function is typically called every frame.
+    if (firstTimeMissing(hash))
         std::cerr << "Warning : Could not find uniform " << name << std::endl;
+    return -1;
+}
+
+bool Shader::hasUniform(UniformId id) const
+{
+    return findUniform(id.hash) != nullptr;
+}
+
+void Shader::set(UniformId id, bool value) const
+{
+    set(id, value ? 1 : 0);
+}
+
+void Shader::set(UniformId id, int value) const
+{
+    if (const UniformSlot* pSlot = updateShadow(id, value))
+        glProgramUniform1i(m_program, pSlot->location, value);
+}
+
+void Shader::set(UniformId id, float value) const
+{
+    if (const UniformSlot* pSlot = updateShadow(id, value))
+        glProgramUniform1f(m_program, pSlot->location, value);
+}
+
+void Shader::set(UniformId id, const glm::vec2& value) const
+{
+    if (const UniformSlot* pSlot = updateShadow(id, value))
+        glProgramUniform2fv(m_program, pSlot->location, 1, glm::value_ptr(value));
+}
+
+void Shader::set(UniformId id, const glm::vec3& value) const
+{
+    if (const UniformSlot* pSlot = updateShadow(id, value))
+        glProgramUniform3fv(m_program, pSlot->location, 1, glm::value_ptr(value));
+}
+
+void Shader::set(UniformId id, const glm::vec4& value) const
+{
+    if (const UniformSlot* pSlot = updateShadow(id, value))
+        glProgramUniform4fv(m_program, pSlot->location, 1, glm::value_ptr(value));
+}
+
+void Shader::set(UniformId id, const glm::mat3& value) const
+{
+    if (const UniformSlot* pSlot = updateShadow(id, value))
+        glProgramUniformMatrix3fv(m_program, pSlot->location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::set(UniformId id, const glm::mat4& value) const
+{
+    if (const UniformSlot* pSlot = updateShadow(id, value))
+        glProgramUniformMatrix4fv(m_program, pSlot->location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::reflectUniforms()
+{
+    GLint numUniforms = 0, maxNameLength = 0;
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORMS, &numUniforms);
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+    std::string name;
+    m_uniforms.clear();
+    m_uniforms.reserve(static_cast<size_t>(numUniforms));
+    for (GLuint i = 0; i < static_cast<GLuint>(numUniforms); ++i) {
+        name.resize(static_cast<size_t>(maxNameLength));
+        GLsizei nameLength = 0;
+        GLint arraySize = 0;
+        GLenum type = 0;
+        glGetActiveUniform(m_program, i, maxNameLength, &nameLength, &arraySize, &type, name.data());
+        name.resize(static_cast<size_t>(nameLength));
+
+        // Members of uniform blocks do not have a location.
+        const GLint location = glGetUniformLocation(m_program, name.c_str());
+        if (location == -1)
+            continue;
+
+        // Arrays are reported as "name[0]", register them by their base name.
+        if (name.ends_with("[0]"))
+            name.resize(name.size() - 3);
+
+        UniformSlot slot {};
+        slot.hash = fnv1a32(name);
+        slot.location = location;
+        slot.type = type;
+        m_uniforms.push_back(slot);
     }
-    return loc;
+
+    std::sort(std::begin(m_uniforms), std::end(m_uniforms), [](const UniformSlot& lhs, const UniformSlot& rhs) { return lhs.hash < rhs.hash; });
+    assert(std::adjacent_find(std::begin(m_uniforms), std::end(m_uniforms), [](const UniformSlot& lhs, const UniformSlot& rhs) { return lhs.hash == rhs.hash; }) == std::end(m_uniforms));
 }
 
-ShaderBuilder::~ShaderBuilder()
+Shader::UniformSlot* Shader::findUniform(uint32_t hash) const
 {
-    freeShaders();
+    auto iter = std::lower_bound(std::begin(m_uniforms), std::end(m_uniforms), hash, [](const UniformSlot& slot, uint32_t h) { return slot.hash < h; });
+    if (iter == std::end(m_uniforms) || iter->hash != hash)
+        return nullptr;
+    return &(*iter);
+}
+
+bool Shader::firstTimeMissing(uint32_t hash) const
+{
+    if (std::find(std::begin(m_missingUniforms), std::end(m_missingUniforms), hash) != std::end(m_missingUniforms))
+        return false;
+    m_missingUniforms.push_back(hash);
+    return true;
+}
+
+// Returns the uniform slot if the value has to be uploaded, nullptr otherwise.
+template <typename T>
+Shader::UniformSlot* Shader::updateShadow(UniformId id, const T& value) const
+{
+    static_assert(sizeof(T) <= sizeof(UniformSlot::shadow));
+
+    UniformSlot* pSlot = findUniform(id.hash);
+    if (!pSlot)
+        return nullptr;
+    if (pSlot->hasShadow && std::memcmp(pSlot->shadow.data(), &value, sizeof(T)) == 0)
+        return nullptr;
+
+    std::memcpy(pSlot->shadow.data(), &value, sizeof(T));
+    pSlot->hasShadow = true;
+    return pSlot;
+}
+
+AsyncShader::AsyncShader(AsyncShader&& other)
+    : m_state(std::exchange(other.m_state, State::Empty))
+    , m_shader(std::move(other.m_shader))
+    , m_program(std::exchange(other.m_program, 0))
+    , m_shaders(std::move(other.m_shaders))
+    , m_stageFiles(std::move(other.m_stageFiles))
+    , m_blockBindings(std::move(other.m_blockBindings))
+    , m_pBinaryCache(other.m_pBinaryCache)
+    , m_cacheKey(other.m_cacheKey)
+{
+    other.m_shaders.clear();
+}
+
+AsyncShader::~AsyncShader()
+{
+    freePending();
+}
+
+AsyncShader& AsyncShader::operator=(AsyncShader&& other)
+{
+    if (this == &other)
+        return *this;
+    freePending();
+    m_state = std::exchange(other.m_state, State::Empty);
+    m_shader = std::move(other.m_shader);
+    m_program = std::exchange(other.m_program, 0);
+    m_shaders = std::move(other.m_shaders);
+    other.m_shaders.clear();
+    m_stageFiles = std::move(other.m_stageFiles);
+    m_blockBindings = std::move(other.m_blockBindings);
+    m_pBinaryCache = other.m_pBinaryCache;
+    m_cacheKey = other.m_cacheKey;
+    return *this;
+}
+
+bool AsyncShader::isReady()
+{
+    if (m_state != State::Pending)
+        return m_state == State::Ready;
+
+    if (hasParallelShaderCompile()) {
+        GLint completed = GL_FALSE;
+        glGetProgramiv(m_program, GL_COMPLETION_STATUS_KHR, &completed);
+        if (!completed)
+            return false;
+    }
+
+    try {
+        ShaderBuilder::finishLink(*this);
+    } catch (const ShaderLoadingException& e) {
+        std::cerr << e.what() << std::endl;
+    }
+    return m_state == State::Ready;
+}
+
+bool AsyncShader::hasFailed() const
+{
+    return m_state == State::Failed;
+}
+
+const Shader& AsyncShader::get() const
+{
+    assert(m_state == State::Ready);
+    return m_shader;
+}
+
+void AsyncShader::freePending()
+{
+    for (GLuint shader : m_shaders)
+        glDeleteShader(shader);
+    m_shaders.clear();
+    if (m_program != 0)
+        glDeleteProgram(std::exchange(m_program, 0));
 }
 
 ShaderBuilder& ShaderBuilder::addStage(GLuint shaderStage, std::filesystem::path shaderFile)
@@ -93,39 +326,163 @@ ShaderBuilder& ShaderBuilder::addStage(GLuint shaderStage, std::filesystem::path
         throw ShaderLoadingException(fmt::format("File {} does not exist", shaderFile.string().c_str()));
     }
 
-    const std::string shaderSource = readFile(shaderFile);
-    const GLuint shader = glCreateShader(shaderStage);
-    const char* shaderSourcePtr = shaderSource.c_str();
-    glShaderSource(shader, 1, &shaderSourcePtr, nullptr);
-    glCompileShader(shader);
-    if (!checkShaderErrors(shader)) {
-        glDeleteShader(shader);
-        throw ShaderLoadingException(fmt::format("Failed to compile shader {}", shaderFile.string().c_str()));
-    }
+    m_stages.push_back({ shaderStage, shaderFile, readFile(shaderFile) });
+    return *this;
+}
+
+ShaderBuilder& ShaderBuilder::addDefine(std::string name, std::string value)
+{
+    m_defines.emplace_back(std::move(name), std::move(value));
+    return *this;
+}
+
+ShaderBuilder& ShaderBuilder::useBinaryCache(const ProgramBinaryCache& cache)
+{
+    m_pBinaryCache = &cache;
+    return *this;
+}
 
-    m_shaders.push_back(shader);
+ShaderBuilder& ShaderBuilder::setUniformBlockBinding(std::string blockName, GLuint bindingLocation)
+{
+    m_blockBindings.emplace_back(std::move(blockName), bindingLocation);
     return *this;
 }
 
 Shader ShaderBuilder::build()
 {
-    // Combine vertex and fragment shaders into a single shader program.
-    GLuint program = glCreateProgram();
-    for (GLuint shader : m_shaders)
-        glAttachShader(program, shader);
-    glLinkProgram(program);
+    AsyncShader pending = buildAsync();
+    if (pending.m_state == AsyncShader::State::Pending)
+        finishLink(pending);
+    return std::move(pending.m_shader);
+}
+
+AsyncShader ShaderBuilder::buildAsync()
+{
+    if (m_pBinaryCache && m_pBinaryCache->isSupported()) {
+        const uint64_t key = cacheKey();
+        if (const GLuint program = m_pBinaryCache->load(key)) {
+            AsyncShader out;
+            out.m_state = AsyncShader::State::Ready;
+            out.m_shader = makeShader(program, m_blockBindings);
+            return out;
+        }
+        AsyncShader out = submit();
+        out.m_pBinaryCache = m_pBinaryCache;
+        out.m_cacheKey = key;
+        return out;
+    }
+    return submit();
+}
+
+std::string ShaderBuilder::stageSource(const Stage& stage) const
+{
+    if (m_defines.empty())
+        return stage.source;
 
-    if (!checkProgramErrors(program)) {
-        throw ShaderLoadingException("Shader program failed to link");
+    // GLSL requires #version to be the first directive, so the defines go on the line after it.
+    size_t insertPos = 0;
+    if (const size_t versionPos = stage.source.find("#version"); versionPos != std::string::npos) {
+        insertPos = stage.source.find('\n', versionPos);
+        insertPos = insertPos == std::string::npos ? stage.source.size() : insertPos + 1;
     }
+    const auto versionLines = std::count(stage.source.begin(), stage.source.begin() + static_cast<std::ptrdiff_t>(insertPos), '\n');
+
+    std::string defines;
+    for (const auto& [name, value] : m_defines)
+        defines += fmt::format("#define {} {}\n", name, value);
+    // Keep the line numbers in compile errors identical to those of the file.
+    defines += fmt::format("#line {}\n", versionLines + 1);
 
-    return Shader(program);
+    std::string source = stage.source;
+    source.insert(insertPos, defines);
+    return source;
 }
 
-void ShaderBuilder::freeShaders()
+uint64_t ShaderBuilder::cacheKey() const
 {
-    for (GLuint shader : m_shaders)
+    uint64_t key = m_pBinaryCache->baseKey();
+    for (const Stage& stage : m_stages)
+        key = ProgramBinaryCache::addToKey(key, stage.shaderStage, stageSource(stage));
+    return key;
+}
+
+AsyncShader ShaderBuilder::submit()
+{
+    // Do not query any compile or link status here, that would force the driver to finish synchronously.
+    AsyncShader out;
+    out.m_state = AsyncShader::State::Pending;
+    out.m_blockBindings = m_blockBindings;
+    for (const Stage& stage : m_stages) {
+        const GLuint shader = glCreateShader(stage.shaderStage);
+        const std::string source = stageSource(stage);
+        const char* shaderSourcePtr = source.c_str();
+        glShaderSource(shader, 1, &shaderSourcePtr, nullptr);
+        glCompileShader(shader);
+        out.m_shaders.push_back(shader);
+        out.m_stageFiles.push_back(stage.filePath);
+    }
+
+    // Combine vertex and fragment shaders into a single shader program.
+    out.m_program = glCreateProgram();
+    if (m_pBinaryCache)
+        glProgramParameteri(out.m_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    for (GLuint shader : out.m_shaders)
+        glAttachShader(out.m_program, shader);
+    glLinkProgram(out.m_program);
+    return out;
+}
+
+// Check the results of a submitted program (blocks until the driver is done) and turn it into a Shader.
+void ShaderBuilder::finishLink(AsyncShader& pending)
+{
+    if (!checkProgramErrors(pending.m_program)) {
+        // Report the stage that failed to compile, if any.
+        std::string message = "Shader program failed to link";
+        for (size_t i = 0; i < pending.m_shaders.size(); ++i) {
+            if (!checkShaderErrors(pending.m_shaders[i])) {
+                message = fmt::format("Failed to compile shader {}", pending.m_stageFiles[i].string().c_str());
+                break;
+            }
+        }
+        pending.freePending();
+        pending.m_state = AsyncShader::State::Failed;
+        throw ShaderLoadingException(message);
+    }
+
+    for (GLuint shader : pending.m_shaders) {
+        glDetachShader(pending.m_program, shader);
         glDeleteShader(shader);
+    }
+    pending.m_shaders.clear();
+
+    if (pending.m_pBinaryCache)
+        pending.m_pBinaryCache->store(pending.m_cacheKey, pending.m_program);
+
+    pending.m_shader = makeShader(std::exchange(pending.m_program, 0), pending.m_blockBindings);
+    pending.m_state = AsyncShader::State::Ready;
+}
+
+Shader ShaderBuilder::makeShader(GLuint program, const std::vector<std::pair<std::string, GLuint>>& blockBindings)
+{
+    Shader shader { program };
+    for (const auto& [blockName, bindingLocation] : blockBindings)
+        shader.setUniformBlockBinding(blockName, bindingLocation);
+    return shader;
+}
+
+static bool hasParallelShaderCompile()
+{
+    static const bool supported = [] {
+        GLint numExtensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+        for (GLuint i = 0; i < static_cast<GLuint>(numExtensions); ++i) {
+            const std::string_view extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if (extension == "GL_KHR_parallel_shader_compile" || extension == "GL_ARB_parallel_shader_compile")
+                return true;
+        }
+        return false;
+    }();
+    return supported;
 }
 
 static std::string readFile(std::filesystem::path filePath)
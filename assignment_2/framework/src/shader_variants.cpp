@@ -0,0 +1,73 @@
+#include "shader_variants.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <cassert>
+
+ShaderVariants::ShaderVariants(std::vector<std::string> featureDefines)
+    : m_featureDefines(std::move(featureDefines))
+{
+    assert(m_featureDefines.size() <= 32);
+}
+
+ShaderVariants& ShaderVariants::addStage(GLuint shaderStage, std::filesystem::path shaderFile)
+{
+    // Fail early instead of when the first variant is requested.
+    if (!std::filesystem::exists(shaderFile)) {
+        throw ShaderLoadingException(fmt::format("File {} does not exist", shaderFile.string().c_str()));
+    }
+
+    m_stages.emplace_back(shaderStage, std::move(shaderFile));
+    return *this;
+}
+
+ShaderVariants& ShaderVariants::useBinaryCache(const ProgramBinaryCache& cache)
+{
+    m_pBinaryCache = &cache;
+    return *this;
+}
+
+ShaderVariants& ShaderVariants::setUniformBlockBinding(std::string blockName, GLuint bindingLocation)
+{
+    m_blockBindings.emplace_back(std::move(blockName), bindingLocation);
+    return *this;
+}
+
+void ShaderVariants::request(uint32_t features)
+{
+    variant(features);
+}
+
+const Shader* ShaderVariants::tryGet(uint32_t features)
+{
+    AsyncShader& shader = variant(features);
+    return shader.isReady() ? &shader.get() : nullptr;
+}
+
+size_t ShaderVariants::numVariants() const
+{
+    return m_variants.size();
+}
+
+AsyncShader& ShaderVariants::variant(uint32_t features)
+{
+    if (auto iter = m_variants.find(features); iter != std::end(m_variants))
+        return iter->second;
+
+    ShaderBuilder builder;
+    if (m_pBinaryCache)
+        builder.useBinaryCache(*m_pBinaryCache);
+    for (const auto& [blockName, bindingLocation] : m_blockBindings)
+        builder.setUniformBlockBinding(blockName, bindingLocation);
+    for (size_t i = 0; i < m_featureDefines.size(); ++i) {
+        if (features & (1u << i))
+            builder.addDefine(m_featureDefines[i]);
+    }
+    for (const auto& [shaderStage, shaderFile] : m_stages)
+        builder.addStage(shaderStage, shaderFile);
+
+    // Compile errors are reported by AsyncShader::isReady(); a failed variant stays in the map so
+    // that it is not rebuilt every frame.
+    return m_variants.emplace(features, builder.buildAsync()).first->second;
+}
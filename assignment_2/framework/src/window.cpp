@@ -1,4 +1,6 @@
 #include "window.h"
+#include "cpu_profiler.h"
+#include "gl_state.h"
 #include <imgui/imgui.h>
 #include <imgui/imgui_impl_glfw.h>
 #include <imgui/imgui_impl_opengl2.h>
@@ -7,6 +9,7 @@
 #include <imgui/imgui_impl_opengl3.h>
 #include <iostream>
 #include <stb/stb_image_write.h>
+#include <tuple>
 
 static void glfwErrorCallback(int error, const char* description)
 {
@@ -28,6 +31,32 @@ void APIENTRY glDebugCallback(GLenum source, GLenum type, GLuint id, GLenum seve
 Window::Window(std::string_view title, const glm::ivec2& windowSize, OpenGLVersion glVersion, bool presentable, bool visible)
     : m_presentable(presentable), m_glVersion(glVersion)
 {
+    // GLFW needs a display server, even for hidden windows. Windows that are never presented render
+    // into an offscreen context instead if there is one.
+    if (!m_presentable) {
+        const auto [glVersionMajor, glVersionMinor, coreProfile] = [&]() {
+            switch (glVersion) {
+            case OpenGLVersion::GL2:
+                return std::tuple { 2, 1, false };
+            case OpenGLVersion::GL3:
+                return std::tuple { 3, 3, true };
+            case OpenGLVersion::GL41:
+                return std::tuple { 4, 1, true };
+            default:
+                return std::tuple { 4, 5, true };
+            }
+        }();
+        try {
+            m_pOffscreenContext = std::make_unique<OffscreenContext>(windowSize, glVersionMajor, glVersionMinor, coreProfile);
+            m_windowSize = windowSize;
+            std::cout << "Initialized headless OpenGL version " << (const char*)glGetString(GL_VERSION)
+                      << (m_pOffscreenContext->backend() == OffscreenBackend::EGL ? " (EGL)" : " (OSMesa)") << std::endl;
+            return;
+        } catch (const OffscreenContextException& e) {
+            std::cerr << e.what() << ", falling back to a hidden window" << std::endl;
+        }
+    }
+
     glfwSetErrorCallback(glfwErrorCallback);
     if (!glfwInit()) {
         std::cerr << "Could not initialize GLFW" << std::endl;
@@ -88,7 +117,11 @@ Window::Window(std::string_view title, const glm::ivec2& windowSize, OpenGLVersi
         exit(1);
     }
     glfwMakeContextCurrent(m_pWindow);
-    glfwSwapInterval(1); // Enable vsync. To disable vsync set this to 0.
+    glfwSwapInterval(1); // Enable vsync, see setPresentMode().
+    if (GLFWmonitor* pMonitor = glfwGetPrimaryMonitor()) {
+        if (const GLFWvidmode* pVideoMode = glfwGetVideoMode(pMonitor))
+            m_framePacer.setRefreshRate(pVideoMode->refreshRate);
+    }
 
     float xScale, yScale;
     glfwGetWindowContentScale(m_pWindow, &xScale, &yScale);
@@ -168,7 +201,13 @@ Window::Window(std::string_view title, const glm::ivec2& windowSize, OpenGLVersi
 
 Window::~Window()
 {
+    if (m_pOffscreenContext) {
+        m_framePacer.reset();
+        return;
+    }
+
     if (m_presentable) {
+        m_framePacer.reset();
         switch (m_glVersion) {
         case OpenGLVersion::GL2: {
             ImGui_ImplOpenGL2_Shutdown();
@@ -192,17 +231,25 @@ Window::~Window()
 
 void Window::close()
 {
-    glfwSetWindowShouldClose(m_pWindow, 1);
+    if (m_pOffscreenContext)
+        m_shouldClose = true;
+    else
+        glfwSetWindowShouldClose(m_pWindow, 1);
 }
 
 bool Window::shouldClose()
 {
+    if (m_pOffscreenContext)
+        return m_shouldClose;
     return glfwWindowShouldClose(m_pWindow) != 0;
 }
 
 void Window::updateInput()
 {
-    glfwPollEvents();
+    CPU_PROFILE_ZONE("Window::updateInput");
+    if (!m_pOffscreenContext)
+        glfwPollEvents();
+    m_framePacer.onInputPolled();
 
     if (m_presentable) {
         // Start the Dear ImGui frame.
@@ -221,13 +268,26 @@ void Window::updateInput()
         };
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
+        m_imGuiRendered = false;
     }
 }
 
 void Window::swapBuffers()
 {
+    CPU_PROFILE_ZONE("Window::swapBuffers");
+    renderImGui();
+    m_framePacer.beforePresent();
+    if (m_pOffscreenContext)
+        glFlush(); // nothing to swap, the image stays in the framebuffer object
+    else
+        glfwSwapBuffers(m_pWindow);
+    if (m_presentable)
+        m_framePacer.afterPresent();
+}
 
-    if (m_presentable) {
+void Window::renderImGui()
+{
+    if (m_presentable && !m_imGuiRendered) {
         // Rendering of Dear ImGui ui.
         ImGui::Render();
         switch (m_glVersion) {
@@ -243,16 +303,90 @@ void Window::swapBuffers()
             ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         } break;
         };
+        // Dear ImGui changes the program, texture and blend state behind our back.
+        GLState::get().invalidate();
+        m_imGuiRendered = true;
     }
+}
 
-    glfwSwapBuffers(m_pWindow);
+bool Window::setPresentMode(PresentMode presentMode)
+{
+    if (!isPresentModeSupported(presentMode))
+        return false;
+    // A headless window has no swap interval; the FramePacer still applies the other settings.
+    if (!m_pOffscreenContext) {
+        switch (presentMode) {
+        case PresentMode::VSync:
+            glfwSwapInterval(1);
+            break;
+        case PresentMode::Immediate:
+            glfwSwapInterval(0);
+            break;
+        case PresentMode::Adaptive:
+            glfwSwapInterval(-1);
+            break;
+        }
+    }
+    m_presentMode = presentMode;
+    m_framePacer.setPresentMode(presentMode);
+    return true;
 }
 
+PresentMode Window::presentMode() const
+{
+    return m_presentMode;
+}
+
+bool Window::isPresentModeSupported(PresentMode presentMode) const
+{
+    if (presentMode != PresentMode::Adaptive)
+        return true;
+    if (m_pOffscreenContext)
+        return false;
+    return glfwExtensionSupported("GLX_EXT_swap_control_tear") || glfwExtensionSupported("WGL_EXT_swap_control_tear");
+}
+
+void Window::setMaxFramesInFlight(int maxFramesInFlight)
+{
+    m_framePacer.setMaxFramesInFlight(maxFramesInFlight);
+}
+
+int Window::maxFramesInFlight() const
+{
+    return m_framePacer.maxFramesInFlight();
+}
+
+void Window::setFrameRateLimit(double framesPerSecond)
+{
+    m_framePacer.setFrameRateLimit(framesPerSecond);
+}
+
+double Window::frameRateLimit() const
+{
+    return m_framePacer.frameRateLimit();
+}
+
+const FramePacingStats& Window::framePacingStats() const
+{
+    return m_framePacer.stats();
+}
+
+bool Window::isHeadless() const
+{
+    return m_pOffscreenContext != nullptr;
+}
+
+GLuint Window::defaultFramebuffer() const
+{
+    return m_pOffscreenContext ? m_pOffscreenContext->framebuffer() : 0;
+}
 
 void Window::renderToImage (const std::filesystem::path& filePath, const bool flipY) {
         std::vector <GLubyte> pixels;
-        pixels.reserve (4 * m_windowSize.x * m_windowSize.y);
+        pixels.resize (4 * m_windowSize.x * m_windowSize.y);
 
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, defaultFramebuffer());
         glReadPixels(0, 0, m_windowSize.x, m_windowSize.y, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
 
         std::string filePathString = filePath.string();
@@ -377,16 +511,22 @@ void Window::windowSizeCallback(GLFWwindow* window, int width, int height)
 
 bool Window::isKeyPressed(int key) const
 {
+    if (m_pOffscreenContext)
+        return false;
     return glfwGetKey(m_pWindow, key) == GLFW_PRESS;
 }
 
 bool Window::isMouseButtonPressed(int button) const
 {
+    if (m_pOffscreenContext)
+        return false;
     return glfwGetMouseButton(m_pWindow, button) == GLFW_PRESS;
 }
 
 glm::vec2 Window::getCursorPos() const
 {
+    if (m_pOffscreenContext)
+        return glm::vec2(0.0f);
     double x, y;
     glfwGetCursorPos(m_pWindow, &x, &y);
     return glm::vec2(x, m_windowSize.y - 1 - y);
@@ -402,6 +542,8 @@ glm::vec2 Window::getCursorPixel() const
     // https://stackoverflow.com/questions/45796287/screen-coordinates-to-world-coordinates
     // Coordinates returned by glfwGetCursorPos are in screen coordinates which may not map 1:1 to
     // pixel coordinates on some machines (e.g. with resolution scaling).
+    if (m_pOffscreenContext)
+        return glm::vec2(0.5f);
     glm::ivec2 screenSize;
     glfwGetWindowSize(m_pWindow, &screenSize.x, &screenSize.y);
     glm::ivec2 framebufferSize;
@@ -418,6 +560,8 @@ glm::vec2 Window::getCursorPixel() const
 
 void Window::setMouseCapture(bool capture)
 {
+    if (m_pOffscreenContext)
+        return;
     if (capture) {
         glfwSetInputMode(m_pWindow, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     } else {
@@ -434,6 +578,8 @@ glm::ivec2 Window::getWindowSize() const
 
 glm::ivec2 Window::getFrameBufferSize() const
 {
+    if (m_pOffscreenContext)
+        return m_pOffscreenContext->size();
     glm::ivec2 out {};
     glfwGetFramebufferSize(m_pWindow, &out.x, &out.y);
     return out;
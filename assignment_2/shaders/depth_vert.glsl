@@ -0,0 +1,36 @@
+#version 410 core
+// Depth pre-pass: positions only (GPUMesh::drawDepthOnly), computed exactly as in shader_vert.glsl so
+// that the main pass can depth test against the pre-pass with GL_LEQUAL.
+layout(location=0) in vec3 aPos;
+#if defined(INSTANCED)
+layout(location=3) in mat4 aInstanceModel;
+#endif
+
+// Must match PerFrameUniforms/PerObjectUniforms in src/uniform_blocks.h
+layout(std140) uniform PerFrame {
+    mat4 viewProjectionMatrix;
+    vec3 camPos;
+    vec3 sunPos;
+    float sunIntensity;
+    vec2 shadowDepthRange;
+    vec4 clusterDepthPlane;
+    vec4 clusterParams;
+};
+
+layout(std140) uniform PerObject {
+    mat4 modelMatrix;
+    mat4 normalModelMatrix;
+    mat4 mvpMatrix;
+    vec3 sunEmissive;
+};
+
+invariant gl_Position;
+
+void main() {
+#if defined(INSTANCED)
+    vec3 worldPos = vec3(aInstanceModel * vec4(aPos, 1.0));
+    gl_Position = viewProjectionMatrix * vec4(worldPos, 1.0);
+#else
+    gl_Position = mvpMatrix * vec4(aPos, 1.0);
+#endif
+}
@@ -0,0 +1,12 @@
+#version 410 core
+// Used with shader_vert.glsl while the real shaders are still compiling: plain diffuse grey.
+in vec3 vWorldPos;
+in vec3 vWorldNrm;
+in vec2 vUv;
+
+out vec4 fragColor;
+
+void main() {
+    float NoL = max(dot(normalize(vWorldNrm), normalize(vec3(0.3, 1.0, 0.5))), 0.0);
+    fragColor = vec4(vec3(0.2 + 0.6 * NoL), 1.0);
+}
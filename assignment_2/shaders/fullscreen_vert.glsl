@@ -0,0 +1,9 @@
+#version 410 core
+// A triangle that covers the whole viewport, drawn with glDrawArrays(GL_TRIANGLES, 0, 3) and no
+// vertex attributes.
+out vec2 vTexCoord;
+
+void main() {
+    vTexCoord = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(vTexCoord * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,21 @@
+#version 410 core
+// Bounding box of an occlusion query (see OcclusionCuller in src/occlusion_culler.h).
+layout(location=0) in vec3 aPos; // corner of the unit cube
+
+uniform vec3 boxLower;
+uniform vec3 boxSize;
+
+// Must match PerFrameUniforms in src/uniform_blocks.h
+layout(std140) uniform PerFrame {
+    mat4 viewProjectionMatrix;
+    vec3 camPos;
+    vec3 sunPos;
+    float sunIntensity;
+    vec2 shadowDepthRange;
+    vec4 clusterDepthPlane;
+    vec4 clusterParams;
+};
+
+void main() {
+    gl_Position = viewProjectionMatrix * vec4(boxLower + aPos * boxSize, 1.0);
+}
@@ -5,11 +5,34 @@ in vec2 vUv;
 
 out vec4 fragColor;
 
-// toggles
-uniform bool hasTexCoords;
-uniform bool useEnvMap;
-uniform bool usePBR;
-uniform bool useNormalMap;     // NEW
+// Features are compiled in by defining (see ShaderFeature in src/application.cpp):
+//   SUN         emissive sun surface, skips all lighting
+//   TEXCOORDS   the mesh has texture coordinates, so the material textures are sampled
+//   PBR         lit by the sun point light (otherwise unlit albedo)
+//   ENV_MAP     image based lighting from envMap (requires PBR)
+//   NORMAL_MAP  perturb the normal with normalMap (requires TEXCOORDS and PBR)
+//   INSTANCED   (vertex shader) transforms come from per-instance attributes instead of PerObject
+//   SHADOWS     the sun light is shadowed by shadowMap (requires PBR)
+//   LOCAL_LIGHTS  lit by the point lights of the fragment's light cluster as well (requires PBR)
+
+// camera and sun/light
+// Must match PerFrameUniforms/PerObjectUniforms in src/uniform_blocks.h
+layout(std140) uniform PerFrame {
+    mat4 viewProjectionMatrix;
+    vec3 camPos;
+    vec3 sunPos;
+    float sunIntensity;
+    vec2 shadowDepthRange; // near and far plane of the sun shadow map
+    vec4 clusterDepthPlane; // view depth of p is dot(clusterDepthPlane, vec4(p, 1))
+    vec4 clusterParams; // tiles per pixel (xy), scale and bias of the log depth slice (zw)
+};
+
+layout(std140) uniform PerObject {
+    mat4 modelMatrix;
+    mat4 normalModelMatrix; // only the upper 3x3 part is used
+    mat4 mvpMatrix;
+    vec3 sunEmissive;
+};
 
 // textures
 uniform sampler2D colorMap;
@@ -17,16 +40,20 @@ uniform sampler2D normalMap;
 uniform sampler2D roughMap;
 uniform sampler2D metalMap;
 uniform samplerCube envMap;
-
-// camera
-uniform vec3 camPos;
-
-// sun/light
-uniform vec3  sunPos;
-uniform float sunIntensity;
-uniform int   isSun;
-uniform vec3  sunEmissive;
-
+#if defined(SHADOWS)
+uniform samplerCubeShadow shadowMap;
+#endif
+#if defined(LOCAL_LIGHTS)
+// See LightClusters in src/light_clusters.h; the grid size must match.
+const int CLUSTER_TILES_X = 16;
+const int CLUSTER_TILES_Y = 9;
+const int CLUSTER_DEPTH_SLICES = 24;
+uniform samplerBuffer lightData; // 2 texels per light: position and radius, color
+uniform usamplerBuffer lightClusters; // offset into lightIndices and number of lights
+uniform usamplerBuffer lightIndices;
+#endif
+
+#if defined(PBR)
 const vec3 F0dielectric = vec3(0.04);
 
 mat3 computeTBN(vec3 pos, vec3 nrm, vec2 uv) {
@@ -48,63 +75,128 @@ float D_GGX(float NoH, float a) { float a2=a*a; float d=(NoH*NoH)*(a2-1.0)+1.0;
 float G_SchlickGGX(float NoX, float k){ return NoX/(NoX*(1.0-k)+k); }
 float G_Smith(float NoV,float NoL,float rough){ float k=(rough+1.0); k=(k*k)/8.0; return G_SchlickGGX(NoV,k)*G_SchlickGGX(NoL,k); }
 
-void main() {
-    // If this draw is the sun, render emissive and get out. No normal map, no PBR.
-    if (isSun == 1) {
-        vec3 base = hasTexCoords ? texture(colorMap, vUv).rgb : vec3(1.0, 0.9, 0.2);
-        fragColor = vec4(base * sunEmissive, 1.0);
-        return;
+// Light reflected towards V from a light of unit intensity in direction L (already multiplied by
+// NoL). kd is the diffuse fraction.
+vec3 shadeLight(vec3 N, vec3 V, vec3 L, vec3 albedo, float metal, float rough, float alpha, out vec3 kd) {
+    float NoL = clamp(dot(N, L), 0.0, 1.0);
+    float NoV = clamp(dot(N, V), 0.0, 1.0);
+    vec3  H   = normalize(V + L);
+    float NoH = clamp(dot(N, H), 0.0, 1.0);
+    float VoH = clamp(dot(V, H), 0.0, 1.0);
+
+    vec3  F = F_Schlick(mix(F0dielectric, albedo, metal), VoH);
+    float D = D_GGX(NoH, alpha);
+    float G = G_Smith(NoV, NoL, rough);
+    vec3  spec = (D * G * F) / max(4.0 * NoV * NoL, 1e-5);
+    kd = (1.0 - F) * (1.0 - metal);
+    return (kd * albedo / 3.14159265 + spec) * NoL;
+}
+#endif
+
+#if defined(LOCAL_LIGHTS)
+// Sum of the point lights of the cluster containing this fragment.
+vec3 localLights(vec3 pos, vec3 N, vec3 V, vec3 albedo, float metal, float rough, float alpha) {
+    ivec2 tile = min(ivec2(gl_FragCoord.xy * clusterParams.xy), ivec2(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1));
+    float depth = dot(clusterDepthPlane, vec4(pos, 1.0));
+    int slice = clamp(int(log(max(depth, 1e-4)) * clusterParams.z + clusterParams.w), 0, CLUSTER_DEPTH_SLICES - 1);
+    uvec2 cluster = texelFetch(lightClusters, (slice * CLUSTER_TILES_Y + tile.y) * CLUSTER_TILES_X + tile.x).xy;
+
+    vec3 color = vec3(0.0);
+    for (uint i = 0u; i < cluster.y; ++i) {
+        int light = int(texelFetch(lightIndices, int(cluster.x + i)).x);
+        vec4 positionRadius = texelFetch(lightData, 2 * light);
+        vec3 lightColor = texelFetch(lightData, 2 * light + 1).rgb;
+
+        vec3 Lvec = positionRadius.xyz - pos;
+        float dist2 = dot(Lvec, Lvec);
+        // Inverse square falloff, smoothly windowed to zero at the light radius.
+        float window = clamp(1.0 - pow(dist2 / (positionRadius.w * positionRadius.w), 2.0), 0.0, 1.0);
+        float atten = window * window / max(dist2, 0.01);
+        vec3 kd;
+        color += shadeLight(N, V, Lvec * inversesqrt(max(dist2, 1e-12)), albedo, metal, rough, alpha, kd) * lightColor * atten;
     }
+    return color;
+}
+#endif
+
+#if defined(SHADOWS)
+// Fraction of the sun light reaching pos (see PointShadowMap in src/point_shadow_map.h). Each cube
+// face stores perspective depth along its axis, so the reference depth is computed from the largest
+// component of the light vector. The position is offset along the geometric normal against acne.
+float sunShadow(vec3 pos, vec3 geometricNormal) {
+    vec3 d = pos + geometricNormal * (0.01 * length(pos - sunPos)) - sunPos;
+    vec3 a = abs(d);
+    float z = max(a.x, max(a.y, a.z));
+    float n = shadowDepthRange.x;
+    float f = shadowDepthRange.y;
+    float ndcDepth = (f + n) / (f - n) - (2.0 * f * n) / ((f - n) * z);
+    return texture(shadowMap, vec4(d, 0.5 * ndcDepth + 0.5));
+}
+#endif
 
+void main() {
+#if defined(SUN)
+    // Emissive only: no normal map, no PBR.
+#if defined(TEXCOORDS)
+    vec3 base = texture(colorMap, vUv).rgb;
+#else
+    vec3 base = vec3(1.0, 0.9, 0.2);
+#endif
+    fragColor = vec4(base * sunEmissive, 1.0);
+#else
+    // Material
+#if defined(TEXCOORDS)
+    vec3  albedo = texture(colorMap, vUv).rgb;
+#else
+    vec3  albedo = vec3(1.0);
+#endif
+
+#if defined(PBR)
     vec3 N = normalize(vWorldNrm);
     vec3 V = normalize(camPos - vWorldPos);
 
-    // Material
-    vec3  albedo = vec3(1.0);
+#if defined(TEXCOORDS)
+    float rough  = texture(roughMap, vUv).r;
+    float metal  = texture(metalMap,  vUv).r;
+#else
     float rough  = 0.6;
     float metal  = 0.0;
-    if (hasTexCoords) {
-        albedo = texture(colorMap, vUv).rgb;
-        rough  = texture(roughMap, vUv).r;
-        metal  = texture(metalMap,  vUv).r;
-    }
+#endif
     rough = clamp(rough, 0.04, 1.0);
     float alpha = max(1e-3, rough * rough);
 
-    // Normal mapping only when requested
-    if (hasTexCoords && useNormalMap) {
-        vec3 nTex = texture(normalMap, vUv).xyz * 2.0 - 1.0;
-        mat3 TBN = computeTBN(vWorldPos, N, vUv);
-        N = normalize(TBN * nTex);
-    }
+#if defined(TEXCOORDS) && defined(NORMAL_MAP)
+    vec3 nTex = texture(normalMap, vUv).xyz * 2.0 - 1.0;
+    mat3 TBN = computeTBN(vWorldPos, N, vUv);
+    N = normalize(TBN * nTex);
+#endif
 
     // Point light from sun
     vec3  Lvec = sunPos - vWorldPos;
     float dist = length(Lvec);
     vec3  L = (dist > 1e-6) ? (Lvec / dist) : vec3(0,1,0);
 
-    float NoL = clamp(dot(N, L), 0.0, 1.0);
-    float NoV = clamp(dot(N, V), 0.0, 1.0);
-    vec3  H   = normalize(V + L);
-    float NoH = clamp(dot(N, H), 0.0, 1.0);
-    float VoH = clamp(dot(V, H), 0.0, 1.0);
-
-    vec3  F = F_Schlick(mix(F0dielectric, albedo, metal), VoH);
-    float D = D_GGX(NoH, alpha);
-    float G = G_Smith(NoV, NoL, rough);
-    vec3  spec = (D * G * F) / max(4.0 * NoV * NoL, 1e-5);
-    vec3  kd   = (1.0 - F) * (1.0 - metal);
-
     float atten = sunIntensity / max(dist * dist, 0.25); // avoid explosion up close
+#if defined(SHADOWS)
+    atten *= sunShadow(vWorldPos, normalize(vWorldNrm));
+#endif
 
-    vec3 direct = (kd * albedo / 3.14159265 + spec) * NoL * atten;
+    vec3 kd;
+    vec3 color = shadeLight(N, V, L, albedo, metal, rough, alpha, kd) * atten;
+#if defined(LOCAL_LIGHTS)
+    color += localLights(vWorldPos, N, V, albedo, metal, rough, alpha);
+#endif
 
+#if defined(ENV_MAP)
     // Cheap IBL
     vec3 R = reflect(-V, N);
     vec3 envSpec = texture(envMap, R).rgb;
     vec3 envDiff = texture(envMap, N).rgb;
-    vec3 ibl = kd * envDiff * 0.3 + envSpec * (0.2 * (1.0 - rough));
-
-    vec3 color = usePBR ? (direct + ibl) : albedo;
+    color += kd * envDiff * 0.3 + envSpec * (0.2 * (1.0 - rough));
+#endif
+#else
+    vec3 color = albedo;
+#endif
     fragColor = vec4(color, 1.0);
+#endif
 }
@@ -2,12 +2,34 @@
 layout(location=0) in vec3 aPos;
 layout(location=1) in vec3 aNormal;
 layout(location=2) in vec2 aTex;
-// If your VAO has a tangent at location 3, we use it. If not, we’ll build TBN in fragment.
-// layout(location=3) in vec3 aTangent;  // optional
+#if defined(INSTANCED)
+// Per-instance data, must match InstanceData in src/mesh.h (GPUMesh::drawInstanced).
+layout(location=3) in mat4 aInstanceModel;
+layout(location=7) in mat3 aInstanceNormal;
+#endif
+// If your VAO has a tangent at location 10, we use it. If not, we’ll build TBN in fragment.
+// layout(location=10) in vec3 aTangent;  // optional
 
-uniform mat4 mvpMatrix;
-uniform mat4 modelMatrix;
-uniform mat3 normalModelMatrix;
+// Must match PerFrameUniforms/PerObjectUniforms in src/uniform_blocks.h
+layout(std140) uniform PerFrame {
+    mat4 viewProjectionMatrix;
+    vec3 camPos;
+    vec3 sunPos;
+    float sunIntensity;
+    vec2 shadowDepthRange; // near and far plane of the sun shadow map
+    vec4 clusterDepthPlane; // view depth of p is dot(clusterDepthPlane, vec4(p, 1))
+    vec4 clusterParams; // tiles per pixel (xy), scale and bias of the log depth slice (zw)
+};
+
+layout(std140) uniform PerObject {
+    mat4 modelMatrix;
+    mat4 normalModelMatrix; // only the upper 3x3 part is used
+    mat4 mvpMatrix;
+    vec3 sunEmissive;
+};
+
+// The depth pre-pass (shaders/depth_vert.glsl) computes the same positions, which must match exactly.
+invariant gl_Position;
 
 out vec3 vWorldPos;
 out vec3 vWorldNrm;
@@ -16,9 +38,15 @@ out vec2 vUv;
 // out vec3 vWorldTan;
 
 void main() {
+#if defined(INSTANCED)
+    vWorldPos = vec3(aInstanceModel * vec4(aPos, 1.0));
+    vWorldNrm = normalize(aInstanceNormal * aNormal);
+    gl_Position = viewProjectionMatrix * vec4(vWorldPos, 1.0);
+#else
     vWorldPos = vec3(modelMatrix * vec4(aPos, 1.0));
-    vWorldNrm = normalize(normalModelMatrix * aNormal);
+    vWorldNrm = normalize(mat3(normalModelMatrix) * aNormal);
+    gl_Position = mvpMatrix * vec4(aPos, 1.0);
+#endif
     vUv = aTex;
     // vWorldTan = normalize(mat3(modelMatrix) * aTangent); // if you enable tangents
-    gl_Position = mvpMatrix * vec4(aPos, 1.0);
 }
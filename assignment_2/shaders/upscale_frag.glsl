@@ -0,0 +1,24 @@
+#version 410 core
+// Upscales the scene to the window (see Upscaler in src/dynamic_resolution.h).
+uniform sampler2D sceneColor;
+uniform float sharpness; // 0 = bilinear only
+
+in vec2 vTexCoord;
+out vec4 fragColor;
+
+void main() {
+    vec3 color = texture(sceneColor, vTexCoord).rgb;
+    if (sharpness > 0.0) {
+        // Unsharp mask with the four neighbours, clamped to their range so edges do not ring.
+        vec2 texel = 1.0 / vec2(textureSize(sceneColor, 0));
+        vec3 north = texture(sceneColor, vTexCoord + vec2(0.0, texel.y)).rgb;
+        vec3 south = texture(sceneColor, vTexCoord - vec2(0.0, texel.y)).rgb;
+        vec3 east = texture(sceneColor, vTexCoord + vec2(texel.x, 0.0)).rgb;
+        vec3 west = texture(sceneColor, vTexCoord - vec2(texel.x, 0.0)).rgb;
+        vec3 lowest = min(color, min(min(north, south), min(east, west)));
+        vec3 highest = max(color, max(max(north, south), max(east, west)));
+        vec3 sharpened = color + sharpness * (4.0 * color - north - south - east - west);
+        color = clamp(sharpened, lowest, highest);
+    }
+    fragColor = vec4(color, 1.0);
+}
@@ -1,5 +1,10 @@
 // cpp
+#include "benchmark.h"
+#include "dynamic_resolution.h"
+#include "light_clusters.h"
 #include "mesh.h"
+#include "occlusion_culler.h"
+#include "point_shadow_map.h"
 #include "texture.h"
 #include "bezier.h"
 #include "free_camera.h" // <-- added free camera include
@@ -17,20 +22,105 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/mat4x4.hpp>
 #include <imgui/imgui.h>
 DISABLE_WARNINGS_POP()
+#include <framework/cpu_profiler.h>
+#include <framework/dynamic_aabb_tree.h>
+#include <framework/frame_arena.h>
+#include <framework/frame_capture.h>
+#include <framework/frame_graph.h>
+#include <framework/frustum_culler.h>
+#include <framework/gl_state.h>
+#include <framework/gpu_profiler.h>
+#include <framework/gpu_timer.h>
+#include <framework/program_binary_cache.h>
+#include <framework/ring_buffer.h>
 #include <framework/shader.h>
+#include <framework/shader_variants.h>
 #include <framework/window.h>
+#include <chrono>
 #include <functional>
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <optional>
+#include <string>
 #include <cassert>
+#include "instance_batcher.h"
+#include "render_queue.h"
+#include "sim_clock.h"
+#include "simulation.h"
 #include "scene_node.h"
 #include "skybox.h"
+#include "uniform_blocks.h"
+
+// Uniforms of the default shader, hashed at compile time.
+// Camera, light and per-draw data live in the uniform blocks of uniform_blocks.h.
+namespace uniforms {
+    constexpr UniformId colorMap { "colorMap" };
+    constexpr UniformId normalMap { "normalMap" };
+    constexpr UniformId roughMap { "roughMap" };
+    constexpr UniformId metalMap { "metalMap" };
+    constexpr UniformId envMap { "envMap" };
+    constexpr UniformId shadowMap { "shadowMap" };
+    constexpr UniformId lightData { "lightData" };
+    constexpr UniformId lightClusters { "lightClusters" };
+    constexpr UniformId lightIndices { "lightIndices" };
+}
+
+// Feature bits of the default shader variants; see the defines at the top of shaders/shader_frag.glsl.
+enum ShaderFeature : uint32_t {
+    FeatureSun = 1 << 0,
+    FeatureTexCoords = 1 << 1,
+    FeaturePBR = 1 << 2,
+    FeatureEnvMap = 1 << 3,
+    FeatureNormalMap = 1 << 4,
+    FeatureInstanced = 1 << 5,
+    FeatureShadows = 1 << 6,
+    FeatureLocalLights = 1 << 7,
+};
+
+// Material ids of the render queue and instance batches.
+constexpr uint32_t DRAGON_MATERIAL = 0;
+constexpr uint32_t SUN_MATERIAL = 1;
+
+// Texture unit of the sun shadow map (units 0-4 are used by the materials).
+constexpr GLuint SHADOW_MAP_UNIT = 5;
+// First of the three texture units of the light clusters.
+constexpr GLuint LIGHT_CLUSTERS_UNIT = 6;
+
+// Upper bound of the number of instanced objects per frame (the swarm, the static ring of dragons and
+// the dragons on the paths: the probe, and the escort with its two stacked dragons).
+constexpr int MAX_SWARM_SIZE = 10000;
+constexpr int NUM_STATIC_DRAGONS = 8;
+constexpr size_t MAX_PATH_DRAGONS = 4;
+constexpr size_t MAX_INSTANCES = MAX_SWARM_SIZE + NUM_STATIC_DRAGONS + MAX_PATH_DRAGONS;
+
+// Wall clock in seconds; glfwGetTime() is not available in headless windows.
+static double wallClockSeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+enum class SceneObjectKind {
+    Sun,
+    PathDragon, // moves every frame, casts shadows
+    StaticDragon, // never moves, casts shadows (drawn if "Draw static scene" is enabled)
+    SwarmDragon, // moves every frame, receives but does not cast shadows
+};
+
+// A mesh placed by a scene graph node, with its (world space) bounds registered in the scene BVH.
+struct SceneObject {
+    SceneObjectKind kind;
+    SceneNode *pNode;
+    GPUMesh *pMesh;
+    uint32_t materialId;
+    int32_t proxyId;
+    AxisAlignedBox worldBounds;
+};
 
 class Application {
 public:
-    Application()
-        : m_window("Final Project", glm::ivec2(1024, 1024), OpenGLVersion::GL41) {
+    explicit Application(const std::optional<BenchmarkSettings> &benchmark)
+        : m_window("Final Project", glm::ivec2(1024, 1024), OpenGLVersion::GL41, !benchmark, !benchmark)
+        , m_benchmark(benchmark) {
         // Register callbacks (no GL calls here)
         m_window.registerKeyCallback([this](int key, int scancode, int action, int mods) {
             if (action == GLFW_PRESS)
@@ -46,20 +136,24 @@ public:
                 onMouseReleased(button, mods);
         });
 
-        // Initialize GL function pointers now that the GLFW context (created by Window) is current
-        if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
-            std::cerr << "Failed to initialize GLAD - OpenGL function pointers not loaded\n";
-            std::terminate();
-        }
-        std::cout << "GL initialized: " << (const char *) glGetString(GL_VERSION) << std::endl;
+        // Initialize GL function pointers now that the GLFW context (created by Window) is current.
+        // The benchmark renders headless (without a display server) if it can; the offscreen
+        // context of the window loads them itself.
+        if (!m_window.isHeadless()) {
+            if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+                std::cerr << "Failed to initialize GLAD - OpenGL function pointers not loaded\n";
+                std::terminate();
+            }
+            std::cout << "GL initialized: " << (const char *) glGetString(GL_VERSION) << std::endl;
 
-        // Setup FreeCamera: set current and register scroll callback on the current GLFW context
-        FreeCamera::setCurrent(&m_freeCam);
-        // use glfwGetCurrentContext() so we don't depend on Window's internals
-        glfwSetScrollCallback(glfwGetCurrentContext(), FreeCamera::scrollCallback);
+            // Setup FreeCamera: set current and register scroll callback on the current GLFW context
+            FreeCamera::setCurrent(&m_freeCam);
+            // use glfwGetCurrentContext() so we don't depend on Window's internals
+            glfwSetScrollCallback(glfwGetCurrentContext(), FreeCamera::scrollCallback);
 
-        glfwSetMouseButtonCallback(glfwGetCurrentContext(), FreeCamera::mouseButtonCallback);
-        glfwSetCursorPosCallback(glfwGetCurrentContext(), FreeCamera::cursorPosCallback);
+            glfwSetMouseButtonCallback(glfwGetCurrentContext(), FreeCamera::mouseButtonCallback);
+            glfwSetCursorPosCallback(glfwGetCurrentContext(), FreeCamera::cursorPosCallback);
+        }
 
 
         // Now safe to create GL-backed resources
@@ -68,25 +162,93 @@ public:
         // Load meshes and shaders (these may call GL functions)
         m_meshes = GPUMesh::loadMeshGPU(RESOURCE_ROOT "resources/dragon.obj");
 
+        // Linked programs are cached on disk so that later launches skip compiling them.
+        m_shaderCache = std::make_unique<ProgramBinaryCache>(std::filesystem::temp_directory_path() / "Master_TechDemo_shader_cache");
+
+        // All programs are submitted up front so the driver can compile them in parallel. Until a
+        // default shader variant is ready, objects using it are drawn with the (small) fallback shader.
         try {
-            ShaderBuilder defaultBuilder;
-            defaultBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
-            defaultBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/shader_frag.glsl");
-            m_defaultShader = defaultBuilder.build();
+            ShaderBuilder fallbackBuilder;
+            fallbackBuilder.useBinaryCache(*m_shaderCache);
+            fallbackBuilder.setUniformBlockBinding("PerFrame", PER_FRAME_BINDING);
+            fallbackBuilder.setUniformBlockBinding("PerObject", PER_OBJECT_BINDING);
+            fallbackBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
+            fallbackBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/fallback_frag.glsl");
+            m_fallbackShader = fallbackBuilder.build();
+            fallbackBuilder.addDefine("INSTANCED");
+            m_fallbackInstancedShader = fallbackBuilder.build();
+
+            // The variants themselves are compiled on first use (see the end of the constructor).
+            m_defaultShaders.useBinaryCache(*m_shaderCache);
+            m_defaultShaders.setUniformBlockBinding("PerFrame", PER_FRAME_BINDING);
+            m_defaultShaders.setUniformBlockBinding("PerObject", PER_OBJECT_BINDING);
+            m_defaultShaders.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
+            m_defaultShaders.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/shader_frag.glsl");
 
             ShaderBuilder shadowBuilder;
+            shadowBuilder.useBinaryCache(*m_shaderCache);
             shadowBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shadow_vert.glsl");
             shadowBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/shadow_frag.glsl");
-            m_shadowShader = shadowBuilder.build();
-        } catch (ShaderLoadingException e) {
+            m_shadowShader = shadowBuilder.buildAsync();
+
+            // Depth pre-pass: positions only, so it is cheap enough to build up front.
+            ShaderBuilder depthBuilder;
+            depthBuilder.useBinaryCache(*m_shaderCache);
+            depthBuilder.setUniformBlockBinding("PerFrame", PER_FRAME_BINDING);
+            depthBuilder.setUniformBlockBinding("PerObject", PER_OBJECT_BINDING);
+            depthBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/depth_vert.glsl");
+            depthBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/shadow_frag.glsl");
+            m_depthShader = depthBuilder.build();
+            depthBuilder.addDefine("INSTANCED");
+            m_depthInstancedShader = depthBuilder.build();
+
+            ShaderBuilder occlusionBoxBuilder;
+            occlusionBoxBuilder.useBinaryCache(*m_shaderCache);
+            occlusionBoxBuilder.setUniformBlockBinding("PerFrame", PER_FRAME_BINDING);
+            occlusionBoxBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/occlusion_box_vert.glsl");
+            occlusionBoxBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/shadow_frag.glsl");
+            m_occlusionBoxShader = occlusionBoxBuilder.build();
+
+            // build skybox shader
+            ShaderBuilder skyB;
+            skyB.useBinaryCache(*m_shaderCache);
+            skyB.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/skybox_vert.glsl");
+            skyB.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/skybox_frag.glsl");
+            m_skyShader = skyB.buildAsync();
+
+            ShaderBuilder upscaleBuilder;
+            upscaleBuilder.useBinaryCache(*m_shaderCache);
+            upscaleBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/fullscreen_vert.glsl");
+            upscaleBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/upscale_frag.glsl");
+            m_upscaleShader = upscaleBuilder.build();
+        } catch (const ShaderLoadingException& e) {
             std::cerr << e.what() << std::endl;
         }
 
-        // build skybox shader
-        ShaderBuilder skyB;
-        skyB.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/skybox_vert.glsl");
-        skyB.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/skybox_frag.glsl");
-        m_skyShader = skyB.build();
+        // Room for the per-frame block plus a few hundred per-object blocks, triple buffered.
+        m_uniformRing = std::make_unique<RingBuffer>(GL_UNIFORM_BUFFER, 64 * 1024);
+        m_instanceBatcher = std::make_unique<InstanceBatcher>(MAX_INSTANCES);
+
+        m_renderQueueCallbacks.bindShader = [this](uint32_t features) -> const Shader & {
+            const Shader &shader = defaultShader(features);
+            shader.bind();
+            return shader;
+        };
+        m_renderQueueCallbacks.bindDepthShader = [this](bool instanced) -> const Shader & {
+            const Shader &shader = instanced ? m_depthInstancedShader : m_depthShader;
+            shader.bind();
+            return shader;
+        };
+        m_renderQueueCallbacks.bindMaterial = [this](uint32_t materialId, const Shader &shader) {
+            if (materialId == DRAGON_MATERIAL) {
+                bindDragonTextures(shader);
+            } else if (materialId == SUN_MATERIAL && m_texSun) {
+                // Base texture for the sun surface
+                m_texSun->bind(GL_TEXTURE0);
+                m_clampSampler->bind(GL_TEXTURE0);
+                shader.set(uniforms::colorMap, 0);
+            }
+        };
 
         // load cubemap faces
         std::array<std::string, 6> faces = {
@@ -135,291 +297,739 @@ public:
             m_pathOuter.setSegments(segs);
         }
 
-        m_texAlbedo = std::make_unique<Texture>(RESOURCE_ROOT "resources/spaceship/basecolor.png");
-        m_texNormal = std::make_unique<Texture>(RESOURCE_ROOT "resources/spaceship/normal.png");
-        m_texRoughness = std::make_unique<Texture>(RESOURCE_ROOT "resources/spaceship/roughness.png");
-        m_texMetallic = std::make_unique<Texture>(RESOURCE_ROOT "resources/spaceship/metallic.png");
+        {
+            const std::filesystem::path texturePaths[] = {
+                RESOURCE_ROOT "resources/spaceship/basecolor.png", RESOURCE_ROOT "resources/spaceship/normal.png",
+                RESOURCE_ROOT "resources/spaceship/roughness.png", RESOURCE_ROOT "resources/spaceship/metallic.png",
+                RESOURCE_ROOT "resources/sun/sunTex.jpg"
+            };
+            std::vector<Texture> textures = Texture::loadAll(texturePaths);
+            m_texAlbedo = std::make_unique<Texture>(std::move(textures[0]));
+            m_texNormal = std::make_unique<Texture>(std::move(textures[1]));
+            m_texRoughness = std::make_unique<Texture>(std::move(textures[2]));
+            m_texMetallic = std::make_unique<Texture>(std::move(textures[3]));
+            m_texSun = std::make_unique<Texture>(std::move(textures[4]));
+        }
 
         buildSunSphere();
-        m_texSun = std::make_unique<Texture>(RESOURCE_ROOT "resources/sun/sunTex.jpg");
+        m_shadowMap = std::make_unique<PointShadowMap>();
+        m_lightClusters = std::make_unique<LightClusters>();
+        m_occlusionCuller = std::make_unique<OcclusionCuller>();
+        m_upscaler = std::make_unique<Upscaler>();
+        // The sun texture must not repeat at the poles of the sphere.
+        m_clampSampler = std::make_unique<Sampler>(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE);
+
+        // Start compiling the shader variants needed for the first frame.
+        m_defaultShaders.request(sunFeatures());
+        m_defaultShaders.request(dragonFeatures());
+        m_defaultShaders.request(0);
 
         // sanity
         assert(m_probeRoot && m_escortRoot && m_probeAntennaBase && m_probeAntennaTip);
+
+        // Static scene: a ring of dragons between the two paths, facing the sun.
+        m_staticRoot = std::make_unique<SceneNode>();
+        for (int i = 0; i < NUM_STATIC_DRAGONS; ++i) {
+            const float angle = float(i) * glm::two_pi<float>() / float(NUM_STATIC_DRAGONS);
+            const glm::vec3 pos(5.5f * std::cos(angle), -0.3f, 5.5f * std::sin(angle));
+            m_staticRoot->addChild(new SceneNode(glm::translate(glm::mat4(1.0f), pos)
+                                                 * glm::rotate(glm::mat4(1.0f), -angle, glm::vec3(0, 1, 0))
+                                                 * glm::scale(glm::mat4(1.0f), glm::vec3(0.3f))));
+        }
+        m_staticRoot->update();
+
+        // Scene objects: the sun, the static scene and the dragons on the paths; the swarm is appended in resizeSwarm().
+        m_sunNode = std::make_unique<SceneNode>();
+        m_swarmRoot = std::make_unique<SceneNode>();
+        addSceneObject(SceneObjectKind::Sun, m_sunNode.get(), *m_sunMesh, SUN_MATERIAL);
+        for (SceneNode *pNode : m_staticRoot->children)
+            addSceneObject(SceneObjectKind::StaticDragon, pNode, m_meshes.front(), DRAGON_MATERIAL);
+        for (SceneNode *pNode : { m_probeRoot, m_escortRoot, m_probeAntennaBase, m_probeAntennaTip })
+            addSceneObject(SceneObjectKind::PathDragon, pNode, m_meshes.front(), DRAGON_MATERIAL);
+        m_numPathObjects = m_sceneObjects.size();
+        rebuildSceneTree();
+        m_occlusionCuller->reset(m_sceneObjects.size());
+
+        // The benchmark renders offscreen without vsync, with a fixed time step and (optionally) a
+        // recorded free camera track.
+        if (m_benchmark) {
+            m_window.setPresentMode(PresentMode::Immediate);
+            if (!m_benchmark->cameraTrack.empty()) {
+                std::optional<CameraTrack> track = CameraTrack::load(m_benchmark->cameraTrack);
+                if (!track) {
+                    std::cerr << "Could not load camera track " << m_benchmark->cameraTrack << std::endl;
+                    exit(1);
+                }
+                m_cameraTrack = std::move(*track);
+                m_camMode = 3;
+            }
+            const glm::ivec2 size = m_window.getFrameBufferSize();
+            for (auto [pTexture, internalFormat] : { std::pair { &m_offscreenColor, GL_RGBA8 }, std::pair { &m_offscreenDepth, GL_DEPTH_COMPONENT24 } }) {
+                glGenTextures(1, pTexture);
+                GLState::get().bindTexture(0, GL_TEXTURE_2D, *pTexture);
+                glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size.x, size.y, 0,
+                             internalFormat == GL_RGBA8 ? GL_RGBA : GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, nullptr);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            }
+            m_benchmarkRecorder = std::make_unique<BenchmarkRecorder>(m_benchmark->numFrames);
+        }
+        m_lastFrameTime = wallClockSeconds();
+
+        // The benchmark steps the simulation inline so that every run renders exactly the same frames.
+        m_simulation = std::make_unique<Simulation>(m_path, m_pathOuter);
+        m_simulation->writeSnapshot(m_simSnapshot);
+        m_useSimulationThread = !m_benchmark;
+        if (m_useSimulationThread)
+            m_simulationThread = std::make_unique<SimulationThread>(*m_simulation, currentSimulationParams());
     }
 
-    void update() {
-        while (!m_window.shouldClose()) {
+    ~Application() {
+        glDeleteTextures(1, &m_offscreenColor);
+        glDeleteTextures(1, &m_offscreenDepth);
+    }
+
+    // Returns the exit code.
+    int update() {
+        for (size_t frame = 0; !m_window.shouldClose(); ++frame) {
+            CpuProfiler::get().beginFrame();
+            const bool measured = m_benchmarkRecorder && frame >= m_benchmark->numWarmupFrames;
+            if (measured)
+                m_benchmarkRecorder->beginFrame();
             m_window.updateInput();
+            m_frameCapture.beginFrame();
 
-            ImGui::Begin("Controls");
-            ImGui::Checkbox("Use material if no texture", &m_useMaterial);
-            ImGui::Checkbox("Show path", &m_showPath);
-            ImGui::SliderFloat("Path speed", &m_pathSpeed, 0.0f, 0.3f, "%.3f");
-            ImGui::Checkbox("Chase camera", &m_chaseCam);
-            ImGui::SliderFloat("Probe scale", &m_probeScale, 0.02f, 0.6f, "%.3f");
-            ImGui::Checkbox("Environment reflections", &m_useEnvMap);
-            ImGui::Checkbox("PBR + Normal Map", &m_usePBR);
-            ImGui::Text("Camera");
-            ImGui::RadioButton("Chase", &m_camMode, 0);
-            ImGui::SameLine();
-            ImGui::RadioButton("Top", &m_camMode, 1);
-            ImGui::SameLine();
-            ImGui::RadioButton("Orbit", &m_camMode, 2);
-            ImGui::SameLine();
-            ImGui::RadioButton("Free", &m_camMode, 3); // <-- added Free camera mode
-            ImGui::DragFloat3("Sun pos", &m_sunPos.x, 0.05f);
-            ImGui::SliderFloat("Sun radius", &m_sunRadius, 0.2f, 2.0f, "%.2f");
-            ImGui::SliderFloat("Sun intensity", &m_sunIntensity, 0.0f, 40.0f, "%.1f");
-            ImGui::Checkbox("Draw static scene", &m_drawStaticScene);
-            ImGui::End();
-
-            glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            glEnable(GL_DEPTH_TEST);
-
-            static double last = glfwGetTime();
-            double now = glfwGetTime();
-            float dtSec = float(now - last);
-            last = now;
-
-            // Advance inner path
-            m_pathU = std::fmod(m_pathU + dtSec * m_pathSpeed, 1.0f);
-            glm::vec3 probePos = m_path.sample(m_pathU);
-            glm::vec3 probeDir = glm::normalize(m_path.tangentAt(m_pathU));
-
-            // Frame from tangent (inner)
-            glm::vec3 fwd = glm::normalize(probeDir);
-            glm::vec3 up = glm::vec3(0, 1, 0);
-            if (std::abs(glm::dot(up, fwd)) > 0.98f) up = glm::vec3(0, 0, 1);
-            glm::vec3 right = glm::normalize(glm::cross(fwd, up));
-            up = glm::normalize(glm::cross(right, fwd));
-            glm::mat4 R = glm::mat4(
-                glm::vec4(right, 0),
-                glm::vec4(up, 0),
-                glm::vec4(-fwd, 0),
-                glm::vec4(0, 0, 0, 1)
-            );
-
-            // Place inner root
-            glm::mat4 Mprobe =
-                    glm::translate(glm::mat4(1.0f), probePos) *
-                    R *
-                    glm::scale(glm::mat4(1.0f), glm::vec3(m_probeScale));
-            m_probeRoot->local = Mprobe;
-
-            // Advance outer path
-            m_pathOuterU = std::fmod(m_pathOuterU + dtSec * m_pathOuterSpeed, 1.0f);
-            glm::vec3 outerPos = m_pathOuter.sample(m_pathOuterU);
-            glm::vec3 outerDir = glm::normalize(m_pathOuter.tangentAt(m_pathOuterU));
-
-            // Frame from tangent (outer)
-            glm::vec3 ofwd = glm::normalize(outerDir);
-            glm::vec3 oup = glm::vec3(0, 1, 0);
-            if (std::abs(glm::dot(oup, ofwd)) > 0.98f) oup = glm::vec3(0, 0, 1);
-            glm::vec3 oright = glm::normalize(glm::cross(ofwd, oup));
-            oup = glm::normalize(glm::cross(oright, ofwd));
-            glm::mat4 oR = glm::mat4(
-                glm::vec4(oright, 0),
-                glm::vec4(oup, 0),
-                glm::vec4(-ofwd, 0),
-                glm::vec4(0, 0, 0, 1)
-            );
-
-            // Place escort root at larger radius
-            glm::mat4 Mescort =
-                    glm::translate(glm::mat4(1.0f), outerPos) *
-                    oR *
-                    glm::scale(glm::mat4(1.0f), glm::vec3(m_probeScale));
-            m_escortRoot->local = Mescort;
-
-            // Keep the stacked one above the other (base at root, tip above with a small bob)
-            float bob = 0.25f * std::sin(float(glfwGetTime()) * 4.0f);
-            m_probeAntennaBase->local = glm::mat4(1.0f);
-            m_probeAntennaTip->local = glm::translate(glm::mat4(1.0f), glm::vec3(0, 1.0f + bob, 0));
-
-            // Camera selection
-            if (m_camMode == 0) {
-                glm::vec3 camTarget = probePos;
-                glm::vec3 camPos = probePos - fwd * 2.0f + up * 0.6f;
-                m_viewMatrix = glm::lookAt(camPos, camTarget, up);
-            } else if (m_camMode == 1) {
-                glm::vec3 camPos = probePos + glm::vec3(0, 5.0f, 0);
-                m_viewMatrix = glm::lookAt(camPos, probePos, glm::vec3(0, 0, -1));
-            } else if (m_camMode == 2) {
-                m_orbitAngle += dtSec * 0.5f;
-                glm::vec3 camPos = probePos + glm::vec3(std::sin(m_orbitAngle) * 3.0f, 1.5f,
-                                                        std::cos(m_orbitAngle) * 3.0f);
-                m_viewMatrix = glm::lookAt(camPos, probePos, glm::vec3(0, 1, 0));
-            } else {
-                // Free camera mode (m_camMode == 3)
-                // Update free camera (polls WASD via glfw) and use its view/projection
-                m_freeCam.update(glfwGetCurrentContext(), dtSec);
-
-                int fbW = 1, fbH = 1;
-                glfwGetFramebufferSize(glfwGetCurrentContext(), &fbW, &fbH);
-                float aspect = (fbH > 0) ? (float(fbW) / float(fbH)) : 1.0f;
-                m_projectionMatrix = glm::perspective(glm::radians(m_freeCam.fov), aspect, 0.1f, 30.0f);
-                m_viewMatrix = m_freeCam.getViewMatrix();
+            if (!m_benchmark)
+                drawControls();
+            GLState::get().resetCounters();
+
+            GLState::get().setDepthTest(true);
+
+            const double wallTime = wallClockSeconds();
+            const float dtSec = m_benchmark ? m_benchmark->timeStep : float(wallTime - m_lastFrameTime);
+            m_lastFrameTime = wallTime;
+
+            // The simulation takes fixed steps; the frame shows the state interpolated between the last two.
+            const SimulationSnapshot &sim = latestSimulationSnapshot(dtSec);
+            {
+                CPU_PROFILE_ZONE("Simulation::interpolate");
+                sim.interpolate(m_simulationThread ? sim.alphaAt(std::chrono::steady_clock::now()) : m_simClock.alpha(), m_simFrame);
             }
 
-            // skybox first (after you set m_viewMatrix)
+            {
+                CPU_PROFILE_ZONE("Path sampling");
+                const glm::vec3 probePos = m_simFrame.probePosition;
+                const glm::vec3 fwd = m_simFrame.probeForward;
+                const glm::vec3 up = m_simFrame.probeUp;
+
+                // The moving nodes take their world transforms from the simulation.
+                m_probeRoot->world = m_simFrame.probe;
+                m_escortRoot->world = m_simFrame.escort;
+                m_probeAntennaBase->world = m_simFrame.escortBase;
+                m_probeAntennaTip->world = m_simFrame.escortTip;
+
+                // Camera selection
+                if (m_camMode == 0) {
+                    glm::vec3 camTarget = probePos;
+                    glm::vec3 camPos = probePos - fwd * 2.0f + up * 0.6f;
+                    m_viewMatrix = glm::lookAt(camPos, camTarget, up);
+                } else if (m_camMode == 1) {
+                    glm::vec3 camPos = probePos + glm::vec3(0, 5.0f, 0);
+                    m_viewMatrix = glm::lookAt(camPos, probePos, glm::vec3(0, 0, -1));
+                } else if (m_camMode == 2) {
+                    m_orbitAngle += dtSec * 0.5f;
+                    glm::vec3 camPos = probePos + glm::vec3(std::sin(m_orbitAngle) * 3.0f, 1.5f,
+                                                            std::cos(m_orbitAngle) * 3.0f);
+                    m_viewMatrix = glm::lookAt(camPos, probePos, glm::vec3(0, 1, 0));
+                } else {
+                    // Free camera mode (m_camMode == 3)
+                    // Update free camera (polls WASD via glfw, or replays the benchmark track) and use its view/projection
+                    if (m_benchmark && !m_cameraTrack.empty()) {
+                        const CameraTrack::Pose &pose = m_cameraTrack.at(frame);
+                        m_freeCam.position = pose.position;
+                        m_freeCam.front = pose.front;
+                        m_freeCam.up = pose.up;
+                        m_freeCam.fov = pose.fov;
+                    } else if (!m_window.isHeadless()) {
+                        m_freeCam.update(glfwGetCurrentContext(), dtSec);
+                        if (m_recordCameraTrack)
+                            m_cameraTrack.add({ m_freeCam.position, m_freeCam.front, m_freeCam.up, m_freeCam.fov });
+                    }
+
+                    const glm::ivec2 fbSize = m_window.getFrameBufferSize();
+                    float aspect = (fbSize.y > 0) ? (float(fbSize.x) / float(fbSize.y)) : 1.0f;
+                    m_projectionMatrix = glm::perspective(glm::radians(m_freeCam.fov), aspect, m_nearPlane, m_farPlane);
+                    m_viewMatrix = m_freeCam.getViewMatrix();
+                }
+            }
+
+            // The sky is queued after the opaque geometry (see RenderPass::Sky)
             glm::mat4 viewNoTrans = m_viewMatrix;
             viewNoTrans[3] = glm::vec4(0, 0, 0, 1);
-            m_sky->draw(m_skyShader, m_projectionMatrix, viewNoTrans);
 
             // bind cubemap to unit 1 for the rest of the frame
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, m_sky->cubemap());
+            GLState::get().bindTexture(1, GL_TEXTURE_CUBE_MAP, m_sky->cubemap());
 
             // cache camera world position for reflections
             glm::mat4 invV = glm::inverse(m_viewMatrix);
             glm::vec3 camPos = glm::vec3(invV[3]);
+            auto normalizedDepth = [&](const glm::vec3 &worldPos) { return glm::distance(camPos, worldPos) / m_farPlane; };
 
-            // Propagate transforms
-            m_probeRoot->update();
-            m_escortRoot->update();
+            // Per-frame scratch memory (e.g. for sorting the render queue)
+            m_frameArena.reset();
+            m_renderQueue.clear();
 
-            // Draw the sun sphere (emissive)
-            {
-                m_defaultShader.bind();
-
-                // Mark this draw as "sun" immediately
-                glUniform1i(m_defaultShader.getUniformLocation("isSun"), 1);
-
-                // Light uniforms
-                glUniform3fv(m_defaultShader.getUniformLocation("sunPos"), 1, &m_sunPos[0]);
-                glUniform1f(m_defaultShader.getUniformLocation("sunIntensity"), m_sunIntensity);
-
-                // Emissive color
-                glm::vec3 sunColor = glm::vec3(m_sunIntensity);
-                glUniform3fv(m_defaultShader.getUniformLocation("sunEmissive"), 1, glm::value_ptr(sunColor));
-
-                // Matrices for the sun sphere
-                glm::mat4 Msun = glm::translate(glm::mat4(1.0f), m_sunPos)
-                                 * glm::scale(glm::mat4(1.0f), glm::vec3(m_sunRadius));
-                glm::mat4 mvp = m_projectionMatrix * m_viewMatrix * Msun;
-                glm::mat3 nrm = glm::inverseTranspose(glm::mat3(Msun));
-                glUniformMatrix4fv(m_defaultShader.getUniformLocation("mvpMatrix"), 1, GL_FALSE, glm::value_ptr(mvp));
-                glUniformMatrix3fv(m_defaultShader.getUniformLocation("normalModelMatrix"), 1, GL_FALSE,
-                                   glm::value_ptr(nrm));
-                glUniformMatrix4fv(m_defaultShader.getUniformLocation("modelMatrix"), 1, GL_FALSE,
-                                   glm::value_ptr(Msun));
+            // Write all uniform data of this frame up front so it can be uploaded in one go;
+            // the draws below then only bind their range of the ring buffer.
+            m_uniformRing->beginFrame();
 
-                // Base texture for the sun surface
-                if (m_texSun) {
-                    m_texSun->bind(GL_TEXTURE0);
-                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-                    glUniform1i(m_defaultShader.getUniformLocation("colorMap"), 0);
-                    glUniform1i(m_defaultShader.getUniformLocation("hasTexCoords"), 1);
-                } else {
-                    glUniform1i(m_defaultShader.getUniformLocation("hasTexCoords"), 0);
-                }
+            PerFrameUniforms perFrame;
+            perFrame.viewProjectionMatrix = m_projectionMatrix * m_viewMatrix;
+            perFrame.camPos = camPos;
+            perFrame.sunPos = m_sunPos;
+            perFrame.sunIntensity = m_sunIntensity;
+            perFrame.shadowDepthRange = glm::vec2(m_shadowMap->settings().nearPlane, m_shadowMap->settings().farPlane);
 
-                // No PBR/EnvMap for emissive blob
-                glUniform1i(m_defaultShader.getUniformLocation("usePBR"), 0);
-                glUniform1i(m_defaultShader.getUniformLocation("useEnvMap"), 0);
-                glUniform3fv(m_defaultShader.getUniformLocation("camPos"), 1, &camPos[0]);
+            // Swarm circling outside the outer path; it follows the size of the simulated one, which
+            // catches up with m_swarmSize within a step.
+            resizeSwarm(int(m_simFrame.swarm.size()));
+            for (size_t i = 0; i < m_simFrame.swarm.size(); ++i)
+                m_swarmRoot->children[i]->world = m_simFrame.swarm[i];
 
-                glBindVertexArray(m_sunVAO);
-                glDrawElements(GL_TRIANGLES, m_sunIndexCount, GL_UNSIGNED_INT, nullptr);
-                glBindVertexArray(0);
+            m_sunNode->local = glm::translate(glm::mat4(1.0f), m_sunPos)
+                               * glm::scale(glm::mat4(1.0f), glm::vec3(m_sunRadius));
 
-                // Reset for subsequent draws
-                glUniform1i(m_defaultShader.getUniformLocation("isSun"), 0);
+            // Propagate transforms
+            {
+                CPU_PROFILE_ZONE("SceneNode::update");
+                m_sunNode->update();
             }
 
-            // Draw single dragon on INNER path (root only)
-            {
-                m_defaultShader.bind();
-                const glm::mat4 &M = m_probeRoot->world;
-                glm::mat4 mvp = m_projectionMatrix * m_viewMatrix * M;
-                glm::mat3 nrm = glm::inverseTranspose(glm::mat3(M));
-                glUniformMatrix4fv(m_defaultShader.getUniformLocation("mvpMatrix"), 1, GL_FALSE, glm::value_ptr(mvp));
-                glUniformMatrix3fv(m_defaultShader.getUniformLocation("normalModelMatrix"), 1, GL_FALSE,
-                                   glm::value_ptr(nrm));
-                glUniformMatrix4fv(m_defaultShader.getUniformLocation("modelMatrix"), 1, GL_FALSE, glm::value_ptr(M));
-
-                glUniform1i(m_defaultShader.getUniformLocation("usePBR"), m_usePBR ? 1 : 0);
-                glUniform1i(m_defaultShader.getUniformLocation("useEnvMap"), m_useEnvMap ? 1 : 0);
-                glUniform1i(m_defaultShader.getUniformLocation("hasTexCoords"), 1);
-
-                if (m_texAlbedo) {
-                    m_texAlbedo->bind(GL_TEXTURE0);
-                    glUniform1i(m_defaultShader.getUniformLocation("colorMap"), 0);
+            // Refit the BVH to the objects that moved. Objects that stay within the margin of their
+            // BVH leaf (most of the swarm in most frames) do not change the tree at all.
+            for (SceneObject &object : m_sceneObjects) {
+                if (object.kind == SceneObjectKind::StaticDragon)
+                    continue;
+                const AxisAlignedBox worldBounds = transformBox(object.pMesh->localBounds(), object.pNode->world);
+                m_sceneTree.moveProxy(object.proxyId, worldBounds, worldBounds.center() - object.worldBounds.center());
+                object.worldBounds = worldBounds;
+            }
+            // Incremental updates slowly degrade the tree; rebuild it once it became considerably worse.
+            if (++m_framesSinceSceneTreeCheck >= 60) {
+                m_framesSinceSceneTreeCheck = 0;
+                if (m_sceneTree.areaRatio() > 1.5f * m_sceneTreeAreaRatio)
+                    rebuildSceneTree();
+            }
+
+            // The BVH rejects whole groups of objects outside the view frustum; the remaining
+            // candidates are tested with their exact bounds, all at once.
+            const Frustum frustum = Frustum::fromMatrix(perFrame.viewProjectionMatrix);
+            uint32_t *candidates = m_frameArena.allocate<uint32_t>(m_sceneObjects.size());
+            size_t numCandidates = 0;
+            m_frustumCuller.clear();
+            m_sceneTree.queryFrustum(frustum, [&](int32_t proxyId) {
+                const uint32_t objectIndex = m_sceneTree.userData(proxyId);
+                candidates[numCandidates++] = objectIndex;
+                m_frustumCuller.add(m_sceneObjects[objectIndex].worldBounds);
+            });
+            m_frustumCuller.cull(frustum);
+
+            // Sun shadows: the static scene is cached in the shadow map, only the dragons on the paths are
+            // re-rendered (and only when they moved). The swarm does not cast shadows.
+            m_shadowsActive = m_useShadows && m_shadowShader.isReady();
+            if (m_shadowsActive) {
+                PointShadowSettings shadowSettings = m_shadowMap->settings();
+                shadowSettings.resolution = 256 << m_shadowResolutionIndex;
+                shadowSettings.policy = m_cacheStaticShadows ? ShadowUpdatePolicy::Cached : ShadowUpdatePolicy::EveryFrame;
+                m_shadowMap->setSettings(shadowSettings);
+                if (m_drawStaticScene != m_staticShadowCasters) {
+                    m_shadowMap->invalidateStatic();
+                    m_staticShadowCasters = m_drawStaticScene;
                 }
-                if (m_texNormal) {
-                    m_texNormal->bind(GL_TEXTURE2);
-                    glUniform1i(m_defaultShader.getUniformLocation("normalMap"), 2);
+
+                m_staticCasters.clear();
+                m_dynamicCasters.clear();
+                for (size_t i = 0; i < m_numPathObjects; ++i) {
+                    const SceneObject &object = m_sceneObjects[i];
+                    const ShadowCaster caster { object.pMesh, object.pNode->world, object.worldBounds };
+                    if (object.kind == SceneObjectKind::StaticDragon && m_drawStaticScene)
+                        m_staticCasters.push_back(caster);
+                    else if (object.kind == SceneObjectKind::PathDragon)
+                        m_dynamicCasters.push_back(caster);
                 }
-                if (m_texRoughness) {
-                    m_texRoughness->bind(GL_TEXTURE3);
-                    glUniform1i(m_defaultShader.getUniformLocation("roughMap"), 3);
+            }
+
+            // The scene is rendered at a lower resolution while its GPU time is above the target and
+            // then upscaled to the window; the UI is drawn at the full resolution.
+            const std::optional<double> sceneGpuMs = m_sceneGpuTimer.milliseconds();
+            if (sceneGpuMs)
+                m_sceneGpuMs[m_useDepthPrepass] = *sceneGpuMs;
+            if (m_useDynamicResolution && m_dynamicResolution.update(sceneGpuMs))
+                m_sceneGpuTimer.reset(); // measured at the old resolution
+            const glm::ivec2 frameBufferSize = m_window.getFrameBufferSize();
+            const glm::ivec2 sceneSize = m_useDynamicResolution ? m_dynamicResolution.scaledSize(frameBufferSize) : frameBufferSize;
+
+            // Every dragon (except the static ones) has an engine light at its tail. The lights are
+            // assigned to the clusters of the view so each pixel only evaluates the nearby ones.
+            if (m_useLocalLights) {
+                m_localLights.clear();
+                for (const SceneObject &object : m_sceneObjects) {
+                    if (object.kind != SceneObjectKind::PathDragon && object.kind != SceneObjectKind::SwarmDragon)
+                        continue;
+                    const AxisAlignedBox &bounds = object.pMesh->localBounds();
+                    const glm::vec3 tail(bounds.center().x, bounds.center().y, bounds.lower.z);
+                    const float hue = float(m_localLights.size() % 7) / 7.0f;
+                    const glm::vec3 color = glm::clamp(glm::abs(glm::mod(hue * 6.0f + glm::vec3(0, 4, 2), 6.0f) - 3.0f) - 1.0f, 0.0f, 1.0f);
+                    m_localLights.push_back({ glm::vec3(object.pNode->world * glm::vec4(tail, 1.0f)), m_localLightRadius, color * m_localLightIntensity });
                 }
-                if (m_texMetallic) {
-                    m_texMetallic->bind(GL_TEXTURE4);
-                    glUniform1i(m_defaultShader.getUniformLocation("metalMap"), 4);
+                m_lightClusters->update(m_localLights, m_viewMatrix, m_projectionMatrix, sceneSize);
+                m_lightClusters->bind(LIGHT_CLUSTERS_UNIT);
+                perFrame.clusterDepthPlane = m_lightClusters->depthPlane();
+                perFrame.clusterParams = m_lightClusters->params();
+            }
+            const GLintptr perFrameOffset = m_uniformRing->push(perFrame);
+
+            // Objects hidden according to the latest available occlusion query results are skipped.
+            // Instanced dragons are culled on the CPU; the sun is drawn with conditional rendering.
+            if (m_useOcclusionCulling)
+                m_occlusionCuller->beginFrame();
+
+            // Dragons share mesh and material, so the visible ones are drawn as instances of a single batch.
+            m_instanceBatcher->beginFrame();
+            for (size_t i = 0; i < numCandidates; ++i) {
+                if (!m_frustumCuller.isVisible(uint32_t(i)))
+                    continue;
+
+                const SceneObject &object = m_sceneObjects[candidates[i]];
+                if (object.kind == SceneObjectKind::StaticDragon && !m_drawStaticScene)
+                    continue;
+                if (object.kind != SceneObjectKind::Sun) {
+                    if (!m_useOcclusionCulling || !m_occlusionCuller->isOccluded(candidates[i]))
+                        m_instanceBatcher->add(*object.pMesh, object.materialId, object.pNode->world);
+                    continue;
                 }
-                glUniform1i(m_defaultShader.getUniformLocation("envMap"), 1);
-                glUniform3fv(m_defaultShader.getUniformLocation("camPos"), 1, &camPos[0]);
 
-                m_meshes.front().draw(m_defaultShader);
+                // Sun sphere (emissive, no PBR/EnvMap)
+                PerObjectUniforms sunUniforms = objectUniforms(perFrame, object.pNode->world);
+                sunUniforms.sunEmissive = glm::vec3(m_sunIntensity);
+
+                DrawCommand sun;
+                sun.shaderFeatures = sunFeatures();
+                sun.materialId = SUN_MATERIAL;
+                sun.uniformBuffer = m_uniformRing->buffer();
+                sun.uniformOffset = m_uniformRing->push(sunUniforms);
+                sun.uniformSize = sizeof(PerObjectUniforms);
+                sun.pMesh = object.pMesh;
+                sun.profileZone = "Sun";
+                if (m_useOcclusionCulling)
+                    sun.conditionQuery = m_occlusionCuller->conditionQuery(candidates[i]);
+                m_renderQueue.push(RenderPass::Opaque, normalizedDepth(m_sunPos), std::move(sun));
             }
 
-            // Draw the two stacked dragons on the OUTER path (traverse escort hierarchy)
-            m_escortRoot->traverse([&](const glm::mat4 &M) {
-                m_defaultShader.bind();
-                glm::mat4 mvp = m_projectionMatrix * m_viewMatrix * M;
-                glm::mat3 nrm = glm::inverseTranspose(glm::mat3(M));
-                glUniformMatrix4fv(m_defaultShader.getUniformLocation("mvpMatrix"), 1, GL_FALSE, glm::value_ptr(mvp));
-                glUniformMatrix3fv(m_defaultShader.getUniformLocation("normalModelMatrix"), 1, GL_FALSE,
-                                   glm::value_ptr(nrm));
-                glUniformMatrix4fv(m_defaultShader.getUniformLocation("modelMatrix"), 1, GL_FALSE, glm::value_ptr(M));
-
-                glUniform1i(m_defaultShader.getUniformLocation("usePBR"), m_usePBR ? 1 : 0);
-                glUniform1i(m_defaultShader.getUniformLocation("useEnvMap"), m_useEnvMap ? 1 : 0);
-                glUniform1i(m_defaultShader.getUniformLocation("hasTexCoords"), 1);
-
-                if (m_texAlbedo) {
-                    m_texAlbedo->bind(GL_TEXTURE0);
-                    glUniform1i(m_defaultShader.getUniformLocation("colorMap"), 0);
-                }
-                if (m_texNormal) {
-                    m_texNormal->bind(GL_TEXTURE2);
-                    glUniform1i(m_defaultShader.getUniformLocation("normalMap"), 2);
-                }
-                if (m_texRoughness) {
-                    m_texRoughness->bind(GL_TEXTURE3);
-                    glUniform1i(m_defaultShader.getUniformLocation("roughMap"), 3);
-                }
-                if (m_texMetallic) {
-                    m_texMetallic->bind(GL_TEXTURE4);
-                    glUniform1i(m_defaultShader.getUniformLocation("metalMap"), 4);
-                }
-                glUniform1i(m_defaultShader.getUniformLocation("envMap"), 1);
-                glUniform3fv(m_defaultShader.getUniformLocation("camPos"), 1, &camPos[0]);
+            // One draw per mesh/material batch. A batch covers instances at all distances, so it
+            // is not sorted by depth.
+            for (const InstanceBatch &batch : m_instanceBatcher->build()) {
+                DrawCommand dragons;
+                dragons.shaderFeatures = dragonFeatures();
+                dragons.materialId = batch.materialId;
+                dragons.pMesh = batch.pMesh;
+                dragons.instanceBuffer = m_instanceBatcher->instanceBuffer();
+                dragons.instanceOffset = batch.instanceOffset;
+                dragons.instanceCount = batch.instanceCount;
+                dragons.profileZone = "Dragons";
+                m_renderQueue.push(RenderPass::Opaque, 0.0f, std::move(dragons));
+            }
+
+            if (m_skyShader.isReady()) {
+                DrawCommand sky;
+                sky.setCustomDraw(m_frameArena, [this, viewNoTrans]() {
+                    m_sky->draw(m_skyShader.get(), m_projectionMatrix, viewNoTrans);
+                });
+                m_renderQueue.push(RenderPass::Sky, 1.0f, std::move(sky));
+            }
+
+            // Splines are drawn unlit in world space, on top of everything (avoid z-fighting)
+            if (m_showPath) {
+                DrawCommand paths;
+                paths.shaderFeatures = 0; // unlit white
+                paths.uniformBuffer = m_uniformRing->buffer();
+                paths.uniformOffset = m_uniformRing->push(objectUniforms(perFrame, glm::mat4(1.0f)));
+                paths.uniformSize = sizeof(PerObjectUniforms);
+                paths.profileZone = "Path lines";
+                paths.setCustomDraw(m_frameArena, [this]() {
+                    m_path.drawGL(); // inner
+                    m_pathOuter.drawGL(); // outer
+                });
+                m_renderQueue.push(RenderPass::Overlay, 0.0f, std::move(paths));
+            }
+
+            m_uniformRing->flush();
+            m_uniformRing->bindRange(PER_FRAME_BINDING, perFrameOffset, sizeof(PerFrameUniforms));
 
-                m_meshes.front().draw(m_defaultShader);
+            m_renderQueue.setDepthPrepass(m_useDepthPrepass);
+            m_renderQueue.sort();
+
+            // The passes of the frame, ordered and culled by the frame graph from what they read and write.
+            m_frameGraph.reset();
+            FrameGraphResource backbufferColor, backbufferDepth;
+            if (m_benchmark) {
+                backbufferColor = m_frameGraph.importTexture("Backbuffer color", m_offscreenColor, { frameBufferSize, GL_RGBA8 });
+                backbufferDepth = m_frameGraph.importTexture("Backbuffer depth", m_offscreenDepth, { frameBufferSize, GL_DEPTH_COMPONENT24 });
+            } else {
+                backbufferColor = m_frameGraph.importBackbuffer("Backbuffer color", frameBufferSize, m_window.defaultFramebuffer());
+                backbufferDepth = m_frameGraph.importBackbuffer("Backbuffer depth", frameBufferSize, m_window.defaultFramebuffer());
+            }
+            FrameGraphResource shadowMap = m_frameGraph.importExternal("Shadow map");
+            FrameGraphResource sceneColor = backbufferColor, sceneDepth = backbufferDepth;
+
+            if (m_shadowsActive) {
+                m_frameGraph.addPass("Shadows", [&](FrameGraph::Builder &builder) {
+                    shadowMap = builder.write(shadowMap);
+                }, [this]() {
+                    m_shadowMap->update(m_shadowShader.get(), m_sunPos, m_staticCasters, m_dynamicCasters);
+                    GLState::get().bindTexture(SHADOW_MAP_UNIT, GL_TEXTURE_CUBE_MAP, m_shadowMap->texture());
+                });
+            }
+            m_frameGraph.addPass("Clear", [&](FrameGraph::Builder &builder) {
+                if (m_useDynamicResolution) {
+                    sceneColor = builder.create("Scene color", { sceneSize, GL_RGBA8 });
+                    sceneDepth = builder.create("Scene depth", { sceneSize, GL_DEPTH_COMPONENT24 });
+                }
+                sceneColor = builder.write(sceneColor);
+                sceneDepth = builder.write(sceneDepth);
+            }, []() {
+                glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            });
+            // The scene GPU timer covers the render queue passes, from the depth pre-pass (if enabled) up
+            // to the transparent pass. It starts in a pass of its own that depends on the shadow map like
+            // the opaque pass does, so the frame graph schedules the shadow update before it in both modes
+            // and the times with and without the pre-pass compare the same work.
+            m_frameGraph.addPass("Scene timer", [&](FrameGraph::Builder &builder) {
+                if ((dragonFeatures() | sunFeatures()) & FeatureShadows)
+                    builder.read(shadowMap);
+                sceneDepth = builder.write(sceneDepth);
+            }, [this]() {
+                m_sceneGpuTimer.begin();
+            });
+            if (m_useDepthPrepass) {
+                m_frameGraph.addPass("Depth pre-pass", [&](FrameGraph::Builder &builder) {
+                    sceneDepth = builder.write(sceneDepth);
+                }, [this]() {
+                    m_renderQueue.submitDepthPrepass(m_renderQueueCallbacks);
+                });
+            }
+            m_frameGraph.addPass("Opaque", [&](FrameGraph::Builder &builder) {
+                if ((dragonFeatures() | sunFeatures()) & FeatureShadows)
+                    builder.read(shadowMap);
+                sceneColor = builder.write(sceneColor);
+                sceneDepth = builder.write(sceneDepth);
+            }, [this]() {
+                m_renderQueue.submitPass(m_renderQueueCallbacks, RenderPass::Opaque);
+            });
+            m_frameGraph.addPass("Sky", [&](FrameGraph::Builder &builder) {
+                sceneColor = builder.write(sceneColor);
+                sceneDepth = builder.write(sceneDepth);
+            }, [this]() {
+                m_renderQueue.submitPass(m_renderQueueCallbacks, RenderPass::Sky);
+            });
+            m_frameGraph.addPass("Transparent", [&](FrameGraph::Builder &builder) {
+                builder.readDepth(sceneDepth);
+                sceneColor = builder.write(sceneColor);
+            }, [this]() {
+                m_renderQueue.submitPass(m_renderQueueCallbacks, RenderPass::Transparent);
+                m_sceneGpuTimer.end();
             });
 
-            // draw the splines (avoid z-fighting)
+            // Test the bounds of all objects in the view frustum against the depth of this frame; the
+            // results decide what is drawn in the following frames.
+            if (m_useOcclusionCulling) {
+                m_frameGraph.addPass("Occlusion queries", [&](FrameGraph::Builder &builder) {
+                    builder.readDepth(sceneDepth);
+                    builder.setSideEffect();
+                }, [this, camPos, candidates, numCandidates]() {
+                    m_occlusionCuller->beginQueries(m_occlusionBoxShader, camPos, m_nearPlane);
+                    for (size_t i = 0; i < numCandidates; ++i) {
+                        const SceneObject &object = m_sceneObjects[candidates[i]];
+                        if (m_frustumCuller.isVisible(uint32_t(i)) && (object.kind != SceneObjectKind::StaticDragon || m_drawStaticScene))
+                            m_occlusionCuller->query(candidates[i], object.worldBounds);
+                    }
+                    m_occlusionCuller->endQueries();
+                });
+            }
             if (m_showPath) {
-                glDisable(GL_DEPTH_TEST);
-                m_defaultShader.bind();
-                glm::mat4 mvpSpline = m_projectionMatrix * m_viewMatrix * glm::mat4(1.0f);
-                glUniformMatrix4fv(m_defaultShader.getUniformLocation("mvpMatrix"), 1, GL_FALSE,
-                                   glm::value_ptr(mvpSpline));
-                m_path.drawGL(); // inner
-                m_pathOuter.drawGL(); // outer
-                glEnable(GL_DEPTH_TEST);
+                m_frameGraph.addPass("Debug lines", [&](FrameGraph::Builder &builder) {
+                    sceneColor = builder.write(sceneColor);
+                }, [this]() {
+                    m_renderQueue.submitPass(m_renderQueueCallbacks, RenderPass::Overlay);
+                });
+            }
+            if (m_useDynamicResolution) {
+                m_frameGraph.addPass("Upscale", [&](FrameGraph::Builder &builder) {
+                    builder.read(sceneColor);
+                    backbufferColor = builder.write(backbufferColor);
+                }, [this, sceneColor]() {
+                    m_upscaler->draw(m_upscaleShader, m_frameGraph.texture(sceneColor), m_upscaleSharpness);
+                });
+            } else {
+                backbufferColor = sceneColor; // the scene was drawn into the back buffer itself
+            }
+            if (m_frameCapture.wantsCapture()) {
+                // Captured before the UI is drawn on top.
+                m_frameGraph.addPass("Capture", [&](FrameGraph::Builder &builder) {
+                    backbufferColor = builder.write(backbufferColor);
+                }, [this, frameBufferSize]() {
+                    m_frameCapture.capture(frameBufferSize);
+                });
+            }
+            m_frameGraph.addPass("UI", [&](FrameGraph::Builder &builder) {
+                backbufferColor = builder.write(backbufferColor);
+            }, [this]() {
+                m_window.renderImGui();
+            });
+            m_frameGraph.compile();
+            GpuProfiler::get().beginFrame();
+            m_frameGraph.execute();
+            GpuProfiler::get().endFrame();
+
+            m_uniformRing->endFrame();
+            m_instanceBatcher->endFrame();
+            if (!m_benchmark) {
+                m_window.swapBuffers();
+                continue;
             }
 
-            m_window.swapBuffers();
+            glFlush();
+            if (measured) {
+                m_benchmarkRecorder->endFrame();
+                if (m_benchmarkRecorder->finished()) {
+                    if (!m_benchmarkRecorder->writeResults(m_benchmark->output)) {
+                        std::cerr << "Could not write the benchmark results to " << m_benchmark->output << std::endl;
+                        return 1;
+                    }
+                    std::cout << "Wrote the benchmark results to " << m_benchmark->output << ".csv/.json" << std::endl;
+                    return 0;
+                }
+            }
         }
+        return 0;
+    }
+
+    SimulationParams currentSimulationParams() const {
+        SimulationParams params = m_simParams;
+        params.pathSpeed = m_pathSpeed;
+        params.pathOuterSpeed = m_pathOuterSpeed;
+        params.probeScale = m_probeScale;
+        params.swarmRadius = m_pathOuterRadius + 1.5f;
+        params.swarmSize = m_swarmSize;
+        return params;
+    }
+
+    // The simulation thread publishes its snapshots by itself; inline, the simulation catches up with
+    // the duration of the frame first.
+    const SimulationSnapshot &latestSimulationSnapshot(float dtSec) {
+        const SimulationParams params = currentSimulationParams();
+        if (m_simulationThread) {
+            m_simulationThread->setParams(params);
+            return m_simulationThread->latestSnapshot();
+        }
+        params.applyTo(m_simClock, m_numAppliedSingleSteps);
+        const bool paramsChanged = m_simulation->applyParams(params);
+        const int numSteps = m_simClock.advance(double(dtSec));
+        for (int step = 0; step < numSteps; ++step)
+            m_simulation->step(params, float(m_simClock.stepSeconds()));
+        if (paramsChanged || numSteps > 0)
+            m_simulation->writeSnapshot(m_simSnapshot);
+        m_simSnapshot.numDroppedSteps = m_simClock.numDroppedSteps();
+        return m_simSnapshot;
+    }
+
+    void setUseSimulationThread(bool useSimulationThread) {
+        m_useSimulationThread = useSimulationThread;
+        if (useSimulationThread) {
+            m_simulationThread = std::make_unique<SimulationThread>(*m_simulation, currentSimulationParams());
+        } else {
+            m_simulationThread.reset();
+            m_simulation->writeSnapshot(m_simSnapshot);
+            m_numAppliedSingleSteps = m_simParams.numSingleSteps;
+        }
+    }
+
+    void drawControls() {
+        CPU_PROFILE_ZONE("ImGui");
+        ImGui::Begin("Controls");
+        ImGui::Checkbox("Use material if no texture", &m_useMaterial);
+        ImGui::Checkbox("Show path", &m_showPath);
+        ImGui::SliderFloat("Path speed", &m_pathSpeed, 0.0f, 0.3f, "%.3f");
+        if (ImGui::CollapsingHeader("Simulation")) {
+            bool useSimulationThread = m_useSimulationThread;
+            if (ImGui::Checkbox("Simulation thread", &useSimulationThread))
+                setUseSimulationThread(useSimulationThread);
+            ImGui::Checkbox("Pause", &m_simParams.paused);
+            ImGui::SameLine();
+            if (ImGui::Button("Step"))
+                ++m_simParams.numSingleSteps;
+            ImGui::SliderFloat("Time scale", &m_simParams.timeScale, 0.0f, 4.0f, "%.2f");
+            int rate = int(std::lround(1.0 / m_simParams.stepSeconds));
+            if (ImGui::SliderInt("Update rate (Hz)", &rate, 5, 240))
+                m_simParams.stepSeconds = 1.0 / double(rate);
+            ImGui::SliderInt("Max steps per frame", &m_simParams.maxStepsPerFrame, 1, 32);
+            const SimulationSnapshot &sim = m_simulationThread ? m_simulationThread->latestSnapshot() : m_simSnapshot;
+            ImGui::Text("Time %.2f s, %llu steps dropped", sim.time, (unsigned long long)sim.numDroppedSteps);
+        }
+        ImGui::Checkbox("Chase camera", &m_chaseCam);
+        ImGui::SliderFloat("Probe scale", &m_probeScale, 0.02f, 0.6f, "%.3f");
+        ImGui::Checkbox("Environment reflections", &m_useEnvMap);
+        ImGui::Checkbox("PBR + Normal Map", &m_usePBR);
+        ImGui::Text("Camera");
+        ImGui::RadioButton("Chase", &m_camMode, 0);
+        ImGui::SameLine();
+        ImGui::RadioButton("Top", &m_camMode, 1);
+        ImGui::SameLine();
+        ImGui::RadioButton("Orbit", &m_camMode, 2);
+        ImGui::SameLine();
+        ImGui::RadioButton("Free", &m_camMode, 3); // <-- added Free camera mode
+        if (ImGui::Checkbox("Record camera track", &m_recordCameraTrack)) {
+            // The free camera poses of every frame are saved for replaying them with --camera-track.
+            if (m_recordCameraTrack)
+                m_cameraTrack.clear();
+            else if (m_cameraTrack.save("camera_track.txt"))
+                std::cout << "Saved " << m_cameraTrack.size() << " camera poses to camera_track.txt" << std::endl;
+        }
+        ImGui::DragFloat3("Sun pos", &m_sunPos.x, 0.05f);
+        ImGui::SliderFloat("Sun radius", &m_sunRadius, 0.2f, 2.0f, "%.2f");
+        ImGui::SliderFloat("Sun intensity", &m_sunIntensity, 0.0f, 40.0f, "%.1f");
+        ImGui::Checkbox("Draw static scene", &m_drawStaticScene);
+        ImGui::Checkbox("Sun shadows", &m_useShadows);
+        ImGui::Combo("Shadow resolution", &m_shadowResolutionIndex, "256\0" "512\0" "1024\0" "2048\0");
+        ImGui::Checkbox("Cache static shadows", &m_cacheStaticShadows);
+        ImGui::Text("Shadow map: %d static faces, %d dynamic faces, %d draws",
+                    m_shadowMap->stats().staticFacesRendered, m_shadowMap->stats().dynamicFacesRendered, m_shadowMap->stats().draws);
+        ImGui::Checkbox("Engine lights", &m_useLocalLights);
+        ImGui::SliderFloat("Engine light radius", &m_localLightRadius, 0.1f, 3.0f, "%.2f");
+        ImGui::SliderFloat("Engine light intensity", &m_localLightIntensity, 0.0f, 5.0f, "%.2f");
+        ImGui::Text("Light clusters: %zu lights, %zu indices (max %u per cluster), binned in %.2f ms on %d threads%s",
+                    m_lightClusters->stats().numLights, m_lightClusters->stats().numIndices, m_lightClusters->stats().maxLightsPerCluster,
+                    m_lightClusters->stats().binMilliseconds, m_lightClusters->stats().numThreads,
+                    m_lightClusters->stats().overflow ? " (overflow)" : "");
+        ImGui::SliderInt("Swarm size", &m_swarmSize, 0, MAX_SWARM_SIZE);
+        if (ImGui::Checkbox("Depth pre-pass", &m_useDepthPrepass))
+            m_sceneGpuTimer.reset(); // results in flight belong to the other mode
+        ImGui::Text("Scene GPU time: %.3f ms with pre-pass, %.3f ms without", m_sceneGpuMs[1], m_sceneGpuMs[0]);
+        if (ImGui::Checkbox("Dynamic resolution", &m_useDynamicResolution))
+            m_sceneGpuTimer.reset();
+        if (m_useDynamicResolution) {
+            DynamicResolutionSettings settings = m_dynamicResolution.settings();
+            ImGui::SliderFloat("Target scene GPU time (ms)", &settings.targetMilliseconds, 1.0f, 50.0f, "%.1f");
+            ImGui::SliderFloat("Min resolution scale", &settings.minScale, 0.25f, 1.0f, "%.2f");
+            ImGui::SliderFloat("Max resolution scale", &settings.maxScale, 0.25f, 1.0f, "%.2f");
+            ImGui::SliderFloat("Hysteresis", &settings.hysteresis, 0.0f, 0.5f, "%.2f");
+            settings.maxScale = std::max(settings.maxScale, settings.minScale);
+            m_dynamicResolution.setSettings(settings);
+            ImGui::SliderFloat("Upscale sharpness", &m_upscaleSharpness, 0.0f, 1.0f, "%.2f");
+            const glm::ivec2 sceneSize = m_dynamicResolution.scaledSize(m_window.getFrameBufferSize());
+            ImGui::Text("Resolution scale %.3f (%dx%d)", double(m_dynamicResolution.scale()), sceneSize.x, sceneSize.y);
+        }
+        ImGui::Text("Render queue: %d draws (+%d pre-pass), %d shader binds, %d material binds",
+                    m_renderQueue.stats().draws, m_renderQueue.stats().depthPrepassDraws,
+                    m_renderQueue.stats().shaderBinds, m_renderQueue.stats().materialBinds);
+        ImGui::Text("Scene BVH: %zu objects, height %d, area ratio %.1f",
+                    m_sceneTree.numProxies(), m_sceneTree.height(), double(m_sceneTree.areaRatio()));
+        ImGui::Text("Frustum culling: BVH kept %zu, exact test (%s) culled %zu of those",
+                    m_frustumCuller.numTested(), FrustumCuller::instructionSet(), m_frustumCuller.numCulled());
+        if (ImGui::Checkbox("Occlusion culling", &m_useOcclusionCulling))
+            m_occlusionCuller->reset(m_sceneObjects.size());
+        ImGui::Text("Occlusion culling: %d objects occluded, %d queries issued, %d results read",
+                    m_occlusionCuller->stats().occluded, m_occlusionCuller->stats().queriesIssued, m_occlusionCuller->stats().resultsRead);
+        std::string passOrder;
+        for (std::string_view pass : m_frameGraph.executionOrder())
+            passOrder.append(passOrder.empty() ? "" : " > ").append(pass);
+        ImGui::Text("Frame graph: %d passes, %d culled", m_frameGraph.stats().passes, m_frameGraph.stats().culledPasses);
+        ImGui::TextWrapped("%s", passOrder.c_str());
+        if (ImGui::Checkbox("GPU profiler", &m_useGpuProfiler))
+            GpuProfiler::get().setEnabled(m_useGpuProfiler);
+        if (m_useGpuProfiler && ImGui::BeginTable("GPU zones", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+            for (const char *header : { "Zone", "avg ms", "p50 ms", "p95 ms", "max ms" })
+                ImGui::TableSetupColumn(header);
+            ImGui::TableHeadersRow();
+            for (const GpuProfiler::ZoneStats &zone : GpuProfiler::get().zoneStats()) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("%*s%s", 2 * zone.depth, "", zone.name.c_str());
+                for (double ms : { zone.averageMs, zone.medianMs, zone.p95Ms, zone.maxMs }) {
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.3f", ms);
+                }
+            }
+            ImGui::EndTable();
+            if (ImGui::Button("Export GPU profile"))
+                std::cout << (GpuProfiler::get().writeCsv("gpu_profile.csv") ? "Wrote" : "Could not write") << " gpu_profile.csv" << std::endl;
+            ImGui::SameLine();
+            if (ImGui::Button("Reset GPU profile"))
+                GpuProfiler::get().clearHistory();
+        }
+        if (ImGui::Checkbox("CPU profiler", &m_useCpuProfiler))
+            CpuProfiler::get().setEnabled(m_useCpuProfiler);
+        if (m_useCpuProfiler) {
+            // Flame summary of the previous frame: nested zones are indented below their parents.
+            const CpuProfiler &profiler = CpuProfiler::get();
+            ImGui::Text("CPU frame: %.2f ms", profiler.lastFrameMilliseconds());
+            uint32_t thread = 0xFFFFFFFF;
+            for (const CpuProfiler::ZoneSummary &zone : profiler.lastFrameSummary()) {
+                if (zone.thread != thread) {
+                    thread = zone.thread;
+                    ImGui::TextDisabled("%s", profiler.threadName(thread).c_str());
+                }
+                const float fraction = float(zone.milliseconds / std::max(profiler.lastFrameMilliseconds(), 1e-6));
+                ImGui::ProgressBar(fraction, ImVec2(80.0f, 0.0f), "");
+                ImGui::SameLine();
+                ImGui::Text("%*s%s %.3f ms (%dx)", 2 * zone.depth, "", zone.name, zone.milliseconds, zone.count);
+            }
+            if (ImGui::Button("Write Chrome trace"))
+                std::cout << (profiler.writeChromeTrace("cpu_trace.json") ? "Wrote" : "Could not write") << " cpu_trace.json" << std::endl;
+        }
+        if (ImGui::CollapsingHeader("Frame pacing")) {
+            int presentMode = int(m_window.presentMode());
+            if (ImGui::Combo("Present mode", &presentMode, "VSync\0" "Immediate\0" "Adaptive\0")
+                && !m_window.setPresentMode(PresentMode(presentMode)))
+                std::cerr << "The driver does not support adaptive vsync" << std::endl;
+            int maxFramesInFlight = m_window.maxFramesInFlight();
+            if (ImGui::SliderInt("Max frames in flight", &maxFramesInFlight, 0, 4, maxFramesInFlight == 0 ? "driver" : "%d"))
+                m_window.setMaxFramesInFlight(maxFramesInFlight);
+            float frameRateLimit = float(m_window.frameRateLimit());
+            if (ImGui::SliderFloat("Frame rate limit", &frameRateLimit, 0.0f, 240.0f, frameRateLimit == 0.0f ? "off" : "%.0f fps"))
+                m_window.setFrameRateLimit(double(frameRateLimit));
+            const FramePacingStats &pacing = m_window.framePacingStats();
+            ImGui::Text("Frame %.2f ms, waited %.2f ms for the GPU and %.2f ms in the limiter, %d frames in flight",
+                        pacing.frameMilliseconds, pacing.gpuWaitMilliseconds, pacing.limiterMilliseconds, pacing.framesInFlight);
+            ImGui::Text("Estimated input to photon latency: %.1f ms", pacing.latencyMilliseconds);
+        }
+        if (ImGui::Button("Screenshot"))
+            m_frameCapture.requestScreenshot("screenshot.png");
+        ImGui::SameLine();
+        bool recordSequence = m_frameCapture.isSequenceActive();
+        if (ImGui::Checkbox("Record image sequence", &recordSequence)) {
+            if (recordSequence) {
+                std::filesystem::create_directories("capture");
+                m_frameCapture.startSequence("capture/frame");
+            } else {
+                m_frameCapture.stopSequence();
+            }
+        }
+        const FrameCapture::Stats captureStats = m_frameCapture.stats();
+        ImGui::Text("Frame capture: %llu captured, %llu written, %llu failed, waited %llu/%llu times on read back/encoders",
+                    (unsigned long long) captureStats.captured, (unsigned long long) captureStats.written,
+                    (unsigned long long) captureStats.failed, (unsigned long long) captureStats.readbackWaits,
+                    (unsigned long long) captureStats.encoderWaits);
+        ImGui::Text("GL state calls: %llu issued, %llu elided",
+                    (unsigned long long) GLState::get().issuedCalls(), (unsigned long long) GLState::get().elidedCalls());
+        ImGui::End();
     }
 
     void onKeyPressed(int key, int mods) {
         std::cout << "Key pressed: " << key << std::endl;
+        if (key == GLFW_KEY_P)
+            pickObject();
     }
 
     void onKeyReleased(int key, int mods) {
@@ -438,11 +1048,118 @@ public:
         std::cout << "Released mouse button: " << button << std::endl;
     }
 
+    void addSceneObject(SceneObjectKind kind, SceneNode *pNode, GPUMesh &mesh, uint32_t materialId) {
+        const AxisAlignedBox worldBounds = transformBox(mesh.localBounds(), pNode->world);
+        const int32_t proxyId = m_sceneTree.createProxy(worldBounds, uint32_t(m_sceneObjects.size()));
+        m_sceneObjects.push_back({ kind, pNode, &mesh, materialId, proxyId, worldBounds });
+    }
+
+    // (Re)create the scene nodes and objects of the swarm when its size changed.
+    void resizeSwarm(int swarmSize) {
+        if (size_t(swarmSize) == m_swarmRoot->children.size())
+            return;
+
+        for (size_t i = m_numPathObjects; i < m_sceneObjects.size(); ++i)
+            m_sceneTree.destroyProxy(m_sceneObjects[i].proxyId);
+        m_sceneObjects.resize(m_numPathObjects);
+        m_swarmRoot = std::make_unique<SceneNode>();
+
+        for (int i = 0; i < swarmSize; ++i)
+            addSceneObject(SceneObjectKind::SwarmDragon, m_swarmRoot->addChild(new SceneNode()), m_meshes.front(), DRAGON_MATERIAL);
+        // Inserting many objects at once gives a worse tree than building it from scratch.
+        rebuildSceneTree();
+        m_occlusionCuller->reset(m_sceneObjects.size());
+    }
+
+    void rebuildSceneTree() {
+        m_sceneTree.rebuild();
+        m_sceneTreeAreaRatio = m_sceneTree.areaRatio();
+    }
+
+    // Print the object under the cursor, found by casting a ray through the scene BVH.
+    void pickObject() {
+        const glm::vec2 cursor = m_window.getNormalizedCursorPos() * 2.0f - 1.0f;
+        const glm::mat4 inverseViewProjection = glm::inverse(m_projectionMatrix * m_viewMatrix);
+        const glm::vec4 nearPoint = inverseViewProjection * glm::vec4(cursor, -1.0f, 1.0f);
+        const glm::vec4 farPoint = inverseViewProjection * glm::vec4(cursor, 1.0f, 1.0f);
+
+        Ray ray;
+        ray.origin = glm::vec3(nearPoint) / nearPoint.w;
+        ray.direction = glm::vec3(farPoint) / farPoint.w - ray.origin;
+        ray.t = 1.0f; // the far plane
+        uint32_t pickedObject = uint32_t(m_sceneObjects.size());
+        m_sceneTree.queryRay(ray, [&](int32_t proxyId, const Ray &clippedRay) {
+            const uint32_t objectIndex = m_sceneTree.userData(proxyId);
+            float t;
+            if (!intersectRayWithBox(m_sceneObjects[objectIndex].worldBounds, clippedRay, t))
+                return clippedRay.t;
+            pickedObject = objectIndex;
+            return t;
+        });
+
+        if (pickedObject == m_sceneObjects.size())
+            std::cout << "Picked nothing" << std::endl;
+        else if (m_sceneObjects[pickedObject].kind == SceneObjectKind::Sun)
+            std::cout << "Picked the sun" << std::endl;
+        else
+            std::cout << "Picked dragon " << pickedObject << std::endl;
+    }
+
+    PerObjectUniforms objectUniforms(const PerFrameUniforms &perFrame, const glm::mat4 &M) const {
+        PerObjectUniforms out;
+        out.modelMatrix = M;
+        out.normalModelMatrix = glm::mat4(glm::inverseTranspose(glm::mat3(M)));
+        out.mvpMatrix = perFrame.viewProjectionMatrix * M;
+        return out;
+    }
+
+    uint32_t sunFeatures() const {
+        return FeatureSun | (m_texSun ? FeatureTexCoords : 0u);
+    }
+
+    uint32_t dragonFeatures() const {
+        uint32_t features = FeatureTexCoords | FeatureInstanced;
+        if (m_usePBR)
+            features |= FeaturePBR | (m_useEnvMap ? FeatureEnvMap : 0u) | (m_shadowsActive ? FeatureShadows : 0u)
+                        | (m_useLocalLights ? FeatureLocalLights : 0u);
+        return features;
+    }
+
+    // Variant of the default shader, or the fallback while that variant is still being compiled.
+    const Shader &defaultShader(uint32_t features) {
+        if (const Shader *pShader = m_defaultShaders.tryGet(features))
+            return *pShader;
+        return (features & FeatureInstanced) ? m_fallbackInstancedShader : m_fallbackShader;
+    }
+
+    void bindDragonTextures(const Shader &shader) {
+        if (m_texAlbedo) {
+            m_texAlbedo->bind(GL_TEXTURE0);
+            Sampler::unbind(GL_TEXTURE0);
+            shader.set(uniforms::colorMap, 0);
+        }
+        if (m_texNormal) {
+            m_texNormal->bind(GL_TEXTURE2);
+            shader.set(uniforms::normalMap, 2);
+        }
+        if (m_texRoughness) {
+            m_texRoughness->bind(GL_TEXTURE3);
+            shader.set(uniforms::roughMap, 3);
+        }
+        if (m_texMetallic) {
+            m_texMetallic->bind(GL_TEXTURE4);
+            shader.set(uniforms::metalMap, 4);
+        }
+        shader.set(uniforms::envMap, 1);
+        shader.set(uniforms::shadowMap, int(SHADOW_MAP_UNIT));
+        shader.set(uniforms::lightData, int(LIGHT_CLUSTERS_UNIT));
+        shader.set(uniforms::lightClusters, int(LIGHT_CLUSTERS_UNIT + 1));
+        shader.set(uniforms::lightIndices, int(LIGHT_CLUSTERS_UNIT + 2));
+    }
+
     void buildSunSphere(int stacks = 32, int slices = 64) {
-        std::vector<glm::vec3> pos;
-        std::vector<glm::vec3> nrm;
-        std::vector<glm::vec2> uv;
-        std::vector<uint32_t> idx;
+        Mesh sphere;
+        sphere.material.kd = glm::vec3(1.0f);
 
         for (int i = 0; i <= stacks; ++i) {
             float v = float(i) / stacks;
@@ -455,53 +1172,22 @@ public:
                     std::cos(phi),
                     std::sin(phi) * std::sin(theta)
                 );
-                pos.push_back(p);
-                nrm.push_back(glm::normalize(p));
-                uv.push_back(glm::vec2(u, 1.0f - v));
+                sphere.vertices.push_back({p, glm::normalize(p), glm::vec2(u, 1.0f - v)});
             }
         }
-        auto ix = [slices](int i, int j) { return i * (slices + 1) + j; };
+        auto ix = [slices](int i, int j) { return uint32_t(i * (slices + 1) + j); };
         for (int i = 0; i < stacks; ++i) {
             for (int j = 0; j < slices; ++j) {
-                int a = ix(i, j);
-                int b = ix(i + 1, j);
-                int c = ix(i + 1, j + 1);
-                int d = ix(i, j + 1);
-                idx.push_back(a);
-                idx.push_back(b);
-                idx.push_back(c);
-                idx.push_back(a);
-                idx.push_back(c);
-                idx.push_back(d);
+                uint32_t a = ix(i, j);
+                uint32_t b = ix(i + 1, j);
+                uint32_t c = ix(i + 1, j + 1);
+                uint32_t d = ix(i, j + 1);
+                sphere.triangles.push_back({a, b, c});
+                sphere.triangles.push_back({a, c, d});
             }
         }
 
-        struct V {
-            glm::vec3 p;
-            glm::vec3 n;
-            glm::vec2 t;
-        };
-        std::vector<V> verts(pos.size());
-        for (size_t i = 0; i < pos.size(); ++i) verts[i] = {pos[i], nrm[i], uv[i]};
-
-        glGenVertexArrays(1, &m_sunVAO);
-        glGenBuffers(1, &m_sunVBO);
-        glGenBuffers(1, &m_sunEBO);
-        glBindVertexArray(m_sunVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, m_sunVBO);
-        glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(verts.size() * sizeof(V)), verts.data(), GL_STATIC_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_sunEBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(idx.size() * sizeof(uint32_t)), idx.data(), GL_STATIC_DRAW);
-
-        glEnableVertexAttribArray(0); // pos
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(V), (void *) offsetof(V, p));
-        glEnableVertexAttribArray(1); // nrm
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(V), (void *) offsetof(V, n));
-        glEnableVertexAttribArray(2); // uv
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(V), (void *) offsetof(V, t));
-
-        glBindVertexArray(0);
-        m_sunIndexCount = int(idx.size());
+        m_sunMesh = std::make_unique<GPUMesh>(sphere);
     }
 
 private:
@@ -509,8 +1195,55 @@ private:
     Window m_window;
 
     // Shaders
-    Shader m_defaultShader;
-    Shader m_shadowShader;
+    std::unique_ptr<ProgramBinaryCache> m_shaderCache;
+    ShaderVariants m_defaultShaders { { "SUN", "TEXCOORDS", "PBR", "ENV_MAP", "NORMAL_MAP", "INSTANCED", "SHADOWS", "LOCAL_LIGHTS" } };
+    AsyncShader m_shadowShader;
+    Shader m_fallbackShader;
+    Shader m_fallbackInstancedShader;
+    Shader m_depthShader;
+    Shader m_depthInstancedShader;
+    Shader m_occlusionBoxShader;
+
+    // Per-frame and per-object uniform blocks
+    std::unique_ptr<RingBuffer> m_uniformRing;
+    std::unique_ptr<InstanceBatcher> m_instanceBatcher;
+
+    // Draw submission
+    FrameArena m_frameArena{256 * 1024};
+    FrustumCuller m_frustumCuller;
+    DynamicAabbTree m_sceneTree{0.2f};
+    std::unique_ptr<OcclusionCuller> m_occlusionCuller;
+    bool m_useOcclusionCulling = true;
+    std::vector<SceneObject> m_sceneObjects;
+    size_t m_numPathObjects = 0; // the sun and the dragons on the paths come before the swarm
+    float m_sceneTreeAreaRatio = 0.0f; // right after the last rebuild
+    int m_framesSinceSceneTreeCheck = 0;
+    RenderQueue m_renderQueue{m_frameArena, PER_OBJECT_BINDING};
+    RenderQueueCallbacks m_renderQueueCallbacks;
+    int m_swarmSize = 0;
+    bool m_useDepthPrepass = false;
+    GpuTimer m_sceneGpuTimer; // around the render queue submission
+    bool m_useDynamicResolution = false;
+    DynamicResolution m_dynamicResolution;
+    std::unique_ptr<Upscaler> m_upscaler;
+    Shader m_upscaleShader;
+    float m_upscaleSharpness = 0.3f;
+    FrameGraph m_frameGraph;
+    bool m_useGpuProfiler = false;
+    bool m_useCpuProfiler = true;
+
+    FrameCapture m_frameCapture;
+
+    // Benchmark mode (see BenchmarkSettings)
+    std::optional<BenchmarkSettings> m_benchmark;
+    std::unique_ptr<BenchmarkRecorder> m_benchmarkRecorder;
+    CameraTrack m_cameraTrack; // replayed in the benchmark, recorded in interactive mode
+    bool m_recordCameraTrack = false;
+    GLuint m_offscreenColor = 0;
+    GLuint m_offscreenDepth = 0;
+    double m_lastFrameTime = 0.0; // wall clock
+
+    double m_sceneGpuMs[2] = {0.0, 0.0}; // last result without / with the depth pre-pass
 
     // Resources
     std::vector<GPUMesh> m_meshes;
@@ -518,14 +1251,15 @@ private:
     bool m_useMaterial{true};
 
     // Matrices
-    glm::mat4 m_projectionMatrix = glm::perspective(glm::radians(80.0f), 1.0f, 0.1f, 30.0f);
+    float m_nearPlane = 0.1f;
+    float m_farPlane = 30.0f;
+    glm::mat4 m_projectionMatrix = glm::perspective(glm::radians(80.0f), 1.0f, m_nearPlane, m_farPlane);
     glm::mat4 m_viewMatrix = glm::lookAt(glm::vec3(-1, 1, -1), glm::vec3(0), glm::vec3(0, 1, 0));
     glm::mat4 m_modelMatrix{1.0f};
 
     // --- Inner path (camera target) ---
     BezierPath m_path{200};
     bool m_showPath = true;
-    float m_pathU = 0.0f;
     float m_pathSpeed = 0.05f;
     GLuint m_basicLineProgram = 0;
 
@@ -534,12 +1268,14 @@ private:
     SceneNode *m_probeAntennaBase = nullptr; // first outer dragon (child of escort root)
     SceneNode *m_probeAntennaTip = nullptr; // second outer dragon (child of base)
     SceneNode *m_escortRoot = nullptr; // parent for the two stacked dragons (outer)
+    std::unique_ptr<SceneNode> m_swarmRoot; // parent of the swarm dragons
+    std::unique_ptr<SceneNode> m_sunNode;
 
     float m_probeScale = 0.12f;
     bool m_chaseCam = true;
 
     std::unique_ptr<Skybox> m_sky;
-    Shader m_skyShader;
+    AsyncShader m_skyShader;
     bool m_useEnvMap = true;
 
     std::unique_ptr<Texture> m_texAlbedo;
@@ -555,23 +1291,54 @@ private:
     FreeCamera m_freeCam; // <-- added member
 
     // ---- Sun (sphere + light) ----
-    GLuint m_sunVAO = 0, m_sunVBO = 0, m_sunEBO = 0;
-    int m_sunIndexCount = 0;
+    std::unique_ptr<GPUMesh> m_sunMesh;
     std::unique_ptr<Texture> m_texSun;
+    std::unique_ptr<Sampler> m_clampSampler;
     glm::vec3 m_sunPos = glm::vec3(0.0f, 1.2f, 0.0f);
     float m_sunRadius = 0.6f;
     float m_sunIntensity = 12.0f;
     bool m_drawStaticScene = false;
+    std::unique_ptr<SceneNode> m_staticRoot; // parent of the static dragons
+
+    // ---- Sun shadows ----
+    std::unique_ptr<PointShadowMap> m_shadowMap;
+    std::vector<ShadowCaster> m_staticCasters;
+    std::vector<ShadowCaster> m_dynamicCasters;
+    bool m_useShadows = true;
+    bool m_shadowsActive = false; // enabled and the shadow shader is ready
+    bool m_cacheStaticShadows = true;
+    bool m_staticShadowCasters = false; // whether the cached static shadows include the static scene
+    int m_shadowResolutionIndex = 1; // 256 << index
+
+    // ---- Engine lights (clustered point lights) ----
+    std::unique_ptr<LightClusters> m_lightClusters;
+    std::vector<PointLight> m_localLights;
+    bool m_useLocalLights = true;
+    float m_localLightRadius = 0.8f;
+    float m_localLightIntensity = 1.0f;
 
     // --- Outer path for the two stacked dragons ---
     BezierPath m_pathOuter{200};
-    float m_pathOuterU = 0.0f;
     float m_pathOuterSpeed = 0.035f;
     float m_pathOuterRadius = 7.0f;
+
+    // Simulation (see Simulation). It runs on its own thread unless disabled, then it is stepped
+    // inline with m_simClock. Declared after the paths it samples.
+    std::unique_ptr<Simulation> m_simulation;
+    std::unique_ptr<SimulationThread> m_simulationThread;
+    bool m_useSimulationThread = true;
+    SimulationParams m_simParams;
+    SimClock m_simClock;
+    uint32_t m_numAppliedSingleSteps = 0;
+    SimulationSnapshot m_simSnapshot; // of the inline simulation
+    SimulationFrame m_simFrame; // interpolated for the current frame
 };
 
-int main() {
-    Application app;
-    app.update();
-    return 0;
+int main(int argc, char **argv) {
+    CpuProfiler::get().setThreadName("Main");
+    const std::optional<BenchmarkSettings> benchmark = BenchmarkSettings::fromCommandLine(argc, argv);
+    if (benchmark && benchmark->numJobRuns > 0)
+        return runJobSystemBenchmark(*benchmark);
+    Application app { benchmark };
+    return app.update();
 }
@@ -0,0 +1,300 @@
+#include "benchmark.h"
+#include <framework/job_system.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/mat4x4.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <numeric>
+#include <span>
+#include <string>
+#include <string_view>
+
+// Upper bounds of the counts on the command line; the recorder keeps two GPU queries per frame.
+static constexpr size_t MAX_FRAMES = 1'000'000;
+static constexpr size_t MAX_JOB_RUNS = 100'000;
+
+static double mean(std::span<const double> samples)
+{
+    return samples.empty() ? 0.0 : std::accumulate(std::begin(samples), std::end(samples), 0.0) / double(samples.size());
+}
+
+// Mean and nearest-rank percentiles as a JSON object.
+static void writeStats(std::ostream& stream, std::vector<double> samples)
+{
+    std::sort(std::begin(samples), std::end(samples));
+    const auto percentile = [&](double fraction) {
+        const size_t rank = size_t(std::ceil(fraction * double(samples.size())));
+        return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+    };
+    stream << "{ \"mean\": " << mean(samples);
+    if (!samples.empty())
+        stream << ", \"p50\": " << percentile(0.5) << ", \"p95\": " << percentile(0.95) << ", \"p99\": " << percentile(0.99);
+    stream << " }";
+}
+
+[[noreturn]] static void printUsageAndExit(std::string_view error)
+{
+    std::cerr << error << "\n"
+              << "Usage: Master_TechDemo [--benchmark <frames> [--warmup <frames>] [--time-step <seconds>]\n"
+              << "                       [--camera-track <file>] [--output <path>]]\n"
+              << "       Master_TechDemo --job-benchmark <runs> [--output <path>]" << std::endl;
+    exit(1);
+}
+
+// A count of at most maxCount, or exits with the usage.
+static size_t parseCount(std::string_view option, const char* value, size_t maxCount)
+{
+    // std::strtoull() accepts a sign and wraps negative values around, so only digits are valid.
+    char* pEnd = nullptr;
+    const unsigned long long count = std::strtoull(value, &pEnd, 10);
+    if (!std::isdigit(static_cast<unsigned char>(value[0])) || *pEnd != '\0')
+        printUsageAndExit("Invalid value of " + std::string(option) + ": " + value);
+    if (count > maxCount)
+        printUsageAndExit("The value of " + std::string(option) + " must be at most " + std::to_string(maxCount));
+    return size_t(count);
+}
+
+std::optional<BenchmarkSettings> BenchmarkSettings::fromCommandLine(int argc, char** argv)
+{
+    BenchmarkSettings settings;
+    bool benchmark = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view option { argv[i] };
+        if (i + 1 == argc)
+            printUsageAndExit("Missing value of " + std::string(option));
+        const char* value = argv[++i];
+        char* pEnd = nullptr;
+        if (option == "--benchmark") {
+            settings.numFrames = parseCount(option, value, MAX_FRAMES);
+            benchmark = true;
+            continue;
+        } else if (option == "--job-benchmark") {
+            settings.numJobRuns = parseCount(option, value, MAX_JOB_RUNS);
+            if (settings.numJobRuns == 0)
+                printUsageAndExit("The job benchmark needs at least one run");
+            continue;
+        } else if (option == "--warmup") {
+            settings.numWarmupFrames = parseCount(option, value, MAX_FRAMES);
+            continue;
+        } else if (option == "--time-step") {
+            settings.timeStep = std::strtof(value, &pEnd);
+        } else if (option == "--camera-track") {
+            settings.cameraTrack = value;
+            continue;
+        } else if (option == "--output") {
+            settings.output = value;
+            continue;
+        } else {
+            printUsageAndExit("Unknown option " + std::string(option));
+        }
+        if (pEnd == value || *pEnd != '\0')
+            printUsageAndExit("Invalid value of " + std::string(option) + ": " + value);
+    }
+    if (settings.numJobRuns > 0)
+        return settings;
+    if (!benchmark)
+        return {};
+    if (settings.numFrames == 0 || settings.timeStep <= 0.0f)
+        printUsageAndExit("The benchmark needs at least one frame and a positive time step");
+    return settings;
+}
+
+void CameraTrack::clear()
+{
+    m_poses.clear();
+}
+
+void CameraTrack::add(const Pose& pose)
+{
+    m_poses.push_back(pose);
+}
+
+bool CameraTrack::empty() const
+{
+    return m_poses.empty();
+}
+
+size_t CameraTrack::size() const
+{
+    return m_poses.size();
+}
+
+const CameraTrack::Pose& CameraTrack::at(size_t frame) const
+{
+    assert(!m_poses.empty());
+    return m_poses[frame % m_poses.size()];
+}
+
+bool CameraTrack::save(const std::filesystem::path& filePath) const
+{
+    std::ofstream file(filePath, std::ios::trunc);
+    file.precision(9);
+    for (const Pose& pose : m_poses) {
+        for (const glm::vec3& v : { pose.position, pose.front, pose.up })
+            file << v.x << ' ' << v.y << ' ' << v.z << ' ';
+        file << pose.fov << '\n';
+    }
+    return bool(file);
+}
+
+std::optional<CameraTrack> CameraTrack::load(const std::filesystem::path& filePath)
+{
+    std::ifstream file(filePath);
+    if (!file)
+        return {};
+
+    CameraTrack track;
+    Pose pose;
+    while (file >> pose.position.x >> pose.position.y >> pose.position.z >> pose.front.x >> pose.front.y >> pose.front.z
+        >> pose.up.x >> pose.up.y >> pose.up.z >> pose.fov)
+        track.add(pose);
+    if (!file.eof() || track.empty())
+        return {};
+    return track;
+}
+
+BenchmarkRecorder::BenchmarkRecorder(size_t numFrames)
+    : m_queries(2 * numFrames)
+{
+    glGenQueries(GLsizei(m_queries.size()), m_queries.data());
+    m_cpuMilliseconds.reserve(numFrames);
+}
+
+BenchmarkRecorder::~BenchmarkRecorder()
+{
+    glDeleteQueries(GLsizei(m_queries.size()), m_queries.data());
+}
+
+void BenchmarkRecorder::beginFrame()
+{
+    assert(!finished());
+    m_frameStart = std::chrono::steady_clock::now();
+    glQueryCounter(m_queries[2 * m_frame], GL_TIMESTAMP);
+}
+
+void BenchmarkRecorder::endFrame()
+{
+    glQueryCounter(m_queries[2 * m_frame + 1], GL_TIMESTAMP);
+    m_cpuMilliseconds.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_frameStart).count());
+    ++m_frame;
+}
+
+bool BenchmarkRecorder::finished() const
+{
+    return 2 * m_frame == m_queries.size();
+}
+
+bool BenchmarkRecorder::writeResults(const std::filesystem::path& output)
+{
+    glFinish();
+    std::vector<double> gpuMilliseconds;
+    for (size_t frame = 0; frame < m_frame; ++frame) {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(m_queries[2 * frame], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(m_queries[2 * frame + 1], GL_QUERY_RESULT, &end);
+        gpuMilliseconds.push_back(double(end - begin) * 1e-6);
+    }
+
+    std::filesystem::path csvPath = output, jsonPath = output;
+    csvPath += ".csv";
+    jsonPath += ".json";
+
+    std::ofstream csv(csvPath, std::ios::trunc);
+    csv << "frame,cpu_ms,gpu_ms\n";
+    for (size_t frame = 0; frame < m_frame; ++frame)
+        csv << frame << ',' << m_cpuMilliseconds[frame] << ',' << gpuMilliseconds[frame] << '\n';
+
+    std::ofstream json(jsonPath, std::ios::trunc);
+    json << "{\n  \"frames\": " << m_frame << ",\n  \"cpu_ms\": ";
+    writeStats(json, m_cpuMilliseconds);
+    json << ",\n  \"gpu_ms\": ";
+    writeStats(json, gpuMilliseconds);
+    json << "\n}\n";
+    return csv && json;
+}
+
+// The work of the swarm in the simulation: place every dragon on its spiral.
+static void moveSwarm(std::span<glm::mat4> batch, const glm::mat4* pFirst, float time)
+{
+    for (glm::mat4& world : batch) {
+        const float i = float(&world - pFirst);
+        const float angle = i * 2.3999632f + time * 0.1f;
+        const glm::vec3 position(8.5f * std::cos(angle), 1.5f * std::sin(i), 8.5f * std::sin(angle));
+        world = glm::translate(glm::mat4(1.0f), position) * glm::rotate(glm::mat4(1.0f), -angle, glm::vec3(0, 1, 0));
+    }
+}
+
+int runJobSystemBenchmark(const BenchmarkSettings& settings)
+{
+    static constexpr size_t SWARM_SIZES[] = { 1000, 10000, 100000 };
+    static constexpr size_t MIN_BATCH_SIZE = 256;
+    static constexpr size_t NUM_WARMUP_RUNS = 3;
+
+    JobSystem& jobSystem = JobSystem::get();
+    std::filesystem::path jsonPath = settings.output;
+    jsonPath += ".json";
+    std::ofstream json(jsonPath, std::ios::trunc);
+    json << "{\n  \"threads\": " << jobSystem.numThreads() << ",\n  \"runs\": " << settings.numJobRuns << ",\n  \"swarms\": [";
+    std::cout << "Job system benchmark on " << jobSystem.numThreads() << " threads, mean of " << settings.numJobRuns << " runs\n"
+              << "  swarm size   single thread   JobSystem   std::async\n";
+
+    for (size_t swarmSize : SWARM_SIZES) {
+        std::vector<glm::mat4> swarm(swarmSize);
+        const std::span<glm::mat4> all { swarm };
+        // The batches of parallelFor (see JobSystem::parallelFor).
+        const size_t numBatches = std::min((swarmSize + MIN_BATCH_SIZE - 1) / MIN_BATCH_SIZE, size_t(4 * jobSystem.numThreads()));
+        const size_t batchSize = (swarmSize + numBatches - 1) / numBatches;
+
+        const auto runSingleThread = [&](float time) { moveSwarm(all, swarm.data(), time); };
+        const auto runJobSystem = [&](float time) {
+            jobSystem.parallelFor(all, MIN_BATCH_SIZE, [&](std::span<glm::mat4> batch) { moveSwarm(batch, swarm.data(), time); });
+        };
+        const auto runAsync = [&](float time) {
+            std::vector<std::future<void>> tasks;
+            for (size_t begin = 0; begin < swarmSize; begin += batchSize) {
+                const std::span<glm::mat4> batch = all.subspan(begin, std::min(batchSize, swarmSize - begin));
+                tasks.push_back(std::async(std::launch::async, [&, batch]() { moveSwarm(batch, swarm.data(), time); }));
+            }
+            for (std::future<void>& task : tasks)
+                task.get();
+        };
+        const auto measure = [&](const auto& run) {
+            std::vector<double> milliseconds;
+            for (size_t i = 0; i < NUM_WARMUP_RUNS + settings.numJobRuns; ++i) {
+                const auto start = std::chrono::steady_clock::now();
+                run(float(i));
+                if (i >= NUM_WARMUP_RUNS)
+                    milliseconds.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            }
+            return milliseconds;
+        };
+        const std::vector<double> singleThread = measure(runSingleThread);
+        const std::vector<double> jobs = measure(runJobSystem);
+        const std::vector<double> async = measure(runAsync);
+
+        std::printf("  %10zu   %10.3f ms   %6.3f ms   %7.3f ms\n", swarmSize, mean(singleThread), mean(jobs), mean(async));
+        json << (swarmSize == SWARM_SIZES[0] ? "\n" : ",\n") << "    { \"size\": " << swarmSize << ", \"batches\": " << numBatches
+             << ",\n      \"single_thread_ms\": ";
+        writeStats(json, singleThread);
+        json << ",\n      \"job_system_ms\": ";
+        writeStats(json, jobs);
+        json << ",\n      \"std_async_ms\": ";
+        writeStats(json, async);
+        json << " }";
+    }
+    json << "\n  ]\n}\n";
+    if (!json) {
+        std::cerr << "Could not write the job benchmark results to " << jsonPath << std::endl;
+        return 1;
+    }
+    return 0;
+}
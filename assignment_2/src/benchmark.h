@@ -0,0 +1,90 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/opengl_includes.h>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+// Command line options of the benchmark mode:
+//   --benchmark <frames>   render this many measured frames offscreen, write the results and exit
+//   --warmup <frames>      frames rendered before measuring (default 10)
+//   --time-step <seconds>  fixed animation time step (default 1/60)
+//   --camera-track <file>  replay a recorded free camera track (default: the chase camera)
+//   --output <path>        results are written to <path>.csv and <path>.json (default "benchmark")
+// or of the job system benchmark, which runs without a window:
+//   --job-benchmark <runs> compare JobSystem::parallelFor with std::async, write <path>.json and exit
+struct BenchmarkSettings {
+    size_t numFrames { 0 };
+    size_t numJobRuns { 0 };
+    size_t numWarmupFrames { 10 };
+    float timeStep { 1.0f / 60.0f };
+    std::filesystem::path cameraTrack;
+    std::filesystem::path output { "benchmark" };
+
+    // Returns std::nullopt if neither --benchmark nor --job-benchmark is given. Prints the usage and
+    // exits on invalid options.
+    static std::optional<BenchmarkSettings> fromCommandLine(int argc, char** argv);
+};
+
+// Free camera poses, one per frame.
+class CameraTrack {
+public:
+    struct Pose {
+        glm::vec3 position;
+        glm::vec3 front;
+        glm::vec3 up;
+        float fov; // degrees
+    };
+
+    void clear();
+    void add(const Pose& pose);
+    [[nodiscard]] bool empty() const;
+    [[nodiscard]] size_t size() const;
+    // Loops around after the last pose.
+    [[nodiscard]] const Pose& at(size_t frame) const;
+
+    // One pose per line: position, front and up vectors, field of view. Return false on failure.
+    bool save(const std::filesystem::path& filePath) const;
+    static std::optional<CameraTrack> load(const std::filesystem::path& filePath);
+
+private:
+    std::vector<Pose> m_poses;
+};
+
+// Measures the CPU and GPU time of every frame of a benchmark run.
+//
+// The GPU time of a frame is the difference of two GL_TIMESTAMP queries, so it can enclose other
+// (elapsed time) queries. All queries are only read back in writeResults(), so measuring never
+// waits for the GPU.
+class BenchmarkRecorder {
+public:
+    explicit BenchmarkRecorder(size_t numFrames);
+    BenchmarkRecorder(const BenchmarkRecorder&) = delete;
+    ~BenchmarkRecorder();
+
+    BenchmarkRecorder& operator=(const BenchmarkRecorder&) = delete;
+
+    void beginFrame();
+    void endFrame();
+    [[nodiscard]] bool finished() const;
+
+    // Per frame times to <output>.csv and their mean and percentiles to <output>.json. Waits for
+    // the GPU to finish. Returns false if a file could not be written.
+    bool writeResults(const std::filesystem::path& output);
+
+private:
+    std::vector<GLuint> m_queries; // begin and end timestamp of every frame
+    std::vector<double> m_cpuMilliseconds;
+    size_t m_frame { 0 };
+    std::chrono::steady_clock::time_point m_frameStart;
+};
+
+// Moves swarms of several sizes with JobSystem::parallelFor, with the same batches as std::async
+// tasks, and on a single thread. Prints the mean times and writes them with their percentiles to
+// <output>.json. Returns the exit code.
+int runJobSystemBenchmark(const BenchmarkSettings& settings);
@@ -1,4 +1,5 @@
 #include "bezier.h"
+#include <framework/gl_state.h>
 #include <glm/glm.hpp>
 #include <algorithm>
 #include <cmath>
@@ -23,6 +24,7 @@ BezierPath::BezierPath(int samplesPerSeg)
 BezierPath::~BezierPath() {
     if (m_vbo) glDeleteBuffers(1, &m_vbo);
     if (m_vao) glDeleteVertexArrays(1, &m_vao);
+    if (m_vao) GLState::get().invalidate();
 }
 
 void BezierPath::ensureGL() const {
@@ -157,18 +159,17 @@ void BezierPath::rebuildGLLine() {
 
     ensureGL();
 
-    glBindVertexArray(m_vao);
+    GLState::get().bindVertexArray(m_vao);
     glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
     glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(sizeof(glm::vec3) * pts.size()), pts.data(), GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
-    glBindVertexArray(0);
+    GLState::get().bindVertexArray(0);
 }
 
 void BezierPath::drawGL() const {
     if (m_totalLineVerts == 0) return;
     ensureGL();
-    glBindVertexArray(m_vao);
+    GLState::get().bindVertexArray(m_vao);
     glDrawArrays(GL_LINE_STRIP, 0, m_totalLineVerts);
-    glBindVertexArray(0);
 }
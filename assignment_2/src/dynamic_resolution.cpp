@@ -0,0 +1,92 @@
+#include "dynamic_resolution.h"
+#include <framework/gl_state.h>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+static constexpr UniformId sceneColorId { "sceneColor" };
+static constexpr UniformId sharpnessId { "sharpness" };
+
+// Smoothing factor of the exponential moving average of the GPU time.
+static constexpr double SMOOTHING = 0.25;
+static constexpr float SCALE_STEPS = 32.0f;
+
+DynamicResolution::DynamicResolution(const DynamicResolutionSettings& settings)
+    : m_settings(settings)
+    , m_scale(settings.maxScale)
+{
+}
+
+void DynamicResolution::setSettings(const DynamicResolutionSettings& settings)
+{
+    assert(settings.minScale > 0.0f && settings.minScale <= settings.maxScale);
+    m_settings = settings;
+}
+
+const DynamicResolutionSettings& DynamicResolution::settings() const
+{
+    return m_settings;
+}
+
+bool DynamicResolution::update(std::optional<double> gpuMilliseconds)
+{
+    if (gpuMilliseconds)
+        m_smoothedMilliseconds = m_smoothedMilliseconds ? *m_smoothedMilliseconds + SMOOTHING * (*gpuMilliseconds - *m_smoothedMilliseconds) : *gpuMilliseconds;
+    ++m_framesSinceChange;
+
+    float scale = std::clamp(m_scale, m_settings.minScale, m_settings.maxScale);
+    const double target = double(m_settings.targetMilliseconds);
+    if (m_smoothedMilliseconds && m_framesSinceChange >= m_settings.framesBetweenChanges
+        && std::abs(*m_smoothedMilliseconds - target) > double(m_settings.hysteresis) * target) {
+        scale *= float(std::sqrt(target / std::max(*m_smoothedMilliseconds, 1e-3)));
+        scale = std::clamp(std::round(scale * SCALE_STEPS) / SCALE_STEPS, m_settings.minScale, m_settings.maxScale);
+    }
+    if (scale == m_scale)
+        return false;
+
+    m_scale = scale;
+    m_smoothedMilliseconds.reset();
+    m_framesSinceChange = 0;
+    return true;
+}
+
+float DynamicResolution::scale() const
+{
+    return m_scale;
+}
+
+glm::ivec2 DynamicResolution::scaledSize(const glm::ivec2& size) const
+{
+    return glm::max(glm::ivec2(glm::round(glm::vec2(size) * m_scale)), glm::ivec2(1));
+}
+
+std::optional<double> DynamicResolution::smoothedMilliseconds() const
+{
+    return m_smoothedMilliseconds;
+}
+
+Upscaler::Upscaler()
+{
+    // The vertices of the full screen triangle are generated from gl_VertexID.
+    glGenVertexArrays(1, &m_emptyVao);
+}
+
+Upscaler::~Upscaler()
+{
+    glDeleteVertexArrays(1, &m_emptyVao);
+}
+
+void Upscaler::draw(const Shader& shader, GLuint texture, float sharpness) const
+{
+    GLState& state = GLState::get();
+    state.setDepthTest(false);
+    state.setBlend(false);
+    shader.bind();
+    state.bindTexture(0, GL_TEXTURE_2D, texture);
+    shader.set(sceneColorId, 0);
+    shader.set(sharpnessId, std::clamp(sharpness, 0.0f, 1.0f));
+    state.bindVertexArray(m_emptyVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    state.bindVertexArray(0);
+    state.setDepthTest(true);
+}
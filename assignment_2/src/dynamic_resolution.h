@@ -0,0 +1,65 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/opengl_includes.h>
+#include <framework/shader.h>
+#include <optional>
+
+struct DynamicResolutionSettings {
+    float targetMilliseconds { 12.0f }; // GPU time of the scene
+    float minScale { 0.5f };
+    float maxScale { 1.0f };
+    // The scale is left alone while the GPU time is within this fraction of the target.
+    float hysteresis { 0.1f };
+    // Frames to measure at a new scale before changing it again (GPU timer results arrive a few frames late).
+    int framesBetweenChanges { 8 };
+};
+
+// Chooses the resolution scale of the scene so that its GPU time stays close to a target.
+//
+// The GPU time is smoothed over the frames since the last change. Fill rate scales with the number
+// of pixels, so a new scale is chosen with sqrt(target / measured) and rounded to multiples of
+// 1/32, which keeps the number of different render target sizes (and textures) small. Together with
+// the hysteresis band and the pause after every change this keeps the scale from oscillating.
+// Measurements taken at the old scale should be dropped when update() returns true.
+class DynamicResolution {
+public:
+    explicit DynamicResolution(const DynamicResolutionSettings& settings = {});
+
+    void setSettings(const DynamicResolutionSettings& settings);
+    [[nodiscard]] const DynamicResolutionSettings& settings() const;
+
+    // Feed the latest GPU time of the scene, if there is a new one. Returns whether the scale changed.
+    bool update(std::optional<double> gpuMilliseconds);
+
+    [[nodiscard]] float scale() const;
+    // At least 1x1 pixels.
+    [[nodiscard]] glm::ivec2 scaledSize(const glm::ivec2& size) const;
+    [[nodiscard]] std::optional<double> smoothedMilliseconds() const;
+
+private:
+    DynamicResolutionSettings m_settings;
+    float m_scale;
+    std::optional<double> m_smoothedMilliseconds;
+    int m_framesSinceChange { 0 };
+};
+
+// Draws a texture over the whole bound framebuffer with bilinear filtering and an optional
+// sharpening filter (an unsharp mask limited to the range of the neighbouring texels, so it does
+// not ring at edges). The shader is shaders/fullscreen_vert.glsl + upscale_frag.glsl.
+class Upscaler {
+public:
+    Upscaler();
+    Upscaler(const Upscaler&) = delete;
+    ~Upscaler();
+
+    Upscaler& operator=(const Upscaler&) = delete;
+
+    // sharpness is between 0 (plain bilinear) and 1.
+    void draw(const Shader& shader, GLuint texture, float sharpness) const;
+
+private:
+    GLuint m_emptyVao { 0 };
+};
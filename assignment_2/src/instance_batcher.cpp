@@ -0,0 +1,66 @@
+#include "instance_batcher.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/matrix_inverse.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <tuple>
+
+InstanceBatcher::InstanceBatcher(size_t maxInstancesPerFrame)
+    : m_instanceBuffer(GL_ARRAY_BUFFER, maxInstancesPerFrame * sizeof(InstanceData))
+{
+    m_instances.reserve(maxInstancesPerFrame);
+    m_instanceData.reserve(maxInstancesPerFrame);
+}
+
+void InstanceBatcher::beginFrame()
+{
+    m_instanceBuffer.beginFrame();
+    m_instances.clear();
+    m_batches.clear();
+}
+
+void InstanceBatcher::add(GPUMesh& mesh, uint32_t materialId, const glm::mat4& modelMatrix)
+{
+    m_instances.push_back({ &mesh, materialId, modelMatrix });
+}
+
+const std::vector<InstanceBatch>& InstanceBatcher::build()
+{
+    m_batches.clear();
+    if (m_instances.empty())
+        return m_batches;
+
+    // Material first: switching textures and programs is more expensive than switching meshes.
+    std::stable_sort(std::begin(m_instances), std::end(m_instances), [](const Instance& lhs, const Instance& rhs) {
+        return std::tie(lhs.materialId, lhs.pMesh) < std::tie(rhs.materialId, rhs.pMesh);
+    });
+
+    m_instanceData.clear();
+    for (const Instance& instance : m_instances)
+        m_instanceData.push_back({ instance.modelMatrix, glm::inverseTranspose(glm::mat3(instance.modelMatrix)) });
+    // A single upload for all batches.
+    const GLintptr baseOffset = m_instanceBuffer.push(m_instanceData.data(), m_instanceData.size() * sizeof(InstanceData));
+    m_instanceBuffer.flush();
+
+    for (size_t i = 0; i < m_instances.size(); ++i) {
+        const Instance& instance = m_instances[i];
+        if (!m_batches.empty() && m_batches.back().pMesh == instance.pMesh && m_batches.back().materialId == instance.materialId) {
+            ++m_batches.back().instanceCount;
+        } else {
+            const auto offset = baseOffset + static_cast<GLintptr>(i * sizeof(InstanceData));
+            m_batches.push_back({ instance.pMesh, instance.materialId, offset, 1 });
+        }
+    }
+    return m_batches;
+}
+
+void InstanceBatcher::endFrame()
+{
+    m_instanceBuffer.endFrame();
+}
+
+GLuint InstanceBatcher::instanceBuffer() const
+{
+    return m_instanceBuffer.buffer();
+}
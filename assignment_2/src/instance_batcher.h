@@ -0,0 +1,48 @@
+#pragma once
+#include "mesh.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/ring_buffer.h>
+#include <cstdint>
+#include <vector>
+
+// Consecutive instances of the same mesh and material in the instance buffer.
+struct InstanceBatch {
+    GPUMesh* pMesh;
+    uint32_t materialId;
+    GLintptr instanceOffset;
+    GLsizei instanceCount;
+};
+
+// Collects the objects drawn in a frame and groups identical mesh/material pairs into batches, so
+// each pair is drawn with a single GPUMesh::drawInstanced call.
+//
+// The meaning of materialId is up to the caller (e.g. which textures and shader variant to use).
+class InstanceBatcher {
+public:
+    explicit InstanceBatcher(size_t maxInstancesPerFrame);
+
+    // Starts a new frame; drops the instances of the previous frame.
+    void beginFrame();
+    void add(GPUMesh& mesh, uint32_t materialId, const glm::mat4& modelMatrix);
+    // Upload the instance data and return the batches, sorted by material and then by mesh.
+    const std::vector<InstanceBatch>& build();
+    // Fence the instance data of this frame (call after the batches have been drawn).
+    void endFrame();
+
+    [[nodiscard]] GLuint instanceBuffer() const;
+
+private:
+    struct Instance {
+        GPUMesh* pMesh;
+        uint32_t materialId;
+        glm::mat4 modelMatrix;
+    };
+
+    RingBuffer m_instanceBuffer;
+    std::vector<Instance> m_instances;
+    std::vector<InstanceData> m_instanceData;
+    std::vector<InstanceBatch> m_batches;
+};
@@ -0,0 +1,263 @@
+#include "light_clusters.h"
+#include <framework/cpu_profiler.h>
+#include <framework/gl_state.h>
+#include <framework/job_system.h>
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/exponential.hpp>
+#include <glm/matrix.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <limits>
+#if defined(__SSE2__) || defined(_M_X64)
+#define LIGHT_CLUSTERS_SSE 1
+#include <emmintrin.h>
+#endif
+
+static constexpr int TILES_PER_SLICE = LightClusters::TILES_X * LightClusters::TILES_Y;
+// Binning a few lights is faster than handing them to other threads.
+static constexpr size_t MIN_LIGHTS_PER_THREAD = 128;
+
+enum Buffer {
+    LightData,
+    Clusters,
+    Indices,
+};
+
+// Candidate lights of a depth slice, as structure of arrays padded to a multiple of 4.
+struct SliceLights {
+    std::vector<float> x, y, z, radius2;
+    std::vector<uint16_t> indices;
+};
+
+static void uploadBuffer(GLuint buffer, const void* pData, size_t size)
+{
+    // Reallocating every frame lets the driver hand out fresh memory instead of waiting for the GPU.
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, GLsizeiptr(std::max(size, size_t(16))), nullptr, GL_STREAM_DRAW);
+    if (size > 0)
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, GLsizeiptr(size), pData);
+}
+
+LightClusters::LightClusters()
+{
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &m_maxTextureBufferSize);
+    glGenBuffers(3, m_buffers);
+    glGenTextures(3, m_textures);
+    const GLenum formats[3] { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+    for (int i = 0; i < 3; ++i) {
+        uploadBuffer(m_buffers[i], nullptr, 0);
+        GLState::get().bindTexture(0, GL_TEXTURE_BUFFER, m_textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_buffers[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    m_clusterCounts.resize(NUM_CLUSTERS);
+    m_sliceIndices.resize(DEPTH_SLICES);
+}
+
+LightClusters::~LightClusters()
+{
+    glDeleteTextures(3, m_textures);
+    glDeleteBuffers(3, m_buffers);
+    GLState::get().invalidate();
+}
+
+void LightClusters::update(std::span<const PointLight> lights, const glm::mat4& view, const glm::mat4& projection, const glm::ivec2& framebufferSize)
+{
+    CPU_PROFILE_ZONE("LightClusters::update");
+    const auto start = std::chrono::steady_clock::now();
+    m_stats = {};
+    lights = lights.first(std::min(lights.size(), MAX_LIGHTS));
+    if (projection != m_projection)
+        computeClusterBounds(projection);
+
+    // Slice s covers view depths nearPlane * (farPlane / nearPlane)^(s / DEPTH_SLICES) and up.
+    const float sliceScale = float(DEPTH_SLICES) / std::log(m_farPlane / m_nearPlane);
+    m_depthPlane = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+    m_params = glm::vec4(float(TILES_X) / float(framebufferSize.x), float(TILES_Y) / float(framebufferSize.y),
+        sliceScale, -std::log(m_nearPlane) * sliceScale);
+
+    m_viewLights.clear();
+    for (const PointLight& light : lights)
+        m_viewLights.emplace_back(glm::vec3(view * glm::vec4(light.position, 1.0f)), light.radius);
+
+    // Every job bins a few slices; the near slices are thin and usually hold fewer lights than the
+    // far ones, so there are a few jobs per thread for the workers to balance the load.
+    JobSystem& jobSystem = JobSystem::get();
+    const unsigned numThreads = std::clamp(unsigned(lights.size() / MIN_LIGHTS_PER_THREAD), 1u, jobSystem.numThreads());
+    const size_t minSlicesPerJob = numThreads == 1 ? size_t(DEPTH_SLICES) : size_t(DEPTH_SLICES) / (4 * numThreads);
+    jobSystem.parallelFor(std::span(m_sliceIndices), minSlicesPerJob, [&](std::span<std::vector<uint16_t>> slices) {
+        CPU_PROFILE_ZONE("Bin light slices");
+        for (std::vector<uint16_t>& sliceIndices : slices)
+            binSlice(int(&sliceIndices - m_sliceIndices.data()), sliceIndices);
+    });
+
+    // Concatenate the lists of the slices (whose clusters are consecutive).
+    m_clusters.resize(2 * NUM_CLUSTERS);
+    m_indices.clear();
+    const size_t maxIndices = size_t(m_maxTextureBufferSize);
+    for (int slice = 0; slice < DEPTH_SLICES; ++slice) {
+        const std::vector<uint16_t>& sliceIndices = m_sliceIndices[size_t(slice)];
+        auto itIndex = std::begin(sliceIndices);
+        for (int cluster = slice * TILES_PER_SLICE; cluster < (slice + 1) * TILES_PER_SLICE; ++cluster) {
+            const uint32_t count = m_clusterCounts[size_t(cluster)];
+            const uint32_t storedCount = uint32_t(std::min(size_t(count), maxIndices - m_indices.size()));
+            m_clusters[2 * size_t(cluster)] = uint32_t(m_indices.size());
+            m_clusters[2 * size_t(cluster) + 1] = storedCount;
+            m_indices.insert(std::end(m_indices), itIndex, itIndex + storedCount);
+            itIndex += count;
+            m_stats.overflow |= storedCount < count;
+            m_stats.maxLightsPerCluster = std::max(m_stats.maxLightsPerCluster, count);
+        }
+    }
+
+    upload(lights);
+    m_stats.numLights = lights.size();
+    m_stats.numIndices = m_indices.size();
+    m_stats.numThreads = int(numThreads);
+    m_stats.binMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+const glm::vec4& LightClusters::depthPlane() const
+{
+    return m_depthPlane;
+}
+
+const glm::vec4& LightClusters::params() const
+{
+    return m_params;
+}
+
+void LightClusters::bind(GLuint firstUnit) const
+{
+    for (GLuint i = 0; i < 3; ++i)
+        GLState::get().bindTexture(firstUnit + i, GL_TEXTURE_BUFFER, m_textures[i]);
+}
+
+const LightClusters::Stats& LightClusters::stats() const
+{
+    return m_stats;
+}
+
+void LightClusters::computeClusterBounds(const glm::mat4& projection)
+{
+    m_projection = projection;
+    // Inverse of the depth row of a perspective projection (see glm::perspective).
+    m_nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+    m_farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+
+    const glm::mat4 inverseProjection = glm::inverse(projection);
+    // View space direction through an NDC position, scaled to a view depth of 1.
+    const auto rayDirection = [&](float x, float y) {
+        const glm::vec4 onNearPlane = inverseProjection * glm::vec4(x, y, -1.0f, 1.0f);
+        return glm::vec3(onNearPlane) / -onNearPlane.z;
+    };
+
+    for (auto* pArray : { &m_minX, &m_minY, &m_minZ, &m_maxX, &m_maxY, &m_maxZ })
+        pArray->resize(NUM_CLUSTERS);
+    for (int slice = 0; slice < DEPTH_SLICES; ++slice) {
+        const float sliceNear = m_nearPlane * std::pow(m_farPlane / m_nearPlane, float(slice) / DEPTH_SLICES);
+        const float sliceFar = m_nearPlane * std::pow(m_farPlane / m_nearPlane, float(slice + 1) / DEPTH_SLICES);
+        for (int tileY = 0; tileY < TILES_Y; ++tileY) {
+            for (int tileX = 0; tileX < TILES_X; ++tileX) {
+                glm::vec3 min { std::numeric_limits<float>::max() };
+                glm::vec3 max { std::numeric_limits<float>::lowest() };
+                for (int corner = 0; corner < 4; ++corner) {
+                    const float x = float(tileX + (corner & 1)) / TILES_X * 2.0f - 1.0f;
+                    const float y = float(tileY + (corner >> 1)) / TILES_Y * 2.0f - 1.0f;
+                    const glm::vec3 direction = rayDirection(x, y);
+                    for (float depth : { sliceNear, sliceFar }) {
+                        min = glm::min(min, direction * depth);
+                        max = glm::max(max, direction * depth);
+                    }
+                }
+                const size_t cluster = size_t((slice * TILES_Y + tileY) * TILES_X + tileX);
+                m_minX[cluster] = min.x;
+                m_minY[cluster] = min.y;
+                m_minZ[cluster] = min.z;
+                m_maxX[cluster] = max.x;
+                m_maxY[cluster] = max.y;
+                m_maxZ[cluster] = max.z;
+            }
+        }
+    }
+}
+
+void LightClusters::binSlice(int slice, std::vector<uint16_t>& indices)
+{
+    thread_local SliceLights lights;
+    for (auto* pArray : { &lights.x, &lights.y, &lights.z, &lights.radius2 })
+        pArray->clear();
+    lights.indices.clear();
+
+    // Only lights whose depth range overlaps the slice can reach its clusters.
+    const size_t firstCluster = size_t(slice * TILES_PER_SLICE);
+    const float sliceNear = -m_maxZ[firstCluster];
+    const float sliceFar = -m_minZ[firstCluster];
+    for (size_t i = 0; i < m_viewLights.size(); ++i) {
+        const glm::vec4& light = m_viewLights[i];
+        if (-light.z + light.w < sliceNear || -light.z - light.w > sliceFar)
+            continue;
+        lights.x.push_back(light.x);
+        lights.y.push_back(light.y);
+        lights.z.push_back(light.z);
+        lights.radius2.push_back(light.w * light.w);
+        lights.indices.push_back(uint16_t(i));
+    }
+    // Padding that overlaps no cluster.
+    while (lights.x.size() % 4 != 0) {
+        lights.x.push_back(std::numeric_limits<float>::max());
+        lights.y.push_back(0.0f);
+        lights.z.push_back(0.0f);
+        lights.radius2.push_back(0.0f);
+    }
+
+    indices.clear();
+    for (size_t cluster = firstCluster; cluster < firstCluster + TILES_PER_SLICE; ++cluster) {
+        const size_t countBefore = indices.size();
+        // Squared distance from the light center to the box, per axis max(min - c, c - max, 0)^2.
+#ifdef LIGHT_CLUSTERS_SSE
+        const __m128 minX = _mm_set1_ps(m_minX[cluster]), maxX = _mm_set1_ps(m_maxX[cluster]);
+        const __m128 minY = _mm_set1_ps(m_minY[cluster]), maxY = _mm_set1_ps(m_maxY[cluster]);
+        const __m128 minZ = _mm_set1_ps(m_minZ[cluster]), maxZ = _mm_set1_ps(m_maxZ[cluster]);
+        const __m128 zero = _mm_setzero_ps();
+        for (size_t i = 0; i < lights.x.size(); i += 4) {
+            const __m128 x = _mm_loadu_ps(lights.x.data() + i);
+            const __m128 y = _mm_loadu_ps(lights.y.data() + i);
+            const __m128 z = _mm_loadu_ps(lights.z.data() + i);
+            const __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, x), _mm_sub_ps(x, maxX)), zero);
+            const __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, y), _mm_sub_ps(y, maxY)), zero);
+            const __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ, z), _mm_sub_ps(z, maxZ)), zero);
+            const __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            for (unsigned mask = unsigned(_mm_movemask_ps(_mm_cmple_ps(distance2, _mm_loadu_ps(lights.radius2.data() + i)))); mask; mask &= mask - 1)
+                indices.push_back(lights.indices[i + size_t(std::countr_zero(mask))]);
+        }
+#else
+        for (size_t i = 0; i < lights.indices.size(); ++i) {
+            const float dx = std::max({ m_minX[cluster] - lights.x[i], lights.x[i] - m_maxX[cluster], 0.0f });
+            const float dy = std::max({ m_minY[cluster] - lights.y[i], lights.y[i] - m_maxY[cluster], 0.0f });
+            const float dz = std::max({ m_minZ[cluster] - lights.z[i], lights.z[i] - m_maxZ[cluster], 0.0f });
+            if (dx * dx + dy * dy + dz * dz <= lights.radius2[i])
+                indices.push_back(lights.indices[i]);
+        }
+#endif
+        m_clusterCounts[cluster] = uint32_t(indices.size() - countBefore);
+    }
+}
+
+void LightClusters::upload(std::span<const PointLight> lights)
+{
+    m_lightData.clear();
+    for (const PointLight& light : lights) {
+        m_lightData.emplace_back(light.position, light.radius);
+        m_lightData.emplace_back(light.color, 0.0f);
+    }
+    uploadBuffer(m_buffers[LightData], m_lightData.data(), m_lightData.size() * sizeof(glm::vec4));
+    uploadBuffer(m_buffers[Clusters], m_clusters.data(), m_clusters.size() * sizeof(uint32_t));
+    uploadBuffer(m_buffers[Indices], m_indices.data(), m_indices.size() * sizeof(uint16_t));
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/opengl_includes.h>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct PointLight {
+    glm::vec3 position;
+    float radius; // the light has no effect beyond this distance
+    glm::vec3 color; // premultiplied by the intensity
+};
+
+// Clustered forward shading: assigns point lights to the cells ("clusters") of a grid of screen
+// tiles by exponentially spaced depth slices, so that a fragment only loops over the lights that
+// can reach its cluster (see the LOCAL_LIGHTS path of shaders/shader_frag.glsl).
+//
+// Every frame the lights are binned on the CPU. Depth slices are independent, so they are split
+// over a few threads. Within a slice, each cluster is tested against 4 lights at a time with SSE
+// (sphere against the view space bounding box of the cluster). The result is uploaded to three
+// texture buffers:
+//   lightData      RGBA32F, 2 texels per light: world position and radius, color
+//   lightClusters  RG32UI, per cluster: offset into lightIndices and number of lights
+//   lightIndices   R16UI, light indices of all clusters, consecutively
+class LightClusters {
+public:
+    // Must match the constants in shaders/shader_frag.glsl.
+    static constexpr int TILES_X = 16;
+    static constexpr int TILES_Y = 9;
+    static constexpr int DEPTH_SLICES = 24;
+    static constexpr int NUM_CLUSTERS = TILES_X * TILES_Y * DEPTH_SLICES;
+    // Light indices are stored as 16 bit integers.
+    static constexpr size_t MAX_LIGHTS = 0xFFFF;
+
+    struct Stats {
+        size_t numLights { 0 };
+        size_t numIndices { 0 }; // sum of the number of lights of all clusters
+        uint32_t maxLightsPerCluster { 0 };
+        int numThreads { 0 };
+        double binMilliseconds { 0.0 };
+        // Set if the light index list exceeded GL_MAX_TEXTURE_BUFFER_SIZE and was cut off.
+        bool overflow { false };
+    };
+
+    LightClusters();
+    LightClusters(const LightClusters&) = delete;
+    ~LightClusters();
+
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    // Bin the lights (at most MAX_LIGHTS) into the clusters of a view with a perspective
+    // projection, and upload the lights and clusters.
+    void update(std::span<const PointLight> lights, const glm::mat4& view, const glm::mat4& projection, const glm::ivec2& framebufferSize);
+
+    // Values for the PerFrame block: view depth of a world position p is dot(depthPlane, vec4(p, 1)),
+    // params holds the tiles per pixel (xy) and the scale and bias of the depth slice (zw).
+    [[nodiscard]] const glm::vec4& depthPlane() const;
+    [[nodiscard]] const glm::vec4& params() const;
+    // Bind lightData, lightClusters and lightIndices to texture units firstUnit, firstUnit + 1
+    // and firstUnit + 2.
+    void bind(GLuint firstUnit) const;
+
+    // Of the last update().
+    [[nodiscard]] const Stats& stats() const;
+
+private:
+    // The bounding boxes of the clusters in view space depend only on the projection.
+    void computeClusterBounds(const glm::mat4& projection);
+    // Appends the lights of each cluster of the slice to indices and stores their number in m_clusterCounts.
+    void binSlice(int slice, std::vector<uint16_t>& indices);
+    void upload(std::span<const PointLight> lights);
+
+private:
+    // View space bounds of the clusters, as structure of arrays.
+    std::vector<float> m_minX, m_minY, m_minZ;
+    std::vector<float> m_maxX, m_maxY, m_maxZ;
+    glm::mat4 m_projection { 0.0f };
+    float m_nearPlane { 0.0f };
+    float m_farPlane { 0.0f };
+
+    // Of the current update(): view space lights (center and radius) and the binning result.
+    std::vector<glm::vec4> m_viewLights;
+    std::vector<uint32_t> m_clusterCounts;
+    std::vector<std::vector<uint16_t>> m_sliceIndices;
+    // Contents of the texture buffers.
+    std::vector<glm::vec4> m_lightData;
+    std::vector<uint32_t> m_clusters;
+    std::vector<uint16_t> m_indices;
+
+    glm::vec4 m_depthPlane { 0.0f };
+    glm::vec4 m_params { 0.0f };
+    GLint m_maxTextureBufferSize { 0 };
+    GLuint m_buffers[3] { 0, 0, 0 };
+    GLuint m_textures[3] { 0, 0, 0 };
+    Stats m_stats;
+};
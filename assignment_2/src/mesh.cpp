@@ -1,8 +1,10 @@
 #include "mesh.h"
+#include <framework/gl_state.h>
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <fmt/format.h>
 DISABLE_WARNINGS_POP()
+#include <algorithm>
 #include <iostream>
 #include <vector>
 
@@ -21,12 +23,16 @@ GPUMesh::GPUMesh(const Mesh& cpuMesh)
     glBindBuffer(GL_UNIFORM_BUFFER, m_uboMaterial);
     glBufferData(GL_UNIFORM_BUFFER, sizeof(GPUMaterial), &gpuMaterial, GL_STATIC_READ);
 
+    std::vector<glm::vec3> positions(cpuMesh.vertices.size());
+    std::transform(std::begin(cpuMesh.vertices), std::end(cpuMesh.vertices), std::begin(positions), [](const Vertex& vertex) { return vertex.position; });
+    m_localBounds = computeBoundingBox(positions);
+
     // Figure out if this mesh has texture coordinates
     m_hasTextureCoords = static_cast<bool>(cpuMesh.material.kdTexture);
 
     // Create VAO and bind it so subsequent creations of VBO and IBO are bound to this VAO
     glGenVertexArrays(1, &m_vao);
-    glBindVertexArray(m_vao);
+    GLState::get().bindVertexArray(m_vao);
 
     // Create vertex buffer object (VBO)
     glGenBuffers(1, &m_vbo);
@@ -51,6 +57,17 @@ GPUMesh::GPUMesh(const Mesh& cpuMesh)
     glVertexAttribDivisor(1, 0);
     glVertexAttribDivisor(2, 0);
 
+    // Depth-only passes read just the positions; keeping them in their own buffer avoids fetching
+    // the (unused) normals and texture coordinates along with them.
+    glGenVertexArrays(1, &m_positionVao);
+    GLState::get().bindVertexArray(m_positionVao);
+    glGenBuffers(1, &m_positionVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m_positionVbo);
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(positions.size() * sizeof(glm::vec3)), positions.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
+
     // Each triangle has 3 vertices.
     m_numIndices = static_cast<GLsizei>(3 * cpuMesh.triangles.size());
 }
@@ -88,6 +105,11 @@ bool GPUMesh::hasTextureCoords() const
     return m_hasTextureCoords;
 }
 
+const AxisAlignedBox& GPUMesh::localBounds() const
+{
+    return m_localBounds;
+}
+
 void GPUMesh::draw(const Shader& drawingShader)
 {
     // Bind material data uniform (we assume that the uniform buffer objects is always called 'Material')
@@ -95,18 +117,75 @@ void GPUMesh::draw(const Shader& drawingShader)
     drawingShader.bindUniformBlock("Material", 0, m_uboMaterial);
     
     // Draw the mesh's triangles
-    glBindVertexArray(m_vao);
+    GLState::get().bindVertexArray(m_vao);
     glDrawElements(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, nullptr);
 }
 
+void GPUMesh::drawInstanced(const Shader& drawingShader, GLuint instanceBuffer, GLintptr instanceOffset, GLsizei instanceCount)
+{
+    drawingShader.bindUniformBlock("Material", 0, m_uboMaterial);
+    GLState::get().bindVertexArray(m_vao);
+    setInstanceAttributes(m_hasInstanceAttributes, true, instanceBuffer, instanceOffset);
+    glDrawElementsInstanced(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, nullptr, instanceCount);
+}
+
+void GPUMesh::drawDepthOnly()
+{
+    GLState::get().bindVertexArray(m_positionVao);
+    glDrawElements(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, nullptr);
+}
+
+void GPUMesh::drawDepthOnlyInstanced(GLuint instanceBuffer, GLintptr instanceOffset, GLsizei instanceCount)
+{
+    GLState::get().bindVertexArray(m_positionVao);
+    setInstanceAttributes(m_hasPositionInstanceAttributes, false, instanceBuffer, instanceOffset);
+    glDrawElementsInstanced(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, nullptr, instanceCount);
+}
+
+void GPUMesh::setInstanceAttributes(bool& hasInstanceAttributes, bool withNormalMatrix, GLuint instanceBuffer, GLintptr instanceOffset)
+{
+    // Matrices occupy one attribute location per column.
+    constexpr GLuint modelLocation = 3;
+    constexpr GLuint normalLocation = 7;
+    const GLuint numNormalColumns = withNormalMatrix ? 3 : 0;
+    if (!hasInstanceAttributes) {
+        for (GLuint i = 0; i < 4; ++i) {
+            glEnableVertexAttribArray(modelLocation + i);
+            glVertexAttribDivisor(modelLocation + i, 1);
+        }
+        for (GLuint i = 0; i < numNormalColumns; ++i) {
+            glEnableVertexAttribArray(normalLocation + i);
+            glVertexAttribDivisor(normalLocation + i, 1);
+        }
+        hasInstanceAttributes = true;
+    }
+
+    // The attribute pointers include the offset, so they are set every draw (without
+    // ARB_vertex_attrib_binding the offset cannot be changed separately).
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (GLuint i = 0; i < 4; ++i) {
+        const GLintptr offset = instanceOffset + static_cast<GLintptr>(offsetof(InstanceData, modelMatrix) + i * sizeof(glm::vec4));
+        glVertexAttribPointer(modelLocation + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), reinterpret_cast<const void*>(offset));
+    }
+    for (GLuint i = 0; i < numNormalColumns; ++i) {
+        const GLintptr offset = instanceOffset + static_cast<GLintptr>(offsetof(InstanceData, normalModelMatrix) + i * sizeof(glm::vec3));
+        glVertexAttribPointer(normalLocation + i, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), reinterpret_cast<const void*>(offset));
+    }
+}
+
 void GPUMesh::moveInto(GPUMesh&& other)
 {
     freeGpuMemory();
     m_numIndices = other.m_numIndices;
+    m_localBounds = other.m_localBounds;
     m_hasTextureCoords = other.m_hasTextureCoords;
+    m_hasInstanceAttributes = other.m_hasInstanceAttributes;
+    m_hasPositionInstanceAttributes = other.m_hasPositionInstanceAttributes;
     m_ibo = other.m_ibo;
     m_vbo = other.m_vbo;
     m_vao = other.m_vao;
+    m_positionVbo = other.m_positionVbo;
+    m_positionVao = other.m_positionVao;
     m_uboMaterial = other.m_uboMaterial;
 
     other.m_numIndices = 0;
@@ -114,6 +193,8 @@ void GPUMesh::moveInto(GPUMesh&& other)
     other.m_ibo = INVALID;
     other.m_vbo = INVALID;
     other.m_vao = INVALID;
+    other.m_positionVbo = INVALID;
+    other.m_positionVao = INVALID;
     other.m_uboMaterial = INVALID;
 }
 
@@ -121,10 +202,16 @@ void GPUMesh::freeGpuMemory()
 {
     if (m_vao != INVALID)
         glDeleteVertexArrays(1, &m_vao);
+    if (m_positionVao != INVALID)
+        glDeleteVertexArrays(1, &m_positionVao);
+    if (m_positionVbo != INVALID)
+        glDeleteBuffers(1, &m_positionVbo);
     if (m_vbo != INVALID)
         glDeleteBuffers(1, &m_vbo);
     if (m_ibo != INVALID)
         glDeleteBuffers(1, &m_ibo);
     if (m_uboMaterial != INVALID)
         glDeleteBuffers(1, &m_uboMaterial);
+    if (m_vao != INVALID || m_uboMaterial != INVALID)
+        GLState::get().invalidate();
 }
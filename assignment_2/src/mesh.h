@@ -1,9 +1,12 @@
 #pragma once
 
+#include <framework/bounds.h>
 #include <framework/disable_all_warnings.h>
 #include <framework/mesh.h>
 #include <framework/shader.h>
 DISABLE_WARNINGS_PUSH()
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x4.hpp>
 #include <glm/vec3.hpp>
 DISABLE_WARNINGS_POP()
 
@@ -25,6 +28,12 @@ struct GPUMaterial {
 	float transparency{ 1.0f };
 };
 
+// Per-instance vertex attributes of GPUMesh::drawInstanced (locations 3-9 of shaders/shader_vert.glsl).
+struct InstanceData {
+    glm::mat4 modelMatrix { 1.0f };
+    glm::mat3 normalModelMatrix { 1.0f };
+};
+
 class GPUMesh {
 public:
     GPUMesh(const Mesh& cpuMesh);
@@ -42,11 +51,24 @@ public:
     GPUMesh& operator=(GPUMesh&&);
 
     bool hasTextureCoords() const;
+    // Bounds of the vertex positions in model space, computed when the mesh is loaded.
+    const AxisAlignedBox& localBounds() const;
 
     // Bind VAO and call glDrawElements.
     void draw(const Shader& drawingShader);
+    // Draw instanceCount instances whose InstanceData is stored consecutively in instanceBuffer,
+    // starting at instanceOffset bytes.
+    void drawInstanced(const Shader& drawingShader, GLuint instanceBuffer, GLintptr instanceOffset, GLsizei instanceCount);
+    // Depth-only variants of draw() and drawInstanced(): only the vertex positions (attribute 0), read
+    // from a separate tightly packed buffer, and the instance model matrices (attributes 3-6). The
+    // caller binds the depth program (it needs no material).
+    void drawDepthOnly();
+    void drawDepthOnlyInstanced(GLuint instanceBuffer, GLintptr instanceOffset, GLsizei instanceCount);
 
 private:
+    // Point the instance attributes of the bound vertex array at the instance buffer.
+    static void setInstanceAttributes(bool& hasInstanceAttributes, bool withNormalMatrix, GLuint instanceBuffer, GLintptr instanceOffset);
+
     void moveInto(GPUMesh&&);
     void freeGpuMemory();
 
@@ -54,9 +76,14 @@ private:
     static constexpr GLuint INVALID = 0xFFFFFFFF;
 
     GLsizei m_numIndices { 0 };
+    AxisAlignedBox m_localBounds;
     bool m_hasTextureCoords { false };
+    bool m_hasInstanceAttributes { false };
+    bool m_hasPositionInstanceAttributes { false };
     GLuint m_ibo { INVALID };
     GLuint m_vbo { INVALID };
     GLuint m_vao { INVALID };
+    GLuint m_positionVbo { INVALID };
+    GLuint m_positionVao { INVALID };
     GLuint m_uboMaterial { INVALID };
 };
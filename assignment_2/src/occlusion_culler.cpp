@@ -0,0 +1,153 @@
+#include "occlusion_culler.h"
+#include <framework/gl_state.h>
+#include <array>
+#include <cassert>
+
+static constexpr UniformId boxLowerId { "boxLower" };
+static constexpr UniformId boxSizeId { "boxSize" };
+
+// Frames between two queries of an object that was visible.
+static constexpr uint32_t VISIBLE_QUERY_INTERVAL = 4;
+
+// Corners of the unit cube and its 12 triangles.
+static constexpr std::array<float, 24> CUBE_CORNERS { 0, 0, 0, 1, 0, 0, 0, 1, 0, 1, 1, 0, 0, 0, 1, 1, 0, 1, 0, 1, 1, 1, 1, 1 };
+static constexpr std::array<uint8_t, 36> CUBE_TRIANGLES {
+    0, 2, 1, 1, 2, 3, // -z
+    4, 5, 6, 5, 7, 6, // +z
+    0, 1, 4, 1, 5, 4, // -y
+    2, 6, 3, 3, 6, 7, // +y
+    0, 4, 2, 2, 4, 6, // -x
+    1, 3, 5, 3, 7, 5, // +x
+};
+
+OcclusionCuller::OcclusionCuller()
+{
+    glGenVertexArrays(1, &m_cubeVao);
+    GLState::get().bindVertexArray(m_cubeVao);
+    glGenBuffers(1, &m_cubeVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m_cubeVbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(CUBE_CORNERS), CUBE_CORNERS.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), nullptr);
+    glGenBuffers(1, &m_cubeIbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_cubeIbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(CUBE_TRIANGLES), CUBE_TRIANGLES.data(), GL_STATIC_DRAW);
+    GLState::get().bindVertexArray(0);
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+    deleteQueries();
+    glDeleteBuffers(1, &m_cubeIbo);
+    glDeleteBuffers(1, &m_cubeVbo);
+    glDeleteVertexArrays(1, &m_cubeVao);
+    GLState::get().invalidate();
+}
+
+void OcclusionCuller::reset(size_t numObjects)
+{
+    deleteQueries();
+    m_objects.clear();
+    m_objects.resize(numObjects);
+}
+
+void OcclusionCuller::beginFrame()
+{
+    ++m_frame;
+    m_stats = {};
+    for (ObjectState& object : m_objects) {
+        if (object.pending) {
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(object.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint anySamplesPassed = GL_TRUE;
+                glGetQueryObjectuiv(object.query, GL_QUERY_RESULT, &anySamplesPassed);
+                object.occluded = !anySamplesPassed;
+                object.pending = false;
+                ++m_stats.resultsRead;
+            }
+        }
+        m_stats.occluded += object.occluded;
+    }
+}
+
+bool OcclusionCuller::isOccluded(uint32_t objectId) const
+{
+    assert(objectId < m_objects.size());
+    return m_objects[objectId].occluded;
+}
+
+GLuint OcclusionCuller::conditionQuery(uint32_t objectId) const
+{
+    assert(objectId < m_objects.size());
+    return m_objects[objectId].query;
+}
+
+void OcclusionCuller::beginQueries(const Shader& boxShader, const glm::vec3& cameraPosition, float nearPlane)
+{
+    m_pBoxShader = &boxShader;
+    m_cameraPosition = cameraPosition;
+    m_nearPlane = nearPlane;
+
+    boxShader.bind();
+    GLState& state = GLState::get();
+    state.bindVertexArray(m_cubeVao);
+    state.setDepthTest(true);
+    state.setDepthMask(false);
+    state.setDepthFunc(GL_LEQUAL);
+    state.setBlend(false);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+}
+
+void OcclusionCuller::query(uint32_t objectId, const AxisAlignedBox& worldBounds)
+{
+    assert(objectId < m_objects.size());
+    ObjectState& object = m_objects[objectId];
+    if (object.pending)
+        return;
+    if (!object.occluded && (m_frame + objectId) % VISIBLE_QUERY_INTERVAL != 0)
+        return;
+
+    // Parts of a box that the near plane cuts off draw no samples, so the object could be reported
+    // as hidden while the camera is inside it. The margin covers the near plane of fields of view up
+    // to about 120 degrees.
+    const glm::vec3 margin { 2.0f * m_nearPlane };
+    if (AxisAlignedBox { worldBounds.lower - margin, worldBounds.upper + margin }.contains({ m_cameraPosition, m_cameraPosition })) {
+        object.occluded = false;
+        return;
+    }
+
+    if (object.query == 0)
+        glGenQueries(1, &object.query);
+    m_pBoxShader->set(boxLowerId, worldBounds.lower);
+    m_pBoxShader->set(boxSizeId, worldBounds.upper - worldBounds.lower);
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, object.query);
+    glDrawElements(GL_TRIANGLES, GLsizei(CUBE_TRIANGLES.size()), GL_UNSIGNED_BYTE, nullptr);
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+    object.pending = true;
+    ++m_stats.queriesIssued;
+}
+
+void OcclusionCuller::endQueries()
+{
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    GLState& state = GLState::get();
+    state.setDepthMask(true);
+    state.setDepthFunc(GL_LESS);
+    m_pBoxShader = nullptr;
+}
+
+const OcclusionCuller::Stats& OcclusionCuller::stats() const
+{
+    return m_stats;
+}
+
+void OcclusionCuller::deleteQueries()
+{
+    for (ObjectState& object : m_objects) {
+        if (object.query != 0)
+            glDeleteQueries(1, &object.query);
+        object.query = 0;
+        object.pending = false;
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <framework/bounds.h>
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/opengl_includes.h>
+#include <framework/shader.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hardware occlusion culling with GL_ANY_SAMPLES_PASSED queries of the bounding boxes of objects.
+//
+// After the scene of a frame has been drawn, the boxes of the objects are drawn against its depth
+// buffer (without writing color or depth). The results are read back in later frames, once the GPU
+// reports them as available, so the CPU never waits: an object is drawn unless its last query showed
+// that it was hidden. Objects that become visible again therefore appear one frame late.
+//
+// Visible objects are only re-queried every few frames (staggered by id), hidden objects every
+// frame. The query of an object can also be used for conditional rendering (conditionQuery()), which
+// lets the GPU skip the draw without any read back.
+class OcclusionCuller {
+public:
+    struct Stats {
+        int queriesIssued { 0 };
+        int resultsRead { 0 };
+        int occluded { 0 }; // objects that were hidden according to their last result
+    };
+
+    OcclusionCuller();
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    ~OcclusionCuller();
+
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+    // Forget all results, e.g. when the objects changed. Object ids are 0 to numObjects - 1.
+    void reset(size_t numObjects);
+    // Collect the results that became available. Call once per frame before isOccluded().
+    void beginFrame();
+
+    [[nodiscard]] bool isOccluded(uint32_t objectId) const;
+    // Last query issued for the object (0 if none), for glBeginConditionalRender.
+    [[nodiscard]] GLuint conditionQuery(uint32_t objectId) const;
+
+    // Issue queries against the current depth buffer. boxShader is shaders/occlusion_box_vert.glsl +
+    // shadow_frag.glsl and expects the PerFrame block to be bound.
+    void beginQueries(const Shader& boxShader, const glm::vec3& cameraPosition, float nearPlane);
+    void query(uint32_t objectId, const AxisAlignedBox& worldBounds);
+    void endQueries();
+
+    // Of the current frame (since beginFrame()).
+    [[nodiscard]] const Stats& stats() const;
+
+private:
+    struct ObjectState {
+        GLuint query { 0 };
+        bool pending { false };
+        bool occluded { false };
+    };
+
+    void deleteQueries();
+
+private:
+    std::vector<ObjectState> m_objects;
+    uint32_t m_frame { 0 };
+    const Shader* m_pBoxShader { nullptr };
+    glm::vec3 m_cameraPosition { 0.0f };
+    float m_nearPlane { 0.0f };
+
+    GLuint m_cubeVao { 0 };
+    GLuint m_cubeVbo { 0 };
+    GLuint m_cubeIbo { 0 };
+    Stats m_stats;
+};
@@ -0,0 +1,203 @@
+#include "point_shadow_map.h"
+#include <framework/gl_state.h>
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/matrix_transform.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <utility>
+
+static constexpr UniformId mvpMatrixId { "mvpMatrix" };
+
+// View direction and up vector of each face, in the order of GL_TEXTURE_CUBE_MAP_POSITIVE_X + i.
+static const std::array<std::pair<glm::vec3, glm::vec3>, 6> FACE_ORIENTATIONS { {
+    { { 1, 0, 0 }, { 0, -1, 0 } },
+    { { -1, 0, 0 }, { 0, -1, 0 } },
+    { { 0, 1, 0 }, { 0, 0, 1 } },
+    { { 0, -1, 0 }, { 0, 0, -1 } },
+    { { 0, 0, 1 }, { 0, -1, 0 } },
+    { { 0, 0, -1 }, { 0, -1, 0 } },
+} };
+
+static void attachFace(GLenum framebufferTarget, GLuint texture, int face)
+{
+    glFramebufferTexture2D(framebufferTarget, GL_DEPTH_ATTACHMENT, GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face), texture, 0);
+}
+
+PointShadowMap::PointShadowMap(const PointShadowSettings& settings)
+    : m_settings(settings)
+{
+}
+
+PointShadowMap::~PointShadowMap()
+{
+    freeTextures();
+}
+
+void PointShadowMap::setSettings(const PointShadowSettings& settings)
+{
+    if (settings.nearPlane != m_settings.nearPlane || settings.farPlane != m_settings.farPlane)
+        m_staticValid = false;
+    m_settings = settings;
+}
+
+const PointShadowSettings& PointShadowMap::settings() const
+{
+    return m_settings;
+}
+
+void PointShadowMap::invalidateStatic()
+{
+    m_staticValid = false;
+}
+
+void PointShadowMap::update(const Shader& depthShader, const glm::vec3& lightPos,
+    std::span<const ShadowCaster> staticCasters, std::span<const ShadowCaster> dynamicCasters)
+{
+    m_stats = {};
+    if (m_settings.resolution != m_textureResolution) {
+        freeTextures();
+        createTextures();
+        m_staticValid = false;
+    }
+    if (lightPos != m_lightPos)
+        m_staticValid = false;
+
+    const bool fullUpdate = !m_staticValid || m_settings.policy == ShadowUpdatePolicy::EveryFrame;
+    const bool dynamicMoved = !std::equal(std::begin(dynamicCasters), std::end(dynamicCasters),
+        std::begin(m_previousDynamicMatrices), std::end(m_previousDynamicMatrices),
+        [](const ShadowCaster& caster, const glm::mat4& previous) { return caster.modelMatrix == previous; });
+    if (!fullUpdate && !dynamicMoved)
+        return;
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glViewport(0, 0, m_textureResolution, m_textureResolution);
+    GLState::get().setDepthTest(true);
+    GLState::get().setDepthMask(true);
+    // Slope scaled bias against shadow acne.
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(1.5f, 4.0f);
+    depthShader.bind();
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_drawFramebuffer);
+    if (fullUpdate) {
+        m_lightPos = lightPos;
+        const glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, m_settings.nearPlane, m_settings.farPlane);
+        for (int face = 0; face < NUM_FACES; ++face) {
+            const auto& [direction, up] = FACE_ORIENTATIONS[size_t(face)];
+            m_faceViewProjections[size_t(face)] = projection * glm::lookAt(lightPos, lightPos + direction, up);
+            m_faceFrustums[size_t(face)] = Frustum::fromMatrix(m_faceViewProjections[size_t(face)]);
+
+            attachFace(GL_DRAW_FRAMEBUFFER, m_staticTexture, face);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            renderCasters(depthShader, face, staticCasters);
+        }
+        m_stats.staticFacesRendered = NUM_FACES;
+        m_staticValid = true;
+    }
+
+    // Faces that dynamic casters left must be restored to their static contents as well.
+    const FaceMask dynamicFaces = touchedFaces(dynamicCasters);
+    const FaceMask facesToUpdate = fullUpdate ? FaceMask((1 << NUM_FACES) - 1) : FaceMask(dynamicFaces | m_previousDynamicFaces);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_readFramebuffer);
+    for (int face = 0; face < NUM_FACES; ++face) {
+        if (!(facesToUpdate & (1 << face)))
+            continue;
+
+        attachFace(GL_READ_FRAMEBUFFER, m_staticTexture, face);
+        attachFace(GL_DRAW_FRAMEBUFFER, m_texture, face);
+        glBlitFramebuffer(0, 0, m_textureResolution, m_textureResolution, 0, 0, m_textureResolution, m_textureResolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        renderCasters(depthShader, face, dynamicCasters);
+        ++m_stats.dynamicFacesRendered;
+    }
+    m_previousDynamicFaces = dynamicFaces;
+    m_previousDynamicMatrices.clear();
+    for (const ShadowCaster& caster : dynamicCasters)
+        m_previousDynamicMatrices.push_back(caster.modelMatrix);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+GLuint PointShadowMap::texture() const
+{
+    return m_texture;
+}
+
+const PointShadowMap::Stats& PointShadowMap::stats() const
+{
+    return m_stats;
+}
+
+void PointShadowMap::createTextures()
+{
+    m_textureResolution = m_settings.resolution;
+    for (GLuint* pTexture : { &m_staticTexture, &m_texture }) {
+        glGenTextures(1, pTexture);
+        GLState::get().bindTexture(0, GL_TEXTURE_CUBE_MAP, *pTexture);
+        for (int face = 0; face < NUM_FACES; ++face) {
+            glTexImage2D(GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face), 0, GL_DEPTH_COMPONENT24,
+                m_textureResolution, m_textureResolution, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 0);
+    }
+    // Linear filtering of a comparison sampler gives 2x2 percentage closer filtering for free.
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+    // Depth only: no color buffers to draw to or read from.
+    GLuint framebuffers[2];
+    glGenFramebuffers(2, framebuffers);
+    m_drawFramebuffer = framebuffers[0];
+    m_readFramebuffer = framebuffers[1];
+    for (GLuint framebuffer : framebuffers) {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void PointShadowMap::freeTextures()
+{
+    if (m_texture == 0)
+        return;
+
+    glDeleteTextures(1, &m_staticTexture);
+    glDeleteTextures(1, &m_texture);
+    const GLuint framebuffers[2] { m_drawFramebuffer, m_readFramebuffer };
+    glDeleteFramebuffers(2, framebuffers);
+    m_staticTexture = m_texture = m_drawFramebuffer = m_readFramebuffer = 0;
+    m_textureResolution = 0;
+    GLState::get().invalidate();
+}
+
+void PointShadowMap::renderCasters(const Shader& depthShader, int face, std::span<const ShadowCaster> casters)
+{
+    const glm::mat4& faceViewProjection = m_faceViewProjections[size_t(face)];
+    for (const ShadowCaster& caster : casters) {
+        if (!m_faceFrustums[size_t(face)].intersects(caster.worldBounds))
+            continue;
+        depthShader.set(mvpMatrixId, faceViewProjection * caster.modelMatrix);
+        caster.pMesh->drawDepthOnly();
+        ++m_stats.draws;
+    }
+}
+
+PointShadowMap::FaceMask PointShadowMap::touchedFaces(std::span<const ShadowCaster> casters) const
+{
+    FaceMask faces = 0;
+    for (int face = 0; face < NUM_FACES; ++face) {
+        const Frustum& frustum = m_faceFrustums[size_t(face)];
+        if (std::any_of(std::begin(casters), std::end(casters), [&](const ShadowCaster& caster) { return frustum.intersects(caster.worldBounds); }))
+            faces |= FaceMask(1 << face);
+    }
+    return faces;
+}
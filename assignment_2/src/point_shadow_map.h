@@ -0,0 +1,104 @@
+#pragma once
+#include "mesh.h"
+#include <framework/bounds.h>
+#include <framework/frustum_culler.h>
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/opengl_includes.h>
+#include <framework/shader.h>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct ShadowCaster {
+    GPUMesh* pMesh;
+    glm::mat4 modelMatrix;
+    AxisAlignedBox worldBounds;
+};
+
+enum class ShadowUpdatePolicy {
+    // Static casters are cached and only re-rendered when the light moves; dynamic casters are
+    // composited on top, only into the faces they touch and only when they moved.
+    Cached,
+    // Re-render all casters into all faces every frame (reference for the cached policy).
+    EveryFrame,
+};
+
+struct PointShadowSettings {
+    int resolution { 512 }; // of each cube face
+    float nearPlane { 0.05f };
+    float farPlane { 16.0f };
+    ShadowUpdatePolicy policy { ShadowUpdatePolicy::Cached };
+};
+
+// Omnidirectional shadow map of a point light, stored as a depth cube map with hardware depth
+// comparison enabled (sample it with a samplerCubeShadow).
+//
+// Each face stores the perspective depth of a 90 degree projection looking down a cube axis, so the
+// reference depth of a world position p is that of the largest component of abs(p - lightPos); see
+// sunShadow() in shaders/shader_frag.glsl.
+//
+// Static casters are rendered into a separate cached cube map. Updating the shadow map copies the
+// cached faces that dynamic casters touched (now or in the previous update) and renders the dynamic
+// casters on top, so an update costs nothing when neither the light nor any caster moved.
+class PointShadowMap {
+public:
+    struct Stats {
+        int staticFacesRendered { 0 };
+        int dynamicFacesRendered { 0 };
+        int draws { 0 };
+    };
+
+    explicit PointShadowMap(const PointShadowSettings& settings = {});
+    PointShadowMap(const PointShadowMap&) = delete;
+    ~PointShadowMap();
+
+    PointShadowMap& operator=(const PointShadowMap&) = delete;
+
+    // Takes effect on the next update().
+    void setSettings(const PointShadowSettings& settings);
+    [[nodiscard]] const PointShadowSettings& settings() const;
+    // Call when static casters were added, removed or moved.
+    void invalidateStatic();
+
+    // depthShader is shaders/shadow_vert.glsl + shadow_frag.glsl, fed with the position-only vertex
+    // stream (GPUMesh::drawDepthOnly). Changes the framebuffer and viewport while rendering and
+    // restores them afterwards.
+    void update(const Shader& depthShader, const glm::vec3& lightPos,
+        std::span<const ShadowCaster> staticCasters, std::span<const ShadowCaster> dynamicCasters);
+
+    [[nodiscard]] GLuint texture() const;
+    // Of the last update().
+    [[nodiscard]] const Stats& stats() const;
+
+private:
+    static constexpr int NUM_FACES = 6;
+    using FaceMask = uint8_t;
+
+    void createTextures();
+    void freeTextures();
+    void renderCasters(const Shader& depthShader, int face, std::span<const ShadowCaster> casters);
+    // Bit i is set if the caster bounds intersect the frustum of face i.
+    FaceMask touchedFaces(std::span<const ShadowCaster> casters) const;
+
+private:
+    PointShadowSettings m_settings;
+    int m_textureResolution { 0 };
+
+    GLuint m_staticTexture { 0 };
+    GLuint m_texture { 0 };
+    GLuint m_drawFramebuffer { 0 };
+    GLuint m_readFramebuffer { 0 };
+
+    std::array<glm::mat4, NUM_FACES> m_faceViewProjections;
+    std::array<Frustum, NUM_FACES> m_faceFrustums;
+    bool m_staticValid { false };
+    glm::vec3 m_lightPos { 0.0f };
+    FaceMask m_previousDynamicFaces { 0 };
+    std::vector<glm::mat4> m_previousDynamicMatrices;
+    Stats m_stats;
+};
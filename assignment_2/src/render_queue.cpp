@@ -0,0 +1,241 @@
+#include "render_queue.h"
+#include <framework/gl_state.h>
+#include <framework/gpu_profiler.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+static constexpr int PASS_SHIFT = 60;
+static constexpr uint64_t DEPTH_MASK = (1u << 24) - 1;
+
+static uint64_t quantizeDepth(float normalizedDepth)
+{
+    return static_cast<uint64_t>(std::clamp(normalizedDepth, 0.0f, 1.0f) * float(DEPTH_MASK)) & DEPTH_MASK;
+}
+
+// Identifies the mesh for sorting purposes only; collisions merely cost an extra state change.
+static uint64_t meshBits(const GPUMesh* pMesh)
+{
+    return (reinterpret_cast<uintptr_t>(pMesh) >> 4) & 0xFFFF;
+}
+
+RenderQueue::RenderQueue(FrameArena& frameArena, GLuint perObjectBinding)
+    : m_frameArena(frameArena)
+    , m_perObjectBinding(perObjectBinding)
+{
+}
+
+void RenderQueue::clear()
+{
+    m_packets.clear();
+    m_commands.clear();
+}
+
+uint64_t RenderQueue::makeKey(RenderPass pass, float normalizedDepth, const DrawCommand& command)
+{
+    const uint64_t variant = command.shaderFeatures & 0xFF;
+    const uint64_t material = command.materialId & 0xFFF;
+    const uint64_t state = (variant << 28) | (material << 16) | meshBits(command.pMesh);
+    const uint64_t depth = quantizeDepth(normalizedDepth);
+
+    uint64_t key = static_cast<uint64_t>(pass) << PASS_SHIFT;
+    if (pass == RenderPass::Transparent)
+        key |= ((DEPTH_MASK - depth) << 36) | state; // back-to-front for correct blending
+    else
+        key |= (state << 24) | depth; // state first, then front-to-back for early-Z
+    return key;
+}
+
+void RenderQueue::push(RenderPass pass, float normalizedDepth, DrawCommand command)
+{
+    m_packets.push_back({ makeKey(pass, normalizedDepth, command), static_cast<uint32_t>(m_commands.size()) });
+    m_commands.push_back(std::move(command));
+}
+
+// LSD radix sort on the key, 8 bits per pass. Passes in which all keys share the same byte are skipped.
+template <typename Packet>
+static void radixSort(Packet* pPackets, Packet* pScratch, size_t count)
+{
+    Packet* pSrc = pPackets;
+    Packet* pDst = pScratch;
+    for (int shift = 0; shift < 64; shift += 8) {
+        std::array<size_t, 256> offsets {};
+        for (size_t i = 0; i < count; ++i)
+            ++offsets[(pSrc[i].key >> shift) & 0xFF];
+        if (offsets[(pSrc[0].key >> shift) & 0xFF] == count)
+            continue;
+
+        size_t sum = 0;
+        for (size_t& offset : offsets)
+            sum += std::exchange(offset, sum);
+        for (size_t i = 0; i < count; ++i)
+            pDst[offsets[(pSrc[i].key >> shift) & 0xFF]++] = pSrc[i];
+        std::swap(pSrc, pDst);
+    }
+    if (pSrc != pPackets)
+        std::memcpy(pPackets, pSrc, count * sizeof(Packet));
+}
+
+void RenderQueue::setDepthPrepass(bool enabled)
+{
+    m_depthPrepass = enabled;
+}
+
+bool RenderQueue::depthPrepass() const
+{
+    return m_depthPrepass;
+}
+
+void RenderQueue::setPassState(RenderPass pass) const
+{
+    GLState& state = GLState::get();
+    const bool afterDepthPrepass = m_depthPrepass && pass == RenderPass::Opaque;
+    state.setDepthTest(pass != RenderPass::Overlay);
+    state.setDepthMask(pass != RenderPass::Transparent && !afterDepthPrepass);
+    state.setDepthFunc(afterDepthPrepass ? GL_LEQUAL : GL_LESS);
+    state.setBlend(pass == RenderPass::Transparent);
+    if (pass == RenderPass::Transparent)
+        state.setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void RenderQueue::submit(const RenderQueueCallbacks& callbacks)
+{
+    sort();
+    submitDepthPrepass(callbacks);
+    for (RenderPass pass : { RenderPass::Opaque, RenderPass::Sky, RenderPass::Transparent, RenderPass::Overlay })
+        submitPass(callbacks, pass);
+}
+
+void RenderQueue::sort()
+{
+    m_stats = {};
+    if (!m_packets.empty())
+        radixSort(m_packets.data(), m_frameArena.allocate<DrawPacket>(m_packets.size()), m_packets.size());
+}
+
+void RenderQueue::submitDepthPrepass(const RenderQueueCallbacks& callbacks)
+{
+    if (!m_depthPrepass)
+        return;
+
+    GLState& state = GLState::get();
+    state.setDepthTest(true);
+    state.setDepthMask(true);
+    state.setDepthFunc(GL_LESS);
+    state.setBlend(false);
+
+    // The opaque pass comes first in the sorted packets.
+    const Shader* pShader = nullptr;
+    bool instanced = false;
+    for (const DrawPacket& packet : m_packets) {
+        if (static_cast<RenderPass>(packet.key >> PASS_SHIFT) != RenderPass::Opaque)
+            break;
+
+        const DrawCommand& command = m_commands[packet.commandIndex];
+        if (!command.pMesh || command.shaderFeatures == DrawCommand::NO_SHADER)
+            continue;
+
+        if (!pShader || (command.instanceCount > 0) != instanced) {
+            instanced = command.instanceCount > 0;
+            pShader = &callbacks.bindDepthShader(instanced);
+        }
+        if (command.uniformBuffer != 0)
+            state.bindUniformBufferRange(m_perObjectBinding, command.uniformBuffer, command.uniformOffset, command.uniformSize);
+
+        if (command.conditionQuery != 0)
+            glBeginConditionalRender(command.conditionQuery, GL_QUERY_NO_WAIT);
+        if (instanced)
+            command.pMesh->drawDepthOnlyInstanced(command.instanceBuffer, command.instanceOffset, command.instanceCount);
+        else
+            command.pMesh->drawDepthOnly();
+        if (command.conditionQuery != 0)
+            glEndConditionalRender();
+        ++m_stats.depthPrepassDraws;
+    }
+    restoreDefaultState();
+}
+
+void RenderQueue::submitPass(const RenderQueueCallbacks& callbacks, RenderPass pass)
+{
+    // The packets are sorted by pass first.
+    const uint64_t passBits = static_cast<uint64_t>(pass);
+    const auto itBegin = std::lower_bound(std::begin(m_packets), std::end(m_packets), passBits,
+        [](const DrawPacket& packet, uint64_t bits) { return (packet.key >> PASS_SHIFT) < bits; });
+    const auto itEnd = std::find_if(itBegin, std::end(m_packets),
+        [&](const DrawPacket& packet) { return (packet.key >> PASS_SHIFT) != passBits; });
+    if (itBegin == itEnd)
+        return;
+
+    setPassState(pass);
+    constexpr uint32_t NONE = 0xFFFFFFFF;
+    uint32_t currentFeatures = NONE, currentMaterial = NONE;
+    const Shader* pShader = nullptr;
+    GpuProfiler& profiler = GpuProfiler::get();
+    std::string_view currentZone;
+    for (auto it = itBegin; it != itEnd; ++it) {
+        const DrawCommand& command = m_commands[it->commandIndex];
+
+        if (profiler.isEnabled() && command.profileZone != currentZone) {
+            if (!currentZone.empty())
+                profiler.endZone();
+            if (!command.profileZone.empty())
+                profiler.beginZone(command.profileZone);
+            currentZone = command.profileZone;
+        }
+
+        if (command.shaderFeatures == DrawCommand::NO_SHADER) {
+            // Binds its own program, so forget which variant and material were bound.
+            pShader = nullptr;
+            currentFeatures = currentMaterial = NONE;
+        } else {
+            if (!pShader || command.shaderFeatures != currentFeatures) {
+                pShader = &callbacks.bindShader(command.shaderFeatures);
+                currentFeatures = command.shaderFeatures;
+                currentMaterial = NONE;
+                ++m_stats.shaderBinds;
+            }
+            if (command.materialId != currentMaterial && command.materialId != DrawCommand::NO_MATERIAL) {
+                callbacks.bindMaterial(command.materialId, *pShader);
+                currentMaterial = command.materialId;
+                ++m_stats.materialBinds;
+            }
+        }
+
+        if (command.uniformBuffer != 0)
+            GLState::get().bindUniformBufferRange(m_perObjectBinding, command.uniformBuffer, command.uniformOffset, command.uniformSize);
+
+        if (command.conditionQuery != 0)
+            glBeginConditionalRender(command.conditionQuery, GL_QUERY_NO_WAIT);
+        if (command.pMesh && pShader) {
+            if (command.instanceCount > 0)
+                command.pMesh->drawInstanced(*pShader, command.instanceBuffer, command.instanceOffset, command.instanceCount);
+            else
+                command.pMesh->draw(*pShader);
+        } else if (command.pCustomDraw) {
+            command.pCustomDraw(command.pCustomDrawContext);
+        }
+        if (command.conditionQuery != 0)
+            glEndConditionalRender();
+        ++m_stats.draws;
+    }
+    if (!currentZone.empty())
+        profiler.endZone();
+    restoreDefaultState();
+}
+
+// Leave the default (opaque, without pre-pass) state for code that draws after the queue.
+void RenderQueue::restoreDefaultState()
+{
+    GLState& state = GLState::get();
+    state.setDepthTest(true);
+    state.setDepthMask(true);
+    state.setDepthFunc(GL_LESS);
+    state.setBlend(false);
+}
+
+const RenderQueue::Stats& RenderQueue::stats() const
+{
+    return m_stats;
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include "mesh.h"
+#include <framework/frame_arena.h>
+#include <framework/opengl_includes.h>
+#include <framework/shader.h>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Passes are submitted in this order.
+enum class RenderPass : uint8_t {
+    Opaque = 0,
+    Sky = 1, // after the opaque geometry so that occluded sky pixels are rejected by the depth test
+    Transparent = 2,
+    Overlay = 3, // no depth test
+};
+
+// Everything needed to issue one draw.
+struct DrawCommand {
+    static constexpr uint32_t NO_SHADER = 0xFFFFFFFF;
+    static constexpr uint32_t NO_MATERIAL = 0xFFFFFFFF;
+
+    // Shader variant (feature mask) and material; NO_SHADER for custom draws that bind their own program.
+    uint32_t shaderFeatures { NO_SHADER };
+    uint32_t materialId { NO_MATERIAL };
+
+    // Per-object uniform block range (skipped if uniformBuffer is 0).
+    GLuint uniformBuffer { 0 };
+    GLintptr uniformOffset { 0 };
+    GLsizeiptr uniformSize { 0 };
+
+    // Either a mesh (instanced if instanceCount > 0) or a custom draw function (see setCustomDraw()).
+    GPUMesh* pMesh { nullptr };
+    GLuint instanceBuffer { 0 };
+    GLintptr instanceOffset { 0 };
+    GLsizei instanceCount { 0 };
+    void (*pCustomDraw)(const void* pContext) { nullptr };
+    const void* pCustomDrawContext { nullptr };
+
+    // If set, the GPU skips the draw when this occlusion query passed no samples (conditional
+    // rendering without waiting for the result).
+    GLuint conditionQuery { 0 };
+
+    // GpuProfiler zone of the draw; consecutive draws with the same name share a zone.
+    std::string_view profileZone;
+
+    // Draws by calling function(), which is copied into the frame arena: it must be trivially
+    // destructible (e.g. a lambda that captures pointers and matrices) and is valid until the arena is reset.
+    template <typename F>
+    void setCustomDraw(FrameArena& frameArena, F function)
+    {
+        F* pFunction = new (frameArena.allocate<F>(1)) F(std::move(function));
+        pCustomDraw = [](const void* pContext) { (*static_cast<const F*>(pContext))(); };
+        pCustomDrawContext = pFunction;
+    }
+};
+
+// Binds the program of a shader variant / the textures of a material. The queue only calls these
+// when the variant or material differs from that of the previous draw.
+struct RenderQueueCallbacks {
+    std::function<const Shader&(uint32_t shaderFeatures)> bindShader;
+    std::function<void(uint32_t materialId, const Shader& shader)> bindMaterial;
+    // Program of the depth pre-pass (shaders/depth_vert.glsl), for instanced or regular draws.
+    std::function<const Shader&(bool instanced)> bindDepthShader;
+};
+
+// Collects the draws of a frame and submits them sorted by a 64-bit key, such that draws sharing a
+// shader variant and material are consecutive and state changes are minimized.
+//
+// Key layout (most significant bits first):
+//   Opaque/Sky/Overlay: pass (4) | shader variant (8) | material (12) | mesh (16) | depth (24, front-to-back)
+//   Transparent:        pass (4) | depth (24, back-to-front) | shader variant (8) | material (12) | mesh (16)
+class RenderQueue {
+public:
+    struct Stats {
+        int draws { 0 };
+        int shaderBinds { 0 };
+        int materialBinds { 0 };
+        int depthPrepassDraws { 0 };
+    };
+
+    RenderQueue(FrameArena& frameArena, GLuint perObjectBinding);
+
+    void clear();
+    // normalizedDepth is the distance to the camera mapped to [0, 1] (e.g. between the near and far plane).
+    void push(RenderPass pass, float normalizedDepth, DrawCommand command);
+    // Sort (using scratch memory of the frame arena) and issue all draws.
+    void submit(const RenderQueueCallbacks& callbacks);
+
+    // The steps of submit(), for callers that interleave the passes with other work (e.g. frame
+    // graph passes): sort() once, then submit the depth pre-pass and the passes in their order.
+    void sort();
+    void submitDepthPrepass(const RenderQueueCallbacks& callbacks);
+    void submitPass(const RenderQueueCallbacks& callbacks, RenderPass pass);
+
+    // With the depth pre-pass enabled, submit() first draws the opaque meshes into the depth buffer
+    // only, using the position-only vertex stream (GPUMesh::drawDepthOnly). The opaque pass then
+    // tests with GL_LEQUAL without writing depth, so every pixel is shaded only once. Custom draws
+    // are not part of the pre-pass and must not be queued in the opaque pass while it is enabled.
+    void setDepthPrepass(bool enabled);
+    [[nodiscard]] bool depthPrepass() const;
+
+    // Since the last sort().
+    [[nodiscard]] const Stats& stats() const;
+
+    [[nodiscard]] static uint64_t makeKey(RenderPass pass, float normalizedDepth, const DrawCommand& command);
+
+private:
+    struct DrawPacket {
+        uint64_t key;
+        uint32_t commandIndex;
+    };
+
+    void setPassState(RenderPass pass) const;
+    static void restoreDefaultState();
+
+private:
+    FrameArena& m_frameArena;
+    GLuint m_perObjectBinding;
+    bool m_depthPrepass { false };
+    std::vector<DrawPacket> m_packets;
+    std::vector<DrawCommand> m_commands;
+    Stats m_stats;
+};
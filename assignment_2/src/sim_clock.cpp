@@ -0,0 +1,94 @@
+#include "sim_clock.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+SimClock::SimClock(double stepSeconds, int maxStepsPerFrame)
+    : m_stepSeconds(stepSeconds)
+    , m_maxStepsPerFrame(maxStepsPerFrame)
+{
+    assert(stepSeconds > 0.0 && maxStepsPerFrame > 0);
+}
+
+void SimClock::setStepSeconds(double stepSeconds)
+{
+    assert(stepSeconds > 0.0);
+    // Keep the same fraction of a step so that the interpolated state does not jump.
+    m_accumulator *= stepSeconds / m_stepSeconds;
+    m_stepSeconds = stepSeconds;
+}
+
+double SimClock::stepSeconds() const
+{
+    return m_stepSeconds;
+}
+
+void SimClock::setMaxStepsPerFrame(int maxStepsPerFrame)
+{
+    assert(maxStepsPerFrame > 0);
+    m_maxStepsPerFrame = maxStepsPerFrame;
+}
+
+int SimClock::maxStepsPerFrame() const
+{
+    return m_maxStepsPerFrame;
+}
+
+void SimClock::setTimeScale(float timeScale)
+{
+    m_timeScale = std::max(timeScale, 0.0f);
+}
+
+float SimClock::timeScale() const
+{
+    return m_timeScale;
+}
+
+void SimClock::setPaused(bool paused)
+{
+    m_paused = paused;
+    m_singleStep = false;
+}
+
+bool SimClock::isPaused() const
+{
+    return m_paused;
+}
+
+void SimClock::singleStep()
+{
+    m_singleStep = m_paused;
+}
+
+int SimClock::advance(double frameSeconds)
+{
+    if (m_paused) {
+        const int numSteps = m_singleStep ? 1 : 0;
+        m_singleStep = false;
+        m_time += double(numSteps) * m_stepSeconds;
+        return numSteps;
+    }
+
+    m_accumulator += std::max(frameSeconds, 0.0) * double(m_timeScale);
+    const double numWholeSteps = std::floor(m_accumulator / m_stepSeconds);
+    m_accumulator -= numWholeSteps * m_stepSeconds;
+    const int numSteps = int(std::min(numWholeSteps, double(m_maxStepsPerFrame)));
+    m_numDroppedSteps += uint64_t(numWholeSteps) - uint64_t(numSteps);
+    m_time += double(numSteps) * m_stepSeconds;
+    return numSteps;
+}
+
+double SimClock::time() const
+{
+    return m_time;
+}
+
+float SimClock::alpha() const
+{
+    return float(std::clamp(m_accumulator / m_stepSeconds, 0.0, 1.0));
+}
+
+uint64_t SimClock::numDroppedSteps() const
+{
+    return m_numDroppedSteps;
+}
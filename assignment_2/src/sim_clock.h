@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+
+// Fixed time step clock for the simulation, decoupled from the frame rate.
+//
+// Every frame adds its (scaled) duration to an accumulator, and advance() returns how many steps of
+// stepSeconds() the simulation should take to catch up. Rendering then interpolates between the
+// state before and after the last step with alpha(), so motion stays smooth when the simulation runs
+// at a lower rate than rendering. After a long frame (a breakpoint, loading) at most
+// maxStepsPerFrame steps are taken and the remaining time is dropped instead of letting the
+// simulation fall further and further behind.
+//
+// The results only depend on the sequence of frame durations, so feeding it a fixed duration (as the
+// benchmark does) reproduces the simulation exactly.
+class SimClock {
+public:
+    explicit SimClock(double stepSeconds = 1.0 / 60.0, int maxStepsPerFrame = 8);
+
+    void setStepSeconds(double stepSeconds);
+    [[nodiscard]] double stepSeconds() const;
+    void setMaxStepsPerFrame(int maxStepsPerFrame);
+    [[nodiscard]] int maxStepsPerFrame() const;
+    void setTimeScale(float timeScale); // Of the real time; 1 by default.
+    [[nodiscard]] float timeScale() const;
+
+    void setPaused(bool paused);
+    [[nodiscard]] bool isPaused() const;
+    // Takes a single step in the next advance() while paused.
+    void singleStep();
+
+    // Returns the number of steps to simulate for a frame that took frameSeconds of real time.
+    int advance(double frameSeconds);
+    // Simulation time after all steps so far.
+    [[nodiscard]] double time() const;
+    // Between 0 (the state before the last step) and 1 (the state after it).
+    [[nodiscard]] float alpha() const;
+    // Steps that were dropped because a frame would have needed more than maxStepsPerFrame.
+    [[nodiscard]] uint64_t numDroppedSteps() const;
+
+private:
+    double m_stepSeconds;
+    int m_maxStepsPerFrame;
+    float m_timeScale { 1.0f };
+    bool m_paused { false };
+    bool m_singleStep { false };
+
+    double m_time { 0.0 };
+    uint64_t m_numDroppedSteps { 0 };
+    double m_accumulator { 0.0 };
+};
@@ -0,0 +1,244 @@
+#include "simulation.h"
+#include <framework/cpu_profiler.h>
+#include <framework/job_system.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+
+// Moving a swarm dragon takes well below a microsecond, so a job should move a few hundred.
+static constexpr size_t MIN_SWARM_BATCH_SIZE = 256;
+// The simulation thread checks for new parameters at least this often while paused.
+static constexpr std::chrono::milliseconds MAX_SLEEP { 10 };
+
+// Rotation frame of an object moving along `forward` (looking down -z).
+static glm::mat4 frameFromTangent(const glm::vec3& forward, glm::vec3& up)
+{
+    up = glm::vec3(0, 1, 0);
+    if (std::abs(glm::dot(up, forward)) > 0.98f)
+        up = glm::vec3(0, 0, 1);
+    const glm::vec3 right = glm::normalize(glm::cross(forward, up));
+    up = glm::normalize(glm::cross(right, forward));
+    return glm::mat4(glm::vec4(right, 0), glm::vec4(up, 0), glm::vec4(-forward, 0), glm::vec4(0, 0, 0, 1));
+}
+
+// For transforms made of a translation, rotation and uniform scale.
+static glm::mat4 interpolateTransform(const glm::mat4& from, const glm::mat4& to, float alpha)
+{
+    const float fromScale = glm::length(glm::vec3(from[0]));
+    const float toScale = glm::length(glm::vec3(to[0]));
+    const glm::quat fromRotation = glm::quat_cast(glm::mat3(from) / std::max(fromScale, 1e-6f));
+    const glm::quat toRotation = glm::quat_cast(glm::mat3(to) / std::max(toScale, 1e-6f));
+    glm::mat4 result = glm::mat4_cast(glm::slerp(fromRotation, toRotation, alpha)) * glm::mix(fromScale, toScale, alpha);
+    result[3] = glm::mix(from[3], to[3], alpha);
+    return result;
+}
+
+void SimulationParams::applyTo(SimClock& clock, uint32_t& numAppliedSingleSteps) const
+{
+    if (clock.stepSeconds() != stepSeconds)
+        clock.setStepSeconds(stepSeconds);
+    clock.setMaxStepsPerFrame(maxStepsPerFrame);
+    clock.setTimeScale(timeScale);
+    if (clock.isPaused() != paused)
+        clock.setPaused(paused);
+    if (numAppliedSingleSteps != numSingleSteps) {
+        clock.singleStep();
+        numAppliedSingleSteps = numSingleSteps;
+    }
+}
+
+float SimulationSnapshot::alphaAt(std::chrono::steady_clock::time_point now) const
+{
+    if (paused)
+        return alpha;
+    const double elapsed = std::chrono::duration<double>(now - publishTime).count() * double(timeScale);
+    return std::min(alpha + float(elapsed / stepSeconds), 1.0f);
+}
+
+void SimulationSnapshot::interpolate(float weight, SimulationFrame& result) const
+{
+    result.probePosition = glm::mix(previous.probePosition, current.probePosition, weight);
+    result.probeForward = glm::normalize(glm::mix(previous.probeForward, current.probeForward, weight));
+    result.probeUp = glm::normalize(glm::mix(previous.probeUp, current.probeUp, weight));
+    result.probe = interpolateTransform(previous.probe, current.probe, weight);
+    result.escort = interpolateTransform(previous.escort, current.escort, weight);
+    result.escortBase = interpolateTransform(previous.escortBase, current.escortBase, weight);
+    result.escortTip = interpolateTransform(previous.escortTip, current.escortTip, weight);
+    result.swarm.resize(std::min(previous.swarm.size(), current.swarm.size()));
+    JobSystem::get().parallelFor(std::span(result.swarm), MIN_SWARM_BATCH_SIZE, [&](std::span<glm::mat4> batch) {
+        for (size_t i = size_t(batch.data() - result.swarm.data()), end = i + batch.size(); i < end; ++i)
+            result.swarm[i] = interpolateTransform(previous.swarm[i], current.swarm[i], weight);
+    });
+}
+
+Simulation::Simulation(const BezierPath& path, const BezierPath& pathOuter)
+    : m_path(path)
+    , m_pathOuter(pathOuter)
+{
+    // The same hierarchy as the scene: two dragons stacked on the escort.
+    m_pEscortBase = m_escortRoot.addChild(new SceneNode());
+    m_pEscortTip = m_pEscortBase->addChild(new SceneNode());
+    updateFrame(m_appliedParams, m_position, m_current);
+    m_previous = m_current;
+}
+
+void Simulation::step(const SimulationParams& params, float stepSeconds)
+{
+    CPU_PROFILE_ZONE("Simulation::step");
+    m_previousPosition = m_position;
+    m_position.pathU = std::fmod(m_position.pathU + stepSeconds * params.pathSpeed, 1.0f);
+    m_position.pathOuterU = std::fmod(m_position.pathOuterU + stepSeconds * params.pathOuterSpeed, 1.0f);
+    m_position.time += double(stepSeconds);
+    std::swap(m_previous, m_current); // keeps the capacity of both swarms
+    updateFrame(params, m_position, m_current);
+    m_appliedParams = params;
+}
+
+bool Simulation::applyParams(const SimulationParams& params)
+{
+    if (params.probeScale == m_appliedParams.probeScale && params.swarmSize == m_appliedParams.swarmSize && params.swarmRadius == m_appliedParams.swarmRadius)
+        return false;
+
+    CPU_PROFILE_ZONE("Simulation::applyParams");
+    updateFrame(params, m_previousPosition, m_previous);
+    updateFrame(params, m_position, m_current);
+    m_appliedParams = params;
+    return true;
+}
+
+void Simulation::writeSnapshot(SimulationSnapshot& snapshot) const
+{
+    snapshot.previous = m_previous;
+    snapshot.current = m_current;
+    snapshot.time = m_position.time;
+}
+
+void Simulation::updateFrame(const SimulationParams& params, const PathPosition& pathPosition, SimulationFrame& frame)
+{
+    const glm::mat4 scale = glm::scale(glm::mat4(1.0f), glm::vec3(params.probeScale));
+
+    // Inner dragon
+    frame.probePosition = m_path.sample(pathPosition.pathU);
+    frame.probeForward = glm::normalize(m_path.tangentAt(pathPosition.pathU));
+    m_probeRoot.local = glm::translate(glm::mat4(1.0f), frame.probePosition) * frameFromTangent(frame.probeForward, frame.probeUp) * scale;
+
+    // Escort on the outer path, with the stacked ones above each other (the tip bobs a little)
+    glm::vec3 outerUp;
+    const glm::vec3 outerPosition = m_pathOuter.sample(pathPosition.pathOuterU);
+    const glm::mat4 outerRotation = frameFromTangent(glm::normalize(m_pathOuter.tangentAt(pathPosition.pathOuterU)), outerUp);
+    m_escortRoot.local = glm::translate(glm::mat4(1.0f), outerPosition) * outerRotation * scale;
+    const float bob = 0.25f * std::sin(float(pathPosition.time) * 4.0f);
+    m_pEscortTip->local = glm::translate(glm::mat4(1.0f), glm::vec3(0, 1.0f + bob, 0));
+
+    // Swarm circling outside the outer path
+    const size_t swarmSize = size_t(std::max(params.swarmSize, 0));
+    while (m_swarmRoot.children.size() > swarmSize) {
+        delete m_swarmRoot.children.back();
+        m_swarmRoot.children.pop_back();
+    }
+    while (m_swarmRoot.children.size() < swarmSize)
+        m_swarmRoot.addChild(new SceneNode());
+    frame.swarm.resize(swarmSize);
+
+    {
+        CPU_PROFILE_ZONE("SceneNode::update");
+        m_probeRoot.update();
+        m_escortRoot.update();
+        m_swarmRoot.world = m_swarmRoot.local;
+    }
+    frame.probe = m_probeRoot.world;
+    frame.escort = m_escortRoot.world;
+    frame.escortBase = m_pEscortBase->world;
+    frame.escortTip = m_pEscortTip->world;
+
+    // The swarm dragons are independent subtrees, so they are placed and propagated in parallel.
+    const std::span<SceneNode*> swarm { m_swarmRoot.children };
+    JobSystem::get().parallelFor(swarm, MIN_SWARM_BATCH_SIZE, [&](std::span<SceneNode*> batch) {
+        CPU_PROFILE_ZONE("Move swarm");
+        for (size_t i = size_t(batch.data() - swarm.data()), end = i + batch.size(); i < end; ++i) {
+            const float angle = float(i) * 2.3999632f + float(pathPosition.time) * 0.1f; // golden angle spiral
+            const float radius = params.swarmRadius + 0.05f * float(i % 100);
+            const glm::vec3 position(radius * std::cos(angle), 1.5f * std::sin(float(i)), radius * std::sin(angle));
+            swarm[i]->local = glm::translate(glm::mat4(1.0f), position) * glm::rotate(glm::mat4(1.0f), -angle, glm::vec3(0, 1, 0)) * scale;
+            swarm[i]->update(m_swarmRoot.world);
+            frame.swarm[i] = swarm[i]->world;
+        }
+    });
+}
+
+SimulationThread::SimulationThread(Simulation& simulation, const SimulationParams& params)
+    : m_simulation(simulation)
+    , m_numAppliedSingleSteps(params.numSingleSteps)
+{
+    params.applyTo(m_clock, m_numAppliedSingleSteps);
+    m_params.back() = params;
+    m_params.publish();
+
+    // The first snapshot is there right away.
+    SimulationSnapshot& snapshot = m_snapshots.back();
+    m_simulation.writeSnapshot(snapshot);
+    snapshot.alpha = 1.0f;
+    snapshot.paused = true;
+    m_snapshots.publish();
+
+    m_thread = std::thread([this]() { run(); });
+}
+
+SimulationThread::~SimulationThread()
+{
+    m_stop.store(true, std::memory_order_relaxed);
+    m_thread.join();
+}
+
+void SimulationThread::setParams(const SimulationParams& params)
+{
+    m_params.back() = params;
+    m_params.publish();
+}
+
+const SimulationSnapshot& SimulationThread::latestSnapshot()
+{
+    m_snapshots.update();
+    return m_snapshots.front();
+}
+
+void SimulationThread::run()
+{
+    CpuProfiler::get().setThreadName("Simulation");
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point last = Clock::now();
+    while (!m_stop.load(std::memory_order_relaxed)) {
+        m_params.update();
+        const SimulationParams& params = m_params.front();
+        params.applyTo(m_clock, m_numAppliedSingleSteps);
+        m_simulation.applyParams(params);
+
+        const Clock::time_point now = Clock::now();
+        const int numSteps = m_clock.advance(std::chrono::duration<double>(now - last).count());
+        last = now;
+        for (int i = 0; i < numSteps; ++i)
+            m_simulation.step(params, float(m_clock.stepSeconds()));
+
+        // Published every iteration, since pausing or changing the time scale changes alpha too.
+        SimulationSnapshot& snapshot = m_snapshots.back();
+        m_simulation.writeSnapshot(snapshot);
+        snapshot.numDroppedSteps = m_clock.numDroppedSteps();
+        snapshot.alpha = m_clock.alpha();
+        snapshot.stepSeconds = m_clock.stepSeconds();
+        snapshot.timeScale = m_clock.timeScale();
+        snapshot.paused = m_clock.isPaused();
+        snapshot.publishTime = now;
+        m_snapshots.publish();
+
+        // Sleep until the next step is due.
+        std::chrono::duration<double> sleepTime = MAX_SLEEP;
+        if (!m_clock.isPaused() && m_clock.timeScale() > 0.0f) {
+            const double untilNextStep = (1.0 - double(m_clock.alpha())) * m_clock.stepSeconds() / double(m_clock.timeScale());
+            sleepTime = std::min(sleepTime, std::chrono::duration<double>(untilNextStep));
+        }
+        std::this_thread::sleep_for(sleepTime);
+    }
+}
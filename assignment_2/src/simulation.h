@@ -0,0 +1,139 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/glm.hpp>
+DISABLE_WARNINGS_POP()
+#include "bezier.h"
+#include "scene_node.h"
+#include "sim_clock.h"
+#include <framework/triple_buffer.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Parameters of the simulation, set from the UI.
+struct SimulationParams {
+    float pathSpeed { 0.05f };
+    float pathOuterSpeed { 0.035f };
+    float probeScale { 0.12f };
+    float swarmRadius { 8.5f }; // of the innermost swarm dragons
+    int swarmSize { 0 };
+
+    // Of the SimClock.
+    double stepSeconds { 1.0 / 60.0 };
+    int maxStepsPerFrame { 8 };
+    float timeScale { 1.0f };
+    bool paused { false };
+    uint32_t numSingleSteps { 0 }; // incremented to take a single step while paused
+
+    // numAppliedSingleSteps is the numSingleSteps the clock has seen so far.
+    void applyTo(SimClock& clock, uint32_t& numAppliedSingleSteps) const;
+};
+
+// World transforms of the moving objects after a step.
+struct SimulationFrame {
+    // Frame of the inner dragon on its path, followed by the chase cameras.
+    glm::vec3 probePosition { 0.0f };
+    glm::vec3 probeForward { 0.0f, 0.0f, -1.0f };
+    glm::vec3 probeUp { 0.0f, 1.0f, 0.0f };
+
+    glm::mat4 probe { 1.0f };
+    glm::mat4 escort { 1.0f };
+    glm::mat4 escortBase { 1.0f };
+    glm::mat4 escortTip { 1.0f };
+    std::vector<glm::mat4> swarm;
+};
+
+// The last two steps of the simulation, for rendering the state in between.
+struct SimulationSnapshot {
+    SimulationFrame previous;
+    SimulationFrame current;
+    double time { 0.0 }; // simulation time of `current`
+    uint64_t numDroppedSteps { 0 };
+
+    // Clock state when the snapshot was taken, for extrapolating alpha to the time of a frame.
+    float alpha { 0.0f };
+    double stepSeconds { 1.0 / 60.0 };
+    float timeScale { 1.0f };
+    bool paused { false };
+    std::chrono::steady_clock::time_point publishTime;
+
+    [[nodiscard]] float alphaAt(std::chrono::steady_clock::time_point now) const;
+    // Weight 0 gives `previous`, 1 gives `current`. Translation and scale are interpolated linearly,
+    // rotations spherically. The swarm of the result has the size of the smaller of the two frames.
+    void interpolate(float weight, SimulationFrame& result) const;
+};
+
+// Moves the dragons along their paths and the swarm around them.
+//
+// It keeps its own copy of the moving part of the scene graph, so it can run on another thread than
+// the one rendering the scene (see SimulationThread). The paths must not change meanwhile.
+class Simulation {
+public:
+    Simulation(const BezierPath& path, const BezierPath& pathOuter);
+
+    void step(const SimulationParams& params, float stepSeconds);
+    // Re-evaluates the frames of the last two steps if the probe scale or the swarm changed, without
+    // advancing time, so they apply while the clock is paused. Returns whether they changed.
+    bool applyParams(const SimulationParams& params);
+    // Copies the frames of the last two steps.
+    void writeSnapshot(SimulationSnapshot& snapshot) const;
+
+private:
+    // Where the dragons are after a step.
+    struct PathPosition {
+        float pathU { 0.0f };
+        float pathOuterU { 0.0f };
+        double time { 0.0 };
+    };
+
+    void updateFrame(const SimulationParams& params, const PathPosition& pathPosition, SimulationFrame& frame);
+
+private:
+    const BezierPath& m_path;
+    const BezierPath& m_pathOuter;
+    PathPosition m_previousPosition;
+    PathPosition m_position;
+    SimulationParams m_appliedParams; // of the current frames
+
+    SceneNode m_probeRoot;
+    SceneNode m_escortRoot;
+    SceneNode* m_pEscortBase;
+    SceneNode* m_pEscortTip;
+    SceneNode m_swarmRoot;
+
+    SimulationFrame m_previous;
+    SimulationFrame m_current;
+};
+
+// Runs a Simulation on its own thread, at the fixed rate of a SimClock in real time.
+//
+// The parameters travel to the simulation thread and the snapshots back through TripleBuffers, so
+// neither thread ever waits for the other. The simulation thread sleeps until its next step is due.
+class SimulationThread {
+public:
+    // The simulation must not be used by other threads until the SimulationThread is destroyed.
+    SimulationThread(Simulation& simulation, const SimulationParams& params);
+    SimulationThread(const SimulationThread&) = delete;
+    ~SimulationThread();
+
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    void setParams(const SimulationParams& params);
+    // The latest complete snapshot.
+    [[nodiscard]] const SimulationSnapshot& latestSnapshot();
+
+private:
+    void run();
+
+private:
+    Simulation& m_simulation;
+    SimClock m_clock;
+    uint32_t m_numAppliedSingleSteps;
+    TripleBuffer<SimulationParams> m_params;
+    TripleBuffer<SimulationSnapshot> m_snapshots;
+    std::atomic<bool> m_stop { false };
+    std::thread m_thread;
+};
@@ -1,4 +1,7 @@
 #include "skybox.h"
+#include <framework/gl_state.h>
+#include <framework/gpu_profiler.h>
+#include <framework/job_system.h>
 #include <framework/shader.h>
 #include <stb/stb_image.h>
 #include <vector>
@@ -14,18 +17,28 @@ static const float CUBE_VERTS[] = {
     -1, 1,-1,  1, 1,-1,  1, 1, 1,  1, 1, 1, -1, 1, 1, -1, 1,-1
 };
 
+static constexpr UniformId uProj { "uProj" };
+static constexpr UniformId uView { "uView" };
+static constexpr UniformId uSky { "uSky" };
+
 static GLuint loadCubemap(const std::array<std::string,6>& faces) {
     GLuint tex; glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, tex);
+    GLState::get().bindTexture(0, GL_TEXTURE_CUBE_MAP, tex);
 
+    // Decode the faces in parallel; only the upload needs the OpenGL context.
+    struct Face { unsigned char* data; int w, h, n; };
+    std::array<Face,6> decoded {};
     stbi_set_flip_vertically_on_load(false);
-    int w,h,n;
+    JobSystem::get().parallelFor(std::span<Face>(decoded), 1, [&](std::span<Face> batch) {
+        for (Face& face : batch)
+            face.data = stbi_load(faces[size_t(&face - decoded.data())].c_str(), &face.w,&face.h,&face.n, 0);
+    });
     for (int i=0;i<6;++i) {
-        unsigned char* data = stbi_load(faces[i].c_str(), &w,&h,&n, 0);
-        if (!data) { std::cerr << "Failed to load cubemap face: " << faces[i] << "\n"; continue; }
-        GLenum fmt = (n==4 ? GL_RGBA : GL_RGB);
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, fmt, w, h, 0, fmt, GL_UNSIGNED_BYTE, data);
-        stbi_image_free(data);
+        const Face& face = decoded[size_t(i)];
+        if (!face.data) { std::cerr << "Failed to load cubemap face: " << faces[i] << "\n"; continue; }
+        GLenum fmt = (face.n==4 ? GL_RGBA : GL_RGB);
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, fmt, face.w, face.h, 0, fmt, GL_UNSIGNED_BYTE, face.data);
+        stbi_image_free(face.data);
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -39,31 +52,32 @@ Skybox::Skybox(const std::array<std::string,6>& faces) {
     m_cubemap = loadCubemap(faces);
     glGenVertexArrays(1, &m_vao);
     glGenBuffers(1, &m_vbo);
-    glBindVertexArray(m_vao);
+    GLState::get().bindVertexArray(m_vao);
     glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(CUBE_VERTS), CUBE_VERTS, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,3*sizeof(float),(void*)0);
-    glBindVertexArray(0);
+    GLState::get().bindVertexArray(0);
 }
 
 Skybox::~Skybox() {
     if (m_vbo) glDeleteBuffers(1,&m_vbo);
     if (m_vao) glDeleteVertexArrays(1,&m_vao);
     if (m_cubemap) glDeleteTextures(1,&m_cubemap);
+    GLState::get().invalidate();
 }
 
 void Skybox::draw(const Shader& shader, const glm::mat4& proj, const glm::mat4& viewNoTrans) const {
-    glDepthFunc(GL_LEQUAL);      // draw behind everything
+    GPU_PROFILE_ZONE("Skybox");
+    GLState& state = GLState::get();
+    state.setDepthFunc(GL_LEQUAL);      // draw behind everything
     shader.bind();
-    glUniformMatrix4fv(shader.getUniformLocation("uProj"), 1, GL_FALSE, &proj[0][0]);
-    glUniformMatrix4fv(shader.getUniformLocation("uView"), 1, GL_FALSE, &viewNoTrans[0][0]);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemap);
-    glUniform1i(shader.getUniformLocation("uSky"), 0);
+    shader.set(uProj, proj);
+    shader.set(uView, viewNoTrans);
+    state.bindTexture(0, GL_TEXTURE_CUBE_MAP, m_cubemap);
+    shader.set(uSky, 0);
 
-    glBindVertexArray(m_vao);
+    state.bindVertexArray(m_vao);
     glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
-    glDepthFunc(GL_LESS);
+    state.setDepthFunc(GL_LESS);
 }
@@ -3,19 +3,25 @@
 DISABLE_WARNINGS_PUSH()
 #include <fmt/format.h>
 DISABLE_WARNINGS_POP()
+#include <framework/gl_state.h>
 #include <framework/image.h>
+#include <framework/job_system.h>
 
 #include <iostream>
+#include <optional>
 
 Texture::Texture(std::filesystem::path filePath)
-{
     // Load image from disk to CPU memory.
     // Image class is defined in <framework/image.h>
-    Image cpuTexture { filePath };
+    : Texture(Image { filePath })
+{
+}
 
+Texture::Texture(Image cpuTexture)
+{
     // Create a texture on the GPU and bind it for parameter setting
     glGenTextures(1, &m_texture);
-    glBindTexture(GL_TEXTURE_2D, m_texture);
+    GLState::get().bindTexture(0, GL_TEXTURE_2D, m_texture);
 
     // Set behavior for when texture coordinates are outside the [0, 1] range (wrap around).
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -53,12 +59,73 @@ Texture::Texture(Texture&& other)
 
 Texture::~Texture()
 {
-    if (m_texture != INVALID)
+    if (m_texture != INVALID) {
         glDeleteTextures(1, &m_texture);
+        GLState::get().invalidate();
+    }
 }
 
 void Texture::bind(GLint textureSlot)
 {
-    glActiveTexture(textureSlot);
-    glBindTexture(GL_TEXTURE_2D, m_texture);
+    GLState::get().bindTexture(static_cast<GLuint>(textureSlot - GL_TEXTURE0), GL_TEXTURE_2D, m_texture);
+}
+
+std::vector<Texture> Texture::loadAll(std::span<const std::filesystem::path> filePaths)
+{
+    // Decoding failures are rethrown on the calling thread.
+    std::vector<std::optional<Image>> images(filePaths.size());
+    std::vector<std::exception_ptr> errors(filePaths.size());
+    JobSystem::get().parallelFor(std::span(images), 1, [&](std::span<std::optional<Image>> batch) {
+        for (std::optional<Image>& image : batch) {
+            const size_t i = size_t(&image - images.data());
+            try {
+                image.emplace(filePaths[i]);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    });
+
+    std::vector<Texture> textures;
+    textures.reserve(images.size());
+    for (size_t i = 0; i < images.size(); ++i) {
+        if (errors[i])
+            std::rethrow_exception(errors[i]);
+        textures.emplace_back(std::move(*images[i]));
+    }
+    return textures;
+}
+
+Sampler::Sampler(GLint minFilter, GLint magFilter, GLint wrap)
+{
+    glGenSamplers(1, &m_sampler);
+    glSamplerParameteri(m_sampler, GL_TEXTURE_MIN_FILTER, minFilter);
+    glSamplerParameteri(m_sampler, GL_TEXTURE_MAG_FILTER, magFilter);
+    glSamplerParameteri(m_sampler, GL_TEXTURE_WRAP_S, wrap);
+    glSamplerParameteri(m_sampler, GL_TEXTURE_WRAP_T, wrap);
+    glSamplerParameteri(m_sampler, GL_TEXTURE_WRAP_R, wrap);
+}
+
+Sampler::Sampler(Sampler&& other)
+    : m_sampler(other.m_sampler)
+{
+    other.m_sampler = INVALID;
+}
+
+Sampler::~Sampler()
+{
+    if (m_sampler != INVALID) {
+        glDeleteSamplers(1, &m_sampler);
+        GLState::get().invalidate();
+    }
+}
+
+void Sampler::bind(GLint textureSlot) const
+{
+    GLState::get().bindSampler(static_cast<GLuint>(textureSlot - GL_TEXTURE0), m_sampler);
+}
+
+void Sampler::unbind(GLint textureSlot)
+{
+    GLState::get().bindSampler(static_cast<GLuint>(textureSlot - GL_TEXTURE0), 0);
 }
@@ -6,6 +6,10 @@ DISABLE_WARNINGS_POP()
 #include <exception>
 #include <filesystem>
 #include <framework/opengl_includes.h>
+#include <span>
+#include <vector>
+
+struct Image;
 
 struct ImageLoadingException : public std::runtime_error {
     using std::runtime_error::runtime_error;
@@ -14,6 +18,7 @@ struct ImageLoadingException : public std::runtime_error {
 class Texture {
 public:
     Texture(std::filesystem::path filePath);
+    explicit Texture(Image image);
     Texture(const Texture&) = delete;
     Texture(Texture&&);
     ~Texture();
@@ -23,7 +28,30 @@ public:
 
     void bind(GLint textureSlot);
 
+    // Decodes the images in parallel (see JobSystem) and uploads them in order.
+    static std::vector<Texture> loadAll(std::span<const std::filesystem::path> filePaths);
+
 private:
     static constexpr GLuint INVALID = 0xFFFFFFFF;
     GLuint m_texture { INVALID };
 };
+
+// Sampling parameters that override those of the textures bound to the same slot, so the same
+// texture can be sampled differently without calling glTexParameter every frame.
+class Sampler {
+public:
+    Sampler(GLint minFilter, GLint magFilter, GLint wrap);
+    Sampler(const Sampler&) = delete;
+    Sampler(Sampler&&);
+    ~Sampler();
+
+    Sampler& operator=(const Sampler&) = delete;
+
+    void bind(GLint textureSlot) const;
+    // Use the parameters of the texture itself again.
+    static void unbind(GLint textureSlot);
+
+private:
+    static constexpr GLuint INVALID = 0xFFFFFFFF;
+    GLuint m_sampler { INVALID };
+};
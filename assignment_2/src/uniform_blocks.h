@@ -0,0 +1,40 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+
+// CPU side mirrors of the std140 uniform blocks declared in shaders/shader_vert.glsl and
+// shaders/shader_frag.glsl. Keep both in sync; the static_asserts below check the std140 offsets.
+
+// Binding points of the blocks (binding 0 is used by GPUMesh for its "Material" block).
+constexpr unsigned PER_FRAME_BINDING = 1;
+constexpr unsigned PER_OBJECT_BINDING = 2;
+
+// Written once per frame.
+struct PerFrameUniforms {
+    glm::mat4 viewProjectionMatrix { 1.0f };
+    alignas(16) glm::vec3 camPos { 0.0f };
+    alignas(16) glm::vec3 sunPos { 0.0f };
+    float sunIntensity { 0.0f };
+    glm::vec2 shadowDepthRange { 0.0f }; // near and far plane of the sun shadow map
+    alignas(16) glm::vec4 clusterDepthPlane { 0.0f }; // see LightClusters in src/light_clusters.h
+    glm::vec4 clusterParams { 0.0f };
+};
+
+// Written once per draw. Material features are shader variants, not uniforms.
+// Aligned so that sizeof() matches the std140 block size (rounded up to 16 bytes).
+struct alignas(16) PerObjectUniforms {
+    glm::mat4 modelMatrix { 1.0f };
+    glm::mat4 normalModelMatrix { 1.0f }; // only the upper 3x3 part is used
+    glm::mat4 mvpMatrix { 1.0f };
+    glm::vec3 sunEmissive { 0.0f };
+};
+
+static_assert(offsetof(PerFrameUniforms, camPos) == 64);
+static_assert(offsetof(PerFrameUniforms, sunPos) == 80);
+static_assert(offsetof(PerFrameUniforms, sunIntensity) == 92);
+static_assert(offsetof(PerFrameUniforms, shadowDepthRange) == 96);
+static_assert(offsetof(PerFrameUniforms, clusterDepthPlane) == 112);
+static_assert(offsetof(PerFrameUniforms, clusterParams) == 128);
+static_assert(offsetof(PerObjectUniforms, sunEmissive) == 192);
+static_assert(sizeof(PerObjectUniforms) == 208);